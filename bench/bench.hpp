@@ -0,0 +1,81 @@
+#pragma once
+
+#include "context.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vkr::bench {
+
+    struct Result {
+        std::string name;
+        double value;
+        std::string unit;
+        bool higherIsBetter;
+    };
+
+    struct Options {
+        uint32_t samples = 7;           // Repetitions per benchmark, the median is reported
+        uint32_t sceneMeshes = 64;      // Stress scene: N meshes
+        uint32_t sceneMaterials = 16;   // Stress scene: M materials
+        uint32_t sceneFrames = 120;
+        std::string filter;             // Only run benchmarks whose name contains this string
+    };
+
+    // Shared state for benchmarks that need a live context
+    struct Fixture {
+        Context* pContext;
+        GraphicsPipelineHandle pipeline;
+        SamplerHandle sampler;
+        VkShaderModule vertexShader;
+        VkShaderModule fragmentShader;
+        VkViewport viewport;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // Run fn() `iterations` times per sample and return the median nanoseconds per iteration
+    template <typename TFn>
+    double MeasureNsPerOp(uint32_t samples, uint32_t iterations, TFn&& fn) {
+        std::vector<double> timings;
+        timings.reserve(samples);
+
+        // Warm up caches and lazily initialized driver state
+        fn();
+
+        for (uint32_t s = 0; s < samples; s++) {
+            auto start = Clock::now();
+            for (uint32_t i = 0; i < iterations; i++)
+                fn();
+            auto end = Clock::now();
+
+            double ns = std::chrono::duration<double, std::nano>(end - start).count();
+            timings.push_back(ns / iterations);
+        }
+
+        std::sort(timings.begin(), timings.end());
+        return timings[timings.size() / 2];
+    }
+
+    inline bool Selected(const Options& options, const char* name) {
+        return options.filter.empty() || std::string(name).find(options.filter) != std::string::npos;
+    }
+
+    // Fills a shader-compatible pipeline description for the test shaders
+    GraphicsPipelineDesc MakePipelineDesc(const Fixture& fixture);
+
+    void RunRegistryBenchmarks(const Options& options, std::vector<Result>& results);
+    // False if the job system computed a wrong result
+    bool RunJobBenchmarks(const Options& options, std::vector<Result>& results);
+    void RunRecordingBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results);
+    void RunUploadBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results);
+    void RunPipelineBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results);
+    void RunSceneBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results);
+
+    // Fixture's context was created with PresentationParameters::renderThread
+    void RunRenderThreadSceneBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results);
+
+}
@@ -0,0 +1,242 @@
+#include "bench.hpp"
+#include "util.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <unordered_map>
+
+using namespace vkr::bench;
+
+namespace {
+
+    struct Arguments {
+        Options options;
+        std::string outPath;
+        std::string baselinePath;
+        double tolerance = 0.10;
+    };
+
+    void PrintUsage() {
+        std::printf(
+            "usage: vkr-bench [options]\n"
+            "  --out <file>          write results as JSON (default: stdout)\n"
+            "  --baseline <file>     compare against a previous --out file, exit 1 on regression\n"
+            "  --tolerance <ratio>   allowed slowdown before a result counts as a regression (default: 0.10)\n"
+            "  --filter <substring>  only run benchmarks whose name contains <substring>\n"
+            "  --samples <n>         repetitions per benchmark (default: 7)\n"
+            "  --meshes <n>          stress scene mesh count (default: 64)\n"
+            "  --materials <n>       stress scene material count (default: 16)\n"
+            "  --frames <n>          stress scene measured frames (default: 120)\n");
+    }
+
+    bool ParseArguments(int argc, char** argv, Arguments& args) {
+        for (int i = 1; i < argc; i++) {
+            const char* arg = argv[i];
+            const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+            auto take = [&]() { i++; return value; };
+
+            if (strcmp(arg, "--help") == 0) {
+                return false;
+            }
+            else if (value == nullptr) {
+                std::fprintf(stderr, "vkr-bench: missing value for %s\n", arg);
+                return false;
+            }
+            else if (strcmp(arg, "--out") == 0)        args.outPath = take();
+            else if (strcmp(arg, "--baseline") == 0)   args.baselinePath = take();
+            else if (strcmp(arg, "--tolerance") == 0)  args.tolerance = std::atof(take());
+            else if (strcmp(arg, "--filter") == 0)     args.options.filter = take();
+            else if (strcmp(arg, "--samples") == 0)    args.options.samples = std::atoi(take());
+            else if (strcmp(arg, "--meshes") == 0)     args.options.sceneMeshes = std::atoi(take());
+            else if (strcmp(arg, "--materials") == 0)  args.options.sceneMaterials = std::atoi(take());
+            else if (strcmp(arg, "--frames") == 0)     args.options.sceneFrames = std::atoi(take());
+            else {
+                std::fprintf(stderr, "vkr-bench: unknown option %s\n", arg);
+                return false;
+            }
+        }
+
+        args.options.samples = std::max(args.options.samples, 1u);
+        args.options.sceneFrames = std::max(args.options.sceneFrames, 1u);
+        return true;
+    }
+
+    std::string ToJson(const std::string& device, const std::vector<Result>& results) {
+        std::ostringstream json;
+        json << "{\n  \"device\": \"" << EscapeJson(device) << "\",\n  \"results\": [\n";
+
+        for (size_t i = 0; i < results.size(); i++) {
+            auto& r = results[i];
+            json << "    { \"name\": \"" << r.name << "\", \"value\": " << r.value
+                << ", \"unit\": \"" << r.unit << "\", \"better\": \"" << (r.higherIsBetter ? "higher" : "lower") << "\" }"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+
+        json << "  ]\n}\n";
+        return json.str();
+    }
+
+    // Reads back the "name"/"value" pairs of a file previously written by ToJson
+    bool LoadBaseline(const std::string& path, std::unordered_map<std::string, double>& baseline) {
+        std::ifstream file(path);
+        if (!file.is_open())
+            return false;
+
+        std::stringstream ss;
+        ss << file.rdbuf();
+        std::string text = ss.str();
+
+        static const std::regex entry(R"re("name"\s*:\s*"([^"]+)"\s*,\s*"value"\s*:\s*([-+0-9.eE]+))re");
+        for (auto it = std::sregex_iterator(text.begin(), text.end(), entry); it != std::sregex_iterator(); ++it)
+            baseline[(*it)[1].str()] = std::atof((*it)[2].str().c_str());
+
+        return true;
+    }
+
+    // Returns the number of results that regressed beyond the tolerance
+    uint32_t CompareBaseline(const std::vector<Result>& results, const std::unordered_map<std::string, double>& baseline, double tolerance) {
+        uint32_t regressions = 0;
+
+        std::fprintf(stderr, "%-28s %14s %14s %9s\n", "benchmark", "baseline", "current", "delta");
+
+        for (auto& r : results) {
+            auto it = baseline.find(r.name);
+            if (it == baseline.end() || it->second == 0.0) {
+                std::fprintf(stderr, "%-28s %14s %14.3f %9s\n", r.name.c_str(), "-", r.value, "new");
+                continue;
+            }
+
+            // Positive delta always means "worse", regardless of the unit's direction
+            double change = (r.value - it->second) / it->second;
+            double delta = r.higherIsBetter ? -change : change;
+            bool regressed = delta > tolerance;
+
+            std::fprintf(stderr, "%-28s %14.3f %14.3f %+8.1f%%%s\n", r.name.c_str(), it->second, r.value,
+                delta * 100.0, regressed ? "  REGRESSION" : "");
+
+            if (regressed)
+                regressions++;
+        }
+
+        return regressions;
+    }
+
+    // Test shaders, pipeline and sampler on `context`, drawing into the full headless extent
+    Fixture CreateFixture(vkr::Context& context, const vkr::PresentationParameters& params, FileReader& vsFile, FileReader& fsFile) {
+        Fixture fixture = {};
+        fixture.pContext = &context;
+        fixture.viewport = {
+            .width = float(params.headlessExtent.width),
+            .height = float(params.headlessExtent.height),
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f
+        };
+
+        vkr::ShaderDesc sd = { vsFile.Data(), vsFile.Size() };
+        fixture.vertexShader = context.CreateShader(sd);
+
+        sd = { fsFile.Data(), fsFile.Size() };
+        fixture.fragmentShader = context.CreateShader(sd);
+
+        fixture.pipeline = context.CreateGraphicsPipeline(MakePipelineDesc(fixture));
+
+        vkr::SamplerDesc smpd = {
+            .minFilter = VK_FILTER_LINEAR,
+            .magFilter = VK_FILTER_LINEAR,
+            .addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+        };
+        fixture.sampler = context.CreateSampler(smpd);
+
+        return fixture;
+    }
+
+    void DestroyFixture(const Fixture& fixture) {
+        fixture.pContext->DestroyShader(fixture.vertexShader);
+        fixture.pContext->DestroyShader(fixture.fragmentShader);
+        fixture.pContext->WaitIdle();
+    }
+
+}
+
+int main(int argc, char** argv) {
+    Arguments args;
+    if (!ParseArguments(argc, argv, args)) {
+        PrintUsage();
+        return 2;
+    }
+
+    std::vector<Result> results;
+
+    // Pure CPU benchmarks first, these do not need a device
+    RunRegistryBenchmarks(args.options, results);
+    if (!RunJobBenchmarks(args.options, results))
+        return 1;
+
+    // Headless context so the suite runs on machines without a display (e.g. lavapipe)
+    vkr::PresentationParameters params = {};
+    params.headless = true;
+    params.headlessExtent = { 1280, 720 };
+
+    auto context = std::make_unique<vkr::Context>(params);
+
+    FileReader vsFile("test.vs.spv");
+    FileReader fsFile("test.fs.spv");
+    if (!vsFile || !fsFile) {
+        std::fprintf(stderr, "vkr-bench: test shaders not found, run from the build directory\n");
+        return 2;
+    }
+
+    Fixture fixture = CreateFixture(*context, params, vsFile, fsFile);
+
+    RunRecordingBenchmarks(fixture, args.options, results);
+    RunUploadBenchmarks(fixture, args.options, results);
+    RunPipelineBenchmarks(fixture, args.options, results);
+    RunSceneBenchmarks(fixture, args.options, results);
+
+    // The stress scene again on a context of its own that records through a render thread
+    if (Selected(args.options, "scene.render_thread")) {
+        vkr::PresentationParameters threadedParams = params;
+        threadedParams.renderThread = true;
+
+        vkr::Context threadedContext(threadedParams);
+        Fixture threadedFixture = CreateFixture(threadedContext, threadedParams, vsFile, fsFile);
+        RunRenderThreadSceneBenchmarks(threadedFixture, args.options, results);
+        DestroyFixture(threadedFixture);
+    }
+
+    DestroyFixture(fixture);
+
+    // Emit machine-readable results
+    std::string json = ToJson(context->GetPhysicalDeviceProperties().deviceName, results);
+
+    if (args.outPath.empty()) {
+        std::fputs(json.c_str(), stdout);
+    }
+    else {
+        std::ofstream out(args.outPath);
+        out << json;
+    }
+
+    // Compare against the stored baseline
+    if (!args.baselinePath.empty()) {
+        std::unordered_map<std::string, double> baseline;
+        if (!LoadBaseline(args.baselinePath, baseline)) {
+            std::fprintf(stderr, "vkr-bench: failed to read baseline %s\n", args.baselinePath.c_str());
+            return 2;
+        }
+
+        uint32_t regressions = CompareBaseline(results, baseline, args.tolerance);
+        if (regressions > 0) {
+            std::fprintf(stderr, "vkr-bench: %u regression(s) beyond %.0f%% tolerance\n", regressions, args.tolerance * 100.0);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,323 @@
+#include "bench.hpp"
+#include "draw_instance.hpp"
+#include "job_system.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <random>
+
+namespace vkr::bench {
+
+    GraphicsPipelineDesc MakePipelineDesc(const Fixture& fixture) {
+        GraphicsPipelineDesc gpd = {};
+
+        VertexAttrib attrib = {
+            .binding = 0,
+            .offset = 0,
+            .stride = sizeof(float) * 3,
+            .format = VK_FORMAT_R32G32B32_SFLOAT
+        };
+        gpd.vertexAttribs.push_back(attrib);    // Vertex positions
+
+        attrib.binding = 1;
+        gpd.vertexAttribs.push_back(attrib);    // Vertex normals
+
+        attrib.binding = 2;
+        attrib.stride = sizeof(float) * 2;
+        attrib.format = VK_FORMAT_R32G32_SFLOAT;
+        gpd.vertexAttribs.push_back(attrib);    // Vertex tex coords
+
+        gpd.vertexShader = fixture.vertexShader;
+        gpd.fragmentShader = fixture.fragmentShader;
+        gpd.vertexSpecialization = GetDrawInstanceSpecialization();
+
+        return gpd;
+    }
+
+    void RunRegistryBenchmarks(const Options& options, std::vector<Result>& results) {
+        constexpr uint32_t resourceCount = 10000;
+        constexpr uint32_t lookupCount = 1 << 16;
+
+        // Fixed seed so every run touches the same access pattern
+        std::mt19937 rng(1337);
+
+        if (Selected(options, "registry.lookup")) {
+            ResourceRegistry<uint64_t> registry;
+            std::vector<ResourceID> ids;
+
+            for (uint32_t i = 0; i < resourceCount; i++)
+                ids.push_back(registry.Create(i));
+
+            std::vector<ResourceID> lookups(lookupCount);
+            std::uniform_int_distribution<uint32_t> dist(0, resourceCount - 1);
+            for (auto& id : lookups)
+                id = ids[dist(rng)];
+
+            uint32_t cursor = 0;
+            volatile uint64_t sink = 0;
+
+            double ns = MeasureNsPerOp(options.samples, lookupCount, [&]() {
+                sink = sink + registry[lookups[cursor++ & (lookupCount - 1)]];
+            });
+
+            results.push_back({ "registry.lookup", ns, "ns/op", false });
+        }
+
+        if (Selected(options, "registry.churn")) {
+            ResourceRegistry<uint64_t> registry;
+            std::vector<ResourceID> live;
+
+            for (uint32_t i = 0; i < resourceCount; i++)
+                live.push_back(registry.Create(i));
+
+            // Destroy a random live resource and create a replacement, keeping the population stable
+            std::uniform_int_distribution<uint32_t> dist(0, resourceCount - 1);
+
+            double ns = MeasureNsPerOp(options.samples, lookupCount, [&]() {
+                uint32_t slot = dist(rng);
+                registry.Destroy(live[slot]);
+                live[slot] = registry.Create(slot);
+            });
+
+            results.push_back({ "registry.churn", ns, "ns/op", false });
+        }
+    }
+
+    bool RunJobBenchmarks(const Options& options, std::vector<Result>& results) {
+        JobSystem jobs;
+        bool correct = true;
+
+        if (Selected(options, "jobs.parallel_for")) {
+            constexpr uint32_t itemCount = 1 << 14;
+            std::vector<float> items(itemCount, 1.0f);
+
+            // Work per item is tiny, so this mostly measures scheduling overhead
+            double ns = MeasureNsPerOp(options.samples, 64, [&]() {
+                jobs.ParallelFor(itemCount, 256, [&](uint32_t begin, uint32_t end) {
+                    for (uint32_t i = begin; i < end; i++)
+                        items[i] = items[i] * 0.5f + 0.5f;
+                });
+            });
+
+            results.push_back({ "jobs.parallel_for", ns / itemCount, "ns/item", false });
+        }
+
+        if (Selected(options, "jobs.graph")) {
+            constexpr uint32_t width = 16;
+            std::atomic<uint32_t> sink = 0;
+
+            // Three levels of 16 tasks, each depending on its neighbours in the level above, then one final task
+            TaskGraph graph;
+            std::vector<TaskId> level;
+            for (uint32_t i = 0; i < width; i++)
+                level.push_back(graph.Add([&]() { sink.fetch_add(1, std::memory_order_relaxed); }));
+
+            for (uint32_t depth = 0; depth < 2; depth++) {
+                std::vector<TaskId> next;
+                for (uint32_t i = 0; i < width; i++)
+                    next.push_back(graph.Add([&]() { sink.fetch_add(1, std::memory_order_relaxed); }, { level[i], level[(i + 1) % width] }));
+                level = std::move(next);
+            }
+
+            graph.Add([&]() { sink.fetch_add(1, std::memory_order_relaxed); }, { level[0], level[width / 2] });
+
+            double ns = MeasureNsPerOp(options.samples, 256, [&]() {
+                graph.Execute(jobs);
+            });
+
+            results.push_back({ "jobs.graph", ns / (width * 3 + 1), "ns/task", false });
+        }
+
+        // Every round checks its results, a scheduling bug fails the run instead of only skewing a timing
+        if (Selected(options, "jobs.stress")) {
+            constexpr uint32_t itemCount = 100000;
+            constexpr uint32_t outerCount = 64;
+            constexpr uint32_t innerCount = 1000;
+
+            uint32_t round = 0;
+            uint32_t failures = 0;
+
+            // Diamond: a before b and c, d after both. Tasks stamp the order they ran in
+            std::atomic<uint32_t> sequence = 0;
+            uint32_t a = 0, b = 0, c = 0, d = 0;
+
+            TaskGraph diamond;
+            TaskId taskA = diamond.Add([&]() { a = sequence.fetch_add(1) + 1; });
+            TaskId taskB = diamond.Add([&]() { b = a != 0 ? sequence.fetch_add(1) + 1 : 0; }, { taskA });
+            TaskId taskC = diamond.Add([&]() { c = a != 0 ? sequence.fetch_add(1) + 1 : 0; }, { taskA });
+            diamond.Add([&]() { d = b != 0 && c != 0 ? sequence.fetch_add(1) + 1 : 0; }, { taskB, taskC });
+
+            double ns = MeasureNsPerOp(options.samples, 16, [&]() {
+                // Grain sizes vary per round, including ranges of a single item and ranges past the end
+                uint32_t grainSize = 1 + (round++ * 97) % 4096;
+
+                std::atomic<uint64_t> sum = 0;
+                std::atomic<uint32_t> visited = 0;
+                jobs.ParallelFor(itemCount, grainSize, [&](uint32_t begin, uint32_t end) {
+                    uint64_t rangeSum = 0;
+                    for (uint32_t i = begin; i < end; i++)
+                        rangeSum += i;
+
+                    sum.fetch_add(rangeSum, std::memory_order_relaxed);
+                    visited.fetch_add(end - begin, std::memory_order_relaxed);
+                });
+
+                if (sum != uint64_t(itemCount) * (itemCount - 1) / 2 || visited != itemCount)
+                    failures++;
+
+                // Every outer job waits on a ParallelFor of its own
+                std::atomic<uint64_t> nestedSum = 0;
+                jobs.ParallelFor(outerCount, 1, [&](uint32_t begin, uint32_t end) {
+                    for (uint32_t outer = begin; outer < end; outer++) {
+                        std::atomic<uint64_t> innerSum = 0;
+                        jobs.ParallelFor(innerCount, 16, [&](uint32_t innerBegin, uint32_t innerEnd) {
+                            for (uint32_t i = innerBegin; i < innerEnd; i++)
+                                innerSum.fetch_add(outer * innerCount + i, std::memory_order_relaxed);
+                        });
+
+                        nestedSum.fetch_add(innerSum, std::memory_order_relaxed);
+                    }
+                });
+
+                uint64_t nestedCount = uint64_t(outerCount) * innerCount;
+                if (nestedSum != nestedCount * (nestedCount - 1) / 2)
+                    failures++;
+
+                sequence = 0;
+                a = b = c = d = 0;
+                diamond.Execute(jobs);
+
+                if (a != 1 || b < 2 || c < 2 || b == c || d != 4)
+                    failures++;
+            });
+
+            if (failures > 0) {
+                std::fprintf(stderr, "vkr-bench: jobs.stress produced wrong results in %u check(s)\n", failures);
+                correct = false;
+            }
+
+            results.push_back({ "jobs.stress", ns, "ns/round", false });
+        }
+
+        return correct;
+    }
+
+    void RunRecordingBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results) {
+        constexpr uint32_t commandCount = 20000;
+        Context& context = *fixture.pContext;
+
+        // A tiny buffer and texture are enough, only the CPU recording cost is measured
+        float vertexData[16] = {};
+        BufferDesc bd = {
+            .pData = vertexData,
+            .size = sizeof(vertexData),
+            .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+        };
+
+        BufferHandle vbos[] = {
+            context.CreateBuffer(bd),
+            context.CreateBuffer(bd),
+            context.CreateBuffer(bd)
+        };
+
+        uint32_t texels[4 * 4] = {};
+        TextureDesc td = {
+            .pData = texels,
+            .width = 4,
+            .height = 4,
+            .format = VK_FORMAT_R8G8B8A8_SRGB
+        };
+        TextureHandle texture = context.CreateTexture(td);
+
+        auto record = [&](const char* name, auto&& fn) {
+            if (!Selected(options, name))
+                return;
+
+            context.BeginFrame();
+            context.BeginRendering(fixture.viewport);
+            context.SetGraphicsPipeline(fixture.pipeline);
+
+            double ns = MeasureNsPerOp(options.samples, commandCount, fn);
+
+            context.EndRendering();
+            context.EndFrame();
+
+            results.push_back({ name, ns, "ns/op", false });
+        };
+
+        record("record.set_vertex_buffers", [&]() {
+            context.SetVertexBuffers(vbos);
+        });
+
+        record("record.set_texture", [&]() {
+            context.SetTexture(texture, fixture.sampler, 1);
+        });
+
+        context.WaitIdle();
+
+        for (auto vbo : vbos)
+            context.DestroyBuffer(vbo);
+        context.DestroyTexture(texture);
+    }
+
+    void RunUploadBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results) {
+        Context& context = *fixture.pContext;
+
+        if (Selected(options, "upload.buffer_1mb")) {
+            constexpr size_t size = 1 << 20;
+            std::vector<uint8_t> data(size, 0xAB);
+
+            BufferDesc bd = {
+                .pData = data.data(),
+                .size = size,
+                .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+            };
+
+            // Destroys are deferred, waiting each time releases the buffer instead of piling them up until teardown
+            double ns = MeasureNsPerOp(options.samples, 4, [&]() {
+                context.DestroyBuffer(context.CreateBuffer(bd));
+                context.WaitIdle();
+            });
+
+            // Bytes per nanosecond -> MB/s
+            results.push_back({ "upload.buffer_1mb", (size / ns) * 1e3, "MB/s", true });
+        }
+
+        if (Selected(options, "upload.texture_512")) {
+            constexpr uint32_t extent = 512;
+            std::vector<uint32_t> texels(extent * extent, 0xFF00FF00);
+
+            TextureDesc td = {
+                .pData = texels.data(),
+                .width = extent,
+                .height = extent,
+                .format = VK_FORMAT_R8G8B8A8_SRGB
+            };
+
+            // The wait also submits the batched copy, so the upload is timed through to completion
+            double ns = MeasureNsPerOp(options.samples, 4, [&]() {
+                context.DestroyTexture(context.CreateTexture(td));
+                context.WaitIdle();
+            });
+
+            double size = texels.size() * sizeof(uint32_t);
+            results.push_back({ "upload.texture_512", (size / ns) * 1e3, "MB/s", true });
+        }
+    }
+
+    void RunPipelineBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results) {
+        if (!Selected(options, "pipeline.create"))
+            return;
+
+        GraphicsPipelineDesc gpd = MakePipelineDesc(fixture);
+
+        // Release each pipeline before creating the next, see upload.buffer_1mb
+        double ns = MeasureNsPerOp(options.samples, 4, [&]() {
+            fixture.pContext->DestroyGraphicsPipeline(fixture.pContext->CreateGraphicsPipeline(gpd));
+            fixture.pContext->WaitIdle();
+        });
+
+        results.push_back({ "pipeline.create", ns * 1e-6, "ms/op", false });
+    }
+
+}
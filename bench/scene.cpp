@@ -0,0 +1,268 @@
+#include "bench.hpp"
+#include "draw_instance.hpp"
+#include "job_system.hpp"
+#include "storage_table.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <initializer_list>
+#include <random>
+
+namespace vkr::bench {
+
+    namespace {
+
+        struct StressMesh {
+            BufferHandle vbo, nbo, uvbo, ibo;
+            uint32_t indexCount;
+        };
+
+        struct StressMaterial {
+            uint32_t index;         // Into the material table
+            TextureHandle texture;
+        };
+
+        // Build a UV sphere, tessellation varies per mesh so vertex counts differ across the scene
+        StressMesh CreateSphere(Context& context, uint32_t rings, uint32_t segments) {
+            std::vector<glm::vec3> positions;
+            std::vector<glm::vec2> texCoords;
+            std::vector<uint32_t> indices;
+
+            for (uint32_t r = 0; r <= rings; r++) {
+                float phi = glm::pi<float>() * r / rings;
+
+                for (uint32_t s = 0; s <= segments; s++) {
+                    float theta = glm::two_pi<float>() * s / segments;
+                    positions.push_back({ std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta) });
+                    texCoords.push_back({ float(s) / segments, float(r) / rings });
+                }
+            }
+
+            for (uint32_t r = 0; r < rings; r++) {
+                for (uint32_t s = 0; s < segments; s++) {
+                    uint32_t i0 = r * (segments + 1) + s;
+                    uint32_t i1 = i0 + segments + 1;
+                    indices.insert(indices.end(), { i0, i1, i0 + 1, i0 + 1, i1, i1 + 1 });
+                }
+            }
+
+            StressMesh mesh = {};
+            BufferDesc bd = {
+                .pData = positions.data(),
+                .size = positions.size() * sizeof(glm::vec3),
+                .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+            };
+            mesh.vbo = context.CreateBuffer(bd);
+            mesh.nbo = context.CreateBuffer(bd);    // Unit sphere normals equal positions
+
+            bd.pData = texCoords.data();
+            bd.size = texCoords.size() * sizeof(glm::vec2);
+            mesh.uvbo = context.CreateBuffer(bd);
+
+            bd.pData = indices.data();
+            bd.size = indices.size() * sizeof(uint32_t);
+            bd.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+            mesh.ibo = context.CreateBuffer(bd);
+
+            mesh.indexCount = static_cast<uint32_t>(indices.size());
+            return mesh;
+        }
+
+        StressMaterial CreateMaterial(Context& context, StorageTable& materialTable, std::mt19937& rng) {
+            constexpr uint32_t extent = 64;
+            std::uniform_int_distribution<uint32_t> channel(0, 255);
+
+            uint32_t colorA = 0xFF000000 | (channel(rng) << 16) | (channel(rng) << 8) | channel(rng);
+            uint32_t colorB = 0xFF000000 | (channel(rng) << 16) | (channel(rng) << 8) | channel(rng);
+
+            // Checkerboard so the texture is not trivially compressible by the driver
+            std::vector<uint32_t> texels(extent * extent);
+            for (uint32_t y = 0; y < extent; y++)
+                for (uint32_t x = 0; x < extent; x++)
+                    texels[y * extent + x] = ((x / 8 + y / 8) & 1) ? colorA : colorB;
+
+            StressMaterial material = {};
+
+            TextureDesc td = {
+                .pData = texels.data(),
+                .width = extent,
+                .height = extent,
+                .format = VK_FORMAT_R8G8B8A8_SRGB
+            };
+            material.texture = context.CreateTexture(td);
+
+            material.index = materialTable.Add(MaterialData{
+                .baseColor = { 1.0f, 1.0f, 1.0f, 1.0f }
+            });
+
+            return material;
+        }
+
+        // Stress scene on the fixture's context, results are named after `name`. A second context sharing the
+        // device draws it as well for scene.shared when `shared` is set
+        void RunStressScene(const Fixture& fixture, const Options& options, const std::string& name, bool shared,
+            std::vector<Result>& results) {
+            if (!Selected(options, name.c_str()) && !(shared && Selected(options, "scene.shared")))
+                return;
+
+            Context& context = *fixture.pContext;
+            std::mt19937 rng(1337);
+
+            std::vector<StressMesh> meshes;
+            for (uint32_t i = 0; i < options.sceneMeshes; i++)
+                meshes.push_back(CreateSphere(context, 8 + (i % 8) * 4, 16 + (i % 8) * 8));
+
+            StorageTable materialTable(context, sizeof(MaterialData));
+            std::vector<StressMaterial> materials;
+            for (uint32_t i = 0; i < options.sceneMaterials; i++)
+                materials.push_back(CreateMaterial(context, materialTable, rng));
+
+            // Lay every (mesh, material) pair out on a square grid
+            uint32_t objectCount = options.sceneMeshes * options.sceneMaterials;
+
+            // Objects in submission order, material-major the way a sorted renderer would submit
+            StorageTable objectTable(context, sizeof(ObjectData), objectCount);
+            for (auto& material : materials) {
+                for (uint32_t i = 0; i < options.sceneMeshes; i++)
+                    objectTable.Add(ObjectData{ .modelMatrix = glm::mat4(1.0f), .material = material.index });
+            }
+
+            uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(float(objectCount))));
+
+            glm::mat4 viewProjectionMatrix = glm::perspectiveLH(glm::radians(60.0f),
+                fixture.viewport.width / fixture.viewport.height, 0.1f, 1000.0f) *
+                glm::translate(glm::mat4(1.0f), glm::vec3(-float(gridSize), -float(gridSize), float(gridSize) * 2.0f));
+
+            // Transforms are updated across the job system's threads, then recorded in submission order
+            JobSystem jobs;
+            std::vector<glm::mat4> modelMatrices(objectCount);
+
+            auto updateObjects = [&](float t) {
+                jobs.ParallelFor(objectCount, 64, [&](uint32_t begin, uint32_t end) {
+                    for (uint32_t object = begin; object < end; object++) {
+                        glm::vec3 position = { float(object % gridSize) * 2.0f, float(object / gridSize) * 2.0f, 0.0f };
+                        modelMatrices[object] = glm::rotate(glm::translate(glm::mat4(1.0f), position), t, glm::vec3(0.0f, 1.0f, 0.0f));
+                    }
+                });
+
+                for (uint32_t object = 0; object < objectCount; object++)
+                    objectTable.Modify<ObjectData>(object).modelMatrix = modelMatrices[object];
+            };
+
+            // Meshes, materials and tables were created on the fixture's context, sharing contexts draw them too
+            auto drawScene = [&](Context& target) {
+                target.BeginRendering(fixture.viewport);
+
+                target.SetGraphicsPipeline(fixture.pipeline);
+                target.SetPrimitiveTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+                target.SetCullMode(VK_CULL_MODE_BACK_BIT);
+                target.SetStorageBuffer(objectTable.GetBuffer(), 0);
+                target.SetStorageBuffer(materialTable.GetBuffer(), 2);
+                target.SetPushConstants(&viewProjectionMatrix, sizeof(glm::mat4), 0);
+
+                uint32_t object = 0;
+                for (auto& material : materials) {
+                    target.SetTexture(material.texture, fixture.sampler, 1);
+
+                    for (auto& mesh : meshes) {
+                        BufferHandle vbos[] = { mesh.vbo, mesh.nbo, mesh.uvbo };
+                        target.SetVertexBuffers(vbos);
+                        target.SetIndexBuffer(mesh.ibo, VK_INDEX_TYPE_UINT32);
+                        target.DrawIndexed(0, mesh.indexCount, EncodeDrawInstance(object));
+
+                        object++;
+                    }
+                }
+
+                target.EndRendering();
+            };
+
+            auto renderFrame = [&](float t) {
+                updateObjects(t);
+
+                context.BeginFrame();
+
+                // Every transform goes up in one copy before rendering
+                objectTable.Flush();
+                materialTable.Flush();
+
+                drawScene(context);
+                context.EndFrame();
+            };
+
+            // Average milliseconds per frame, every context is idle before and after
+            auto measureFrames = [&](auto&& frame, std::initializer_list<Context*> contexts) {
+                auto waitIdle = [&]() {
+                    for (Context* pContext : contexts)
+                        pContext->WaitIdle();
+                };
+
+                // Warm up until every frame in flight has been through the pipeline once
+                for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT * 2; i++)
+                    frame(0.0f);
+                waitIdle();
+
+                auto start = Clock::now();
+                for (uint32_t i = 0; i < options.sceneFrames; i++)
+                    frame(i / 60.0f);
+                waitIdle();
+                auto end = Clock::now();
+
+                return std::chrono::duration<double, std::milli>(end - start).count() / options.sceneFrames;
+            };
+
+            if (Selected(options, name.c_str())) {
+                double ms = measureFrames(renderFrame, { &context });
+                double drawsPerSecond = objectCount / (ms * 1e-3);
+
+                results.push_back({ name + ".frame", ms, "ms/frame", false });
+                results.push_back({ name + ".draws", drawsPerSecond, "draws/s", true });
+            }
+
+            // A second context on the same device, e.g. a second window, draws the scene every frame as well
+            if (shared && Selected(options, "scene.shared")) {
+                PresentationParameters params = {};
+                params.headless = true;
+                params.headlessExtent = { uint32_t(fixture.viewport.width), uint32_t(fixture.viewport.height) };
+                params.sharedContext = &context;
+
+                Context second(params);
+
+                auto renderSharedFrame = [&](float t) {
+                    renderFrame(t);
+
+                    second.BeginFrame();
+                    drawScene(second);
+                    second.EndFrame();
+                };
+
+                results.push_back({ "scene.shared.frame", measureFrames(renderSharedFrame, { &context, &second }), "ms/frame", false });
+            }
+
+            // The fixture's context outlives the scene, later benchmarks should not share the device with it
+            for (auto& mesh : meshes) {
+                context.DestroyBuffer(mesh.vbo);
+                context.DestroyBuffer(mesh.nbo);
+                context.DestroyBuffer(mesh.uvbo);
+                context.DestroyBuffer(mesh.ibo);
+            }
+
+            for (auto& material : materials)
+                context.DestroyTexture(material.texture);
+
+            context.WaitIdle();
+        }
+
+    }
+
+    void RunSceneBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results) {
+        RunStressScene(fixture, options, "scene.stress", true, results);
+    }
+
+    void RunRenderThreadSceneBenchmarks(const Fixture& fixture, const Options& options, std::vector<Result>& results) {
+        RunStressScene(fixture, options, "scene.render_thread", false, results);
+    }
+
+}
@@ -0,0 +1,654 @@
+#include "capture.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace vkr;
+
+namespace {
+
+    struct Arguments {
+        std::string capturePath;
+        std::string outPath;
+        const char* device = nullptr;
+    };
+
+    void PrintUsage() {
+        std::printf(
+            "usage: vkr-replay <capture> [options]\n"
+            "  --out <file>          write per-frame timings as JSON (default: stdout)\n"
+            "  --device <name>       replay on this device, a substring of its name or its UUID\n");
+    }
+
+    bool ParseArguments(int argc, char** argv, Arguments& args) {
+        for (int i = 1; i < argc; i++) {
+            const char* arg = argv[i];
+            const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+            auto take = [&]() { i++; return value; };
+
+            if (strcmp(arg, "--help") == 0) {
+                return false;
+            }
+            else if (arg[0] != '-') {
+                args.capturePath = arg;
+                continue;
+            }
+            else if (value == nullptr) {
+                std::fprintf(stderr, "vkr-replay: missing value for %s\n", arg);
+                return false;
+            }
+            else if (strcmp(arg, "--out") == 0)     args.outPath = take();
+            else if (strcmp(arg, "--device") == 0)  args.device = take();
+            else {
+                std::fprintf(stderr, "vkr-replay: unknown option %s\n", arg);
+                return false;
+            }
+        }
+
+        return !args.capturePath.empty();
+    }
+
+    struct FrameTiming {
+        double cpuMs;
+        double gpuMs = -1.0;    // Negative until the frame's timestamps have been read back
+    };
+
+    // Issues the recorded calls on a context, translating captured handles to the ones the replay created
+    class Replayer {
+    public:
+        Replayer(Context& context, CaptureReader& reader)
+            : m_context(context), m_reader(reader) {}
+
+        // Replay the current record, false if it was skipped: it uses a resource created before the capture began,
+        // draws with state bound from one, or the record is corrupt (the reader then turns false)
+        bool Replay(CaptureOp op) {
+            using Handles = std::unordered_map<ResourceID, ResourceID>;
+
+            // Arguments are all read before a call is made, a corrupt record is never replayed
+            auto resolve = [&](Handles& handles, ResourceID& handle) {
+                auto it = handles.find(handle);
+                handle = it != handles.end() ? it->second : 0;
+                return handle != 0 && m_reader;
+            };
+
+            // Track bindings that could not be made, so that the draws and dispatches relying on them are skipped
+            auto bind = [&](uint32_t slot, bool resolved) {
+                if (resolved)
+                    m_missingBindings.erase(slot);
+                else
+                    m_missingBindings.insert(slot);
+                return resolved;
+            };
+
+            auto canDraw = [&](bool indexed) {
+                return m_reader && !m_missingBindings.contains(VERTEX_BUFFERS_SLOT) &&
+                    !m_missingBindings.contains(GRAPHICS_PIPELINE_SLOT) &&
+                    !(indexed && m_missingBindings.contains(INDEX_BUFFER_SLOT)) &&
+                    !MissingDescriptors();
+            };
+
+            auto canDispatch = [&]() {
+                return m_reader && !m_missingBindings.contains(COMPUTE_PIPELINE_SLOT) && !MissingDescriptors();
+            };
+
+            switch (op) {
+            case CaptureOp::BeginFrame:
+                // Nothing stays bound across frames
+                m_missingBindings.clear();
+                m_context.BeginFrame();
+                return true;
+            case CaptureOp::EndFrame:
+                m_context.EndFrame();
+                return true;
+            case CaptureOp::BeginRendering:
+            case CaptureOp::BeginDepthPrepass: {
+                VkViewport viewport = m_reader.Read<VkViewport>();
+                if (!m_reader)
+                    return false;
+
+                if (op == CaptureOp::BeginRendering)
+                    m_context.BeginRendering(viewport);
+                else
+                    m_context.BeginDepthPrepass(viewport);
+                return true;
+            }
+            case CaptureOp::EndRendering:
+                m_context.EndRendering();
+                return true;
+
+            case CaptureOp::SetVertexBuffers: {
+                size_t size;
+                const void* pHandles = m_reader.ReadBlob(size);
+
+                std::vector<BufferHandle> buffers(size / sizeof(BufferHandle));
+                if (size > 0)
+                    std::memcpy(buffers.data(), pHandles, size);
+
+                bool resolved = true;
+                for (auto& buffer : buffers)
+                    resolved = resolve(m_buffers, buffer) && resolved;
+
+                if (!bind(VERTEX_BUFFERS_SLOT, resolved && m_reader))
+                    return false;
+
+                m_context.SetVertexBuffers(buffers);
+                return true;
+            }
+            case CaptureOp::SetIndexBuffer: {
+                BufferHandle buffer = m_reader.Read<BufferHandle>();
+                VkIndexType indexType = m_reader.Read<VkIndexType>();
+                if (!bind(INDEX_BUFFER_SLOT, resolve(m_buffers, buffer)))
+                    return false;
+
+                m_context.SetIndexBuffer(buffer, indexType);
+                return true;
+            }
+            case CaptureOp::SetUniformBuffer:
+            case CaptureOp::SetStorageBuffer: {
+                BufferHandle buffer = m_reader.Read<BufferHandle>();
+                uint32_t binding = m_reader.Read<uint32_t>();
+                if (!bind(binding, resolve(m_buffers, buffer)))
+                    return false;
+
+                if (op == CaptureOp::SetUniformBuffer)
+                    m_context.SetUniformBuffer(buffer, binding);
+                else
+                    m_context.SetStorageBuffer(buffer, binding);
+                return true;
+            }
+            case CaptureOp::SetTexture: {
+                TextureHandle texture = m_reader.Read<TextureHandle>();
+                SamplerHandle sampler = m_reader.Read<SamplerHandle>();
+                uint32_t binding = m_reader.Read<uint32_t>();
+                bool resolved = resolve(m_textures, texture);
+                if (!bind(binding, resolve(m_samplers, sampler) && resolved))
+                    return false;
+
+                m_context.SetTexture(texture, sampler, binding);
+                return true;
+            }
+            case CaptureOp::SetStorageImage: {
+                TextureHandle texture = m_reader.Read<TextureHandle>();
+                uint32_t mipLevel = m_reader.Read<uint32_t>();
+                uint32_t binding = m_reader.Read<uint32_t>();
+                if (!bind(binding, resolve(m_textures, texture)))
+                    return false;
+
+                m_context.SetStorageImage(texture, mipLevel, binding);
+                return true;
+            }
+            case CaptureOp::SetDepthTexture: {
+                SamplerHandle sampler = m_reader.Read<SamplerHandle>();
+                uint32_t binding = m_reader.Read<uint32_t>();
+                if (!bind(binding, resolve(m_samplers, sampler)))
+                    return false;
+
+                m_context.SetDepthTexture(sampler, binding);
+                return true;
+            }
+            case CaptureOp::SetGraphicsPipeline: {
+                GraphicsPipelineHandle pipeline = m_reader.Read<GraphicsPipelineHandle>();
+                if (!bind(GRAPHICS_PIPELINE_SLOT, resolve(m_graphicsPipelines, pipeline)))
+                    return false;
+
+                m_context.SetGraphicsPipeline(pipeline);
+                return true;
+            }
+            case CaptureOp::SetComputePipeline: {
+                ComputePipelineHandle pipeline = m_reader.Read<ComputePipelineHandle>();
+                if (!bind(COMPUTE_PIPELINE_SLOT, resolve(m_computePipelines, pipeline)))
+                    return false;
+
+                m_context.SetComputePipeline(pipeline);
+                return true;
+            }
+            case CaptureOp::SetPushConstants: {
+                size_t offset = m_reader.Read<size_t>();
+                size_t size;
+                const void* pData = m_reader.ReadBlob(size);
+                if (!m_reader)
+                    return false;
+
+                m_context.SetPushConstants(const_cast<void*>(pData), size, offset);
+                return true;
+            }
+            case CaptureOp::SetPrimitiveTopology: {
+                VkPrimitiveTopology topology = m_reader.Read<VkPrimitiveTopology>();
+                if (!m_reader)
+                    return false;
+
+                m_context.SetPrimitiveTopology(topology);
+                return true;
+            }
+            case CaptureOp::SetCullMode: {
+                VkCullModeFlags cullMode = m_reader.Read<VkCullModeFlags>();
+                if (!m_reader)
+                    return false;
+
+                m_context.SetCullMode(cullMode);
+                return true;
+            }
+
+            case CaptureOp::Draw: {
+                uint32_t offset = m_reader.Read<uint32_t>();
+                uint32_t count = m_reader.Read<uint32_t>();
+                if (!canDraw(false))
+                    return false;
+
+                m_context.Draw(offset, count);
+                return true;
+            }
+            case CaptureOp::DrawIndexed: {
+                uint32_t offset = m_reader.Read<uint32_t>();
+                uint32_t count = m_reader.Read<uint32_t>();
+                uint32_t firstInstance = m_reader.Read<uint32_t>();
+                if (!canDraw(true))
+                    return false;
+
+                m_context.DrawIndexed(offset, count, firstInstance);
+                return true;
+            }
+            case CaptureOp::DrawIndexedIndirect: {
+                BufferHandle buffer = m_reader.Read<BufferHandle>();
+                size_t offset = m_reader.Read<size_t>();
+                uint32_t drawCount = m_reader.Read<uint32_t>();
+                uint32_t stride = m_reader.Read<uint32_t>();
+                if (!resolve(m_buffers, buffer) || !canDraw(true))
+                    return false;
+
+                m_context.DrawIndexedIndirect(buffer, offset, drawCount, stride);
+                return true;
+            }
+            case CaptureOp::Dispatch: {
+                uint32_t x = m_reader.Read<uint32_t>();
+                uint32_t y = m_reader.Read<uint32_t>();
+                uint32_t z = m_reader.Read<uint32_t>();
+                if (!canDispatch())
+                    return false;
+
+                m_context.Dispatch(x, y, z);
+                return true;
+            }
+            case CaptureOp::DispatchIndirect: {
+                BufferHandle buffer = m_reader.Read<BufferHandle>();
+                size_t offset = m_reader.Read<size_t>();
+                if (!resolve(m_buffers, buffer) || !canDispatch())
+                    return false;
+
+                m_context.DispatchIndirect(buffer, offset);
+                return true;
+            }
+            case CaptureOp::BeginAsyncCompute:
+                m_context.BeginAsyncCompute();
+                return true;
+            case CaptureOp::EndAsyncCompute: {
+                VkPipelineStageFlags2 consumerStages = m_reader.Read<VkPipelineStageFlags2>();
+                if (!m_reader)
+                    return false;
+
+                m_context.EndAsyncCompute(consumerStages);
+                return true;
+            }
+            case CaptureOp::PipelineBarrier: {
+                auto srcStage = m_reader.Read<VkPipelineStageFlags2>();
+                auto srcAccess = m_reader.Read<VkAccessFlags2>();
+                auto dstStage = m_reader.Read<VkPipelineStageFlags2>();
+                auto dstAccess = m_reader.Read<VkAccessFlags2>();
+                if (!m_reader)
+                    return false;
+
+                m_context.PipelineBarrier(srcStage, srcAccess, dstStage, dstAccess);
+                return true;
+            }
+
+            case CaptureOp::CreateBuffer: {
+                BufferDesc desc = m_reader.ReadBufferDesc();
+                BufferHandle handle = m_reader.Read<BufferHandle>();
+                if (!m_reader)
+                    return false;
+
+                m_buffers[handle] = m_context.CreateBuffer(desc);
+                return true;
+            }
+            case CaptureOp::CreateShader: {
+                ShaderDesc desc = m_reader.ReadShaderDesc();
+                uint64_t handle = m_reader.Read<uint64_t>();
+                if (!m_reader)
+                    return false;
+
+                m_shaders[handle] = m_context.CreateShader(desc);
+                return true;
+            }
+            case CaptureOp::CreateSampler: {
+                SamplerDesc desc = m_reader.Read<SamplerDesc>();
+                SamplerHandle handle = m_reader.Read<SamplerHandle>();
+                if (!m_reader)
+                    return false;
+
+                m_samplers[handle] = m_context.CreateSampler(desc);
+                return true;
+            }
+            case CaptureOp::CreateTexture:
+            case CaptureOp::TextureUpload: {
+                TextureDesc desc = m_reader.ReadTextureDesc();
+                TextureHandle handle = m_reader.Read<TextureHandle>();
+                if (!m_reader)
+                    return false;
+
+                m_textures[handle] = m_context.CreateTexture(desc);
+                return true;
+            }
+            case CaptureOp::CreateGraphicsPipeline: {
+                GraphicsPipelineDesc desc = m_reader.ReadGraphicsPipelineDesc(m_shaders);
+                GraphicsPipelineHandle handle = m_reader.Read<GraphicsPipelineHandle>();
+                if (!m_reader)
+                    return false;
+
+                m_graphicsPipelines[handle] = m_context.CreateGraphicsPipeline(desc);
+                return true;
+            }
+            case CaptureOp::CreateComputePipeline: {
+                ComputePipelineDesc desc = m_reader.ReadComputePipelineDesc(m_shaders);
+                ComputePipelineHandle handle = m_reader.Read<ComputePipelineHandle>();
+                if (!m_reader)
+                    return false;
+
+                m_computePipelines[handle] = m_context.CreateComputePipeline(desc);
+                return true;
+            }
+
+            case CaptureOp::DestroyBuffer: {
+                BufferHandle buffer = m_reader.Read<BufferHandle>();
+                if (!resolve(m_buffers, buffer))
+                    return false;
+
+                m_context.DestroyBuffer(buffer);
+                return true;
+            }
+            case CaptureOp::DestroyShader: {
+                VkShaderModule shader = m_reader.ReadShader(m_shaders);
+                if (shader == nullptr || !m_reader)
+                    return false;
+
+                m_context.DestroyShader(shader);
+                return true;
+            }
+            case CaptureOp::DestroySampler: {
+                SamplerHandle sampler = m_reader.Read<SamplerHandle>();
+                if (!resolve(m_samplers, sampler))
+                    return false;
+
+                m_context.DestroySampler(sampler);
+                return true;
+            }
+            case CaptureOp::DestroyTexture: {
+                TextureHandle texture = m_reader.Read<TextureHandle>();
+                if (!resolve(m_textures, texture))
+                    return false;
+
+                m_context.DestroyTexture(texture);
+                return true;
+            }
+            case CaptureOp::DestroyGraphicsPipeline: {
+                GraphicsPipelineHandle pipeline = m_reader.Read<GraphicsPipelineHandle>();
+                if (!resolve(m_graphicsPipelines, pipeline))
+                    return false;
+
+                m_context.DestroyGraphicsPipeline(pipeline);
+                return true;
+            }
+            case CaptureOp::DestroyComputePipeline: {
+                ComputePipelineHandle pipeline = m_reader.Read<ComputePipelineHandle>();
+                if (!resolve(m_computePipelines, pipeline))
+                    return false;
+
+                m_context.DestroyComputePipeline(pipeline);
+                return true;
+            }
+
+            case CaptureOp::CopyBufferData: {
+                BufferHandle buffer = m_reader.Read<BufferHandle>();
+                size_t offset = m_reader.Read<size_t>();
+                size_t size;
+                const void* pData = m_reader.ReadBlob(size);
+                if (!resolve(m_buffers, buffer))
+                    return false;
+
+                m_context.CopyBufferData(buffer, const_cast<void*>(pData), offset, size);
+                return true;
+            }
+            case CaptureOp::SetFramePacing: {
+                FramePacingDesc desc = m_reader.Read<FramePacingDesc>();
+                if (!m_reader)
+                    return false;
+
+                m_context.SetFramePacing(desc);
+                return true;
+            }
+            case CaptureOp::SetDynamicResolution: {
+                DynamicResolutionDesc desc = m_reader.ReadDynamicResolutionDesc(m_shaders);
+                if (!m_reader)
+                    return false;
+
+                m_context.SetDynamicResolution(desc);
+                return true;
+            }
+            case CaptureOp::SetMemoryBudget: {
+                MemoryBudgetDesc desc = m_reader.Read<MemoryBudgetDesc>();
+                if (!m_reader)
+                    return false;
+
+                m_context.SetMemoryBudget(desc);
+                return true;
+            }
+            case CaptureOp::SetTextureStreaming: {
+                TextureStreamingDesc desc = m_reader.Read<TextureStreamingDesc>();
+                if (!m_reader)
+                    return false;
+
+                m_context.SetTextureStreaming(desc);
+                return true;
+            }
+            case CaptureOp::SetDefragmentation: {
+                DefragmentationDesc desc = m_reader.Read<DefragmentationDesc>();
+                if (!m_reader)
+                    return false;
+
+                m_context.SetDefragmentation(desc);
+                return true;
+            }
+            case CaptureOp::RequestTextureResolution: {
+                TextureHandle texture = m_reader.Read<TextureHandle>();
+                float screenSize = m_reader.Read<float>();
+                if (!resolve(m_textures, texture))
+                    return false;
+
+                m_context.RequestTextureResolution(texture, screenSize);
+                return true;
+            }
+            case CaptureOp::WaitIdle:
+                m_context.WaitIdle();
+                return true;
+            }
+
+            return false;
+        }
+
+    private:
+        // Slots for m_missingBindings besides descriptor bindings, which use their binding number
+        static constexpr uint32_t VERTEX_BUFFERS_SLOT = UINT32_MAX;
+        static constexpr uint32_t INDEX_BUFFER_SLOT = UINT32_MAX - 1;
+        static constexpr uint32_t GRAPHICS_PIPELINE_SLOT = UINT32_MAX - 2;
+        static constexpr uint32_t COMPUTE_PIPELINE_SLOT = UINT32_MAX - 3;
+
+        bool MissingDescriptors() const {
+            return std::any_of(m_missingBindings.begin(), m_missingBindings.end(), [](uint32_t slot) {
+                return slot < COMPUTE_PIPELINE_SLOT;
+            });
+        }
+
+        Context& m_context;
+        CaptureReader& m_reader;
+
+        std::unordered_map<ResourceID, ResourceID> m_buffers;
+        std::unordered_map<ResourceID, ResourceID> m_textures;
+        std::unordered_map<ResourceID, ResourceID> m_samplers;
+        std::unordered_map<ResourceID, ResourceID> m_graphicsPipelines;
+        std::unordered_map<ResourceID, ResourceID> m_computePipelines;
+        CaptureShaderMap m_shaders;
+        std::unordered_set<uint32_t> m_missingBindings;
+    };
+
+    struct Summary {
+        double mean, median, p95, max;
+    };
+
+    Summary Summarize(std::vector<double> values) {
+        if (values.empty())
+            return {};
+
+        std::sort(values.begin(), values.end());
+
+        double sum = 0.0;
+        for (double value : values)
+            sum += value;
+
+        return {
+            .mean = sum / values.size(),
+            .median = values[values.size() / 2],
+            .p95 = values[std::min(values.size() - 1, values.size() * 95 / 100)],
+            .max = values.back()
+        };
+    }
+
+    std::string ToJson(const std::string& device, const std::string& capture, const std::vector<FrameTiming>& frames) {
+        std::ostringstream json;
+        json << "{\n  \"device\": \"" << EscapeJson(device) << "\",\n  \"capture\": \"" << EscapeJson(capture) << "\",\n  \"frames\": [\n";
+
+        for (size_t i = 0; i < frames.size(); i++) {
+            json << "    { \"frame\": " << i << ", \"cpuMs\": " << frames[i].cpuMs;
+            if (frames[i].gpuMs >= 0.0)
+                json << ", \"gpuMs\": " << frames[i].gpuMs;
+
+            json << " }" << (i + 1 < frames.size() ? "," : "") << "\n";
+        }
+
+        json << "  ]\n}\n";
+        return json.str();
+    }
+
+}
+
+int main(int argc, char** argv) {
+    Arguments args;
+    if (!ParseArguments(argc, argv, args)) {
+        PrintUsage();
+        return 2;
+    }
+
+    CaptureReader reader(args.capturePath.c_str());
+    if (!reader) {
+        std::fprintf(stderr, "vkr-replay: %s is not a capture from this version\n", args.capturePath.c_str());
+        return 2;
+    }
+
+    // Headless at the captured extent, so the replay runs without a display at the size the capture rendered
+    const CaptureHeader& header = reader.GetHeader();
+
+    PresentationParameters params = {};
+    params.headless = true;
+    params.headlessExtent = header.extent;
+    params.framePacing.framesInFlight = header.framesInFlight;
+    params.deviceSelection.device = args.device;
+
+    auto context = std::make_unique<Context>(params);
+    Replayer replayer(*context, reader);
+
+    std::vector<FrameTiming> frames;
+    uint32_t skipped = 0;
+
+    // Timestamps of a frame are read back when its slot comes around again, framesInFlight BeginFrames later
+    auto collectGpuTime = [&]() {
+        size_t framesInFlight = context->GetFramePacing().framesInFlight;
+        double gpuMs = context->GetFrameStats().gpuFrameMs;
+
+        // Stays 0 on devices without timestamp support
+        if (frames.size() >= framesInFlight && gpuMs > 0.0)
+            frames[frames.size() - framesInFlight].gpuMs = gpuMs;
+    };
+
+    CaptureOp op;
+    while (reader.Next(op)) {
+        if (!replayer.Replay(op)) {
+            if (!reader)
+                break;
+
+            skipped++;
+            continue;
+        }
+
+        if (op == CaptureOp::BeginFrame)
+            collectGpuTime();
+        else if (op == CaptureOp::EndFrame)
+            frames.push_back({ .cpuMs = context->GetFrameStats().cpuFrameMs });
+    }
+
+    // Empty frames bring the slots of the last captured frames around so their timestamps are read
+    size_t capturedFrames = frames.size();
+    for (uint32_t i = 0; i < context->GetFramePacing().framesInFlight; i++) {
+        context->BeginFrame();
+        collectGpuTime();
+        context->EndFrame();
+        frames.push_back({});
+    }
+
+    frames.resize(capturedFrames);
+    context->WaitIdle();
+
+    // A corrupt record ends the replay, the frames before it are still reported
+    bool corrupt = !reader;
+    if (corrupt)
+        std::fprintf(stderr, "vkr-replay: %s has a corrupt record after frame %zu, replay stopped\n", args.capturePath.c_str(), capturedFrames);
+
+    if (skipped > 0)
+        std::fprintf(stderr, "vkr-replay: skipped %u call(s) on resources created before the capture began, or drawing with them\n", skipped);
+
+    // Emit machine-readable results
+    std::string json = ToJson(context->GetPhysicalDeviceProperties().deviceName, args.capturePath, frames);
+
+    if (args.outPath.empty()) {
+        std::fputs(json.c_str(), stdout);
+    }
+    else {
+        std::ofstream out(args.outPath);
+        out << json;
+    }
+
+    std::vector<double> cpuTimes, gpuTimes;
+    for (auto& frame : frames) {
+        cpuTimes.push_back(frame.cpuMs);
+        if (frame.gpuMs >= 0.0)
+            gpuTimes.push_back(frame.gpuMs);
+    }
+
+    Summary cpu = Summarize(cpuTimes);
+    Summary gpu = Summarize(gpuTimes);
+
+    std::fprintf(stderr, "%u frames replayed\n", uint32_t(frames.size()));
+    std::fprintf(stderr, "%-8s %10s %10s %10s %10s\n", "ms", "mean", "median", "p95", "max");
+    std::fprintf(stderr, "%-8s %10.3f %10.3f %10.3f %10.3f\n", "cpu", cpu.mean, cpu.median, cpu.p95, cpu.max);
+    std::fprintf(stderr, "%-8s %10.3f %10.3f %10.3f %10.3f\n", "gpu", gpu.mean, gpu.median, gpu.p95, gpu.max);
+
+    return corrupt ? 1 : 0;
+}
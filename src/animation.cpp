@@ -0,0 +1,101 @@
+#include "animation.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace vkr {
+
+    namespace {
+
+        // Value of a channel at time, every path is interpolated as one four-wide vector
+        glm::vec4 SampleChannel(const AnimationChannel& channel, float time) {
+            const std::vector<float>& times = channel.times;
+
+            if (time <= times.front())
+                return channel.values.front();
+            if (time >= times.back())
+                return channel.values.back();
+
+            // The segment ends at the first key after time
+            size_t next = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+            size_t previous = next - 1;
+
+            if (channel.interpolation == AnimationInterpolation::Step)
+                return channel.values[previous];
+
+            float t = (time - times[previous]) / (times[next] - times[previous]);
+            glm::vec4 a = channel.values[previous];
+            glm::vec4 b = channel.values[next];
+
+            // q and -q are the same rotation, blend toward the closer one
+            if (channel.path == AnimationPath::Rotation && glm::dot(a, b) < 0.0f)
+                b = -b;
+
+            return glm::mix(a, b, t);
+        }
+
+        glm::mat4 ToMatrix(const JointTransform& transform) {
+            glm::mat4 matrix = glm::mat4_cast(transform.rotation);
+            matrix[0] *= transform.scale.x;
+            matrix[1] *= transform.scale.y;
+            matrix[2] *= transform.scale.z;
+            matrix[3] = glm::vec4(transform.translation, 1.0f);
+            return matrix;
+        }
+
+    }
+
+    void SampleAnimation(const AnimationClip& clip, const Skeleton& skeleton, float time, std::span<JointTransform> pose) {
+        assert(pose.size() >= skeleton.restPose.size());
+        std::copy(skeleton.restPose.begin(), skeleton.restPose.end(), pose.begin());
+
+        for (const AnimationChannel& channel : clip.channels) {
+            if (channel.times.empty() || channel.joint >= pose.size())
+                continue;
+
+            glm::vec4 value = SampleChannel(channel, time);
+            JointTransform& transform = pose[channel.joint];
+
+            switch (channel.path) {
+            case AnimationPath::Translation:
+                transform.translation = glm::vec3(value);
+                break;
+            case AnimationPath::Rotation:
+                transform.rotation = glm::normalize(glm::quat(value.w, value.x, value.y, value.z));
+                break;
+            case AnimationPath::Scale:
+                transform.scale = glm::vec3(value);
+                break;
+            }
+        }
+    }
+
+    void ComputeJointMatrices(const Skeleton& skeleton, std::span<const JointTransform> pose, std::span<glm::mat4> jointMatrices) {
+        uint32_t jointCount = static_cast<uint32_t>(skeleton.parents.size());
+        assert(pose.size() >= jointCount && jointMatrices.size() >= jointCount);
+
+        // Model space transforms first, parents may come after their children
+        std::vector<uint8_t> resolved(jointCount, 0);
+        std::vector<uint32_t> chain;
+
+        for (uint32_t joint = 0; joint < jointCount; joint++) {
+            // Walk up to the first resolved ancestor, then resolve back down
+            for (int32_t j = static_cast<int32_t>(joint); j >= 0 && !resolved[j]; j = skeleton.parents[j])
+                chain.push_back(static_cast<uint32_t>(j));
+
+            while (!chain.empty()) {
+                uint32_t j = chain.back();
+                chain.pop_back();
+
+                int32_t parent = skeleton.parents[j];
+                const glm::mat4& parentMatrix = parent >= 0 ? jointMatrices[parent] : skeleton.rootTransform;
+                jointMatrices[j] = parentMatrix * ToMatrix(pose[j]);
+                resolved[j] = 1;
+            }
+        }
+
+        for (uint32_t joint = 0; joint < jointCount; joint++)
+            jointMatrices[joint] = jointMatrices[joint] * skeleton.inverseBindMatrices[joint];
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace vkr {
+
+    // Local transform of a joint relative to its parent
+    struct JointTransform {
+        glm::vec3 translation = glm::vec3(0.0f);
+        glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        glm::vec3 scale = glm::vec3(1.0f);
+    };
+
+    struct Skeleton {
+        std::vector<int32_t> parents;                   // Parent joint, -1 for roots
+        std::vector<glm::mat4> inverseBindMatrices;     // Model space to joint space in the bind pose
+        std::vector<JointTransform> restPose;           // Local transforms of joints no animation channel drives
+        glm::mat4 rootTransform = glm::mat4(1.0f);      // Applied above the roots, e.g. from their parent nodes
+    };
+
+    enum class AnimationPath {
+        Translation,
+        Rotation,
+        Scale
+    };
+
+    enum class AnimationInterpolation {
+        Step,
+        Linear
+    };
+
+    // Keyframes of one property of one joint
+    struct AnimationChannel {
+        uint32_t joint;
+        AnimationPath path;
+        AnimationInterpolation interpolation;
+        std::vector<float> times;           // Ascending, in seconds
+        std::vector<glm::vec4> values;      // xyz for translation and scale, xyzw quaternion for rotation
+    };
+
+    struct AnimationClip {
+        std::vector<AnimationChannel> channels;
+        float duration;
+    };
+
+    // Sample a clip at time (clamped to its keys) over the rest pose, one transform per joint
+    // Every path interpolates four floats per key, rotations are normalized afterwards (nlerp)
+    void SampleAnimation(const AnimationClip& clip, const Skeleton& skeleton, float time, std::span<JointTransform> pose);
+
+    // Skinning matrices of a pose: each joint's model space transform times its inverse bind matrix
+    void ComputeJointMatrices(const Skeleton& skeleton, std::span<const JointTransform> pose, std::span<glm::mat4> jointMatrices);
+
+}
\ No newline at end of file
@@ -0,0 +1,280 @@
+#include "capture.hpp"
+
+namespace vkr {
+
+    CaptureWriter::CaptureWriter(const char* path, const CaptureHeader& header)
+        : m_file(path, std::ios::binary | std::ios::trunc) {
+        m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    void CaptureWriter::Begin(CaptureOp op) {
+        m_op = op;
+        m_record.clear();
+    }
+
+    void CaptureWriter::End() {
+        uint16_t op = static_cast<uint16_t>(m_op);
+        uint32_t size = static_cast<uint32_t>(m_record.size());
+
+        m_file.write(reinterpret_cast<const char*>(&op), sizeof(op));
+        m_file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        m_file.write(reinterpret_cast<const char*>(m_record.data()), m_record.size());
+    }
+
+    void CaptureWriter::WriteBytes(const void* pData, size_t size) {
+        const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+        m_record.insert(m_record.end(), pBytes, pBytes + size);
+    }
+
+    void CaptureWriter::WriteBlob(const void* pData, size_t size) {
+        uint64_t blobSize = pData != nullptr ? size : 0;
+        Write(blobSize);
+        WriteBytes(pData, blobSize);
+    }
+
+    void CaptureWriter::Write(VkShaderModule shader) {
+        uint64_t value = 0;
+        std::memcpy(&value, &shader, sizeof(shader));
+        Write(value);
+    }
+
+    void CaptureWriter::Write(const BufferDesc& desc) {
+        Write(desc.usage);
+        Write(uint64_t(desc.size));
+        WriteBlob(desc.pData, desc.size);
+    }
+
+    void CaptureWriter::Write(const ShaderDesc& desc) {
+        WriteBlob(desc.pData, desc.size);
+    }
+
+    void CaptureWriter::Write(const TextureDesc& desc) {
+        Write(desc.width);
+        Write(desc.height);
+        Write(desc.format);
+        Write(desc.streamed);
+        Write(desc.usage);
+        Write(desc.mipLevels);
+        WriteBlob(desc.pData, size_t(desc.width) * desc.height * Context::GetFormatSize(desc.format));
+    }
+
+    void CaptureWriter::WriteSpecialization(const VkSpecializationInfo* pInfo) {
+        Write(pInfo != nullptr);
+        if (pInfo == nullptr)
+            return;
+
+        WriteBlob(pInfo->pMapEntries, pInfo->mapEntryCount * sizeof(VkSpecializationMapEntry));
+        WriteBlob(pInfo->pData, pInfo->dataSize);
+    }
+
+    void CaptureWriter::Write(const GraphicsPipelineDesc& desc) {
+        WriteBlob(desc.vertexAttribs.data(), desc.vertexAttribs.size() * sizeof(VertexAttrib));
+        Write(desc.vertexShader);
+        Write(desc.fragmentShader);
+        Write(desc.depthStencil);
+        WriteSpecialization(desc.vertexSpecialization);
+        WriteSpecialization(desc.fragmentSpecialization);
+        Write(desc.depthOnly);
+    }
+
+    void CaptureWriter::Write(const ComputePipelineDesc& desc) {
+        Write(desc.computeShader);
+        WriteSpecialization(desc.specialization);
+    }
+
+    void CaptureWriter::Write(const DynamicResolutionDesc& desc) {
+        Write(desc.enabled);
+        Write(desc.targetGpuFrameMs);
+        Write(desc.minScale);
+        Write(desc.maxScale);
+        Write(desc.sharpness);
+        Write(desc.upscaleVertexShader);
+        Write(desc.upscaleFragmentShader);
+    }
+
+    CaptureReader::CaptureReader(const char* path) {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open())
+            return;
+
+        m_contents.resize(size_t(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(m_contents.data()), m_contents.size());
+
+        if (m_contents.size() < sizeof(CaptureHeader))
+            return;
+
+        std::memcpy(&m_header, m_contents.data(), sizeof(CaptureHeader));
+        m_recordOffset = sizeof(CaptureHeader);
+        m_valid = m_header.magic == CAPTURE_MAGIC && m_header.version == CAPTURE_VERSION;
+    }
+
+    bool CaptureReader::Next(CaptureOp& op) {
+        constexpr size_t RECORD_HEADER_SIZE = sizeof(uint16_t) + sizeof(uint32_t);
+
+        m_specializations.clear();
+
+        if (!m_valid || m_recordOffset + RECORD_HEADER_SIZE > m_contents.size())
+            return false;
+
+        uint16_t value;
+        uint32_t size;
+        std::memcpy(&value, m_contents.data() + m_recordOffset, sizeof(value));
+        std::memcpy(&size, m_contents.data() + m_recordOffset + sizeof(value), sizeof(size));
+
+        // A record cut short, e.g. by a crash while capturing, ends the capture
+        m_offset = m_recordOffset + RECORD_HEADER_SIZE;
+        m_recordEnd = m_offset + size;
+        if (m_recordEnd > m_contents.size())
+            return false;
+
+        m_recordOffset = m_recordEnd;
+        op = static_cast<CaptureOp>(value);
+        return true;
+    }
+
+    bool CaptureReader::Overreads(size_t size) {
+        // A record shorter than its arguments is corrupt, nothing after it can be trusted either
+        if (m_valid && size <= m_recordEnd - m_offset)
+            return false;
+
+        m_valid = false;
+        return true;
+    }
+
+    void CaptureReader::ReadBytes(void* pData, size_t size) {
+        if (Overreads(size))
+            return;
+
+        std::memcpy(pData, m_contents.data() + m_offset, size);
+        m_offset += size;
+    }
+
+    const void* CaptureReader::ReadBlob(size_t& size) {
+        size = size_t(Read<uint64_t>());
+        if (Overreads(size)) {
+            size = 0;
+            return nullptr;
+        }
+
+        const void* pData = size > 0 ? m_contents.data() + m_offset : nullptr;
+        m_offset += size;
+        return pData;
+    }
+
+    VkShaderModule CaptureReader::ReadShader(const CaptureShaderMap& shaders) {
+        auto it = shaders.find(Read<uint64_t>());
+        return it != shaders.end() ? it->second : nullptr;
+    }
+
+    BufferDesc CaptureReader::ReadBufferDesc() {
+        BufferDesc desc = {};
+        desc.usage = Read<VkBufferUsageFlags>();
+        desc.size = size_t(Read<uint64_t>());
+
+        // The buffer is created with desc.size bytes of initial data, a blob of any other size is corrupt
+        size_t size;
+        desc.pData = const_cast<void*>(ReadBlob(size));
+        if (desc.pData != nullptr && size != desc.size) {
+            desc.pData = nullptr;
+            m_valid = false;
+        }
+
+        return desc;
+    }
+
+    ShaderDesc CaptureReader::ReadShaderDesc() {
+        size_t size;
+        const void* pData = ReadBlob(size);
+
+        // SPIR-V is read as words, copy it out to an aligned buffer
+        m_shaderCode.resize((size + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+        if (size > 0)
+            std::memcpy(m_shaderCode.data(), pData, size);
+
+        return { m_shaderCode.data(), size };
+    }
+
+    TextureDesc CaptureReader::ReadTextureDesc() {
+        TextureDesc desc = {};
+        desc.width = Read<uint32_t>();
+        desc.height = Read<uint32_t>();
+        desc.format = Read<VkFormat>();
+        desc.streamed = Read<bool>();
+        desc.usage = Read<VkImageUsageFlags>();
+        desc.mipLevels = Read<uint32_t>();
+
+        // The texture is created from width * height texels of the format, a blob of any other size is corrupt
+        size_t size;
+        desc.pData = const_cast<void*>(ReadBlob(size));
+        if (desc.pData != nullptr && size != size_t(desc.width) * desc.height * Context::GetFormatSize(desc.format)) {
+            desc.pData = nullptr;
+            m_valid = false;
+        }
+
+        return desc;
+    }
+
+    const VkSpecializationInfo* CaptureReader::ReadSpecialization() {
+        if (!Read<bool>())
+            return nullptr;
+
+        Specialization& spec = m_specializations.emplace_back();
+
+        // Map entries are copied out, the file contents carry no alignment guarantee
+        size_t entriesSize;
+        const void* pEntries = ReadBlob(entriesSize);
+        spec.entries.resize(entriesSize / sizeof(VkSpecializationMapEntry));
+        if (entriesSize > 0)
+            std::memcpy(spec.entries.data(), pEntries, entriesSize);
+
+        size_t dataSize;
+        const void* pData = ReadBlob(dataSize);
+
+        spec.info = {
+            .mapEntryCount = static_cast<uint32_t>(spec.entries.size()),
+            .pMapEntries = spec.entries.data(),
+            .dataSize = dataSize,
+            .pData = pData
+        };
+        return &spec.info;
+    }
+
+    GraphicsPipelineDesc CaptureReader::ReadGraphicsPipelineDesc(const CaptureShaderMap& shaders) {
+        GraphicsPipelineDesc desc = {};
+
+        size_t attribsSize;
+        const void* pAttribs = ReadBlob(attribsSize);
+        desc.vertexAttribs.resize(attribsSize / sizeof(VertexAttrib));
+        if (attribsSize > 0)
+            std::memcpy(desc.vertexAttribs.data(), pAttribs, attribsSize);
+
+        desc.vertexShader = ReadShader(shaders);
+        desc.fragmentShader = ReadShader(shaders);
+        desc.depthStencil = Read<DepthStencilDesc>();
+        desc.vertexSpecialization = ReadSpecialization();
+        desc.fragmentSpecialization = ReadSpecialization();
+        desc.depthOnly = Read<bool>();
+        return desc;
+    }
+
+    ComputePipelineDesc CaptureReader::ReadComputePipelineDesc(const CaptureShaderMap& shaders) {
+        ComputePipelineDesc desc = {};
+        desc.computeShader = ReadShader(shaders);
+        desc.specialization = ReadSpecialization();
+        return desc;
+    }
+
+    DynamicResolutionDesc CaptureReader::ReadDynamicResolutionDesc(const CaptureShaderMap& shaders) {
+        DynamicResolutionDesc desc = {};
+        desc.enabled = Read<bool>();
+        desc.targetGpuFrameMs = Read<double>();
+        desc.minScale = Read<float>();
+        desc.maxScale = Read<float>();
+        desc.sharpness = Read<float>();
+        desc.upscaleVertexShader = ReadShader(shaders);
+        desc.upscaleFragmentShader = ReadShader(shaders);
+        return desc;
+    }
+
+}
\ No newline at end of file
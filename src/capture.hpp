@@ -0,0 +1,221 @@
+#pragma once
+
+#include "context.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace vkr {
+
+    constexpr uint32_t CAPTURE_MAGIC = 0x43524B56;     // "VKRC"
+    // Bumped whenever a record's layout or meaning changes, replay rejects captures of other versions
+    // 2: CopyBufferData writes its blob at its offset into the buffer, instead of at the start
+    constexpr uint32_t CAPTURE_VERSION = 2;
+
+    // One per recorded Context call. A record is [u16 op][u32 payload size][payload], the payload holds the
+    // call's arguments in declaration order, followed by the returned handle for Create* calls
+    enum class CaptureOp : uint16_t {
+        BeginFrame,
+        EndFrame,
+        BeginRendering,
+        BeginDepthPrepass,
+        EndRendering,
+
+        SetVertexBuffers,
+        SetIndexBuffer,
+        SetUniformBuffer,
+        SetTexture,
+        SetStorageBuffer,
+        SetStorageImage,
+        SetDepthTexture,
+        SetGraphicsPipeline,
+        SetComputePipeline,
+        SetPushConstants,
+        SetPrimitiveTopology,
+        SetCullMode,
+
+        Draw,
+        DrawIndexed,
+        DrawIndexedIndirect,
+        Dispatch,
+        DispatchIndirect,
+        BeginAsyncCompute,
+        EndAsyncCompute,
+        PipelineBarrier,
+
+        CreateBuffer,
+        CreateShader,
+        CreateSampler,
+        CreateTexture,
+        CreateGraphicsPipeline,
+        CreateComputePipeline,
+        TextureUpload,          // EndTextureUpload, with the texels written into the staging memory
+
+        DestroyBuffer,
+        DestroyShader,
+        DestroySampler,
+        DestroyTexture,
+        DestroyGraphicsPipeline,
+        DestroyComputePipeline,
+
+        CopyBufferData,
+        SetFramePacing,
+        SetDynamicResolution,
+        SetMemoryBudget,
+        SetTextureStreaming,
+        RequestTextureResolution,
+        WaitIdle,
+        SetDefragmentation
+    };
+
+    struct CaptureHeader {
+        uint32_t magic;
+        uint32_t version;
+        VkExtent2D extent;          // Render extent when the capture began
+        uint32_t framesInFlight;
+    };
+
+    // Shader modules are recorded by handle value, replays map them to the modules they created
+    using CaptureShaderMap = std::unordered_map<uint64_t, VkShaderModule>;
+
+    // Appends Context calls to a capture file
+    class CaptureWriter {
+    public:
+        CaptureWriter(const char* path, const CaptureHeader& header);
+
+        operator bool() const { return m_file.good(); }
+
+        void Begin(CaptureOp op);
+        void End();
+
+        template <typename T>
+            requires std::is_trivially_copyable_v<T>
+        void Write(const T& value) {
+            WriteBytes(&value, sizeof(T));
+        }
+
+        // Size-prefixed bytes, empty for null data
+        void WriteBlob(const void* pData, size_t size);
+
+        void Write(VkShaderModule shader);
+        void Write(const BufferDesc& desc);
+        void Write(const ShaderDesc& desc);
+        void Write(const TextureDesc& desc);
+        void Write(const GraphicsPipelineDesc& desc);
+        void Write(const ComputePipelineDesc& desc);
+        void Write(const DynamicResolutionDesc& desc);
+
+    private:
+        void WriteBytes(const void* pData, size_t size);
+        void WriteSpecialization(const VkSpecializationInfo* pInfo);
+
+        std::ofstream m_file;
+        std::vector<uint8_t> m_record;      // Payload of the record being written
+        CaptureOp m_op;
+    };
+
+    // Reads back a capture file record by record
+    class CaptureReader {
+    public:
+        CaptureReader(const char* path);
+
+        // False if the file is missing, truncated or from another version, or once a read went past the end of
+        // a record. Reads past the end return zeros and empty blobs
+        operator bool() const { return m_valid; }
+
+        const CaptureHeader& GetHeader() const { return m_header; }
+
+        // Move to the next record, false at the end of the file
+        bool Next(CaptureOp& op);
+
+        template <typename T>
+            requires std::is_trivially_copyable_v<T>
+        T Read() {
+            T value = {};
+            ReadBytes(&value, sizeof(T));
+            return value;
+        }
+
+        // Points into the file contents, valid until the reader is destroyed. Sets size to 0 for an empty blob
+        const void* ReadBlob(size_t& size);
+
+        // Descs point into the file contents or the reader's storage, valid until the next call to Next
+        VkShaderModule ReadShader(const CaptureShaderMap& shaders);
+        BufferDesc ReadBufferDesc();
+        ShaderDesc ReadShaderDesc();
+        TextureDesc ReadTextureDesc();
+        GraphicsPipelineDesc ReadGraphicsPipelineDesc(const CaptureShaderMap& shaders);
+        ComputePipelineDesc ReadComputePipelineDesc(const CaptureShaderMap& shaders);
+        DynamicResolutionDesc ReadDynamicResolutionDesc(const CaptureShaderMap& shaders);
+
+    private:
+        bool Overreads(size_t size);
+        void ReadBytes(void* pData, size_t size);
+        const VkSpecializationInfo* ReadSpecialization();
+
+        struct Specialization {
+            VkSpecializationInfo info;
+            std::vector<VkSpecializationMapEntry> entries;
+        };
+
+        std::vector<uint8_t> m_contents;
+        CaptureHeader m_header = {};
+        bool m_valid = false;
+
+        size_t m_recordOffset = 0;      // Start of the next record
+        size_t m_offset = 0;            // Read position within the current record
+        size_t m_recordEnd = 0;
+
+        std::deque<Specialization> m_specializations;
+        std::vector<uint32_t> m_shaderCode;
+    };
+
+    // Records one Context call for as long as it is in scope. Calls the context makes to itself while recording
+    // are nested and skipped, a replay repeats them by replaying the outer call
+    class CaptureCall {
+    public:
+        CaptureCall(CaptureWriter* pWriter, uint32_t& depth, CaptureOp op)
+            : m_pWriter(depth == 0 ? pWriter : nullptr), m_depth(depth) {
+            m_depth++;
+            if (m_pWriter != nullptr)
+                m_pWriter->Begin(op);
+        }
+
+        ~CaptureCall() {
+            m_depth--;
+            if (m_pWriter != nullptr)
+                m_pWriter->End();
+        }
+
+        CaptureCall(const CaptureCall&) = delete;
+        CaptureCall& operator=(const CaptureCall&) = delete;
+
+        template <typename... TArgs>
+        void Args(const TArgs&... args) {
+            if (m_pWriter != nullptr)
+                (m_pWriter->Write(args), ...);
+        }
+
+        void Blob(const void* pData, size_t size) {
+            if (m_pWriter != nullptr)
+                m_pWriter->WriteBlob(pData, size);
+        }
+
+        // Record the handle a Create* call returns
+        template <typename T>
+        T Return(T value) {
+            Args(value);
+            return value;
+        }
+
+    private:
+        CaptureWriter* m_pWriter;
+        uint32_t& m_depth;
+    };
+
+}
\ No newline at end of file
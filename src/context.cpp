@@ -1,8 +1,19 @@
 #define VOLK_IMPLEMENTATION
 #define VMA_IMPLEMENTATION
 #include "context.hpp"
+#include "capture.hpp"
+#include "render_thread.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
 #include <vector>
 
 #define VK_ASSERT_RESULT(exp, r) { VkResult vkResult = exp; assert(vkResult == r); }
@@ -10,8 +21,147 @@
 
 namespace vkr {
 
+    // Stages and accesses a compute-only queue family can synchronize, see PipelineBarrier
+    static constexpr VkPipelineStageFlags2 COMPUTE_QUEUE_STAGES = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT |
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT |
+        VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT |
+        VK_PIPELINE_STAGE_2_HOST_BIT | VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+    static constexpr VkAccessFlags2 GRAPHICS_ACCESSES = VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT |
+        VK_ACCESS_2_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    bool Context::HasStencilComponent(VkFormat format) {
+        return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+    }
+
+    VkImageAspectFlags Context::GetImageAspect(VkFormat format) {
+        switch (format) {
+        case VK_FORMAT_D32_SFLOAT:
+        case VK_FORMAT_D16_UNORM:
+            return VK_IMAGE_ASPECT_DEPTH_BIT;
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+            return VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+    }
+
+    uint32_t Context::GetFormatSize(VkFormat format) {
+        switch (format) {
+        case VK_FORMAT_R8_UNORM:
+        case VK_FORMAT_R8_SRGB:
+        case VK_FORMAT_R8_UINT:
+            return 1;
+        case VK_FORMAT_R8G8_UNORM:
+        case VK_FORMAT_R8G8_SRGB:
+        case VK_FORMAT_R16_SFLOAT:
+        case VK_FORMAT_R16_UNORM:
+        case VK_FORMAT_R16_UINT:
+            return 2;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+        case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+        case VK_FORMAT_R16G16_SFLOAT:
+        case VK_FORMAT_R32_SFLOAT:
+        case VK_FORMAT_R32_UINT:
+            return 4;
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+        case VK_FORMAT_R16G16B16A16_UNORM:
+        case VK_FORMAT_R32G32_SFLOAT:
+            return 8;
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+        case VK_FORMAT_R32G32B32A32_UINT:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    // Streamed textures are box filtered byte by byte, which only holds for 8-bit channels
+    static bool HasByteChannels(VkFormat format) {
+        switch (format) {
+        case VK_FORMAT_R8_UNORM:
+        case VK_FORMAT_R8_SRGB:
+        case VK_FORMAT_R8G8_UNORM:
+        case VK_FORMAT_R8G8_SRGB:
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Fill every level below 0 with a 2x2 box filter of the level above it
+    static void BuildMipChain(std::vector<std::vector<uint8_t>>& mips, VkExtent2D extent, uint32_t channels) {
+        for (uint32_t level = 1; level < mips.size(); level++) {
+            uint32_t srcWidth = std::max(extent.width >> (level - 1), 1u);
+            uint32_t srcHeight = std::max(extent.height >> (level - 1), 1u);
+            uint32_t width = std::max(extent.width >> level, 1u);
+            uint32_t height = std::max(extent.height >> level, 1u);
+
+            auto& src = mips[level - 1];
+            auto& dst = mips[level];
+            dst.resize(size_t(width) * height * channels);
+
+            for (uint32_t y = 0; y < height; y++) {
+                for (uint32_t x = 0; x < width; x++) {
+                    uint32_t x0 = std::min(x * 2, srcWidth - 1), x1 = std::min(x * 2 + 1, srcWidth - 1);
+                    uint32_t y0 = std::min(y * 2, srcHeight - 1), y1 = std::min(y * 2 + 1, srcHeight - 1);
+
+                    for (uint32_t c = 0; c < channels; c++) {
+                        uint32_t sum = src[(size_t(y0) * srcWidth + x0) * channels + c] + src[(size_t(y0) * srcWidth + x1) * channels + c] +
+                            src[(size_t(y1) * srcWidth + x0) * channels + c] + src[(size_t(y1) * srcWidth + x1) * channels + c];
+                        dst[(size_t(y) * width + x) * channels + c] = static_cast<uint8_t>((sum + 2) / 4);
+                    }
+                }
+            }
+        }
+    }
+
+    // Match a device against a name substring or its deviceUUID in hex (dashes ignored, any case)
+    static bool MatchesDevice(VkPhysicalDevice pd, const char* device) {
+        VkPhysicalDeviceIDProperties pdidp = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES
+        };
+
+        VkPhysicalDeviceProperties2 pdp2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &pdidp
+        };
+
+        vkGetPhysicalDeviceProperties2(pd, &pdp2);
+
+        if (strstr(pdp2.properties.deviceName, device) != nullptr)
+            return true;
+
+        char uuid[VK_UUID_SIZE * 2 + 1] = {};
+        for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+            snprintf(uuid + i * 2, 3, "%02x", pdidp.deviceUUID[i]);
+
+        std::string requested;
+        for (const char* c = device; *c != '\0'; c++) {
+            if (*c != '-')
+                requested.push_back(static_cast<char>(tolower(*c)));
+        }
+
+        return requested == uuid;
+    }
+
     Context::Context(const PresentationParameters& params) 
-        : m_presentParams(params) {
+        : m_shared(params.sharedContext != nullptr ? params.sharedContext->m_shared : std::make_shared<SharedDevice>()),
+        m_presentParams(params), m_framePacing(params.framePacing) {
+        m_framePacing.framesInFlight = std::clamp(m_framePacing.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+        m_frameStats.framesInFlight = m_framePacing.framesInFlight;
+        m_frameStats.renderScale = 1.0f;
+
         // Create single VkInstance
         if (s_vkInstance == nullptr) {
             VK_ASSERT(volkInitialize());
@@ -22,12 +172,23 @@ namespace vkr {
             };
 
             // Initialize instance layers
-            std::vector<const char*> instanceLayerNames = {
-                "VK_LAYER_KHRONOS_validation"
-            };
+            // Validation is optional so that GPU-less machines without the SDK layers can still run
+            std::vector<const char*> instanceLayerNames;
+
+            uint32_t ilpc = 0;
+            vkEnumerateInstanceLayerProperties(&ilpc, nullptr);
+
+            std::vector<VkLayerProperties> ilps(ilpc);
+            vkEnumerateInstanceLayerProperties(&ilpc, ilps.data());
+
+            for (auto& ilp : ilps) {
+                if (strcmp(ilp.layerName, "VK_LAYER_KHRONOS_validation") == 0)
+                    instanceLayerNames.push_back("VK_LAYER_KHRONOS_validation");
+            }
 
             // Initialize instance extensions (OS surfaces, etc.)
-            std::vector<const char*> instanceExtensionNames = {
+            // The instance outlives this context, so surfaces are enabled whenever available, even when headless
+            const char* surfaceExtensionNames[] = {
                 VK_KHR_SURFACE_EXTENSION_NAME,
 
                 #if defined(VK_USE_PLATFORM_WIN32_KHR)
@@ -37,6 +198,23 @@ namespace vkr {
                 #endif
             };
 
+            uint32_t iepc = 0;
+            vkEnumerateInstanceExtensionProperties(nullptr, &iepc, nullptr);
+
+            std::vector<VkExtensionProperties> ieps(iepc);
+            vkEnumerateInstanceExtensionProperties(nullptr, &iepc, ieps.data());
+
+            std::vector<const char*> instanceExtensionNames;
+
+            for (const char* name : surfaceExtensionNames) {
+                for (auto& iep : ieps) {
+                    if (strcmp(iep.extensionName, name) == 0)
+                        instanceExtensionNames.push_back(name);
+                }
+            }
+
+            assert((params.headless || instanceExtensionNames.size() == std::size(surfaceExtensionNames)) &&
+                "the Vulkan instance does not support window surfaces");
 
             VkInstanceCreateInfo ici = {
                 .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
@@ -51,42 +229,242 @@ namespace vkr {
             volkLoadInstance(s_vkInstance);
         }
 
-        // Select a physical device
-        // TODO: just grabbing the first one for now
-        uint32_t pdc = 0;
-        vkEnumeratePhysicalDevices(s_vkInstance, &pdc, nullptr);
+        // The first context creates the device, others render with it
+        if (params.sharedContext == nullptr)
+            CreateDevice();
 
-        std::vector<VkPhysicalDevice> pds(pdc);
-        vkEnumeratePhysicalDevices(s_vkInstance, &pdc, pds.data());
-        m_physicalDevice = pds[0];
+        assert((m_presentParams.headless || m_shared->swapchainEnabled) && "the shared context's device was created headless");
+
+        // Registries and deferred destroys live in the shared device, SyncRenderThread only waits for this context's
+        // render thread, so another context's render thread could race on them
+        assert(!(params.renderThread && params.sharedContext != nullptr) && "a context sharing a device cannot use a render thread");
+        assert((params.sharedContext == nullptr || params.sharedContext->m_renderThread == nullptr) &&
+            "a context with a render thread cannot share its device");
+
+        // Create presentation resources
+        m_depthFormat = SelectDepthFormat();
+
+        if (m_presentParams.headless)
+            CreateHeadlessTarget();
+        else
+            ValidateSwapchain();
+        
+        // Create command resources
+        VkCommandPoolCreateInfo cpci = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = m_queueTopology.graphicsFamily
+        };
+
+        VK_ASSERT(vkCreateCommandPool(m_device, &cpci, nullptr, &m_graphicsCommandPool));
+        
+        VkCommandBufferAllocateInfo cbai = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = m_graphicsCommandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1
+        };
+
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            VK_ASSERT(vkAllocateCommandBuffers(m_device, &cbai, &m_graphicsCommandBuffers[i]));
+        }
+
+        // GPU frame timing, skipped on queues that cannot write timestamps
+        uint32_t qfpc = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &qfpc, nullptr);
+
+        std::vector<VkQueueFamilyProperties> qfps(qfpc);
+        vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &qfpc, qfps.data());
+
+        if (qfps[m_queueTopology.graphicsFamily].timestampValidBits != 0) {
+            VkQueryPoolCreateInfo qpci = {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = 2 * MAX_FRAMES_IN_FLIGHT
+            };
+
+            VK_ASSERT(vkCreateQueryPool(m_device, &qpci, nullptr, &m_timestampQueries));
+        }
+
+        // Async compute batches get their own pool and timeline
+        if (m_computeQueue != nullptr) {
+            cpci.queueFamilyIndex = m_queueTopology.computeFamily;
+
+            VK_ASSERT(vkCreateCommandPool(m_device, &cpci, nullptr, &m_computeCommandPool));
+
+            cbai.commandPool = m_computeCommandPool;
+            for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                VK_ASSERT(vkAllocateCommandBuffers(m_device, &cbai, &m_computeCommandBuffers[i]));
+            }
+
+            cbai.commandPool = m_graphicsCommandPool;
+            for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                VK_ASSERT(vkAllocateCommandBuffers(m_device, &cbai, &m_setupCommandBuffers[i]));
+            }
+
+            VkSemaphoreTypeCreateInfo stci = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                .initialValue = 0
+            };
+
+            VkSemaphoreCreateInfo sci = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                .pNext = &stci
+            };
+
+            VK_ASSERT(vkCreateSemaphore(m_device, &sci, nullptr, &m_computeTimeline));
+        }
+
+        if (params.renderThread) {
+            m_renderThread = std::make_unique<RenderThread>(*this);
+            SyncRenderThread();
+        }
+
+        s_contextCount++;
+    }
+
+    void Context::CreateDevice() {
+        // Required device extensions
+        std::vector<const char*> deviceExtensionNames = {
+            VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+            VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+            VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
+            VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME,
+            VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+        };
+
+        if (!m_presentParams.headless)
+            deviceExtensionNames.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+        m_shared->swapchainEnabled = !m_presentParams.headless;
+
+        // Select a physical device
+        m_physicalDevice = SelectPhysicalDevice(deviceExtensionNames);
+        vkGetPhysicalDeviceProperties(m_physicalDevice, &m_physicalDeviceProperties);
 
         // Create logical device
 
-        // Find a graphics queue
+        // Map out the queue families, dedicated compute and transfer families run alongside graphics
+        // Uploads are recorded on the graphics queue, the transfer family is only reported
+        m_queueTopology = {
+            .graphicsFamily = FindQueueFamilyIndex(m_physicalDevice, VK_QUEUE_GRAPHICS_BIT),
+            .computeFamily = FindQueueFamilyIndex(m_physicalDevice, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT),
+            .transferFamily = FindQueueFamilyIndex(m_physicalDevice, VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)
+        };
+
         std::vector<float> graphicsQueuePriorities = { 1.0f };
 
         VkDeviceQueueCreateInfo gdqci = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = FindQueueFamilyIndex(m_physicalDevice, VK_QUEUE_GRAPHICS_BIT),
+            .queueFamilyIndex = m_queueTopology.graphicsFamily,
             .queueCount = 1,
             .pQueuePriorities = graphicsQueuePriorities.data()
         };
 
         std::vector<VkDeviceQueueCreateInfo> dqcis = { gdqci };
+        m_sharedQueueFamilies = { gdqci.queueFamilyIndex };
 
-        // Initialize device extensions
-        std::vector<const char*> deviceExtensionNames = {
-            VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-            VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
-            VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
-            VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
-            VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME,
-            VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+        // Async compute needs a family without graphics, queues of the graphics family would not overlap
+        uint32_t computeQueueFamilyIndex = m_presentParams.asyncCompute ? m_queueTopology.computeFamily : UINT32_MAX;
+
+        if (computeQueueFamilyIndex != UINT32_MAX) {
+            VkDeviceQueueCreateInfo cdqci = gdqci;
+            cdqci.queueFamilyIndex = computeQueueFamilyIndex;
+
+            dqcis.push_back(cdqci);
+            m_sharedQueueFamilies.push_back(computeQueueFamilyIndex);
+        }
+
+        // Query optional device extensions
+        uint32_t depc = 0;
+        vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &depc, nullptr);
+
+        std::vector<VkExtensionProperties> deps(depc);
+        vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &depc, deps.data());
+
+        auto hasDeviceExtension = [&](const char* name) {
+            for (auto& dep : deps) {
+                if (strcmp(dep.extensionName, name) == 0)
+                    return true;
+            }
+            return false;
+        };
+
+        // Present id/wait let frame pacing measure real presentation times
+        VkPhysicalDevicePresentWaitFeaturesKHR pdpwf = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR
+        };
+
+        VkPhysicalDevicePresentIdFeaturesKHR pdpif = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+            .pNext = &pdpwf
         };
 
+        if (!m_presentParams.headless &&
+            hasDeviceExtension(VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+            hasDeviceExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+            VkPhysicalDeviceFeatures2 pdf2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &pdpif
+            };
+
+            vkGetPhysicalDeviceFeatures2(m_physicalDevice, &pdf2);
+            m_presentWaitSupported = pdpif.presentId && pdpwf.presentWait;
+        }
+
+        if (m_presentWaitSupported) {
+            deviceExtensionNames.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+            deviceExtensionNames.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+        }
+
+        // Real per-heap budgets from the driver, VMA estimates them otherwise
+        bool memoryBudgetSupported = hasDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (memoryBudgetSupported)
+            deviceExtensionNames.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+        // Graphics pipeline libraries let new pipelines be fast-linked from cached state subsets
+        VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pdgplf = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT
+        };
+
+        if (hasDeviceExtension(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+            hasDeviceExtension(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)) {
+            VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT pdgplp = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT
+            };
+
+            VkPhysicalDeviceProperties2 pdp2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+                .pNext = &pdgplp
+            };
+
+            VkPhysicalDeviceFeatures2 pdf2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &pdgplf
+            };
+
+            vkGetPhysicalDeviceProperties2(m_physicalDevice, &pdp2);
+            vkGetPhysicalDeviceFeatures2(m_physicalDevice, &pdf2);
+
+            // Without fast linking, linking libraries costs as much as a monolithic compile
+            m_pipelineLibrarySupported = pdgplf.graphicsPipelineLibrary && pdgplp.graphicsPipelineLibraryFastLinking;
+        }
+
+        if (m_pipelineLibrarySupported) {
+            deviceExtensionNames.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+            deviceExtensionNames.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+        }
+
         // Device extension structs
+        VkPhysicalDeviceTimelineSemaphoreFeatures pdtsf = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+            .timelineSemaphore = true
+        };
+
         VkPhysicalDeviceDynamicRenderingFeatures pddrf = {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES,
+            .pNext = &pdtsf,
             .dynamicRendering = true
         };
 
@@ -111,16 +489,27 @@ namespace vkr {
             .runtimeDescriptorArray = true
         };
 
+        if (m_presentWaitSupported) {
+            pdpwf.pNext = &pddif;
+        }
+
         // Initialize the device and create allocator
         VkDeviceCreateInfo dci = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-            .pNext = &pddif,
+            .pNext = m_presentWaitSupported
+                ? static_cast<void*>(&pdpif)
+                : static_cast<void*>(&pddif),
             .queueCreateInfoCount = static_cast<uint32_t>(dqcis.size()),
             .pQueueCreateInfos = dqcis.data(),
             .enabledExtensionCount = static_cast<uint32_t>(deviceExtensionNames.size()),
             .ppEnabledExtensionNames = deviceExtensionNames.data()
         };
 
+        if (m_pipelineLibrarySupported) {
+            pdgplf.pNext = const_cast<void*>(dci.pNext);
+            dci.pNext = &pdgplf;
+        }
+
         VK_ASSERT(vkCreateDevice(m_physicalDevice, &dci, nullptr, &m_device));
         volkLoadDevice(m_device);
 
@@ -130,76 +519,166 @@ namespace vkr {
         };
         
         VmaAllocatorCreateInfo aci = {
-            .vulkanApiVersion = VK_API_VERSION_1_3,
-            .instance = s_vkInstance,
+            .flags = memoryBudgetSupported ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0u,
             .physicalDevice = m_physicalDevice,
             .device = m_device,
-            .pVulkanFunctions = &vmaVkFns
+            .pVulkanFunctions = &vmaVkFns,
+            .instance = s_vkInstance,
+            .vulkanApiVersion = VK_API_VERSION_1_3
         };
         
         VK_ASSERT(vmaCreateAllocator(&aci, &m_allocator));
 
+        // Eviction needs somewhere to evict to, unified memory devices have no separate host heap
+        const VkPhysicalDeviceMemoryProperties* pMemoryProperties = nullptr;
+        vmaGetMemoryProperties(m_allocator, &pMemoryProperties);
+
+        for (uint32_t i = 0; i < pMemoryProperties->memoryHeapCount; i++) {
+            if (!(pMemoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+                m_evictionSupported = true;
+        }
+
         // Grab handles to the queues
         vkGetDeviceQueue(m_device, gdqci.queueFamilyIndex, 0, &m_graphicsQueue);
 
-        // Create presentation resources
-        ValidateSwapchain();    
-        
-        // Create command resources
+        if (computeQueueFamilyIndex != UINT32_MAX)
+            vkGetDeviceQueue(m_device, computeQueueFamilyIndex, 0, &m_computeQueue);
+
         VkCommandPoolCreateInfo cpci = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-            .queueFamilyIndex = gdqci.queueFamilyIndex
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = m_queueTopology.graphicsFamily
         };
 
-        VK_ASSERT(vkCreateCommandPool(m_device, &cpci, nullptr, &m_graphicsCommandPool));
-
-        cpci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
-
         VK_ASSERT(vkCreateCommandPool(m_device, &cpci, nullptr, &m_transientCommandPool));
-        
-        VkCommandBufferAllocateInfo cbai = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = m_graphicsCommandPool,
-            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = 1
-        };
-
-        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            VK_ASSERT(vkAllocateCommandBuffers(m_device, &cbai, &m_graphicsCommandBuffers[i]));
-        }
 
-        // Create the frameInFlightFence already signalled so that the first frame can start
-        VkFenceCreateInfo fci = {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .flags = VK_FENCE_CREATE_SIGNALED_BIT   
+        // Create the device timeline at 0, frame slots waiting on 0 can start immediately
+        VkSemaphoreTypeCreateInfo stci = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0
         };
 
-        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-            VK_ASSERT(vkCreateFence(m_device, &fci, nullptr, &m_frameInFlightFences[i]));
-
-        fci.flags = 0;
-        VK_ASSERT(vkCreateFence(m_device, &fci, nullptr, &m_imageAcquiredFence));
+        VkSemaphoreCreateInfo sci = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &stci
+        };
 
-        s_contextCount++;
+        VK_ASSERT(vkCreateSemaphore(m_device, &sci, nullptr, &m_timeline));
     }
 
     Context::~Context() {
+        // A capture still running ends with the context, teardown is not recorded
+        m_capture.reset();
+
+        // Finish the submitted frame on the render thread, everything below runs on this one
+        m_renderThread.reset();
+
+        if (m_jobSystem != nullptr)
+            m_jobSystem->Wait(m_mipChainBuilds);
+
+        FlushUploads();
         vkDeviceWaitIdle(m_device);
+
+        // The upscale pass belongs to this context, the device may outlive it
+        if (m_upscalePipeline != 0) {
+            DestroyGraphicsPipeline(m_upscalePipeline);
+            DestroySampler(m_upscaleSampler);
+        }
+
+        // Finish background links so their pipelines are released below
+        UpdatePipelineLinks(true);
+
+        // Everything queued for destruction is now safe to release
+        for (auto& deferred : m_deferredDestroys)
+            deferred.destroy();
+        m_deferredDestroys.clear();
+
+        for (auto& destroy : m_frameDestroys)
+            destroy();
+        m_frameDestroys.clear();
         
         if (m_swapchain != nullptr) {
-            //vkDestroySemaphore(m_device, m_imageAcquiredSignal, nullptr);
-
             for (auto& imageView : m_swapchainImageViews)
                 vkDestroyImageView(m_device, imageView, nullptr);
             
             vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
             vkDestroySurfaceKHR(s_vkInstance, m_surface, nullptr);
         }
+
+        for (auto& signal : m_imageAcquiredSignals)
+            vkDestroySemaphore(m_device, signal, nullptr);
+
+        for (auto& signal : m_presentReadySignals)
+            vkDestroySemaphore(m_device, signal, nullptr);
+
+        if (m_headlessTarget.image != nullptr) {
+            vkDestroyImageView(m_device, m_headlessTarget.imageView, nullptr);
+            vmaDestroyImage(m_allocator, m_headlessTarget.image, m_headlessTarget.alloc);
+        }
+
+        if (m_depthTarget.image != nullptr) {
+            vkDestroyImageView(m_device, m_depthSampledView, nullptr);
+            vkDestroyImageView(m_device, m_depthTarget.imageView, nullptr);
+            vmaDestroyImage(m_allocator, m_depthTarget.image, m_depthTarget.alloc);
+        }
+
+        if (m_sceneTarget.image != nullptr) {
+            vkDestroyImageView(m_device, m_sceneTarget.imageView, nullptr);
+            vmaDestroyImage(m_allocator, m_sceneTarget.image, m_sceneTarget.alloc);
+        }
         
         if (m_device != nullptr) {
-            //vkDestroySemaphore(m_device, m_graphicsSubmitSignal, nullptr);
-            //vkDestroyFence(m_device, m_frameInFlightFence, nullptr);
+            vkDestroyQueryPool(m_device, m_timestampQueries, nullptr);
+            vkDestroySemaphore(m_device, m_computeTimeline, nullptr);
+            vkDestroyCommandPool(m_device, m_computeCommandPool, nullptr);
+            vkDestroyCommandPool(m_device, m_graphicsCommandPool, nullptr);
+        }
+
+        // Contexts still sharing the device keep its resources alive
+        if (m_device != nullptr && m_shared.use_count() == 1) {
+            // Every frame is finished, so the moves in flight can be completed
+            if (m_defragmentationContext != nullptr)
+                EndDefragmentation();
+
+            // Release resources the application never destroyed
+            for (auto& [id, buffer] : m_buffers)
+                vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.alloc);
+
+            for (auto& [id, stagingBuffer] : m_textureUploads)
+                vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.alloc);
+
+            for (auto& [id, texture] : m_textures) {
+                for (auto& mipView : texture.mipViews)
+                    vkDestroyImageView(m_device, mipView, nullptr);
+
+                vkDestroyImageView(m_device, texture.imageView, nullptr);
+                vmaDestroyImage(m_allocator, texture.image, texture.alloc);
+
+                if (texture.evicted)
+                    vmaDestroyBuffer(m_allocator, texture.hostCopy.buffer, texture.hostCopy.alloc);
+            }
+
+            for (auto& [id, sampler] : m_samplers)
+                vkDestroySampler(m_device, sampler, nullptr);
+
+            for (auto& [id, pipeline] : m_graphicsPipelines)
+                vkDestroyPipeline(m_device, pipeline.pipeline, nullptr);
+
+            for (auto& [id, pipeline] : m_computePipelines)
+                vkDestroyPipeline(m_device, pipeline.pipeline, nullptr);
+
+            for (auto& [key, pipelineLibrary] : m_pipelineLibraries)
+                vkDestroyPipeline(m_device, pipelineLibrary.library, nullptr);
+
+            for (auto& [key, pipelineLayout] : m_pipelineLayouts) {
+                vkDestroyPipelineLayout(m_device, pipelineLayout.layout, nullptr);
+                vkDestroyDescriptorSetLayout(m_device, pipelineLayout.pushDescriptorSetLayout, nullptr);
+            }
+
+            vkDestroySemaphore(m_device, m_timeline, nullptr);
+            vkDestroyCommandPool(m_device, m_transientCommandPool, nullptr);
+            vmaDestroyAllocator(m_allocator);
             vkDestroyDevice(m_device, nullptr);
         }
         
@@ -211,12 +690,70 @@ namespace vkr {
     }
 
     void Context::BeginFrame() {
-        // Wait until the last frame is finished before compiling more commands
-        vkWaitForFences(m_device, 1, &m_frameInFlightFences[m_frameIndex], true, UINT64_MAX);
-        vkResetFences(m_device, 1, &m_frameInFlightFences[m_frameIndex]);
+        CaptureCall call = Capture(CaptureOp::BeginFrame);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::BeginFrame);
+
+        // Low latency: hold off CPU work until the previous frame is on screen
+        if (m_framePacing.lowLatency && m_presentWaitSupported)
+            UpdateLatencyStats(true);
+
+        // Wait until the last frame in this slot is finished before compiling more commands
+        WaitTimeline(m_frameSlotTimelineValues[m_frameIndex]);
+        CollectDeferredDestroys();
+        UpdatePipelineLinks(false);
+
+        if (m_presentWaitSupported) {
+            UpdateLatencyStats(false);
+        }
+        // Without present wait, bound latency by how long ago this slot's previous frame began, it has left the GPU now
+        else if (m_frameSlotBeginTimes[m_frameIndex] != Clock::time_point{}) {
+            auto elapsed = Clock::now() - m_frameSlotBeginTimes[m_frameIndex];
+            RecordLatency(std::chrono::duration<double, std::milli>(elapsed).count(), false);
+        }
+
+        // The slot's previous frame is finished, so its timestamps are available
+        if (m_timestampsWritten[m_frameIndex]) {
+            uint64_t timestamps[2] = {};
+            VkResult result = vkGetQueryPoolResults(m_device, m_timestampQueries, 2 * m_frameIndex, 2,
+                sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+            if (result == VK_SUCCESS && timestamps[1] > timestamps[0]) {
+                double ticks = static_cast<double>(timestamps[1] - timestamps[0]);
+                m_frameStats.gpuFrameMs = ticks * m_physicalDeviceProperties.limits.timestampPeriod / 1e6;
+                UpdateRenderScale(m_frameSlotRenderScales[m_frameIndex]);
+            }
+        }
+
+        m_frameRecording = true;
+
+        // Input is expected to be sampled once BeginFrame returns
+        m_frameBeginTime = Clock::now();
+        m_frameSlotBeginTimes[m_frameIndex] = m_frameBeginTime;
         
-        // Get the next swapchain image
-        vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_imageAcquiredSignals[m_frameIndex], nullptr, &m_swapchainImageIndex);
+        // Get the next swapchain image, recreating the swapchain once it no longer matches the window
+        if (!m_presentParams.headless) {
+            if (m_swapchainOutOfDate)
+                ValidateSwapchain();
+
+            VkResult result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX,
+                m_imageAcquiredSignals[m_frameIndex], nullptr, &m_swapchainImageIndex);
+
+            // Nothing was acquired or signalled, so the same semaphore can be used again
+            while (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                ValidateSwapchain();
+                result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX,
+                    m_imageAcquiredSignals[m_frameIndex], nullptr, &m_swapchainImageIndex);
+            }
+
+            // A suboptimal image is still presentable, the swapchain is replaced next frame
+            assert((result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) && "vkAcquireNextImageKHR failed");
+            m_swapchainOutOfDate = (result == VK_SUBOPTIMAL_KHR);
+        }
+
+        // Textures uploaded since the last frame go ahead of this frame's submissions
+        FlushUploads();
 
         // Start the graphics command buffer
         VkCommandBufferBeginInfo cbbi = {
@@ -226,66 +763,298 @@ namespace vkr {
 
         VK_ASSERT(vkBeginCommandBuffer(m_graphicsCommandBuffers[m_frameIndex], &cbbi));
 
+        if (m_timestampQueries != nullptr) {
+            vkCmdResetQueryPool(m_graphicsCommandBuffers[m_frameIndex], m_timestampQueries, 2 * m_frameIndex, 2);
+            vkCmdWriteTimestamp2(m_graphicsCommandBuffers[m_frameIndex], VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+                m_timestampQueries, 2 * m_frameIndex);
+        }
+
+        m_frameSlotRenderScales[m_frameIndex] = m_renderScale;
+        m_frameStats.renderScale = m_renderScale;
+
+        // With async compute the memory copies below are submitted on their own, so the batch can wait for them
+        VkCommandBuffer setupCmds = m_graphicsCommandBuffers[m_frameIndex];
+        if (m_computeQueue != nullptr) {
+            setupCmds = m_setupCommandBuffers[m_frameIndex];
+            VK_ASSERT(vkBeginCommandBuffer(setupCmds, &cbbi));
+        }
+
+        // Sharing contexts render the same frames side by side, so idle and LRU ages count frames rather than
+        // BeginFrame calls: the device's frame only advances when a context moves past it
+        m_contextFrameNumber++;
+        m_frameNumber = std::max(m_frameNumber, m_contextFrameNumber);
+
+        // Keep device memory within budget before any of this frame's commands are recorded
+        vmaSetCurrentFrameIndex(m_allocator, static_cast<uint32_t>(m_frameNumber));
+        UpdateMemoryBudget();
+        UpdateResidency(setupCmds);
+        UpdateTextureStreaming(setupCmds);
+        UpdateDefragmentation(setupCmds);
+
+        // Later submissions on the graphics queue are ordered after the copies by their trailing barriers
+        if (m_computeQueue != nullptr) {
+            VK_ASSERT(vkEndCommandBuffer(setupCmds));
+
+            VkCommandBufferSubmitInfo cbsi = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+                .commandBuffer = setupCmds
+            };
+
+            VkSemaphoreSubmitInfo signalInfo = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                .semaphore = m_timeline,
+                .value = ++m_timelineValue,
+                .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+            };
+
+            VkSubmitInfo2 si = {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+                .commandBufferInfoCount = 1,
+                .pCommandBufferInfos = &cbsi,
+                .signalSemaphoreInfoCount = 1,
+                .pSignalSemaphoreInfos = &signalInfo
+            };
+
+            VK_ASSERT(vkQueueSubmit2(m_graphicsQueue, 1, &si, nullptr));
+        }
+
         // Ready the swapchain image for rendering
         TransitionImageLayout(m_graphicsCommandBuffers[m_frameIndex], m_swapchainImages[m_swapchainImageIndex],
         m_swapchainFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+        // Depth contents never carry over between frames
+        TransitionImageLayout(m_graphicsCommandBuffers[m_frameIndex], m_depthTarget.image,
+            m_depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+        m_depthLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        // Scene target contents never carry over either, the last frame's upscale may still be reading it
+        if (m_dynamicResolution.enabled) {
+            TransitionImageLayout(m_graphicsCommandBuffers[m_frameIndex], m_sceneTarget.image,
+                m_sceneTarget.format, m_sceneTarget.layout, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+            m_sceneTarget.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        }
+
+        m_colorWritten = false;
+        m_depthWritten = false;
     }
 
     void Context::EndFrame() {
-        // Ready the swapchain image to be presented
-        TransitionImageLayout(m_graphicsCommandBuffers[m_frameIndex], m_swapchainImages[m_swapchainImageIndex],
-            m_swapchainFormat, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+        CaptureCall call = Capture(CaptureOp::EndFrame);
 
-        // Finalize graphics commands
-        VK_ASSERT(vkEndCommandBuffer(m_graphicsCommandBuffers[m_frameIndex]));
+        if (DefersToRenderThread()) {
+            m_renderThread->Push(RenderOp::EndFrame);
 
-        // Submit commands to graphics queue
-        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            // The next frame is recorded while the render thread executes this one
+            SyncRenderThread();
+            m_renderThread->Submit();
+            return;
+        }
 
-        VkSubmitInfo si = {
-            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &m_imageAcquiredSignals[m_frameIndex],
-            .pWaitDstStageMask = &waitStage,
-            .commandBufferCount = 1,
-            .pCommandBuffers = &m_graphicsCommandBuffers[m_frameIndex],
-            .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &m_presentReadySignals[m_swapchainImageIndex]
-        };
-        
-        VK_ASSERT(vkQueueSubmit(m_graphicsQueue, 1, &si, m_frameInFlightFences[m_frameIndex]));
+        assert(!m_asyncComputeRecording && "EndAsyncCompute was not called");
 
-        VkResult presentResult;
+        m_frameStats.cpuFrameMs = std::chrono::duration<double, std::milli>(Clock::now() - m_frameBeginTime).count();
+
+        if (m_dynamicResolution.enabled && m_colorWritten)
+            UpscaleSceneTarget();
+
+        // Ready the swapchain image to be presented
+        if (!m_presentParams.headless) {
+            TransitionImageLayout(m_graphicsCommandBuffers[m_frameIndex], m_swapchainImages[m_swapchainImageIndex],
+                m_swapchainFormat, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+        }
+
+        if (m_timestampQueries != nullptr) {
+            vkCmdWriteTimestamp2(m_graphicsCommandBuffers[m_frameIndex], VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                m_timestampQueries, 2 * m_frameIndex + 1);
+            m_timestampsWritten[m_frameIndex] = true;
+        }
+
+        // Finalize graphics commands, textures uploaded during the frame are submitted ahead of it
+        VK_ASSERT(vkEndCommandBuffer(m_graphicsCommandBuffers[m_frameIndex]));
+        FlushUploads();
+
+        // Submit commands to graphics queue, signalling the next timeline value for this frame slot
+        m_frameSlotTimelineValues[m_frameIndex] = ++m_timelineValue;
+        m_frameRecording = false;
+
+        for (auto& destroy : m_frameDestroys)
+            m_deferredDestroys.push_back({ m_timelineValue, std::move(destroy) });
+        m_frameDestroys.clear();
+
+        VkCommandBufferSubmitInfo cbsi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+            .commandBuffer = m_graphicsCommandBuffers[m_frameIndex]
+        };
+
+        VkSemaphoreSubmitInfo waitInfos[2] = {};
+        uint32_t waitCount = 0;
+
+        if (!m_presentParams.headless) {
+            waitInfos[waitCount++] = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                .semaphore = m_imageAcquiredSignals[m_frameIndex],
+                .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT
+            };
+        }
+
+        // The frame's timeline value then also covers its async compute batch
+        if (m_computeConsumerStages != 0 && m_computeQueue != nullptr) {
+            waitInfos[waitCount++] = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                .semaphore = m_computeTimeline,
+                .value = m_computeTimelineValue,
+                .stageMask = m_computeConsumerStages
+            };
+        }
+        m_computeConsumerStages = 0;
+
+        VkSemaphoreSubmitInfo signalInfos[] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                .semaphore = m_timeline,
+                .value = m_timelineValue,
+                .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                .semaphore = m_presentParams.headless ? nullptr : m_presentReadySignals[m_swapchainImageIndex],
+                .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+            }
+        };
+
+        // Headless targets have no presentation engine to hand off to
+        uint32_t binaryCount = m_presentParams.headless ? 0 : 1;
+
+        VkSubmitInfo2 si = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+            .waitSemaphoreInfoCount = waitCount,
+            .pWaitSemaphoreInfos = waitInfos,
+            .commandBufferInfoCount = 1,
+            .pCommandBufferInfos = &cbsi,
+            .signalSemaphoreInfoCount = 1 + binaryCount,
+            .pSignalSemaphoreInfos = signalInfos
+        };
+        
+        VK_ASSERT(vkQueueSubmit2(m_graphicsQueue, 1, &si, nullptr));
+
+        if (m_presentParams.headless) {
+            m_frameIndex = (m_frameIndex + 1) % m_framePacing.framesInFlight;
+            return;
+        }
+
+        // Tag the present so its completion can be waited on and timed
+        uint64_t presentID = m_presentID + 1;
+
+        VkPresentIdKHR pid = {
+            .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+            .swapchainCount = 1,
+            .pPresentIds = &presentID
+        };
 
         VkPresentInfoKHR pi = {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .pNext = m_presentWaitSupported ? &pid : nullptr,
             .waitSemaphoreCount = 1,
             .pWaitSemaphores = &m_presentReadySignals[m_swapchainImageIndex],
             .swapchainCount = 1,
             .pSwapchains = &m_swapchain,
-            .pImageIndices = &m_swapchainImageIndex,
-            .pResults = &presentResult
+            .pImageIndices = &m_swapchainImageIndex
         };
 
-        VK_ASSERT(vkQueuePresentKHR(m_graphicsQueue, &pi));
+        VkResult presentResult = vkQueuePresentKHR(m_graphicsQueue, &pi);
+
+        // The window changed underneath the swapchain, it is recreated before the next acquire
+        if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR)
+            m_swapchainOutOfDate = true;
+        else
+            assert(presentResult == VK_SUCCESS && "vkQueuePresentKHR failed");
 
-        m_frameIndex = (m_frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
+        // An out of date present never reaches the screen, so it cannot be waited on
+        if (m_presentWaitSupported && presentResult != VK_ERROR_OUT_OF_DATE_KHR) {
+            m_presentID = presentID;
+            m_presentBeginTimes[m_presentID % PRESENT_HISTORY_SIZE] = m_frameBeginTime;
+        }
+
+        m_frameIndex = (m_frameIndex + 1) % m_framePacing.framesInFlight;
     }
 
     void Context::BeginRendering(const VkViewport& viewport) {
+        CaptureCall call = Capture(CaptureOp::BeginRendering);
+        call.Args(viewport);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::BeginRendering, viewport);
+
+        BeginRenderingPass(viewport, false);
+    }
+
+    void Context::BeginDepthPrepass(const VkViewport& viewport) {
+        CaptureCall call = Capture(CaptureOp::BeginDepthPrepass);
+        call.Args(viewport);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::BeginDepthPrepass, viewport);
+
+        BeginRenderingPass(viewport, true);
+    }
+
+    void Context::BeginRenderingPass(const VkViewport& viewport, bool depthOnly) {
+        VkCommandBuffer cmds = m_graphicsCommandBuffers[m_frameIndex];
+
+        // Make earlier passes' writes visible, depth may also have been sampled in between
+        if (m_depthLayout != VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+            TransitionDepth(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+        }
+        else if (m_depthWritten) {
+            TransitionImageLayout(cmds, m_depthTarget.image, m_depthFormat,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+        }
+
+        // With dynamic resolution, passes render into the scene target instead of the swapchain image
+        bool scaled = m_dynamicResolution.enabled;
+        VkImage colorImage = scaled ? m_sceneTarget.image : m_swapchainImages[m_swapchainImageIndex];
+        VkImageView colorView = scaled ? m_sceneTarget.imageView : m_swapchainImageViews[m_swapchainImageIndex];
+
+        if (m_colorWritten && !depthOnly) {
+            TransitionImageLayout(cmds, colorImage, m_swapchainFormat,
+                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+        }
+
+        // The first pass of a frame clears, later passes (pre-pass, occlusion late pass) continue on top
         VkRenderingAttachmentInfo rai = {
             .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-            .imageView = m_swapchainImageViews[m_swapchainImageIndex],
+            .imageView = colorView,
             .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .loadOp = m_colorWritten ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
             .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
             .clearValue.color = { 0.0f, 0.0f, 0.0f, 1.0f }
         };
 
-        int x = static_cast<int>(viewport.x);
-        int y = static_cast<int>(viewport.y);
-        uint32_t width = static_cast<uint32_t>(viewport.width);
-        uint32_t height = static_cast<uint32_t>(viewport.height);
+        VkRenderingAttachmentInfo depthRai = {
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = m_depthTarget.imageView,
+            .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .loadOp = m_depthWritten ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .clearValue.depthStencil = { 1.0f, 0 }
+        };
+
+        m_depthWritten = true;
+        m_colorWritten = m_colorWritten || !depthOnly;
+
+        // Scale into the top-left part of the targets, the upscale pass samples the same area
+        VkViewport scaledViewport = viewport;
+        if (scaled) {
+            scaledViewport.x = std::floor(viewport.x * m_renderScale);
+            scaledViewport.y = std::floor(viewport.y * m_renderScale);
+            scaledViewport.width = std::max(std::floor(viewport.width * m_renderScale), 1.0f);
+            scaledViewport.height = std::max(std::floor(viewport.height * m_renderScale), 1.0f);
+        }
+
+        int x = static_cast<int>(scaledViewport.x);
+        int y = static_cast<int>(scaledViewport.y);
+        uint32_t width = static_cast<uint32_t>(scaledViewport.width);
+        uint32_t height = static_cast<uint32_t>(scaledViewport.height);
 
         VkRenderingInfo ri = {
             .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
@@ -294,11 +1063,13 @@ namespace vkr {
                 .offset = { x, y },
                 .extent = { width, height }
             },
-            .colorAttachmentCount = 1,
-            .pColorAttachments = &rai
+            .colorAttachmentCount = depthOnly ? 0u : 1u,
+            .pColorAttachments = &rai,
+            .pDepthAttachment = &depthRai,
+            .pStencilAttachment = HasStencilComponent(m_depthFormat) ? &depthRai : nullptr
         };
 
-        vkCmdBeginRendering(m_graphicsCommandBuffers[m_frameIndex], &ri);
+        vkCmdBeginRendering(cmds, &ri);
         
         VkRect2D scissor = {
             .offset = { x, y },
@@ -306,37 +1077,168 @@ namespace vkr {
         };
         
         // Vulkan sizes the viewport -y up by default
-        VkViewport vp = viewport;
+        VkViewport vp = scaledViewport;
         vp.y = vp.height;
         vp.height *= -1.0f; 
-        vkCmdSetViewport(m_graphicsCommandBuffers[m_frameIndex], 0, 1, &vp);
-        vkCmdSetScissor(m_graphicsCommandBuffers[m_frameIndex], 0, 1, &scissor);
+        vkCmdSetViewport(cmds, 0, 1, &vp);
+        vkCmdSetScissor(cmds, 0, 1, &scissor);
     }
 
     void Context::EndRendering() {
-        vkCmdEndRendering(m_graphicsCommandBuffers[m_frameIndex]);
+        CaptureCall call = Capture(CaptureOp::EndRendering);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::EndRendering);
+
+        vkCmdEndRendering(GetCommandBuffer());
+    }
+
+    // Push constants of upscale.fs.glsl
+    struct UpscaleConstants {
+        float uvScale[2];
+        float texelSize[2];
+        float sharpness;
+    };
+
+    void Context::UpscaleSceneTarget() {
+        VkCommandBuffer cmds = m_graphicsCommandBuffers[m_frameIndex];
+
+        TransitionImageLayout(cmds, m_sceneTarget.image, m_sceneTarget.format,
+            m_sceneTarget.layout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        m_sceneTarget.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        // Depth is only bound to match the pipeline's rendering formats, but still orders after earlier passes
+        if (m_depthLayout != VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+            TransitionDepth(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+        }
+        else {
+            TransitionImageLayout(cmds, m_depthTarget.image, m_depthFormat,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+        }
+
+        // Every swapchain pixel is written, nothing needs loading
+        VkRenderingAttachmentInfo rai = {
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = m_swapchainImageViews[m_swapchainImageIndex],
+            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE
+        };
+
+        VkRenderingAttachmentInfo depthRai = {
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = m_depthTarget.imageView,
+            .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE
+        };
+
+        VkRenderingInfo ri = {
+            .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+            .renderArea = {
+                .extent = m_swapchainExtent
+            },
+            .layerCount = 1,
+            .colorAttachmentCount = 1,
+            .pColorAttachments = &rai,
+            .pDepthAttachment = &depthRai,
+            .pStencilAttachment = HasStencilComponent(m_depthFormat) ? &depthRai : nullptr
+        };
+
+        vkCmdBeginRendering(cmds, &ri);
+
+        SetGraphicsPipeline(m_upscalePipeline);
+        SetPrimitiveTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        SetCullMode(VK_CULL_MODE_NONE);
+
+        VkViewport vp = {
+            .width = static_cast<float>(m_swapchainExtent.width),
+            .height = static_cast<float>(m_swapchainExtent.height),
+            .maxDepth = 1.0f
+        };
+
+        VkRect2D scissor = {
+            .extent = m_swapchainExtent
+        };
+
+        vkCmdSetViewport(cmds, 0, 1, &vp);
+        vkCmdSetScissor(cmds, 0, 1, &scissor);
+
+        VkDescriptorImageInfo dii = {
+            .sampler = m_samplers[m_upscaleSampler],
+            .imageView = m_sceneTarget.imageView,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        };
+
+        VkWriteDescriptorSet wds = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .pImageInfo = &dii
+        };
+
+        vkCmdPushDescriptorSetKHR(cmds, m_boundBindPoint, m_boundPipelineLayout, 0, 1, &wds);
+
+        // The rendered area is renderScale of the swapchain extent, the target itself is sized for maxScale
+        float targetWidth = static_cast<float>(m_sceneTarget.extent.width);
+        float targetHeight = static_cast<float>(m_sceneTarget.extent.height);
+
+        UpscaleConstants constants = {
+            .uvScale = {
+                std::floor(m_swapchainExtent.width * m_renderScale) / targetWidth,
+                std::floor(m_swapchainExtent.height * m_renderScale) / targetHeight
+            },
+            .texelSize = { 1.0f / targetWidth, 1.0f / targetHeight },
+            .sharpness = m_dynamicResolution.sharpness
+        };
+
+        SetPushConstants(&constants, sizeof(constants), 0);
+
+        vkCmdDraw(cmds, 3, 1, 0, 0);
+        vkCmdEndRendering(cmds);
     }
 
     void Context::SetVertexBuffers(std::span<BufferHandle> bufferHandles) {
+        CaptureCall call = Capture(CaptureOp::SetVertexBuffers);
+        call.Blob(bufferHandles.data(), bufferHandles.size_bytes());
+
+        if (DefersToRenderThread()) {
+            uint64_t dataOffset = m_renderThread->PushData(bufferHandles.data(), bufferHandles.size_bytes());
+            return m_renderThread->Push(RenderOp::SetVertexBuffers, dataOffset, uint64_t(bufferHandles.size()));
+        }
+
         std::vector<VkBuffer> buffers;
         for (auto handle : bufferHandles) {
-            buffers.push_back(m_buffers[handle].buffer);
+            buffers.push_back(TouchBuffer(handle).buffer);
         }
 
         // TODO: support offsets?
         VkDeviceSize offsets[16] = {};
 
-        vkCmdBindVertexBuffers(m_graphicsCommandBuffers[m_frameIndex], 0,
+        vkCmdBindVertexBuffers(GetCommandBuffer(), 0,
             buffers.size(), buffers.data(), offsets);
     }
 
     void Context::SetIndexBuffer(BufferHandle bufferHandle, VkIndexType indexType) {
-        BufferAllocation& buffer = m_buffers[bufferHandle];
-        vkCmdBindIndexBuffer(m_graphicsCommandBuffers[m_frameIndex], buffer.buffer, 0, indexType);
+        CaptureCall call = Capture(CaptureOp::SetIndexBuffer);
+        call.Args(bufferHandle, indexType);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetIndexBuffer, bufferHandle, indexType);
+
+        BufferAllocation& buffer = TouchBuffer(bufferHandle);
+        vkCmdBindIndexBuffer(GetCommandBuffer(), buffer.buffer, 0, indexType);
     }
 
     void Context::SetUniformBuffer(BufferHandle bufferHandle, uint32_t binding) {
-        BufferAllocation& ba = m_buffers[bufferHandle];
+        CaptureCall call = Capture(CaptureOp::SetUniformBuffer);
+        call.Args(bufferHandle, binding);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetUniformBuffer, bufferHandle, binding);
+
+        BufferAllocation& ba = TouchBuffer(bufferHandle);
 
         VkDescriptorBufferInfo dbi = {
             .buffer = ba.buffer,
@@ -352,19 +1254,25 @@ namespace vkr {
             .pBufferInfo = &dbi
         };
 
-        vkCmdPushDescriptorSetKHR(m_graphicsCommandBuffers[m_frameIndex], 
-            VK_PIPELINE_BIND_POINT_GRAPHICS, m_pBoundGraphicsPipeline->layout,
+        vkCmdPushDescriptorSetKHR(GetCommandBuffer(), 
+            m_boundBindPoint, m_boundPipelineLayout,
             0, 1, &wds);
     }
 
     void Context::SetTexture(TextureHandle textureHandle, SamplerHandle samplerHandle, uint32_t binding) {
-        TextureAllocation& ta = m_textures[textureHandle];
+        CaptureCall call = Capture(CaptureOp::SetTexture);
+        call.Args(textureHandle, samplerHandle, binding);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetTexture, textureHandle, samplerHandle, binding);
+
+        TextureAllocation& ta = TouchTexture(textureHandle);
         VkSampler sampler = m_samplers[samplerHandle];
 
         VkDescriptorImageInfo dii = {
-            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .sampler = sampler,
             .imageView = ta.imageView,
-            .sampler = sampler
+            .imageLayout = ta.layout
         };
 
         VkWriteDescriptorSet wds = {
@@ -375,56 +1283,359 @@ namespace vkr {
             .pImageInfo = &dii
         };
 
-        vkCmdPushDescriptorSetKHR(m_graphicsCommandBuffers[m_frameIndex],
-            VK_PIPELINE_BIND_POINT_GRAPHICS, m_pBoundGraphicsPipeline->layout,
+        vkCmdPushDescriptorSetKHR(GetCommandBuffer(),
+            m_boundBindPoint, m_boundPipelineLayout,
+            0, 1, &wds);
+    }
+
+    void Context::SetStorageBuffer(BufferHandle bufferHandle, uint32_t binding) {
+        CaptureCall call = Capture(CaptureOp::SetStorageBuffer);
+        call.Args(bufferHandle, binding);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetStorageBuffer, bufferHandle, binding);
+
+        BufferAllocation& ba = TouchBuffer(bufferHandle);
+
+        VkDescriptorBufferInfo dbi = {
+            .buffer = ba.buffer,
+            .offset = 0,
+            .range = VK_WHOLE_SIZE
+        };
+
+        VkWriteDescriptorSet wds = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = binding,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .pBufferInfo = &dbi
+        };
+
+        vkCmdPushDescriptorSetKHR(GetCommandBuffer(),
+            m_boundBindPoint, m_boundPipelineLayout,
+            0, 1, &wds);
+    }
+
+    void Context::SetStorageImage(TextureHandle textureHandle, uint32_t mipLevel, uint32_t binding) {
+        CaptureCall call = Capture(CaptureOp::SetStorageImage);
+        call.Args(textureHandle, mipLevel, binding);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetStorageImage, textureHandle, mipLevel, binding);
+
+        TextureAllocation& ta = TouchTexture(textureHandle);
+        assert(mipLevel < ta.mipViews.size() && "texture was not created with VK_IMAGE_USAGE_STORAGE_BIT");
+
+        VkDescriptorImageInfo dii = {
+            .imageView = ta.mipViews[mipLevel],
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL
+        };
+
+        VkWriteDescriptorSet wds = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = binding,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .pImageInfo = &dii
+        };
+
+        vkCmdPushDescriptorSetKHR(GetCommandBuffer(),
+            m_boundBindPoint, m_boundPipelineLayout,
+            0, 1, &wds);
+    }
+
+    void Context::SetDepthTexture(SamplerHandle samplerHandle, uint32_t binding) {
+        CaptureCall call = Capture(CaptureOp::SetDepthTexture);
+        call.Args(samplerHandle, binding);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetDepthTexture, samplerHandle, binding);
+
+        assert(!m_asyncComputeRecording && "depth is only sampled on the graphics queue");
+        TransitionDepth(VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+        VkDescriptorImageInfo dii = {
+            .sampler = m_samplers[samplerHandle],
+            .imageView = m_depthSampledView,
+            .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+        };
+
+        VkWriteDescriptorSet wds = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = binding,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .pImageInfo = &dii
+        };
+
+        vkCmdPushDescriptorSetKHR(GetCommandBuffer(),
+            m_boundBindPoint, m_boundPipelineLayout,
             0, 1, &wds);
     }
 
-    
     void Context::SetGraphicsPipeline(GraphicsPipelineHandle pipelineHandle) {
+        CaptureCall call = Capture(CaptureOp::SetGraphicsPipeline);
+        call.Args(pipelineHandle);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetGraphicsPipeline, pipelineHandle);
+
         auto& pipeline = m_graphicsPipelines[pipelineHandle];
-        vkCmdBindPipeline(m_graphicsCommandBuffers[m_frameIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
-        m_pBoundGraphicsPipeline = &pipeline;
+        vkCmdBindPipeline(GetCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
+
+        m_boundBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        m_boundPipelineLayout = pipeline.layout;
+        m_boundPushConstantStages = pipeline.pushConstantStages;
+    }
+
+    void Context::SetComputePipeline(ComputePipelineHandle pipelineHandle) {
+        CaptureCall call = Capture(CaptureOp::SetComputePipeline);
+        call.Args(pipelineHandle);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetComputePipeline, pipelineHandle);
+
+        auto& pipeline = m_computePipelines[pipelineHandle];
+        vkCmdBindPipeline(GetCommandBuffer(), VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+
+        m_boundBindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+        m_boundPipelineLayout = pipeline.layout;
+        m_boundPushConstantStages = pipeline.pushConstantStages;
     }
 
     void Context::SetPushConstants(void* pData, size_t size, size_t offset) {
-        vkCmdPushConstants(m_graphicsCommandBuffers[m_frameIndex], m_pBoundGraphicsPipeline->layout, 
-            VK_SHADER_STAGE_ALL_GRAPHICS, offset, size, pData);
+        CaptureCall call = Capture(CaptureOp::SetPushConstants);
+        call.Args(offset);
+        call.Blob(pData, size);
+
+        if (DefersToRenderThread()) {
+            uint64_t dataOffset = m_renderThread->PushData(pData, size);
+            return m_renderThread->Push(RenderOp::SetPushConstants, dataOffset, size, offset);
+        }
+
+        vkCmdPushConstants(GetCommandBuffer(), m_boundPipelineLayout, 
+            m_boundPushConstantStages, offset, size, pData);
     }
     
     void Context::SetPrimitiveTopology(VkPrimitiveTopology topology) {
-        vkCmdSetPrimitiveTopology(m_graphicsCommandBuffers[m_frameIndex], topology);
+        CaptureCall call = Capture(CaptureOp::SetPrimitiveTopology);
+        call.Args(topology);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetPrimitiveTopology, topology);
+
+        vkCmdSetPrimitiveTopology(GetCommandBuffer(), topology);
     }
     
     void Context::SetCullMode(VkCullModeFlags cullMode) {
-        vkCmdSetCullMode(m_graphicsCommandBuffers[m_frameIndex], cullMode);
+        CaptureCall call = Capture(CaptureOp::SetCullMode);
+        call.Args(cullMode);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::SetCullMode, cullMode);
+
+        vkCmdSetCullMode(GetCommandBuffer(), cullMode);
     }
     
     void Context::Draw(uint32_t offset, uint32_t count) {
-        vkCmdDraw(m_graphicsCommandBuffers[m_frameIndex], count, 1, offset, 0);
+        CaptureCall call = Capture(CaptureOp::Draw);
+        call.Args(offset, count);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::Draw, offset, count);
+
+        vkCmdDraw(GetCommandBuffer(), count, 1, offset, 0);
+    }
+
+    void Context::DrawIndexed(uint32_t offset, uint32_t count, uint32_t firstInstance) {
+        CaptureCall call = Capture(CaptureOp::DrawIndexed);
+        call.Args(offset, count, firstInstance);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DrawIndexed, offset, count, firstInstance);
+
+        vkCmdDrawIndexed(GetCommandBuffer(), count, 1, offset, 0, firstInstance);
+    }
+
+    void Context::DrawIndexedIndirect(BufferHandle bufferHandle, size_t offset, uint32_t drawCount, uint32_t stride) {
+        CaptureCall call = Capture(CaptureOp::DrawIndexedIndirect);
+        call.Args(bufferHandle, offset, drawCount, stride);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DrawIndexedIndirect, bufferHandle, offset, drawCount, stride);
+
+        BufferAllocation& ba = TouchBuffer(bufferHandle);
+        vkCmdDrawIndexedIndirect(GetCommandBuffer(), ba.buffer, offset, drawCount, stride);
+    }
+
+    void Context::Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) {
+        CaptureCall call = Capture(CaptureOp::Dispatch);
+        call.Args(groupCountX, groupCountY, groupCountZ);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::Dispatch, groupCountX, groupCountY, groupCountZ);
+
+        vkCmdDispatch(GetCommandBuffer(), groupCountX, groupCountY, groupCountZ);
+    }
+
+    void Context::DispatchIndirect(BufferHandle bufferHandle, size_t offset) {
+        CaptureCall call = Capture(CaptureOp::DispatchIndirect);
+        call.Args(bufferHandle, offset);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DispatchIndirect, bufferHandle, offset);
+
+        BufferAllocation& ba = TouchBuffer(bufferHandle);
+        vkCmdDispatchIndirect(GetCommandBuffer(), ba.buffer, offset);
+    }
+
+    void Context::BeginAsyncCompute() {
+        CaptureCall call = Capture(CaptureOp::BeginAsyncCompute);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::BeginAsyncCompute);
+
+        assert(m_frameRecording && !m_asyncComputeRecording && m_computeConsumerStages == 0 && "one async compute batch per frame");
+        m_asyncComputeRecording = true;
+
+        if (m_computeQueue == nullptr)
+            return;
+
+        VkCommandBufferBeginInfo cbbi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+        };
+
+        VK_ASSERT(vkBeginCommandBuffer(m_computeCommandBuffers[m_frameIndex], &cbbi));
+    }
+
+    void Context::EndAsyncCompute(VkPipelineStageFlags2 consumerStages) {
+        CaptureCall call = Capture(CaptureOp::EndAsyncCompute);
+        call.Args(consumerStages);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::EndAsyncCompute, consumerStages);
+
+        assert(m_asyncComputeRecording);
+        m_asyncComputeRecording = false;
+        m_computeConsumerStages = consumerStages;
+
+        // Inline fallback, a barrier stands in for the semaphore wait
+        if (m_computeQueue == nullptr) {
+            PipelineBarrier(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+                consumerStages, VK_ACCESS_2_MEMORY_READ_BIT);
+            return;
+        }
+
+        VK_ASSERT(vkEndCommandBuffer(m_computeCommandBuffers[m_frameIndex]));
+        FlushUploads();
+
+        // Submitted right away so it overlaps the graphics frames still in flight
+        VkCommandBufferSubmitInfo cbsi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+            .commandBuffer = m_computeCommandBuffers[m_frameIndex]
+        };
+
+        // Start after every graphics submission so far: earlier frames, texture uploads, and this frame's restores,
+        // streamed levels and defragmentation copies from BeginFrame
+        VkSemaphoreSubmitInfo waitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = m_timeline,
+            .value = m_timelineValue,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+        };
+
+        VkSemaphoreSubmitInfo signalInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = m_computeTimeline,
+            .value = ++m_computeTimelineValue,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+        };
+
+        VkSubmitInfo2 si = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+            .waitSemaphoreInfoCount = 1,
+            .pWaitSemaphoreInfos = &waitInfo,
+            .commandBufferInfoCount = 1,
+            .pCommandBufferInfos = &cbsi,
+            .signalSemaphoreInfoCount = 1,
+            .pSignalSemaphoreInfos = &signalInfo
+        };
+
+        VK_ASSERT(vkQueueSubmit2(m_computeQueue, 1, &si, nullptr));
+    }
+
+    VkCommandBuffer Context::GetCommandBuffer() const {
+        if (m_asyncComputeRecording && m_computeQueue != nullptr)
+            return m_computeCommandBuffers[m_frameIndex];
+
+        return m_graphicsCommandBuffers[m_frameIndex];
     }
 
-    void Context::DrawIndexed(uint32_t offset, uint32_t count) {
-        vkCmdDrawIndexed(m_graphicsCommandBuffers[m_frameIndex], count, 1, offset, 0, 0);
+    void Context::PipelineBarrier(VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+        CaptureCall call = Capture(CaptureOp::PipelineBarrier);
+        call.Args(srcStage, srcAccess, dstStage, dstAccess);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::PipelineBarrier, srcStage, srcAccess, dstStage, dstAccess);
+
+        VkMemoryBarrier2 mb = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = srcStage,
+            .srcAccessMask = srcAccess,
+            .dstStageMask = dstStage,
+            .dstAccessMask = dstAccess
+        };
+
+        VkDependencyInfo di = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &mb
+        };
+
+        // The compute queue cannot wait on graphics stages, the batch's semaphores already order it against them
+        if (m_asyncComputeRecording && m_computeQueue != nullptr) {
+            mb.srcStageMask &= COMPUTE_QUEUE_STAGES;
+            mb.dstStageMask &= COMPUTE_QUEUE_STAGES;
+            mb.srcAccessMask = mb.srcStageMask != 0 ? (srcAccess & ~GRAPHICS_ACCESSES) : 0;
+            mb.dstAccessMask = mb.dstStageMask != 0 ? (dstAccess & ~GRAPHICS_ACCESSES) : 0;
+
+            if (mb.srcStageMask == 0 && mb.dstStageMask == 0)
+                return;
+        }
+
+        vkCmdPipelineBarrier2(GetCommandBuffer(), &di);
     }
     
     BufferHandle Context::CreateBuffer(const BufferDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::CreateBuffer);
+        SyncRenderThread();
+
         BufferHandle handle = m_buffers.Create();
+        call.Args(desc, handle);
         BufferAllocation& buffer = m_buffers[handle];
 
         // Create the device-local buffer
         VkBufferCreateInfo bci = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
             .size = desc.size,
-            .usage = desc.usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            // Transfer src so the buffer can be copied out on eviction or defragmentation
+            .usage = desc.usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
             .sharingMode = VK_SHARING_MODE_EXCLUSIVE
         };
+        SetSharingMode(bci);
 
         VmaAllocationCreateInfo aci = {
             .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
         };
 
         VK_ASSERT(vmaCreateBuffer(m_allocator, &bci, &aci, &buffer.buffer, &buffer.alloc, &buffer.allocInfo));
+        buffer.usage = bci.usage;
+        buffer.size = desc.size;
+
+        // Buffers filled on the GPU (e.g. indirect arguments) have nothing to upload
+        if (desc.pData == nullptr)
+            return handle;
 
         // Copy data from host to the buffer on device
         BufferAllocation stagingBuffer;
@@ -457,8 +1668,19 @@ namespace vkr {
     }
 
     VkShaderModule Context::CreateShader(const ShaderDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::CreateShader);
+        call.Args(desc);
+        SyncRenderThread();
+
         VkShaderModule shader = nullptr;
 
+        // Pipeline layouts are derived from what the shaders declare, data that does not parse never reaches the driver
+        ShaderReflection reflection;
+        if (!ReflectShader(desc.pData, desc.size, reflection)) {
+            fprintf(stderr, "vkr: shader is not well-formed SPIR-V\n");
+            return call.Return(shader);
+        }
+
         VkShaderModuleCreateInfo smci = {
             .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
             .codeSize = desc.size,
@@ -466,12 +1688,17 @@ namespace vkr {
         };
 
         VK_ASSERT(vkCreateShaderModule(m_device, &smci, nullptr, &shader));
+        m_shaderReflections[shader] = std::move(reflection);
 
-        return shader;
+        return call.Return(shader);
     }
 
     SamplerHandle Context::CreateSampler(const SamplerDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::CreateSampler);
+        SyncRenderThread();
+
         SamplerHandle handle = m_samplers.Create();
+        call.Args(desc, handle);
         VkSampler& sampler = m_samplers[handle];
 
         VkSamplerCreateInfo sci = {
@@ -491,87 +1718,176 @@ namespace vkr {
 
 
     TextureHandle Context::CreateTexture(const TextureDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::CreateTexture);
+        call.Args(desc);
+        SyncRenderThread();
+
+        if (desc.streamed && desc.pData != nullptr && HasByteChannels(desc.format))
+            return call.Return(CreateStreamedTexture(desc));
+
+        // Texels go through the same staging path as uploads written by the application
+        if (desc.pData != nullptr) {
+            TextureUpload upload = BeginTextureUpload(desc);
+            memcpy(upload.pData, desc.pData, size_t(desc.width) * desc.height * GetFormatSize(desc.format));
+            return call.Return(EndTextureUpload(upload));
+        }
+
+        // Without data the image is still made shader readable so it can be bound
         TextureHandle handle = m_textures.Create();
         TextureAllocation& ta = m_textures[handle];
 
-        VkImageCreateInfo ici = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-            .imageType = VK_IMAGE_TYPE_2D,
-            .extent = {
-                .width = desc.width,
-                .height = desc.height,
-                .depth = 1
-            },
-            .mipLevels = 1,
-            .arrayLayers = 1,
-            .format = desc.format,
-            .tiling = VK_IMAGE_TILING_OPTIMAL,
-            .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-            .samples = VK_SAMPLE_COUNT_1_BIT
-        };
-
-        VmaAllocationCreateInfo aci = {
-            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-        };
+        AllocateTextureImage(ta, { desc.width, desc.height }, desc.format, desc.mipLevels, desc.usage);
 
-        VK_ASSERT(vmaCreateImage(m_allocator, &ici, &aci, &ta.image, &ta.alloc, &ta.allocInfo));
+        TransitionImageLayout(GetUploadCommands(), ta.image, desc.format,
+            VK_IMAGE_LAYOUT_UNDEFINED, ta.layout, desc.mipLevels);
 
-        // Early-out if desc data empty
-        if (desc.pData == nullptr)
-            return handle;
+        return call.Return(handle);
+    }
 
-        // Prepare image to be transfer dst optimal
-        VkCommandBuffer cmds = BeginImmediateCommands();
-        TransitionImageLayout(cmds, ta.image, desc.format,
-            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    TextureUpload Context::BeginTextureUpload(const TextureDesc& desc) {
+        SyncRenderThread();
 
-        // Copy data from host buffer to device texture
-        BufferAllocation stagingBuffer;
+        ResourceID staging = m_textureUploads.Create();
+        BufferAllocation& stagingBuffer = m_textureUploads[staging];
 
-        // TODO: defaulting to RGBA- wasteful. determine actual pixel width later. 
-        uint32_t pixelWidth = sizeof(uint32_t);
+        uint32_t texelSize = GetFormatSize(desc.format);
+        assert(texelSize != 0 && "Texture uploads need an uncompressed format");
 
         VkBufferCreateInfo bci = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = desc.width * desc.height * pixelWidth,
+            .size = VkDeviceSize(desc.width) * desc.height * texelSize,
             .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
         };
 
-        aci.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
-        aci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-            VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        // Streamed textures build their host mip chain from the staging memory, so it is also read back
+        VmaAllocationCreateInfo aci = {
+            .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | (desc.streamed
+                ? VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT
+                : VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT),
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST
+        };
 
-        VK_ASSERT(vmaCreateBuffer(m_allocator, &bci, &aci, &stagingBuffer.buffer, &stagingBuffer.alloc, 
+        VK_ASSERT(vmaCreateBuffer(m_allocator, &bci, &aci, &stagingBuffer.buffer, &stagingBuffer.alloc,
             &stagingBuffer.allocInfo));
 
-        memcpy(stagingBuffer.allocInfo.pMappedData, desc.pData, bci.size);
+        return {
+            .desc = desc,
+            .pData = stagingBuffer.allocInfo.pMappedData,
+            .staging = staging
+        };
+    }
+
+    TextureHandle Context::EndTextureUpload(const TextureUpload& upload) {
+        // Recorded as a creation from the texels the application wrote
+        CaptureCall call = Capture(CaptureOp::TextureUpload);
+        SyncRenderThread();
+
+        BufferAllocation stagingBuffer = m_textureUploads[upload.staging];
+        m_textureUploads.Destroy(upload.staging);
+
+        // Make the texels visible to the device in case the memory is not host coherent
+        VK_ASSERT(vmaFlushAllocation(m_allocator, stagingBuffer.alloc, 0, VK_WHOLE_SIZE));
+
+        TextureDesc desc = upload.desc;
+        desc.pData = stagingBuffer.allocInfo.pMappedData;
+        call.Args(desc);
+
+        if (desc.streamed && HasByteChannels(desc.format)) {
+            TextureHandle handle = CreateStreamedTexture(desc);
+            vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.alloc);
+            return call.Return(handle);
+        }
+
+        TextureHandle handle = m_textures.Create();
+        TextureAllocation& ta = m_textures[handle];
+
+        AllocateTextureImage(ta, { desc.width, desc.height }, desc.format, desc.mipLevels, desc.usage);
 
+        // Recorded into the upload batch, so uploads ended back to back share one submission
+        VkCommandBuffer cmds = GetUploadCommands();
+
+        // Prepare image to be transfer dst optimal
+        TransitionImageLayout(cmds, ta.image, desc.format,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, desc.mipLevels);
 
+        // Copy data from the staging buffer to the device texture
         VkBufferImageCopy bic = {
             .imageSubresource = {
                 .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                 .layerCount = 1
             },
-            .imageExtent = ici.extent
+            .imageExtent = { desc.width, desc.height, 1 }
         };
 
         vkCmdCopyBufferToImage(cmds, stagingBuffer.buffer, ta.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
             1, &bic);
 
-            
-            // Transition image so that shaders may use it
-        TransitionImageLayout(cmds, ta.image, desc.format,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-                
-        EndImmediateCommands(cmds);
-        vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.alloc);
+        // The texels fill the first level, the others are filtered down from it
+        VkImageLayout uploadLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        if (desc.mipLevels > 1) {
+            RecordMipChain(cmds, ta);
+            uploadLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        }
+
+        // Transition image so that shaders may use it
+        TransitionImageLayout(cmds, ta.image, desc.format, uploadLayout, ta.layout, desc.mipLevels);
+
+        // The staging memory is read by the batch, it goes once the batch has executed
+        DeferDestroy([allocator = m_allocator, stagingBuffer]() {
+            vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.alloc);
+        });
+
+        return call.Return(handle);
+    }
+
+    void Context::AllocateTextureImage(TextureAllocation& ta, VkExtent2D extent, VkFormat format, uint32_t mipLevels, VkImageUsageFlags usage) {
+        VkImageCreateInfo ici = GetTextureImageInfo(extent, format, mipLevels, usage);
+
+        VmaAllocationCreateInfo aci = {
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        };
+
+        VK_ASSERT(vmaCreateImage(m_allocator, &ici, &aci, &ta.image, &ta.alloc, &ta.allocInfo));
+
+        ta.format = format;
+        ta.extent = extent;
+        ta.mipLevels = mipLevels;
+        ta.usage = ici.usage;
+        ta.layout = (usage & VK_IMAGE_USAGE_STORAGE_BIT)
+            ? VK_IMAGE_LAYOUT_GENERAL
+            : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        CreateTextureViews(ta);
+    }
+
+    VkImageCreateInfo Context::GetTextureImageInfo(VkExtent2D extent, VkFormat format, uint32_t mipLevels, VkImageUsageFlags usage) {
+        VkImageCreateInfo ici = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = format,
+            .extent = {
+                .width = extent.width,
+                .height = extent.height,
+                .depth = 1
+            },
+            .mipLevels = mipLevels,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            // Transfer src so the texture can be read back or downsampled on eviction
+            .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | usage
+        };
+        SetSharingMode(ici);
+
+        return ici;
+    }
 
-        // Create image view
+    void Context::CreateTextureViews(TextureAllocation& ta) {
         VkImageViewCreateInfo ivci = {
             .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
             .image = ta.image,
             .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = VK_FORMAT_R8G8B8A8_SRGB,
+            .format = ta.format,
             .components = {
                 VK_COMPONENT_SWIZZLE_IDENTITY,
                 VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -580,63 +1896,48 @@ namespace vkr {
             },
             .subresourceRange = {
                 .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .levelCount = 1,
+                .levelCount = ta.mipLevels,
                 .layerCount = 1
             }
         };
 
         VK_ASSERT(vkCreateImageView(m_device, &ivci, nullptr, &ta.imageView));
 
-        return handle;
+        // Storage images are written one level at a time
+        ta.mipViews.clear();
+        if (ta.usage & VK_IMAGE_USAGE_STORAGE_BIT) {
+            ta.mipViews.resize(ta.mipLevels);
+
+            for (uint32_t level = 0; level < ta.mipLevels; level++) {
+                ivci.subresourceRange.baseMipLevel = level;
+                ivci.subresourceRange.levelCount = 1;
+                VK_ASSERT(vkCreateImageView(m_device, &ivci, nullptr, &ta.mipViews[level]));
+            }
+        }
     }
 
     GraphicsPipelineHandle Context::CreateGraphicsPipeline(const GraphicsPipelineDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::CreateGraphicsPipeline);
+        SyncRenderThread();
+
         GraphicsPipelineHandle handle = m_graphicsPipelines.Create();
+        call.Args(desc, handle);
         GraphicsPipelineAllocation& pipeline = m_graphicsPipelines[handle];
 
-        // Setup pipeline layout
-        VkDescriptorSetLayoutBinding uniformBinding = {
-            .binding = 0,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
-        };
-
-        VkDescriptorSetLayoutBinding samplerBinding = {
-            .binding = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
-        };
-
-        VkDescriptorSetLayoutBinding descriptorSetBindings[] = {
-            uniformBinding, samplerBinding
-        };
-
-        VkDescriptorSetLayoutCreateInfo dslci = {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-            .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT,
-            .bindingCount = 2,
-            .pBindings = descriptorSetBindings
-        };
-
-        VK_ASSERT(vkCreateDescriptorSetLayout(m_device,  &dslci, nullptr, &pipeline.pushDescriptorSetLayout));
+        // Setup pipeline layout, shared with every pipeline whose shaders declare the same interface
+        VkShaderModule shaders[] = { desc.vertexShader, desc.fragmentShader };
+        uint32_t shaderCount = desc.fragmentShader != nullptr ? 2 : 1;
 
-        // TODO: poll for PCR size?
-        VkPushConstantRange pcr = {
-            .stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS,
-            .size = 128
-        };
+        const PipelineLayout* pPipelineLayout = AcquirePipelineLayout(
+            std::span(shaders, shaderCount), VK_SHADER_STAGE_ALL_GRAPHICS);
 
-        VkPipelineLayoutCreateInfo plci = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-            .setLayoutCount = 1,
-            .pSetLayouts = &pipeline.pushDescriptorSetLayout,
-            .pushConstantRangeCount = 1,
-            .pPushConstantRanges = &pcr
-        };
+        if (pPipelineLayout == nullptr) {
+            m_graphicsPipelines.Destroy(handle);
+            return 0;
+        }
 
-        VK_ASSERT(vkCreatePipelineLayout(m_device, &plci, nullptr, &pipeline.layout));
+        pipeline.layout = pPipelineLayout->layout;
+        pipeline.pushConstantStages = pPipelineLayout->pushConstantStages;
 
         // Setup dynamic pipeline states
         static const std::vector<VkDynamicState> dynamicStates = {
@@ -691,122 +1992,2035 @@ namespace vkr {
             .primitiveRestartEnable = false
         };
 
-        // Setup (dynamic) viewport state
-        VkPipelineViewportStateCreateInfo pvsci = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-            .viewportCount = 1,
-            .scissorCount = 1
-        };
+        // Setup (dynamic) viewport state
+        VkPipelineViewportStateCreateInfo pvsci = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+            .viewportCount = 1,
+            .scissorCount = 1
+        };
+
+        // Setup (dynamic) rasterizer state
+        VkPipelineRasterizationStateCreateInfo prsci = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+            .polygonMode = VK_POLYGON_MODE_FILL,
+            .lineWidth = 1.0f,
+            .cullMode = VK_CULL_MODE_NONE,
+            .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE
+        };
+
+        // Setup multisampling state
+        VkPipelineMultisampleStateCreateInfo pmssci = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+            .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+        };
+
+        // Setup depth stencil state
+        bool stencilTest = desc.depthStencil.stencilTest && HasStencilComponent(m_depthFormat);
+
+        VkPipelineDepthStencilStateCreateInfo pdssci = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+            .depthTestEnable = desc.depthStencil.depthTest,
+            .depthWriteEnable = desc.depthStencil.depthWrite,
+            .depthCompareOp = desc.depthStencil.depthCompareOp,
+            .stencilTestEnable = stencilTest,
+            .front = desc.depthStencil.front,
+            .back = desc.depthStencil.back,
+            .minDepthBounds = 0.0f,
+            .maxDepthBounds = 1.0f
+        };
+
+        // Setup color blending state
+        // TODO: for testing only- add attachment descriptor
+        uint32_t colorAttachmentCount = desc.depthOnly ? 0 : 1;
+
+        std::vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates;
+        for (uint32_t i = 0; i < colorAttachmentCount; i++) {
+            VkPipelineColorBlendAttachmentState blendAttachment = {
+                .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | 
+                    VK_COLOR_COMPONENT_G_BIT |
+                    VK_COLOR_COMPONENT_B_BIT | 
+                    VK_COLOR_COMPONENT_A_BIT,
+                .blendEnable = true,
+                .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+                .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+                .colorBlendOp = VK_BLEND_OP_ADD,
+                .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+                .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+                .alphaBlendOp = VK_BLEND_OP_ADD
+            };
+
+            blendAttachmentStates.push_back(blendAttachment);
+        }
+
+        VkPipelineColorBlendStateCreateInfo pcbsci = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+            .attachmentCount = static_cast<uint32_t>(blendAttachmentStates.size()),
+            .pAttachments = blendAttachmentStates.data()
+        };
+
+        // Setup shader stages
+        VkPipelineShaderStageCreateInfo pssciVertex = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = desc.vertexShader,
+            .pName = "main",
+            .pSpecializationInfo = desc.vertexSpecialization
+        };
+
+        VkPipelineShaderStageCreateInfo pssciFrag = pssciVertex;
+        pssciFrag.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        pssciFrag.module = desc.fragmentShader;
+        pssciFrag.pSpecializationInfo = desc.fragmentSpecialization;
+
+        VkPipelineShaderStageCreateInfo psscis[] = {
+            pssciVertex,
+            pssciFrag
+        };
+
+        // Depth-only pipelines can skip the fragment stage entirely
+        uint32_t stageCount = (desc.depthOnly && desc.fragmentShader == nullptr) ? 1 : 2;
+
+        // Setup dynamic rendering pipeline struct
+        VkFormat colorFormat = m_swapchainFormat;
+
+        VkPipelineRenderingCreateInfo prci = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+            .colorAttachmentCount = colorAttachmentCount,
+            .pColorAttachmentFormats = &colorFormat,
+            .depthAttachmentFormat = m_depthFormat,
+            .stencilAttachmentFormat = HasStencilComponent(m_depthFormat) ? m_depthFormat : VK_FORMAT_UNDEFINED
+        };
+
+        // Create the pipeline
+        VkGraphicsPipelineCreateInfo gpci = {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .pNext = &prci,
+            .stageCount = stageCount,
+            .pStages = psscis,
+            .pVertexInputState = &pvisci,
+            .pInputAssemblyState = &piasci,
+            .pViewportState = &pvsci,
+            .pRasterizationState = &prsci,
+            .pMultisampleState = &pmssci,
+            .pDepthStencilState = &pdssci,
+            .pColorBlendState = &pcbsci,
+            .pDynamicState = &pdsci,
+            .layout = pipeline.layout
+        };
+
+        if (!m_pipelineLibrarySupported) {
+            VK_ASSERT(vkCreateGraphicsPipelines(m_device, nullptr, 1, &gpci, nullptr, &pipeline.pipeline));
+            return handle;
+        }
+
+        // Build each state subset as a library, pipelines sharing a subset reuse the cached library
+        auto appendKey = [](std::string& key, const auto& value) {
+            key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        };
+
+        // Differently specialized shaders compile to different libraries
+        auto appendSpecializationKey = [&](std::string& key, const VkSpecializationInfo* pSpecialization) {
+            if (pSpecialization == nullptr)
+                return;
+
+            appendKey(key, pSpecialization->mapEntryCount);
+            appendKey(key, pSpecialization->dataSize);
+            key.append(reinterpret_cast<const char*>(pSpecialization->pMapEntries),
+                pSpecialization->mapEntryCount * sizeof(VkSpecializationMapEntry));
+            key.append(static_cast<const char*>(pSpecialization->pData), pSpecialization->dataSize);
+        };
+
+        std::string vertexInputKey;
+        for (auto& attrib : desc.vertexAttribs)
+            appendKey(vertexInputKey, attrib);
+
+        VkGraphicsPipelineCreateInfo vigpci = {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .pVertexInputState = &pvisci,
+            .pInputAssemblyState = &piasci,
+            .pDynamicState = &pdsci
+        };
+
+        std::string preRasterizationKey;
+        appendKey(preRasterizationKey, desc.vertexShader);
+        appendKey(preRasterizationKey, pipeline.layout);
+        appendSpecializationKey(preRasterizationKey, desc.vertexSpecialization);
+
+        VkGraphicsPipelineCreateInfo prgpci = {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .pNext = &prci,
+            .stageCount = 1,
+            .pStages = &psscis[0],
+            .pViewportState = &pvsci,
+            .pRasterizationState = &prsci,
+            .pDynamicState = &pdsci,
+            .layout = pipeline.layout
+        };
+
+        std::string fragmentShaderKey;
+        appendKey(fragmentShaderKey, desc.fragmentShader);
+        appendKey(fragmentShaderKey, pipeline.layout);
+        appendKey(fragmentShaderKey, pdssci.depthTestEnable);
+        appendKey(fragmentShaderKey, pdssci.depthWriteEnable);
+        appendKey(fragmentShaderKey, pdssci.depthCompareOp);
+        appendKey(fragmentShaderKey, pdssci.stencilTestEnable);
+        appendKey(fragmentShaderKey, pdssci.front);
+        appendKey(fragmentShaderKey, pdssci.back);
+        appendSpecializationKey(fragmentShaderKey, desc.fragmentSpecialization);
+
+        VkGraphicsPipelineCreateInfo fsgpci = {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .pNext = &prci,
+            .stageCount = stageCount - 1,
+            .pStages = &psscis[1],
+            .pMultisampleState = &pmssci,
+            .pDepthStencilState = &pdssci,
+            .pDynamicState = &pdsci,
+            .layout = pipeline.layout
+        };
+
+        std::string fragmentOutputKey;
+        appendKey(fragmentOutputKey, colorAttachmentCount);
+        appendKey(fragmentOutputKey, colorFormat);
+        appendKey(fragmentOutputKey, m_depthFormat);
+
+        VkGraphicsPipelineCreateInfo fogpci = {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .pNext = &prci,
+            .pMultisampleState = &pmssci,
+            .pColorBlendState = &pcbsci,
+            .pDynamicState = &pdsci
+        };
+
+        std::array<VkPipeline, 4> libraries = {
+            GetPipelineLibrary(VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+                std::move(vertexInputKey), vigpci),
+            GetPipelineLibrary(VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+                std::move(preRasterizationKey), prgpci, desc.vertexShader, pipeline.layout),
+            GetPipelineLibrary(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+                std::move(fragmentShaderKey), fsgpci, desc.fragmentShader, pipeline.layout),
+            GetPipelineLibrary(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+                std::move(fragmentOutputKey), fogpci)
+        };
+
+        // Link without optimization so the pipeline is usable right away
+        auto link = [device = m_device, layout = pipeline.layout, libraries](VkPipelineCreateFlags flags) {
+            VkPipelineLibraryCreateInfoKHR plci = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+                .libraryCount = static_cast<uint32_t>(libraries.size()),
+                .pLibraries = libraries.data()
+            };
+
+            VkGraphicsPipelineCreateInfo lgpci = {
+                .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+                .pNext = &plci,
+                .flags = flags,
+                .layout = layout
+            };
+
+            VkPipeline linked = nullptr;
+            VK_ASSERT(vkCreateGraphicsPipelines(device, nullptr, 1, &lgpci, nullptr, &linked));
+            return linked;
+        };
+
+        pipeline.pipeline = link(0);
+
+        // Then produce the optimized pipeline as a job, it replaces this one once ready. Without a job system it is
+        // linked right away, like the mip chains of streamed textures
+        auto optimized = std::make_shared<OptimizedLink>();
+
+        auto linkOptimized = [link, optimized]() {
+            optimized->pipeline = link(VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT);
+            optimized->linked.store(true, std::memory_order_release);
+        };
+
+        if (m_jobSystem != nullptr)
+            m_jobSystem->Run(std::move(linkOptimized), m_pipelineLinkJobs);
+        else
+            linkOptimized();
+
+        m_pipelineLinks.push_back({
+            .handle = handle,
+            .optimized = std::move(optimized),
+            .discarded = false
+        });
+
+        return handle;
+    }
+
+    ComputePipelineHandle Context::CreateComputePipeline(const ComputePipelineDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::CreateComputePipeline);
+        SyncRenderThread();
+
+        ComputePipelineHandle handle = m_computePipelines.Create();
+        call.Args(desc, handle);
+        ComputePipelineAllocation& pipeline = m_computePipelines[handle];
+
+        // Setup pipeline layout from the shader's bindings
+        const PipelineLayout* pPipelineLayout = AcquirePipelineLayout(
+            std::span(&desc.computeShader, 1), VK_SHADER_STAGE_COMPUTE_BIT);
+
+        if (pPipelineLayout == nullptr) {
+            m_computePipelines.Destroy(handle);
+            return 0;
+        }
+
+        pipeline.layout = pPipelineLayout->layout;
+        pipeline.pushConstantStages = pPipelineLayout->pushConstantStages;
+
+        VkComputePipelineCreateInfo cpci = {
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .stage = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = desc.computeShader,
+                .pName = "main",
+                .pSpecializationInfo = desc.specialization
+            },
+            .layout = pipeline.layout
+        };
+
+        VK_ASSERT(vkCreateComputePipelines(m_device, nullptr, 1, &cpci, nullptr, &pipeline.pipeline));
+
+        return handle;
+    }
+
+    void Context::DestroyBuffer(BufferHandle bufferHandle) {
+        CaptureCall call = Capture(CaptureOp::DestroyBuffer);
+        call.Args(bufferHandle);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DestroyBuffer, bufferHandle);
+
+        BufferAllocation ba = m_buffers[bufferHandle];
+        m_buffers.Destroy(bufferHandle);
+
+        if (ba.moving) {
+            return AbandonMove(ba.alloc, [device = m_device, buffer = ba.buffer]() {
+                vkDestroyBuffer(device, buffer, nullptr);
+            });
+        }
+
+        DeferDestroy([allocator = m_allocator, ba]() {
+            vmaDestroyBuffer(allocator, ba.buffer, ba.alloc);
+        });
+    }
+
+    void Context::DestroyShader(VkShaderModule shader) {
+        CaptureCall call = Capture(CaptureOp::DestroyShader);
+        call.Args(shader);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DestroyShader, shader);
+
+        m_shaderReflections.erase(shader);
+        EvictPipelineLibraries(shader, nullptr);
+
+        DeferDestroy([device = m_device, shader]() {
+            vkDestroyShaderModule(device, shader, nullptr);
+        });
+    }
+
+    void Context::DestroySampler(SamplerHandle samplerHandle) {
+        CaptureCall call = Capture(CaptureOp::DestroySampler);
+        call.Args(samplerHandle);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DestroySampler, samplerHandle);
+
+        VkSampler sampler = m_samplers[samplerHandle];
+        m_samplers.Destroy(samplerHandle);
+
+        DeferDestroy([device = m_device, sampler]() {
+            vkDestroySampler(device, sampler, nullptr);
+        });
+    }
+
+    void Context::DestroyTexture(TextureHandle textureHandle) {
+        CaptureCall call = Capture(CaptureOp::DestroyTexture);
+        call.Args(textureHandle);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DestroyTexture, textureHandle);
+
+        TextureAllocation ta = m_textures[textureHandle];
+        m_textures.Destroy(textureHandle);
+        m_streamedTextures.erase(textureHandle);
+
+        if (ta.moving) {
+            return AbandonMove(ta.alloc, [device = m_device, ta]() {
+                for (auto& mipView : ta.mipViews)
+                    vkDestroyImageView(device, mipView, nullptr);
+
+                vkDestroyImageView(device, ta.imageView, nullptr);
+                vkDestroyImage(device, ta.image, nullptr);
+            });
+        }
+
+        DeferDestroy([device = m_device, allocator = m_allocator, ta]() {
+            for (auto& mipView : ta.mipViews)
+                vkDestroyImageView(device, mipView, nullptr);
+
+            vkDestroyImageView(device, ta.imageView, nullptr);
+            vmaDestroyImage(allocator, ta.image, ta.alloc);
+
+            if (ta.evicted)
+                vmaDestroyBuffer(allocator, ta.hostCopy.buffer, ta.hostCopy.alloc);
+        });
+    }
+
+    void Context::DestroyGraphicsPipeline(GraphicsPipelineHandle pipelineHandle) {
+        CaptureCall call = Capture(CaptureOp::DestroyGraphicsPipeline);
+        call.Args(pipelineHandle);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DestroyGraphicsPipeline, pipelineHandle);
+
+        GraphicsPipelineAllocation pipeline = m_graphicsPipelines[pipelineHandle];
+        m_graphicsPipelines.Destroy(pipelineHandle);
+
+        // An optimized link still in flight is thrown away once it finishes, see UpdatePipelineLinks
+        auto link = std::find_if(m_pipelineLinks.begin(), m_pipelineLinks.end(),
+            [&](const PipelineLink& l) { return l.handle == pipelineHandle && !l.discarded; });
+
+        if (link != m_pipelineLinks.end())
+            link->discarded = true;
+
+        DeferDestroy([device = m_device, pipeline]() {
+            vkDestroyPipeline(device, pipeline.pipeline, nullptr);
+        });
+
+        ReleasePipelineLayout(pipeline.layout);
+    }
+
+    void Context::DestroyComputePipeline(ComputePipelineHandle pipelineHandle) {
+        CaptureCall call = Capture(CaptureOp::DestroyComputePipeline);
+        call.Args(pipelineHandle);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::DestroyComputePipeline, pipelineHandle);
+
+        ComputePipelineAllocation pipeline = m_computePipelines[pipelineHandle];
+        m_computePipelines.Destroy(pipelineHandle);
+
+        DeferDestroy([device = m_device, pipeline]() {
+            vkDestroyPipeline(device, pipeline.pipeline, nullptr);
+        });
+
+        ReleasePipelineLayout(pipeline.layout);
+    }
+
+    void Context::CopyBufferData(BufferHandle bufferHandle, void* pData, size_t offset, size_t size) {
+        // Only the bytes that are copied are recorded
+        CaptureCall call = Capture(CaptureOp::CopyBufferData);
+        call.Args(bufferHandle, offset);
+        call.Blob(pData, size);
+
+        if (DefersToRenderThread()) {
+            uint64_t dataOffset = m_renderThread->PushData(pData, size);
+            return m_renderThread->Push(RenderOp::CopyBufferData, bufferHandle, dataOffset, offset, size);
+        }
+
+        BufferAllocation& ba = m_buffers[bufferHandle];
+
+        // Host local buffer
+        if (ba.allocInfo.pMappedData != nullptr) {
+            memcpy((uint8_t*)ba.allocInfo.pMappedData + offset, pData, size);
+        }
+        // Device local buffer, through a staging buffer
+        else {
+            BufferAllocation stagingBuffer;
+
+            VkBufferCreateInfo bci = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                .size = size,
+                .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+            };
+
+            VmaAllocationCreateInfo aci = {
+                .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST
+            };
+
+            VK_ASSERT(vmaCreateBuffer(m_allocator, &bci, &aci,
+                &stagingBuffer.buffer, &stagingBuffer.alloc,
+                &stagingBuffer.allocInfo));
+
+            memcpy(stagingBuffer.allocInfo.pMappedData, pData, size);
+
+            VkBufferCopy bc = {
+                .dstOffset = offset,
+                .size = size
+            };
+
+            // During a frame the copy is ordered with the frame's commands, so it must be outside a rendering scope
+            if (m_frameRecording) {
+                // Earlier commands are done reading the buffer before it is overwritten, later ones see the new data
+                PipelineBarrier(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+                vkCmdCopyBuffer(GetCommandBuffer(), stagingBuffer.buffer, ba.buffer, 1, &bc);
+                PipelineBarrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT);
+
+                DeferDestroy([allocator = m_allocator, stagingBuffer]() {
+                    vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.alloc);
+                });
+            }
+            else {
+                VkCommandBuffer cmds = BeginImmediateCommands();
+                vkCmdCopyBuffer(cmds, stagingBuffer.buffer, ba.buffer, 1, &bc);
+                EndImmediateCommands(cmds);
+
+                vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.alloc);
+            }
+        }
+    }
+
+    void Context::WaitIdle() {
+        CaptureCall call = Capture(CaptureOp::WaitIdle);
+        SyncRenderThread();
+
+        FlushUploads();
+        vkDeviceWaitIdle(m_device);
+        CollectDeferredDestroys();
+    }
+
+    bool Context::BeginCapture(const char* path) {
+        SyncRenderThread();
+        assert(!m_frameRecording && "captures begin between frames");
+
+        CaptureHeader header = {
+            .magic = CAPTURE_MAGIC,
+            .version = CAPTURE_VERSION,
+            .extent = m_swapchainExtent,
+            .framesInFlight = m_framePacing.framesInFlight
+        };
+
+        auto capture = std::make_unique<CaptureWriter>(path, header);
+        if (!*capture)
+            return false;
+
+        m_capture = std::move(capture);
+        return true;
+    }
+
+    void Context::EndCapture() {
+        SyncRenderThread();
+        assert(!m_frameRecording && "captures end between frames");
+        m_capture.reset();
+    }
+
+    CaptureCall Context::Capture(CaptureOp op) {
+        // The application thread recorded the calls the render thread executes
+        if (m_renderThread != nullptr && m_renderThread->IsCurrent())
+            return CaptureCall(nullptr, m_renderThreadCaptureDepth, op);
+
+        return CaptureCall(m_capture.get(), m_captureDepth, op);
+    }
+
+    bool Context::DefersToRenderThread() const {
+        return m_renderThread != nullptr && !m_renderThread->IsCurrent();
+    }
+
+    void Context::SyncRenderThread() {
+        if (!DefersToRenderThread())
+            return;
+
+        m_renderThread->Wait();
+
+        // The render thread is idle, so what it measured can be copied out for the application thread
+        m_publishedFrameStats = m_frameStats;
+        m_publishedRenderExtent = m_swapchainExtent;
+        m_publishedMemoryStats = m_memoryStats;
+        m_publishedTextureStreamingStats = m_textureStreamingStats;
+        m_publishedDefragmentationStats = m_defragmentationStats;
+    }
+
+    void Context::DeferDestroy(std::function<void()>&& destroy) {
+        // Objects destroyed mid-frame may be referenced by the frame being recorded,
+        // they are tagged with its timeline value once it is submitted
+        if (m_frameRecording) {
+            m_frameDestroys.push_back(std::move(destroy));
+            return;
+        }
+
+        // Or by the pending upload batch, which takes the next timeline value once it is submitted
+        if (m_uploadCommands != nullptr) {
+            m_uploadDestroys.push_back(std::move(destroy));
+            return;
+        }
+
+        m_deferredDestroys.push_back({ m_timelineValue, std::move(destroy) });
+    }
+
+    const Context::PipelineLayout* Context::AcquirePipelineLayout(std::span<const VkShaderModule> shaders, VkShaderStageFlags stages) {
+        // Merge the bindings and push constant blocks of every stage
+        std::vector<ShaderBinding> bindings;
+        uint32_t pushConstantSize = 0;
+
+        for (VkShaderModule shader : shaders) {
+            // Rejected SPIR-V leaves the caller with a null module, destroyed shaders are forgotten too
+            auto reflectionIt = m_shaderReflections.find(shader);
+            if (reflectionIt == m_shaderReflections.end()) {
+                fprintf(stderr, "vkr: pipeline uses a shader that was not created or failed to load\n");
+                return nullptr;
+            }
+
+            const ShaderReflection& reflection = reflectionIt->second;
+            pushConstantSize = std::max(pushConstantSize, reflection.pushConstantSize);
+
+            for (const ShaderBinding& binding : reflection.bindings) {
+                // Everything is bound through the single push descriptor set
+                assert(binding.set == 0 && "Only descriptor set 0 is supported");
+                assert(binding.count != 0 && "Runtime descriptor arrays are not supported");
+
+                auto it = std::find_if(bindings.begin(), bindings.end(),
+                    [&](const ShaderBinding& b) { return b.binding == binding.binding; });
+
+                if (it == bindings.end())
+                    bindings.push_back(binding);
+                else
+                    assert(it->type == binding.type && it->count == binding.count && "Stages disagree on a binding");
+            }
+        }
+
+        std::sort(bindings.begin(), bindings.end(),
+            [](const ShaderBinding& a, const ShaderBinding& b) { return a.binding < b.binding; });
+
+        // Ranges are multiples of 4 bytes
+        pushConstantSize = (pushConstantSize + 3) & ~3u;
+
+        // Layouts are looked up by everything that goes into creating them
+        std::string key = std::to_string(stages) + ":" + std::to_string(pushConstantSize);
+        for (const ShaderBinding& binding : bindings)
+            key += ":" + std::to_string(binding.binding) + "/" + std::to_string(binding.type) + "/" + std::to_string(binding.count);
+
+        auto it = m_pipelineLayouts.find(key);
+        if (it != m_pipelineLayouts.end()) {
+            it->second.refCount++;
+            return &it->second;
+        }
+
+        PipelineLayout pipelineLayout = {
+            .pushConstantStages = pushConstantSize > 0 ? stages : 0,
+            .refCount = 1
+        };
+
+        std::vector<VkDescriptorSetLayoutBinding> descriptorSetBindings;
+        for (const ShaderBinding& binding : bindings) {
+            descriptorSetBindings.push_back({
+                .binding = binding.binding,
+                .descriptorType = binding.type,
+                .descriptorCount = binding.count,
+                .stageFlags = stages
+            });
+        }
+
+        VkDescriptorSetLayoutCreateInfo dslci = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT,
+            .bindingCount = static_cast<uint32_t>(descriptorSetBindings.size()),
+            .pBindings = descriptorSetBindings.data()
+        };
+
+        VK_ASSERT(vkCreateDescriptorSetLayout(m_device, &dslci, nullptr, &pipelineLayout.pushDescriptorSetLayout));
+
+        VkPushConstantRange pcr = {
+            .stageFlags = stages,
+            .size = pushConstantSize
+        };
+
+        VkPipelineLayoutCreateInfo plci = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .setLayoutCount = 1,
+            .pSetLayouts = &pipelineLayout.pushDescriptorSetLayout,
+            .pushConstantRangeCount = pushConstantSize > 0 ? 1u : 0u,
+            .pPushConstantRanges = &pcr
+        };
+
+        VK_ASSERT(vkCreatePipelineLayout(m_device, &plci, nullptr, &pipelineLayout.layout));
+
+        return &m_pipelineLayouts.emplace(std::move(key), pipelineLayout).first->second;
+    }
+
+    void Context::ReleasePipelineLayout(VkPipelineLayout layout) {
+        auto it = std::find_if(m_pipelineLayouts.begin(), m_pipelineLayouts.end(),
+            [&](const auto& entry) { return entry.second.layout == layout; });
+
+        assert(it != m_pipelineLayouts.end() && "Pipeline layout released more often than acquired");
+        if (it == m_pipelineLayouts.end() || --it->second.refCount > 0)
+            return;
+
+        if (m_boundPipelineLayout == layout)
+            m_boundPipelineLayout = nullptr;
+
+        EvictPipelineLibraries(nullptr, layout);
+
+        DeferDestroy([device = m_device, pipelineLayout = it->second]() {
+            vkDestroyPipelineLayout(device, pipelineLayout.layout, nullptr);
+            vkDestroyDescriptorSetLayout(device, pipelineLayout.pushDescriptorSetLayout, nullptr);
+        });
+
+        m_pipelineLayouts.erase(it);
+    }
+
+    VkPipeline Context::GetPipelineLibrary(VkGraphicsPipelineLibraryFlagsEXT subset, std::string&& key,
+        VkGraphicsPipelineCreateInfo gpci, VkShaderModule shader, VkPipelineLayout layout) {
+        key.append(reinterpret_cast<const char*>(&subset), sizeof(subset));
+
+        auto it = m_pipelineLibraries.find(key);
+        if (it != m_pipelineLibraries.end())
+            return it->second.library;
+
+        VkGraphicsPipelineLibraryCreateInfoEXT gplci = {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT,
+            .pNext = gpci.pNext,
+            .flags = subset
+        };
+
+        // Keep what the optimized link needs to optimize across libraries
+        gpci.pNext = &gplci;
+        gpci.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+
+        PipelineLibrary pipelineLibrary = {
+            .shader = shader,
+            .layout = layout
+        };
+
+        VK_ASSERT(vkCreateGraphicsPipelines(m_device, nullptr, 1, &gpci, nullptr, &pipelineLibrary.library));
+
+        m_pipelineLibraries.emplace(std::move(key), pipelineLibrary);
+        return pipelineLibrary.library;
+    }
+
+    void Context::EvictPipelineLibraries(VkShaderModule shader, VkPipelineLayout layout) {
+        // Linked pipelines do not depend on their libraries, only links in flight do
+        UpdatePipelineLinks(true);
+
+        for (auto it = m_pipelineLibraries.begin(); it != m_pipelineLibraries.end();) {
+            bool evict = (shader != nullptr && it->second.shader == shader) ||
+                (layout != nullptr && it->second.layout == layout);
+
+            if (!evict) {
+                ++it;
+                continue;
+            }
+
+            DeferDestroy([device = m_device, library = it->second.library]() {
+                vkDestroyPipeline(device, library, nullptr);
+            });
+
+            it = m_pipelineLibraries.erase(it);
+        }
+    }
+
+    void Context::UpdatePipelineLinks(bool wait) {
+        // Links started by a sharing context run on its job system, whose workers finish them
+        if (wait && m_jobSystem != nullptr)
+            m_jobSystem->Wait(m_pipelineLinkJobs);
+
+        while (wait && !m_pipelineLinkJobs.IsDone())
+            std::this_thread::yield();
+
+        for (auto it = m_pipelineLinks.begin(); it != m_pipelineLinks.end();) {
+            if (!it->optimized->linked.load(std::memory_order_acquire)) {
+                ++it;
+                continue;
+            }
+
+            if (it->discarded) {
+                DeferDestroy([device = m_device, optimized = it->optimized->pipeline]() {
+                    vkDestroyPipeline(device, optimized, nullptr);
+                });
+
+                it = m_pipelineLinks.erase(it);
+                continue;
+            }
+
+            // Already recorded command buffers keep the fast-linked pipeline alive until they retire
+            GraphicsPipelineAllocation& pipeline = m_graphicsPipelines[it->handle];
+
+            DeferDestroy([device = m_device, fastLinked = pipeline.pipeline]() {
+                vkDestroyPipeline(device, fastLinked, nullptr);
+            });
+
+            pipeline.pipeline = it->optimized->pipeline;
+            it = m_pipelineLinks.erase(it);
+        }
+    }
+
+    void Context::CollectDeferredDestroys() {
+        uint64_t completedValue = 0;
+        VK_ASSERT(vkGetSemaphoreCounterValue(m_device, m_timeline, &completedValue));
+
+        // Values are queued in increasing order, so stop at the first pending one
+        while (!m_deferredDestroys.empty() && m_deferredDestroys.front().timelineValue <= completedValue) {
+            m_deferredDestroys.front().destroy();
+            m_deferredDestroys.pop_front();
+        }
+    }
+
+    void Context::WaitTimeline(uint64_t value) {
+        VkSemaphoreWaitInfo swi = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &m_timeline,
+            .pValues = &value
+        };
+
+        VK_ASSERT(vkWaitSemaphores(m_device, &swi, UINT64_MAX));
+    }
+
+    void Context::SetMemoryBudget(const MemoryBudgetDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::SetMemoryBudget);
+        call.Args(desc);
+        SyncRenderThread();
+
+        m_memoryBudget = desc;
+    }
+
+    void Context::SetEvictionCallback(EvictionCallback callback) {
+        SyncRenderThread();
+
+        m_evictionCallback = std::move(callback);
+    }
+
+    void Context::UpdateMemoryBudget() {
+        const VkPhysicalDeviceMemoryProperties* pMemoryProperties = nullptr;
+        vmaGetMemoryProperties(m_allocator, &pMemoryProperties);
+
+        VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+        vmaGetHeapBudgets(m_allocator, budgets);
+
+        m_memoryStats.heaps.resize(pMemoryProperties->memoryHeapCount);
+        for (uint32_t i = 0; i < pMemoryProperties->memoryHeapCount; i++) {
+            m_memoryStats.heaps[i] = {
+                .usage = budgets[i].usage,
+                .budget = budgets[i].budget,
+                .deviceLocal = (pMemoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0
+            };
+        }
+    }
+
+    void Context::UpdateResidency(VkCommandBuffer cmds) {
+        if (!m_evictionSupported)
+            return;
+
+        // Make earlier transfer writes visible to the residency copies
+        VkMemoryBarrier2 mb = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT
+        };
+
+        VkDependencyInfo di = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &mb
+        };
+
+        bool recorded = false;
+        auto beginTransfers = [&]() {
+            if (!recorded)
+                vkCmdPipelineBarrier2(cmds, &di);
+            recorded = true;
+        };
+
+        // Restore evicted resources that were used last frame
+        for (auto handle : m_bufferRestores) {
+            if (!m_buffers.Contains(handle))
+                continue;
+
+            beginTransfers();
+            RestoreBuffer(cmds, m_buffers[handle]);
+        }
+
+        for (auto handle : m_textureRestores) {
+            if (!m_textures.Contains(handle))
+                continue;
+
+            beginTransfers();
+            RestoreTexture(cmds, m_textures[handle]);
+        }
+
+        m_bufferRestores.clear();
+        m_textureRestores.clear();
+
+        // Free device-local heaps that are over the eviction threshold
+        const VkPhysicalDeviceMemoryProperties* pMemoryProperties = nullptr;
+        vmaGetMemoryProperties(m_allocator, &pMemoryProperties);
+
+        for (uint32_t heap = 0; heap < m_memoryStats.heaps.size(); heap++) {
+            auto& heapStats = m_memoryStats.heaps[heap];
+            VkDeviceSize threshold = static_cast<VkDeviceSize>(heapStats.budget * m_memoryBudget.evictionThreshold);
+
+            if (!heapStats.deviceLocal || heapStats.usage <= threshold)
+                continue;
+
+            // Gather idle resources living in this heap
+            std::vector<EvictionCandidate> candidates;
+            auto idle = [&](uint64_t lastUsedFrame) {
+                return lastUsedFrame + m_framePacing.framesInFlight + m_memoryBudget.minIdleFrames < m_frameNumber;
+            };
+            auto inHeap = [&](const VmaAllocationInfo& allocInfo) {
+                return pMemoryProperties->memoryTypes[allocInfo.memoryType].heapIndex == heap;
+            };
+
+            // Resources moved by the defragmentation pass in flight keep their memory until it ends
+            // Storage and indirect buffers may be written by the GPU, which would go to the host copy and be lost on restore
+            const VkBufferUsageFlags gpuWritten = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+            for (auto& [id, ba] : m_buffers) {
+                if (!ba.evicted && !ba.moving && !(ba.usage & gpuWritten) && idle(ba.lastUsedFrame) && inHeap(ba.allocInfo))
+                    candidates.push_back({ ResourceType::Buffer, id, ba.allocInfo.size, ba.lastUsedFrame });
+            }
+
+            for (auto& [id, ta] : m_textures) {
+                // Streamed textures manage their own residency, storage and render graph textures are written by the GPU
+                // Eviction keeps a single level on the host and on the device, so mipmapped textures stay resident
+                if (!ta.evicted && !ta.moving && idle(ta.lastUsedFrame) && inHeap(ta.allocInfo) && !m_streamedTextures.contains(id) &&
+                    ta.layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && !ta.aliased && ta.mipLevels == 1)
+                    candidates.push_back({ ResourceType::Texture, id, ta.allocInfo.size, ta.lastUsedFrame });
+            }
+
+            std::sort(candidates.begin(), candidates.end(), [](auto& a, auto& b) {
+                return a.lastUsedFrame < b.lastUsedFrame;
+            });
+
+            // Evict in LRU order until the heap is back under the threshold
+            VkDeviceSize usage = heapStats.usage;
+            for (auto& candidate : candidates) {
+                if (usage <= threshold)
+                    break;
+
+                if (m_evictionCallback && !m_evictionCallback(candidate))
+                    continue;
+
+                beginTransfers();
+
+                bool evicted = (candidate.type == ResourceType::Buffer)
+                    ? EvictBuffer(cmds, m_buffers[candidate.handle])
+                    : EvictTexture(cmds, m_textures[candidate.handle]);
+
+                if (evicted)
+                    usage -= std::min(usage, candidate.size);
+            }
+        }
+
+        // Make the copies visible to everything recorded after them this frame
+        if (recorded) {
+            mb = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT
+            };
+
+            vkCmdPipelineBarrier2(cmds, &di);
+        }
+    }
+
+    Context::BufferAllocation& Context::TouchBuffer(BufferHandle bufferHandle) {
+        BufferAllocation& ba = m_buffers[bufferHandle];
+        ba.lastUsedFrame = m_frameNumber;
+
+        if (ba.evicted && !ba.restoreRequested) {
+            ba.restoreRequested = true;
+            m_bufferRestores.push_back(bufferHandle);
+        }
+
+        return ba;
+    }
+
+    Context::TextureAllocation& Context::TouchTexture(TextureHandle textureHandle) {
+        TextureAllocation& ta = m_textures[textureHandle];
+        ta.lastUsedFrame = m_frameNumber;
+
+        if (ta.evicted && !ta.restoreRequested) {
+            ta.restoreRequested = true;
+            m_textureRestores.push_back(textureHandle);
+        }
+
+        return ta;
+    }
+
+    bool Context::IsDeviceLocal(const VmaAllocationInfo& allocInfo) const {
+        VkMemoryPropertyFlags flags = 0;
+        vmaGetMemoryTypeProperties(m_allocator, allocInfo.memoryType, &flags);
+        return (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+    }
+
+    bool Context::EvictBuffer(VkCommandBuffer cmds, BufferAllocation& ba) {
+        // Host memory copy that stays bindable, the GPU reads it over the bus until restored
+        BufferAllocation host = {};
+
+        VkBufferCreateInfo bci = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = ba.allocInfo.size,
+            .usage = ba.usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+        };
+        SetSharingMode(bci);
+
+        VmaAllocationCreateInfo aci = {
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST
+        };
+
+        if (vmaCreateBuffer(m_allocator, &bci, &aci, &host.buffer, &host.alloc, &host.allocInfo) != VK_SUCCESS)
+            return false;
+
+        if (IsDeviceLocal(host.allocInfo)) {
+            vmaDestroyBuffer(m_allocator, host.buffer, host.alloc);
+            return false;
+        }
+
+        VkBufferCopy bc = {
+            .size = ba.allocInfo.size
+        };
+
+        vkCmdCopyBuffer(cmds, ba.buffer, host.buffer, 1, &bc);
+
+        DeferDestroy([allocator = m_allocator, old = ba]() {
+            vmaDestroyBuffer(allocator, old.buffer, old.alloc);
+        });
+
+        ba.evictedSize = ba.allocInfo.size;
+        ba.buffer = host.buffer;
+        ba.alloc = host.alloc;
+        ba.allocInfo = host.allocInfo;
+        ba.evicted = true;
+
+        m_memoryStats.evictedBytes += ba.evictedSize;
+        m_memoryStats.evictedBuffers++;
+        return true;
+    }
+
+    void Context::RestoreBuffer(VkCommandBuffer cmds, BufferAllocation& ba) {
+        BufferAllocation device = {};
+
+        VkBufferCreateInfo bci = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = ba.allocInfo.size,
+            .usage = ba.usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+        };
+        SetSharingMode(bci);
+
+        VmaAllocationCreateInfo aci = {
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        };
+
+        // Stay in host memory if the device is still full, the next use requests another restore
+        ba.restoreRequested = false;
+        if (vmaCreateBuffer(m_allocator, &bci, &aci, &device.buffer, &device.alloc, &device.allocInfo) != VK_SUCCESS)
+            return;
+
+        VkBufferCopy bc = {
+            .size = ba.allocInfo.size
+        };
+
+        vkCmdCopyBuffer(cmds, ba.buffer, device.buffer, 1, &bc);
+
+        DeferDestroy([allocator = m_allocator, old = ba]() {
+            vmaDestroyBuffer(allocator, old.buffer, old.alloc);
+        });
+
+        m_memoryStats.evictedBytes -= ba.evictedSize;
+        m_memoryStats.evictedBuffers--;
+
+        ba.buffer = device.buffer;
+        ba.alloc = device.alloc;
+        ba.allocInfo = device.allocInfo;
+        ba.evictedSize = 0;
+        ba.evicted = false;
+    }
+
+    bool Context::EvictTexture(VkCommandBuffer cmds, TextureAllocation& ta) {
+        // Keep the full image on the host so it can be restored losslessly
+        BufferAllocation hostCopy = {};
+
+        uint32_t texelSize = GetFormatSize(ta.format);
+        if (texelSize == 0)
+            return false;
+
+        VkBufferCreateInfo bci = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = static_cast<VkDeviceSize>(ta.extent.width) * ta.extent.height * texelSize,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+        };
+
+        VmaAllocationCreateInfo aci = {
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST
+        };
+
+        if (vmaCreateBuffer(m_allocator, &bci, &aci, &hostCopy.buffer, &hostCopy.alloc, &hostCopy.allocInfo) != VK_SUCCESS)
+            return false;
+
+        if (IsDeviceLocal(hostCopy.allocInfo)) {
+            vmaDestroyBuffer(m_allocator, hostCopy.buffer, hostCopy.alloc);
+            return false;
+        }
+
+        // Replace the image with a quarter-resolution version that stays bindable
+        TextureAllocation lowMip = {};
+        VkExtent2D lowExtent = {
+            std::max(ta.extent.width / 4, 1u),
+            std::max(ta.extent.height / 4, 1u)
+        };
+
+        assert(ta.mipLevels == 1 && "only single level textures are evicted");
+        AllocateTextureImage(lowMip, lowExtent, ta.format, 1, ta.usage);
+
+        TransitionImageLayout(cmds, ta.image, ta.format,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        TransitionImageLayout(cmds, lowMip.image, ta.format,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        VkBufferImageCopy bic = {
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .layerCount = 1
+            },
+            .imageExtent = { ta.extent.width, ta.extent.height, 1 }
+        };
+
+        vkCmdCopyImageToBuffer(cmds, ta.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, hostCopy.buffer, 1, &bic);
+
+        VkImageBlit ib = {
+            .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .srcOffsets = { { 0, 0, 0 }, { int32_t(ta.extent.width), int32_t(ta.extent.height), 1 } },
+            .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .dstOffsets = { { 0, 0, 0 }, { int32_t(lowExtent.width), int32_t(lowExtent.height), 1 } }
+        };
+
+        vkCmdBlitImage(cmds, ta.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            lowMip.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &ib, VK_FILTER_LINEAR);
+
+        TransitionImageLayout(cmds, lowMip.image, ta.format,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        DeferDestroy([device = m_device, allocator = m_allocator, old = ta]() {
+            vkDestroyImageView(device, old.imageView, nullptr);
+            vmaDestroyImage(allocator, old.image, old.alloc);
+        });
+
+        // The low mip stays in device memory
+        ta.evictedSize = ta.allocInfo.size - std::min(ta.allocInfo.size, lowMip.allocInfo.size);
+        m_memoryStats.evictedBytes += ta.evictedSize;
+        m_memoryStats.evictedTextures++;
+
+        ta.image = lowMip.image;
+        ta.imageView = lowMip.imageView;
+        ta.alloc = lowMip.alloc;
+        ta.allocInfo = lowMip.allocInfo;
+        ta.hostCopy = hostCopy;
+        ta.evicted = true;
+        return true;
+    }
+
+    void Context::RestoreTexture(VkCommandBuffer cmds, TextureAllocation& ta) {
+        // The allocation's extent is left at full resolution while evicted
+        VkExtent2D extent = ta.extent;
+
+        TextureAllocation full = {};
+        AllocateTextureImage(full, extent, ta.format, ta.mipLevels, ta.usage);
+
+        TransitionImageLayout(cmds, full.image, ta.format,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        VkBufferImageCopy bic = {
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .layerCount = 1
+            },
+            .imageExtent = { extent.width, extent.height, 1 }
+        };
+
+        vkCmdCopyBufferToImage(cmds, ta.hostCopy.buffer, full.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bic);
+
+        TransitionImageLayout(cmds, full.image, ta.format,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        DeferDestroy([device = m_device, allocator = m_allocator, old = ta]() {
+            vkDestroyImageView(device, old.imageView, nullptr);
+            vmaDestroyImage(allocator, old.image, old.alloc);
+            vmaDestroyBuffer(allocator, old.hostCopy.buffer, old.hostCopy.alloc);
+        });
+
+        m_memoryStats.evictedBytes -= ta.evictedSize;
+        m_memoryStats.evictedTextures--;
+
+        ta.image = full.image;
+        ta.imageView = full.imageView;
+        ta.alloc = full.alloc;
+        ta.allocInfo = full.allocInfo;
+        ta.mipLevels = full.mipLevels;
+        ta.hostCopy = {};
+        ta.evictedSize = 0;
+        ta.evicted = false;
+        ta.restoreRequested = false;
+    }
+
+    void Context::SetDefragmentation(const DefragmentationDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::SetDefragmentation);
+        call.Args(desc);
+        SyncRenderThread();
+
+        m_defragmentation = desc;
+        m_defragmentationIdleUntil = 0;
+    }
+
+    void Context::UpdateDefragmentation(VkCommandBuffer cmds) {
+        // The pass in flight ends once the frames and destroys referencing its old places are finished
+        if (m_defragmentationPassActive) {
+            if (m_defragmentationHolds > 0)
+                return;
+
+            EndDefragmentationPass();
+        }
+
+        if (m_defragmentationContext == nullptr) {
+            if (!m_defragmentation.enabled || m_frameNumber < m_defragmentationIdleUntil || !IsFragmented())
+                return;
+
+            VmaDefragmentationInfo dfi = {
+                .flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT,
+                .maxBytesPerPass = m_defragmentation.maxBytesPerFrame,
+                .maxAllocationsPerPass = m_defragmentation.maxAllocationsPerFrame
+            };
+
+            if (vmaBeginDefragmentation(m_allocator, &dfi, &m_defragmentationContext) != VK_SUCCESS) {
+                m_defragmentationContext = nullptr;
+                m_defragmentationIdleUntil = m_frameNumber + m_defragmentation.minIdleFrames;
+                return;
+            }
+
+            m_defragmentationStats.active = true;
+        }
+        else if (!m_defragmentation.enabled) {
+            EndDefragmentation();
+            return;
+        }
+
+        BeginDefragmentationPass(cmds);
+    }
+
+    bool Context::IsFragmented() const {
+        VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+        vmaGetHeapBudgets(m_allocator, budgets);
+
+        // Compacting only gives memory back when a heap spans several blocks
+        for (uint32_t heap = 0; heap < m_memoryStats.heaps.size(); heap++) {
+            const VmaStatistics& stats = budgets[heap].statistics;
+            VkDeviceSize unused = stats.blockBytes - stats.allocationBytes;
+            VkDeviceSize threshold = static_cast<VkDeviceSize>(stats.blockBytes * m_defragmentation.fragmentationThreshold);
+
+            if (m_memoryStats.heaps[heap].deviceLocal && stats.blockCount > 1 && unused > threshold)
+                return true;
+        }
+
+        return false;
+    }
+
+    void Context::BeginDefragmentationPass(VkCommandBuffer cmds) {
+        // VK_SUCCESS means nothing is left to move
+        if (vmaBeginDefragmentationPass(m_allocator, m_defragmentationContext, &m_defragmentationPass) == VK_SUCCESS) {
+            EndDefragmentation();
+            return;
+        }
+
+        // Only registry resources are moved, everything else refers to them by handle
+        std::unordered_map<VmaAllocation, std::pair<ResourceType, ResourceID>> resources;
+        for (auto& [id, ba] : m_buffers) {
+            if (!ba.evicted)
+                resources[ba.alloc] = { ResourceType::Buffer, id };
+        }
+
+        for (auto& [id, ta] : m_textures) {
+            // Streamed textures are resized under their handle, render graph textures alias memory owned by the graph
+            bool restingLayout = ta.layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL || ta.layout == VK_IMAGE_LAYOUT_GENERAL;
+            if (!ta.evicted && !ta.aliased && !m_streamedTextures.contains(id) && restingLayout)
+                resources[ta.alloc] = { ResourceType::Texture, id };
+        }
+
+        // Make earlier writes visible to the copies
+        VkMemoryBarrier2 mb = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT
+        };
+
+        VkDependencyInfo di = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &mb
+        };
+
+        bool recorded = false;
+        m_defragmentationMoves.assign(m_defragmentationPass.moveCount, {});
+
+        for (uint32_t i = 0; i < m_defragmentationPass.moveCount; i++) {
+            VmaDefragmentationMove& move = m_defragmentationPass.pMoves[i];
+            DefragmentationMove& moved = m_defragmentationMoves[i];
+
+            auto it = resources.find(move.srcAllocation);
+            if (it == resources.end()) {
+                move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                continue;
+            }
+
+            if (!recorded)
+                vkCmdPipelineBarrier2(cmds, &di);
+            recorded = true;
+
+            moved.type = it->second.first;
+            moved.handle = it->second.second;
+
+            bool copied = false;
+            if (moved.type == ResourceType::Buffer) {
+                moved.oldBuffer = m_buffers[moved.handle];
+                copied = MoveBuffer(cmds, m_buffers[moved.handle], move.dstTmpAllocation);
+            }
+            else {
+                moved.oldTexture = m_textures[moved.handle];
+                copied = MoveTexture(cmds, m_textures[moved.handle], move.dstTmpAllocation);
+            }
+
+            if (!copied)
+                move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+        }
+
+        // Make the copies visible to everything recorded after them this frame
+        if (recorded) {
+            mb = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT
+            };
+
+            vkCmdPipelineBarrier2(cmds, &di);
+        }
+
+        // Held until this frame, the last one that can read the old places, is finished
+        m_defragmentationPassActive = true;
+        m_defragmentationHolds++;
+        DeferDestroy([shared = m_shared.get()]() {
+            shared->defragmentationHolds--;
+        });
+    }
+
+    void Context::EndDefragmentationPass() {
+        for (uint32_t i = 0; i < m_defragmentationPass.moveCount; i++) {
+            VmaDefragmentationMoveOperation operation = m_defragmentationPass.pMoves[i].operation;
+            DefragmentationMove& moved = m_defragmentationMoves[i];
+
+            if (operation == VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE)
+                continue;
+
+            // Only the objects are destroyed, the pass frees or reuses their memory
+            if (moved.type == ResourceType::Buffer) {
+                vkDestroyBuffer(m_device, moved.oldBuffer.buffer, nullptr);
+            }
+            else {
+                for (auto& mipView : moved.oldTexture.mipViews)
+                    vkDestroyImageView(m_device, mipView, nullptr);
+
+                vkDestroyImageView(m_device, moved.oldTexture.imageView, nullptr);
+                vkDestroyImage(m_device, moved.oldTexture.image, nullptr);
+            }
+        }
+
+        VkResult result = vmaEndDefragmentationPass(m_allocator, m_defragmentationContext, &m_defragmentationPass);
+
+        // Moved allocations now describe their new place, destroyed resources are no longer in the registry
+        for (auto& moved : m_defragmentationMoves) {
+            if (moved.type == ResourceType::Buffer && m_buffers.Contains(moved.handle) && m_buffers[moved.handle].moving) {
+                BufferAllocation& ba = m_buffers[moved.handle];
+                vmaGetAllocationInfo(m_allocator, ba.alloc, &ba.allocInfo);
+                ba.moving = false;
+            }
+            else if (moved.type == ResourceType::Texture && m_textures.Contains(moved.handle) && m_textures[moved.handle].moving) {
+                TextureAllocation& ta = m_textures[moved.handle];
+                vmaGetAllocationInfo(m_allocator, ta.alloc, &ta.allocInfo);
+                ta.moving = false;
+            }
+        }
+
+        m_defragmentationMoves.clear();
+        m_defragmentationPass = {};
+        m_defragmentationPassActive = false;
+
+        // VK_SUCCESS means nothing is left to move
+        if (result == VK_SUCCESS)
+            EndDefragmentation();
+    }
+
+    void Context::EndDefragmentation() {
+        if (m_defragmentationPassActive) {
+            // Ending the last pass ends the defragmentation
+            EndDefragmentationPass();
+            if (m_defragmentationContext == nullptr)
+                return;
+        }
+
+        VmaDefragmentationStats stats = {};
+        vmaEndDefragmentation(m_allocator, m_defragmentationContext, &stats);
+        m_defragmentationContext = nullptr;
+        m_defragmentationIdleUntil = m_frameNumber + m_defragmentation.minIdleFrames;
+
+        m_defragmentationStats.bytesMoved += stats.bytesMoved;
+        m_defragmentationStats.bytesReclaimed += stats.bytesFreed;
+        m_defragmentationStats.allocationsMoved += stats.allocationsMoved;
+        m_defragmentationStats.blocksReclaimed += stats.deviceMemoryBlocksFreed;
+        m_defragmentationStats.defragmentations++;
+        m_defragmentationStats.active = false;
+    }
+
+    bool Context::MoveBuffer(VkCommandBuffer cmds, BufferAllocation& ba, VmaAllocation dst) {
+        VkBufferCreateInfo bci = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = ba.size,
+            .usage = ba.usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+        };
+        SetSharingMode(bci);
+
+        VkBuffer buffer = nullptr;
+        if (vkCreateBuffer(m_device, &bci, nullptr, &buffer) != VK_SUCCESS)
+            return false;
+
+        if (vmaBindBufferMemory(m_allocator, dst, buffer) != VK_SUCCESS) {
+            vkDestroyBuffer(m_device, buffer, nullptr);
+            return false;
+        }
+
+        VkBufferCopy bc = {
+            .size = ba.size
+        };
+
+        vkCmdCopyBuffer(cmds, ba.buffer, buffer, 1, &bc);
+
+        // The allocation keeps its handle, which describes the new place once the pass ends
+        ba.buffer = buffer;
+        ba.moving = true;
+        return true;
+    }
+
+    bool Context::MoveTexture(VkCommandBuffer cmds, TextureAllocation& ta, VmaAllocation dst) {
+        VkImageCreateInfo ici = GetTextureImageInfo(ta.extent, ta.format, ta.mipLevels, ta.usage);
+
+        TextureAllocation moved = ta;
+        if (vkCreateImage(m_device, &ici, nullptr, &moved.image) != VK_SUCCESS)
+            return false;
+
+        if (vmaBindImageMemory(m_allocator, dst, moved.image) != VK_SUCCESS) {
+            vkDestroyImage(m_device, moved.image, nullptr);
+            return false;
+        }
+
+        CreateTextureViews(moved);
+
+        TransitionImageLayout(cmds, ta.image, ta.format,
+            ta.layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ta.mipLevels);
+        TransitionImageLayout(cmds, moved.image, ta.format,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, ta.mipLevels);
+
+        std::vector<VkImageCopy> regions(ta.mipLevels);
+        for (uint32_t level = 0; level < ta.mipLevels; level++) {
+            regions[level] = {
+                .srcSubresource = { GetImageAspect(ta.format), level, 0, 1 },
+                .dstSubresource = { GetImageAspect(ta.format), level, 0, 1 },
+                .extent = { std::max(ta.extent.width >> level, 1u), std::max(ta.extent.height >> level, 1u), 1 }
+            };
+        }
+
+        vkCmdCopyImage(cmds, ta.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            moved.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, ta.mipLevels, regions.data());
+
+        TransitionImageLayout(cmds, moved.image, ta.format,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, ta.layout, ta.mipLevels);
+
+        ta.image = moved.image;
+        ta.imageView = moved.imageView;
+        ta.mipViews = std::move(moved.mipViews);
+        ta.moving = true;
+        return true;
+    }
+
+    void Context::AbandonMove(VmaAllocation alloc, std::function<void()>&& destroy) {
+        for (uint32_t i = 0; i < m_defragmentationPass.moveCount; i++) {
+            if (m_defragmentationPass.pMoves[i].srcAllocation == alloc)
+                m_defragmentationPass.pMoves[i].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_DESTROY;
+        }
+
+        // The pass ends after the frames still using the new place, and frees both places
+        m_defragmentationHolds++;
+        DeferDestroy([shared = m_shared.get(), destroy = std::move(destroy)]() {
+            destroy();
+            shared->defragmentationHolds--;
+        });
+    }
+
+    TextureHandle Context::CreateStreamedTexture(const TextureDesc& desc) {
+        uint32_t texelSize = GetFormatSize(desc.format);
+        uint32_t mipCount = 1 + static_cast<uint32_t>(std::log2(std::max(desc.width, desc.height)));
+
+        StreamedTexture st = {
+            .chain = std::make_shared<MipChain>(),
+            .extent = { desc.width, desc.height },
+            .mipCount = mipCount,
+            .residentMip = mipCount,
+            .requestedMip = mipCount - 1,
+            .lastRequestFrame = m_frameNumber
+        };
+
+        // Level 0 is copied now since the texels may be released on return, the rest is filtered from it as a job
+        const uint8_t* pTexels = static_cast<const uint8_t*>(desc.pData);
+        st.chain->mips.resize(mipCount);
+        st.chain->mips[0].assign(pTexels, pTexels + size_t(desc.width) * desc.height * texelSize);
+
+        auto build = [chain = st.chain, extent = st.extent, texelSize]() {
+            BuildMipChain(chain->mips, extent, texelSize);
+            chain->built.store(true, std::memory_order_release);
+        };
+
+        if (m_jobSystem != nullptr)
+            m_jobSystem->Run(std::move(build), m_mipChainBuilds);
+        else
+            build();
+
+        // A grey texel is bound until UpdateTextureStreaming finds the chain built and uploads its tail
+        TextureHandle handle = m_textures.Create();
+        TextureAllocation& ta = m_textures[handle];
+
+        AllocateTextureImage(ta, { 1, 1 }, desc.format);
+
+        VkClearColorValue grey = { .float32 = { 0.5f, 0.5f, 0.5f, 1.0f } };
+        VkImageSubresourceRange range = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = 1,
+            .layerCount = 1
+        };
+
+        VkCommandBuffer cmds = BeginImmediateCommands();
+
+        TransitionImageLayout(cmds, ta.image, desc.format,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        vkCmdClearColorImage(cmds, ta.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &grey, 1, &range);
+
+        TransitionImageLayout(cmds, ta.image, desc.format,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        EndImmediateCommands(cmds);
+
+        m_streamedTextures.emplace(handle, std::move(st));
+        return handle;
+    }
+
+    void Context::SetTextureStreaming(const TextureStreamingDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::SetTextureStreaming);
+        call.Args(desc);
+        SyncRenderThread();
+
+        m_textureStreaming = desc;
+    }
+
+    void Context::SetJobSystem(JobSystem* pJobSystem) {
+        SyncRenderThread();
+
+        // Chains and links already in flight keep running on the previous job system
+        if (m_jobSystem != nullptr) {
+            m_jobSystem->Wait(m_mipChainBuilds);
+            m_jobSystem->Wait(m_pipelineLinkJobs);
+        }
+
+        m_jobSystem = pJobSystem;
+    }
+
+    void Context::RequestTextureResolution(TextureHandle textureHandle, float screenSize) {
+        CaptureCall call = Capture(CaptureOp::RequestTextureResolution);
+        call.Args(textureHandle, screenSize);
+
+        if (DefersToRenderThread())
+            return m_renderThread->Push(RenderOp::RequestTextureResolution, textureHandle, screenSize);
+
+        auto it = m_streamedTextures.find(textureHandle);
+        if (it == m_streamedTextures.end())
+            return;
+
+        StreamedTexture& st = it->second;
+        uint32_t mipCount = st.mipCount;
+
+        // One texel per pixel: every halving of screen size drops a level
+        float textureSize = float(std::max(st.extent.width, st.extent.height));
+        float lod = std::log2(textureSize / std::max(screenSize, 1.0f));
+        uint32_t mip = std::min(static_cast<uint32_t>(std::max(lod, 0.0f)), mipCount - 1);
+
+        // Keep the finest request made since the last update
+        if (st.lastRequestFrame != m_frameNumber || mip < st.requestedMip)
+            st.requestedMip = mip;
+        st.lastRequestFrame = m_frameNumber;
+    }
+
+    void Context::UpdateTextureStreaming(VkCommandBuffer cmds) {
+        m_textureStreamingStats = {};
+
+        VkDeviceSize budget = m_textureStreaming.uploadBudgetPerFrame;
+
+        auto getTailMip = [&](const StreamedTexture& st) {
+            uint32_t tailMip = st.mipCount - 1;
+            while (tailMip > 0 && std::max(st.extent.width >> (tailMip - 1), st.extent.height >> (tailMip - 1)) <= m_textureStreaming.residentTailSize)
+                tailMip--;
+            return tailMip;
+        };
+
+        // Smallest levels first: the tails of freshly built chains replace their placeholders whatever the budget
+        for (auto& [handle, st] : m_streamedTextures) {
+            if (st.residentMip != st.mipCount || !st.chain->built.load(std::memory_order_acquire))
+                continue;
+
+            uint32_t tailMip = getTailMip(st);
+            SetStreamedTextureResidency(cmds, m_textures[handle], st, tailMip);
+
+            for (uint32_t level = tailMip; level < st.mipCount; level++) {
+                VkDeviceSize levelSize = st.chain->mips[level].size();
+                budget -= std::min(budget, levelSize);
+                m_textureStreamingStats.uploadedBytes += levelSize;
+            }
+        }
+
+        for (auto& [handle, st] : m_streamedTextures) {
+            TextureAllocation& ta = m_textures[handle];
+
+            // Still building
+            if (st.residentMip == st.mipCount) {
+                m_textureStreamingStats.residentBytes += ta.allocInfo.size;
+                m_textureStreamingStats.pendingTextures++;
+                continue;
+            }
+
+            // Nobody asked for detail in a while, fall back towards the tail to release memory
+            uint32_t tailMip = getTailMip(st);
+            uint32_t targetMip = (st.lastRequestFrame + m_textureStreaming.dropAfterFrames < m_frameNumber)
+                ? tailMip
+                : std::min(st.requestedMip, tailMip);
+
+            if (targetMip > st.residentMip) {
+                SetStreamedTextureResidency(cmds, ta, st, targetMip);
+            }
+            // Stream in one level at a time, coarse to fine, while the frame budget lasts
+            else if (targetMip < st.residentMip) {
+                VkDeviceSize levelSize = st.chain->mips[st.residentMip - 1].size();
+
+                if (levelSize <= budget || m_textureStreamingStats.uploadedBytes == 0) {
+                    SetStreamedTextureResidency(cmds, ta, st, st.residentMip - 1);
+                    budget -= std::min(budget, levelSize);
+                    m_textureStreamingStats.uploadedBytes += levelSize;
+                }
+
+                if (targetMip < st.residentMip)
+                    m_textureStreamingStats.pendingTextures++;
+            }
+
+            m_textureStreamingStats.residentBytes += ta.allocInfo.size;
+        }
+    }
+
+    void Context::SetStreamedTextureResidency(VkCommandBuffer cmds, TextureAllocation& ta, StreamedTexture& st, uint32_t residentMip) {
+        auto& mips = st.chain->mips;
+        uint32_t mipCount = st.mipCount;
+        uint32_t oldResidentMip = st.residentMip;
+        uint32_t levelCount = mipCount - residentMip;
+
+        TextureAllocation resized = {};
+        AllocateTextureImage(resized, { std::max(st.extent.width >> residentMip, 1u), std::max(st.extent.height >> residentMip, 1u) },
+            ta.format, levelCount);
+
+        // The placeholder holds none of the chain's levels, there is nothing to carry over
+        if (oldResidentMip < mipCount) {
+            TransitionImageLayout(cmds, ta.image, ta.format,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, mipCount - oldResidentMip);
+        }
+
+        TransitionImageLayout(cmds, resized.image, ta.format,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levelCount);
+
+        // Carry over the levels both images share
+        std::vector<VkImageCopy> ics;
+        for (uint32_t level = std::max(residentMip, oldResidentMip); level < mipCount; level++) {
+            VkExtent3D extent = { std::max(st.extent.width >> level, 1u), std::max(st.extent.height >> level, 1u), 1 };
+
+            ics.push_back({
+                .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - oldResidentMip, 0, 1 },
+                .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - residentMip, 0, 1 },
+                .extent = extent
+            });
+        }
+
+        if (!ics.empty()) {
+            vkCmdCopyImage(cmds, ta.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                resized.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(ics.size()), ics.data());
+        }
+
+        // Upload the newly resident levels from the host mip chain
+        if (residentMip < oldResidentMip) {
+            VkDeviceSize stagingSize = 0;
+            for (uint32_t level = residentMip; level < oldResidentMip; level++)
+                stagingSize += mips[level].size();
+
+            BufferAllocation stagingBuffer;
+
+            VkBufferCreateInfo bci = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                .size = stagingSize,
+                .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+            };
+
+            VmaAllocationCreateInfo aci = {
+                .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                    VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST
+            };
+
+            VK_ASSERT(vmaCreateBuffer(m_allocator, &bci, &aci, &stagingBuffer.buffer, &stagingBuffer.alloc,
+                &stagingBuffer.allocInfo));
+
+            std::vector<VkBufferImageCopy> bics;
+            VkDeviceSize offset = 0;
+
+            for (uint32_t level = residentMip; level < oldResidentMip; level++) {
+                memcpy(static_cast<uint8_t*>(stagingBuffer.allocInfo.pMappedData) + offset, mips[level].data(), mips[level].size());
+
+                bics.push_back({
+                    .bufferOffset = offset,
+                    .imageSubresource = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .mipLevel = level - residentMip,
+                        .layerCount = 1
+                    },
+                    .imageExtent = { std::max(st.extent.width >> level, 1u), std::max(st.extent.height >> level, 1u), 1 }
+                });
+
+                offset += mips[level].size();
+            }
+
+            vkCmdCopyBufferToImage(cmds, stagingBuffer.buffer, resized.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(bics.size()), bics.data());
+
+            DeferDestroy([allocator = m_allocator, stagingBuffer]() {
+                vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.alloc);
+            });
+        }
+
+        TransitionImageLayout(cmds, resized.image, ta.format,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, levelCount);
+
+        // The handle now points at the resized image, which only ever exposes resident levels
+        DeferDestroy([device = m_device, allocator = m_allocator, old = ta]() {
+            vkDestroyImageView(device, old.imageView, nullptr);
+            vmaDestroyImage(allocator, old.image, old.alloc);
+        });
+
+        ta.image = resized.image;
+        ta.imageView = resized.imageView;
+        ta.alloc = resized.alloc;
+        ta.allocInfo = resized.allocInfo;
+        ta.extent = resized.extent;
+        ta.mipLevels = resized.mipLevels;
+        st.residentMip = residentMip;
+    }
+
+    void Context::SetFramePacing(const FramePacingDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::SetFramePacing);
+        call.Args(desc);
+        SyncRenderThread();
+
+        FramePacingDesc pacing = desc;
+        pacing.framesInFlight = std::clamp(pacing.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+
+        bool recreateSwapchain = pacing.presentMode != m_framePacing.presentMode ||
+            pacing.framesInFlight != m_framePacing.framesInFlight;
+
+        // Drain in-flight frames so that frame slots can be reassigned
+        vkDeviceWaitIdle(m_device);
+
+        m_framePacing = pacing;
+        m_frameIndex = 0;
+        m_frameStats.framesInFlight = pacing.framesInFlight;
+
+        for (auto& beginTime : m_frameSlotBeginTimes)
+            beginTime = {};
+
+        for (auto& written : m_timestampsWritten)
+            written = false;
+
+        if (recreateSwapchain && !m_presentParams.headless)
+            ValidateSwapchain();
+    }
+
+    void Context::SetDynamicResolution(const DynamicResolutionDesc& desc) {
+        CaptureCall call = Capture(CaptureOp::SetDynamicResolution);
+        call.Args(desc);
+        SyncRenderThread();
+
+        assert(!m_frameRecording && "dynamic resolution cannot change while a frame is recording");
+
+        DynamicResolutionDesc dynamicResolution = desc;
+        dynamicResolution.maxScale = std::clamp(dynamicResolution.maxScale, 0.1f, 1.0f);
+        dynamicResolution.minScale = std::clamp(dynamicResolution.minScale, 0.1f, dynamicResolution.maxScale);
+        dynamicResolution.sharpness = std::clamp(dynamicResolution.sharpness, 0.0f, 1.0f);
+
+        if (m_upscalePipeline != 0) {
+            DestroyGraphicsPipeline(m_upscalePipeline);
+            DestroySampler(m_upscaleSampler);
+            m_upscalePipeline = 0;
+            m_upscaleSampler = 0;
+        }
+
+        m_dynamicResolution = dynamicResolution;
+        m_renderScale = dynamicResolution.enabled ? dynamicResolution.maxScale : 1.0f;
+        m_frameStats.renderScale = m_renderScale;
+
+        CreateSceneTarget();
+
+        if (!dynamicResolution.enabled)
+            return;
+
+        assert(desc.upscaleVertexShader != nullptr && desc.upscaleFragmentShader != nullptr &&
+            "dynamic resolution needs the upscale shaders");
+
+        m_upscalePipeline = CreateGraphicsPipeline({
+            .vertexShader = desc.upscaleVertexShader,
+            .fragmentShader = desc.upscaleFragmentShader,
+            .depthStencil = {
+                .depthTest = false,
+                .depthWrite = false
+            }
+        });
+
+        m_upscaleSampler = CreateSampler({
+            .minFilter = VK_FILTER_LINEAR,
+            .magFilter = VK_FILTER_LINEAR,
+            .addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+        });
+    }
+
+    void Context::UpdateRenderScale(float frameScale) {
+        if (!m_dynamicResolution.enabled || m_frameStats.gpuFrameMs <= 0.0)
+            return;
+
+        // GPU time follows the pixel count, so the per-axis scale goes with the square root of the time ratio
+        double ratio = m_dynamicResolution.targetGpuFrameMs / m_frameStats.gpuFrameMs;
+        float target = frameScale * static_cast<float>(std::sqrt(ratio));
+        target = std::clamp(target, m_dynamicResolution.minScale, m_dynamicResolution.maxScale);
+
+        // Ease toward the target so a single slow frame does not make the image pump, ignoring jitter
+        float step = (target - m_renderScale) * 0.25f;
+        if (std::abs(step) < 0.005f)
+            return;
+
+        m_renderScale = std::clamp(m_renderScale + step, m_dynamicResolution.minScale, m_dynamicResolution.maxScale);
+    }
+
+    VkPresentModeKHR Context::SelectPresentMode(VkSurfaceKHR surface, VkPresentModeKHR requested) {
+        uint32_t pmc = 0;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(m_physicalDevice, surface, &pmc, nullptr);
+
+        std::vector<VkPresentModeKHR> pms(pmc);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(m_physicalDevice, surface, &pmc, pms.data());
+
+        // Non-blocking modes stand in for each other before falling back to vsync
+        std::vector<VkPresentModeKHR> candidates = { requested };
+        switch (requested) {
+        case VK_PRESENT_MODE_MAILBOX_KHR: candidates.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR); break;
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: candidates.push_back(VK_PRESENT_MODE_MAILBOX_KHR); break;
+        default: break;
+        }
+
+        for (auto candidate : candidates) {
+            if (std::find(pms.begin(), pms.end(), candidate) != pms.end())
+                return candidate;
+        }
+
+        // FIFO support is required by the spec
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    void Context::UpdateLatencyStats(bool block) {
+        if (m_lastMeasuredPresentID == m_presentID)
+            return;
+
+        // Blocking only waits on the newest present, earlier ones complete in order before it
+        if (block) {
+            VkResult result = vkWaitForPresentKHR(m_device, m_swapchain, m_presentID, 100'000'000);
+            if (result == VK_SUCCESS) {
+                auto elapsed = Clock::now() - m_presentBeginTimes[m_presentID % PRESENT_HISTORY_SIZE];
+                RecordLatency(std::chrono::duration<double, std::milli>(elapsed).count(), true);
+            }
+
+            m_lastMeasuredPresentID = m_presentID;
+            return;
+        }
+
+        while (m_lastMeasuredPresentID < m_presentID) {
+            uint64_t presentID = m_lastMeasuredPresentID + 1;
+
+            if (vkWaitForPresentKHR(m_device, m_swapchain, presentID, 0) != VK_SUCCESS)
+                break;
+
+            auto elapsed = Clock::now() - m_presentBeginTimes[presentID % PRESENT_HISTORY_SIZE];
+            RecordLatency(std::chrono::duration<double, std::milli>(elapsed).count(), true);
+
+            m_lastMeasuredPresentID = presentID;
+        }
+    }
+
+    void Context::RecordLatency(double ms, bool presentWaitMeasured) {
+        double& latest = presentWaitMeasured ? m_frameStats.inputToPhotonMs : m_frameStats.estimatedLatencyMs;
+        double& average = presentWaitMeasured ? m_frameStats.averageInputToPhotonMs : m_frameStats.averageEstimatedLatencyMs;
+        latest = ms;
+
+        // Exponential moving average, seeded with the first sample
+        average = (average == 0.0) ? ms : average * 0.9 + ms * 0.1;
+    }
+
+    VkPhysicalDevice Context::SelectPhysicalDevice(std::span<const char* const> requiredExtensions) {
+        uint32_t pdc = 0;
+        vkEnumeratePhysicalDevices(s_vkInstance, &pdc, nullptr);
+
+        std::vector<VkPhysicalDevice> pds(pdc);
+        vkEnumeratePhysicalDevices(s_vkInstance, &pdc, pds.data());
+
+        const char* device = m_presentParams.deviceSelection.device;
+        if (device == nullptr)
+            device = getenv("VKR_DEVICE");
+
+        VkPhysicalDevice best = nullptr;
+        int64_t bestScore = -1;
+        bool forcedRejected = false;
+
+        for (auto pd : pds) {
+            int64_t score = ScorePhysicalDevice(pd, requiredExtensions);
+
+            // A forced device still has to be usable, otherwise the highest scoring one is used instead
+            if (device != nullptr && MatchesDevice(pd, device)) {
+                if (score >= 0)
+                    return pd;
+
+                VkPhysicalDeviceProperties pdp;
+                vkGetPhysicalDeviceProperties(pd, &pdp);
+                fprintf(stderr, "vkr: device \"%s\" lacks required extensions or features, selecting another device\n", pdp.deviceName);
+                forcedRejected = true;
+            }
+
+            if (score < 0)
+                continue;
+
+            if (score > bestScore) {
+                best = pd;
+                bestScore = score;
+            }
+        }
 
-        // Setup (dynamic) rasterizer state
-        VkPipelineRasterizationStateCreateInfo prsci = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-            .polygonMode = VK_POLYGON_MODE_FILL,
-            .lineWidth = 1.0f,
-            .cullMode = VK_CULL_MODE_NONE,
-            .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE
-        };
+        if (device != nullptr && !forcedRejected)
+            fprintf(stderr, "vkr: no device matches \"%s\", selecting the highest scoring device\n", device);
 
-        // Setup multisampling state
-        VkPipelineMultisampleStateCreateInfo pmssci = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-            .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
-        };
+        assert(best != nullptr && "no device supports the required extensions and features");
+        return best;
+    }
 
-        // TODO: Setup depth stencil state 
+    int64_t Context::ScorePhysicalDevice(VkPhysicalDevice pd, std::span<const char* const> requiredExtensions) {
+        uint32_t depc = 0;
+        vkEnumerateDeviceExtensionProperties(pd, nullptr, &depc, nullptr);
 
-        // Setup color blending state
-        // TODO: for testing only- add attachment descriptor
-        std::vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates;
-        for (uint32_t i = 0; i < 1; i++) {
-            VkPipelineColorBlendAttachmentState blendAttachment = {
-                .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | 
-                    VK_COLOR_COMPONENT_G_BIT |
-                    VK_COLOR_COMPONENT_B_BIT | 
-                    VK_COLOR_COMPONENT_A_BIT,
-                .blendEnable = true,
-                .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-                .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-                .colorBlendOp = VK_BLEND_OP_ADD,
-                .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-                .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-                .alphaBlendOp = VK_BLEND_OP_ADD
-            };
+        std::vector<VkExtensionProperties> deps(depc);
+        vkEnumerateDeviceExtensionProperties(pd, nullptr, &depc, deps.data());
 
-            blendAttachmentStates.push_back(blendAttachment);
+        for (auto name : requiredExtensions) {
+            bool found = std::any_of(deps.begin(), deps.end(), [&](auto& dep) {
+                return strcmp(dep.extensionName, name) == 0;
+            });
+
+            if (!found)
+                return -1;
         }
 
-        VkPipelineColorBlendStateCreateInfo pcbsci = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-            .attachmentCount = static_cast<uint32_t>(blendAttachmentStates.size()),
-            .pAttachments = blendAttachmentStates.data()
+        // Every feature enabled at device creation
+        VkPhysicalDeviceTimelineSemaphoreFeatures pdtsf = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES
         };
 
-        // Setup shader stages
-        VkPipelineShaderStageCreateInfo pssciVertex = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_VERTEX_BIT,
-            .module = desc.vertexShader,
-            .pName = "main"
+        VkPhysicalDeviceDynamicRenderingFeatures pddrf = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES,
+            .pNext = &pdtsf
         };
 
-        VkPipelineShaderStageCreateInfo pssciFrag = pssciVertex;
-        pssciFrag.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        pssciFrag.module = desc.fragmentShader;
-
-        VkPipelineShaderStageCreateInfo psscis[] = {
-            pssciVertex,
-            pssciFrag
+        VkPhysicalDeviceSynchronization2Features pds2f = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES,
+            .pNext = &pddrf
         };
 
-        // Setup dynamic rendering pipeline struct
-        VkFormat colorFormat = m_swapchainFormat;
-        VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+        VkPhysicalDeviceExtendedDynamicStateFeaturesEXT pdedsf = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+            .pNext = &pds2f
+        };
 
-        VkPipelineRenderingCreateInfo prci = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
-            .colorAttachmentCount = 1,
-            .pColorAttachmentFormats = &colorFormat,
-            //.depthAttachmentFormat = depthFormat
+        VkPhysicalDeviceDescriptorIndexingFeatures pddif = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+            .pNext = &pdedsf
         };
 
-        // Create the pipeline
-        VkGraphicsPipelineCreateInfo gpci = {
-            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-            .pNext = &prci,
-            .stageCount = 2,
-            .pStages = psscis,
-            .pVertexInputState = &pvisci,
-            .pInputAssemblyState = &piasci,
-            .pViewportState = &pvsci,
-            .pRasterizationState = &prsci,
-            .pMultisampleState = &pmssci,
-            // TODO: depth stencil state here
-            .pColorBlendState = &pcbsci,
-            .pDynamicState = &pdsci,
-            .layout = pipeline.layout
+        VkPhysicalDeviceFeatures2 pdf2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &pddif
         };
 
-        // TODO: use pipeline cache?
-        VK_ASSERT(vkCreateGraphicsPipelines(m_device, nullptr, 1, &gpci, nullptr, &pipeline.pipeline));
+        vkGetPhysicalDeviceFeatures2(pd, &pdf2);
 
-        return handle;
-    }
+        if (!pdtsf.timelineSemaphore || !pddrf.dynamicRendering || !pds2f.synchronization2 ||
+            !pdedsf.extendedDynamicState || !pddif.shaderSampledImageArrayNonUniformIndexing ||
+            !pddif.descriptorBindingPartiallyBound || !pddif.descriptorBindingVariableDescriptorCount ||
+            !pddif.runtimeDescriptorArray)
+            return -1;
 
-    void Context::CopyBufferData(BufferHandle bufferHandle, void* pData, size_t offset, size_t size) {
-        BufferAllocation& ba = m_buffers[bufferHandle];
+        if (FindQueueFamilyIndex(pd, VK_QUEUE_GRAPHICS_BIT) == UINT32_MAX)
+            return -1;
 
-        // Host local buffer
-        if (ba.allocInfo.pMappedData != nullptr) {
-            memcpy(ba.allocInfo.pMappedData, (uint8_t*)pData + offset, size);
+        // Discrete beats integrated beats virtual beats software rasterizers
+        VkPhysicalDeviceProperties pdp;
+        vkGetPhysicalDeviceProperties(pd, &pdp);
+
+        int64_t typeScore = 0;
+        switch (pdp.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:      typeScore = 4; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:    typeScore = 3; break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:       typeScore = 2; break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:               typeScore = 1; break;
+        default:                                        typeScore = 0; break;
         }
-        // Device local buffer
-        else {
-            assert(false); // TODO: staging buffer for device local
+
+        // Within a type, prefer the largest device-local heap
+        VkPhysicalDeviceMemoryProperties pdmp;
+        vkGetPhysicalDeviceMemoryProperties(pd, &pdmp);
+
+        VkDeviceSize deviceLocal = 0;
+        for (uint32_t i = 0; i < pdmp.memoryHeapCount; i++) {
+            if (pdmp.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+                deviceLocal = std::max(deviceLocal, pdmp.memoryHeaps[i].size);
         }
+
+        return (typeScore << 32) + static_cast<int64_t>(deviceLocal >> 20);
     }
 
-    uint32_t Context::FindQueueFamilyIndex(VkPhysicalDevice pd, VkQueueFlags flags) {
+    uint32_t Context::FindQueueFamilyIndex(VkPhysicalDevice pd, VkQueueFlags flags, VkQueueFlags excludeFlags) {
         uint32_t qfpc = 0;
         vkGetPhysicalDeviceQueueFamilyProperties(pd, &qfpc, nullptr);
         
@@ -814,7 +4028,7 @@ namespace vkr {
         vkGetPhysicalDeviceQueueFamilyProperties(pd, &qfpc, qfps.data());
         for (uint32_t i = 0; i < qfpc; i++) {
             auto& qfp = qfps[i];
-            if (qfp.queueFlags & flags)
+            if ((qfp.queueFlags & flags) == flags && !(qfp.queueFlags & excludeFlags))
                 return i;
         }
 
@@ -823,10 +4037,8 @@ namespace vkr {
     }
 
     void Context::ValidateSwapchain() {
-        // Create the platform-specific surface from the window handle
-        VkSurfaceKHR surface = nullptr;
-        
-        {
+        // Create the platform-specific surface from the window handle, once per window
+        if (m_surface == nullptr) {
             #if defined(VK_USE_PLATFORM_XLIB_KHR)
                 VkXlibSurfaceCreateInfoKHR sci = {
                     .sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR,
@@ -834,10 +4046,12 @@ namespace vkr {
                     .window = m_presentParams.window
                 };
             
-                VK_ASSERT(vkCreateXlibSurfaceKHR(s_vkInstance, &sci, nullptr, &surface));
+                VK_ASSERT(vkCreateXlibSurfaceKHR(s_vkInstance, &sci, nullptr, &m_surface));
             #endif
         }
 
+        VkSurfaceKHR surface = m_surface;
+
         // Get surface capabilities
         VkSurfaceCapabilitiesKHR caps;
         vkGetPhysicalDeviceSurfaceCapabilitiesKHR(m_physicalDevice, surface, &caps);
@@ -861,21 +4075,40 @@ namespace vkr {
             }
         }
         
+        // Pick the present mode and enough images for every frame in flight plus the one on screen
+        VkPresentModeKHR presentMode = SelectPresentMode(surface, m_framePacing.presentMode);
+
+        uint32_t imageCount = std::max(caps.minImageCount, m_framePacing.framesInFlight + 1);
+        if (caps.maxImageCount != 0)
+            imageCount = std::min(imageCount, caps.maxImageCount);
+
+        m_frameStats.presentMode = presentMode;
+        m_frameStats.framesInFlight = m_framePacing.framesInFlight;
+
+        // Match the window, surfaces that leave the size to the swapchain keep the previous one
+        VkExtent2D extent = caps.currentExtent;
+        if (extent.width == UINT32_MAX)
+            extent = (m_swapchainExtent.width != 0) ? m_swapchainExtent : caps.maxImageExtent;
+
+        // A minimized window can report 0x0, which no swapchain can be created with
+        extent.width = std::clamp(extent.width, std::max(caps.minImageExtent.width, 1u), caps.maxImageExtent.width);
+        extent.height = std::clamp(extent.height, std::max(caps.minImageExtent.height, 1u), caps.maxImageExtent.height);
+
         // Create the swapchain
         VkSwapchainKHR swapchain = nullptr;
 
         VkSwapchainCreateInfoKHR scci = {
             .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
             .surface = surface,
-            .minImageCount = caps.minImageCount,
+            .minImageCount = imageCount,
             .imageFormat = surfaceFormat.format,
             .imageColorSpace = surfaceFormat.colorSpace,
-            .imageExtent = caps.maxImageExtent,
+            .imageExtent = extent,
             .imageArrayLayers = 1,
             .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
             .preTransform = caps.currentTransform,
             .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-            .presentMode = VK_PRESENT_MODE_FIFO_KHR,
+            .presentMode = presentMode,
             .clipped = true,
             .oldSwapchain = (m_swapchain == nullptr)
             ? nullptr
@@ -883,32 +4116,34 @@ namespace vkr {
         };
 
         m_swapchainFormat = scci.imageFormat;
+        m_swapchainExtent = scci.imageExtent;
         
         VK_ASSERT(vkCreateSwapchainKHR(m_device, &scci, nullptr, &swapchain));
 
-        // Destroy the old swapchain resources if they already exist
+        // Retire the old swapchain once the frames that still present from it are finished
         if (m_swapchain != nullptr) {
-            vkDeviceWaitIdle(m_device);
-
-            for (auto& signal : m_imageAcquiredSignals) {
-                vkDestroySemaphore(m_device, signal, nullptr);
-            }
+            DeferDestroy([device = m_device, old = m_swapchain, imageViews = std::move(m_swapchainImageViews),
+                presentReadySignals = std::move(m_presentReadySignals)]() {
+                for (auto& imageView : imageViews)
+                    vkDestroyImageView(device, imageView, nullptr);
 
-            for (auto& imageView : m_swapchainImageViews) {
-                vkDestroyImageView(m_device, imageView, nullptr);
-            }
+                for (auto& signal : presentReadySignals)
+                    vkDestroySemaphore(device, signal, nullptr);
 
-            vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
-            vkDestroySurfaceKHR(s_vkInstance, m_surface, nullptr);
+                vkDestroySwapchainKHR(device, old, nullptr);
+            });
 
             m_swapchainImages.clear();
             m_swapchainImageViews.clear();
-            m_imageAcquiredSignals.clear();
+            m_presentReadySignals.clear();
         }
 
         // Assign new swapchain resource handles
-        m_surface = surface;
         m_swapchain = swapchain;
+        m_swapchainOutOfDate = false;
+
+        // Present ids of the retired swapchain can no longer be waited on
+        m_lastMeasuredPresentID = m_presentID;
 
         // Gather new swapchain images
         uint32_t scic = 0;
@@ -946,13 +4181,183 @@ namespace vkr {
             .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
         };
 
-        m_imageAcquiredSignals.resize(MAX_FRAMES_IN_FLIGHT);
-        for (auto& signal : m_imageAcquiredSignals)
-            VK_ASSERT(vkCreateSemaphore(m_device, &sci, nullptr, &signal))
+        // Acquire signals belong to frame slots and outlive the swapchain
+        if (m_imageAcquiredSignals.empty()) {
+            m_imageAcquiredSignals.resize(MAX_FRAMES_IN_FLIGHT);
+            for (auto& signal : m_imageAcquiredSignals)
+                VK_ASSERT(vkCreateSemaphore(m_device, &sci, nullptr, &signal))
+        }
 
         m_presentReadySignals.resize(scic);
         for (auto& signal : m_presentReadySignals)
             VK_ASSERT(vkCreateSemaphore(m_device, &sci, nullptr, &signal));
+
+        CreateDepthTarget();
+        CreateSceneTarget();
+    }
+
+    void Context::CreateHeadlessTarget() {
+        m_swapchainFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+        VkImageCreateInfo ici = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = m_swapchainFormat,
+            .extent = {
+                .width = m_presentParams.headlessExtent.width,
+                .height = m_presentParams.headlessExtent.height,
+                .depth = 1
+            },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+        };
+
+        VmaAllocationCreateInfo aci = {
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        };
+
+        VK_ASSERT(vmaCreateImage(m_allocator, &ici, &aci, &m_headlessTarget.image, 
+            &m_headlessTarget.alloc, &m_headlessTarget.allocInfo));
+
+        VkImageViewCreateInfo ivci = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = m_headlessTarget.image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = m_swapchainFormat,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .levelCount = 1,
+                .layerCount = 1
+            }
+        };
+
+        VK_ASSERT(vkCreateImageView(m_device, &ivci, nullptr, &m_headlessTarget.imageView));
+        m_headlessTarget.format = m_swapchainFormat;
+
+        // The offscreen target stands in for a single-image swapchain
+        m_swapchainImages = { m_headlessTarget.image };
+        m_swapchainImageViews = { m_headlessTarget.imageView };
+        m_swapchainExtent = m_presentParams.headlessExtent;
+
+        CreateDepthTarget();
+        CreateSceneTarget();
+    }
+
+    void Context::CreateDepthTarget() {
+        // Frames still in flight may be testing against the old target
+        if (m_depthTarget.image != nullptr) {
+            DeferDestroy([device = m_device, allocator = m_allocator, old = m_depthTarget, sampledView = m_depthSampledView]() {
+                vkDestroyImageView(device, sampledView, nullptr);
+                vkDestroyImageView(device, old.imageView, nullptr);
+                vmaDestroyImage(allocator, old.image, old.alloc);
+            });
+        }
+
+        m_depthTarget = {};
+
+        VkImageCreateInfo ici = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = m_depthFormat,
+            .extent = {
+                .width = m_swapchainExtent.width,
+                .height = m_swapchainExtent.height,
+                .depth = 1
+            },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            // Sampled for occlusion culling and other depth-based compute
+            .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+        };
+
+        // Render targets are never worth evicting, give them their own block
+        VmaAllocationCreateInfo aci = {
+            .flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        };
+
+        VK_ASSERT(vmaCreateImage(m_allocator, &ici, &aci, &m_depthTarget.image,
+            &m_depthTarget.alloc, &m_depthTarget.allocInfo));
+
+        VkImageViewCreateInfo ivci = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = m_depthTarget.image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = m_depthFormat,
+            .subresourceRange = {
+                .aspectMask = GetImageAspect(m_depthFormat),
+                .levelCount = 1,
+                .layerCount = 1
+            }
+        };
+
+        VK_ASSERT(vkCreateImageView(m_device, &ivci, nullptr, &m_depthTarget.imageView));
+
+        // Descriptors may only reference one aspect of a depth/stencil image
+        ivci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        VK_ASSERT(vkCreateImageView(m_device, &ivci, nullptr, &m_depthSampledView));
+
+        m_depthTarget.format = m_depthFormat;
+        m_depthTarget.extent = m_swapchainExtent;
+        m_depthLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    void Context::CreateSceneTarget() {
+        // Frames still in flight may be upscaling from the old target
+        if (m_sceneTarget.image != nullptr) {
+            DeferDestroy([device = m_device, allocator = m_allocator, old = m_sceneTarget]() {
+                vkDestroyImageView(device, old.imageView, nullptr);
+                vmaDestroyImage(allocator, old.image, old.alloc);
+            });
+        }
+
+        m_sceneTarget = {};
+
+        if (!m_dynamicResolution.enabled)
+            return;
+
+        VkExtent2D extent = {
+            .width = static_cast<uint32_t>(std::ceil(m_swapchainExtent.width * m_dynamicResolution.maxScale)),
+            .height = static_cast<uint32_t>(std::ceil(m_swapchainExtent.height * m_dynamicResolution.maxScale))
+        };
+
+        AllocateTextureImage(m_sceneTarget, extent, m_swapchainFormat, 1, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+        m_sceneTarget.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    void Context::TransitionDepth(VkImageLayout layout) {
+        if (m_depthLayout == layout)
+            return;
+
+        TransitionImageLayout(m_graphicsCommandBuffers[m_frameIndex], m_depthTarget.image, m_depthFormat,
+            m_depthLayout, layout);
+        m_depthLayout = layout;
+    }
+
+    VkFormat Context::SelectDepthFormat() {
+        // Prefer a float depth with stencil, D32_SFLOAT is the mandatory fallback
+        const VkFormat candidates[] = {
+            VK_FORMAT_D32_SFLOAT_S8_UINT,
+            VK_FORMAT_D24_UNORM_S8_UINT,
+            VK_FORMAT_D32_SFLOAT
+        };
+
+        for (VkFormat format : candidates) {
+            VkFormatProperties fp;
+            vkGetPhysicalDeviceFormatProperties(m_physicalDevice, format, &fp);
+
+            // Depth is also sampled, e.g. to build the occlusion culling depth pyramid
+            VkFormatFeatureFlags required = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+            if ((fp.optimalTilingFeatures & required) == required)
+                return format;
+        }
+
+        return VK_FORMAT_D32_SFLOAT;
     }
 
     VkCommandBuffer Context::BeginImmediateCommands() {
@@ -977,23 +4382,132 @@ namespace vkr {
     }
 
     void Context::EndImmediateCommands(VkCommandBuffer cmds) {
-        vkEndCommandBuffer(cmds);
+        // Pending uploads go first, immediate work may use their textures
+        FlushUploads();
+
+        uint64_t value = SubmitTransientCommands(cmds);
+
+        WaitTimeline(value);
+        CollectDeferredDestroys();
+
+        vkFreeCommandBuffers(m_device, m_transientCommandPool, 1, &cmds);
+    }
+
+    uint64_t Context::SubmitTransientCommands(VkCommandBuffer cmds) {
+        VK_ASSERT(vkEndCommandBuffer(cmds));
+
+        // Transient work takes the next timeline value like any other submission
+        uint64_t value = ++m_timelineValue;
 
-        VkSubmitInfo si = {
-            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .commandBufferCount = 1,
-            .pCommandBuffers = &cmds
+        VkCommandBufferSubmitInfo cbsi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+            .commandBuffer = cmds
         };
 
-        vkQueueSubmit(m_graphicsQueue, 1, &si, nullptr);
+        VkSemaphoreSubmitInfo ssi = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = m_timeline,
+            .value = value,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+        };
+
+        VkSubmitInfo2 si = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+            .commandBufferInfoCount = 1,
+            .pCommandBufferInfos = &cbsi,
+            .signalSemaphoreInfoCount = 1,
+            .pSignalSemaphoreInfos = &ssi
+        };
 
-        // TODO: bad sync, use timeline semaphore later
-        vkQueueWaitIdle(m_graphicsQueue);
+        VK_ASSERT(vkQueueSubmit2(m_graphicsQueue, 1, &si, nullptr));
 
-        vkFreeCommandBuffers(m_device, m_transientCommandPool, 1, &cmds);
+        return value;
+    }
+
+    VkCommandBuffer Context::GetUploadCommands() {
+        if (m_uploadCommands == nullptr)
+            m_uploadCommands = BeginImmediateCommands();
+
+        return m_uploadCommands;
+    }
+
+    void Context::FlushUploads() {
+        if (m_uploadCommands == nullptr)
+            return;
+
+        // Later submissions on the graphics queue are ordered after the uploads by their trailing barriers
+        VkCommandBuffer cmds = m_uploadCommands;
+        m_uploadCommands = nullptr;
+
+        uint64_t value = SubmitTransientCommands(cmds);
+
+        for (auto& destroy : m_uploadDestroys)
+            m_deferredDestroys.push_back({ value, std::move(destroy) });
+        m_uploadDestroys.clear();
+
+        m_deferredDestroys.push_back({ value, [device = m_device, pool = m_transientCommandPool, cmds]() {
+            vkFreeCommandBuffers(device, pool, 1, &cmds);
+        } });
+    }
+
+    void Context::RecordMipChain(VkCommandBuffer cmds, const TextureAllocation& ta) {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(m_physicalDevice, ta.format, &formatProperties);
+
+        constexpr VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        assert((formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures &&
+            "Mip levels are generated with linear blits, which the format does not support");
+
+        // Each level is finished once it has been written, then read by the blit to the next one
+        VkImageMemoryBarrier2 imb = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = ta.image,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .levelCount = 1,
+                .layerCount = 1
+            }
+        };
+
+        VkDependencyInfo di = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &imb
+        };
+
+        auto levelSize = [&](uint32_t level) {
+            return VkOffset3D{ int32_t(std::max(ta.extent.width >> level, 1u)), int32_t(std::max(ta.extent.height >> level, 1u)), 1 };
+        };
+
+        for (uint32_t level = 1; level < ta.mipLevels; level++) {
+            imb.subresourceRange.baseMipLevel = level - 1;
+            vkCmdPipelineBarrier2(cmds, &di);
+
+            VkImageBlit ib = {
+                .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 },
+                .srcOffsets = { { 0, 0, 0 }, levelSize(level - 1) },
+                .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 },
+                .dstOffsets = { { 0, 0, 0 }, levelSize(level) }
+            };
+
+            vkCmdBlitImage(cmds, ta.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                ta.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &ib, VK_FILTER_LINEAR);
+        }
+
+        imb.subresourceRange.baseMipLevel = ta.mipLevels - 1;
+        vkCmdPipelineBarrier2(cmds, &di);
     }
 
-    void Context::TransitionImageLayout(VkCommandBuffer cmds, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
+    void Context::TransitionImageLayout(VkCommandBuffer cmds, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
         VkImageMemoryBarrier2 imb = {
             .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
             .oldLayout = oldLayout,
@@ -1002,8 +4516,8 @@ namespace vkr {
             .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image = image,
             .subresourceRange = {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .levelCount = 1,
+                .aspectMask = GetImageAspect(format),
+                .levelCount = mipLevels,
                 .layerCount = 1
             }
         };
@@ -1018,6 +4532,23 @@ namespace vkr {
             imb.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
             imb.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
             break;
+        case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+        case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+            imb.srcAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+            imb.srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            break;
+        case VK_IMAGE_LAYOUT_GENERAL:
+            imb.srcAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
+            imb.srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            break;
+        case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+            imb.srcAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+            imb.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+            break;
+        case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+            imb.srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            imb.srcStageMask = VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+            break;
         default:
             imb.srcAccessMask = 0;
             imb.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
@@ -1030,13 +4561,32 @@ namespace vkr {
             imb.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
             break;
         case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+        case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
             imb.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
-            imb.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+            imb.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            break;
+        case VK_IMAGE_LAYOUT_GENERAL:
+            imb.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
+            imb.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
             break;
         case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-            imb.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+            imb.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
             imb.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
             break;
+        case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+            imb.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+            imb.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+            break;
+        case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+            imb.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            imb.dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+
+            // A shared depth target may still be in use by the previous frame's depth tests
+            if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED) {
+                imb.srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                imb.srcStageMask = VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+            }
+            break;
         default:
             imb.dstAccessMask = 0;
             imb.dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
@@ -10,12 +10,23 @@
 #include <volk/volk.h>
 #include <vma/vk_mem_alloc.h>
 
+#include "job_system.hpp"
+#include "spirv.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <span>
 
 namespace vkr {
 
-    constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+    // Upper bound for frames in flight, the active count is set at runtime through FramePacingDesc
+    constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
 
     struct BufferDesc {
         void* pData;
@@ -29,10 +40,25 @@ namespace vkr {
         void* pData;
         uint32_t width, height;
         VkFormat format;
+
+        // Keep a host mip chain and upload finer levels on demand, see RequestTextureResolution
+        // Only formats with 8-bit channels are streamed, others are uploaded whole
+        bool streamed = false;
+
+        // Extra usage, e.g. VK_IMAGE_USAGE_STORAGE_BIT. Storage textures live in the GENERAL layout
+        VkImageUsageFlags usage = 0;
+        uint32_t mipLevels = 1;
     };
 
     using TextureHandle = ResourceID;
 
+    // Staging memory for a texture's texels, see Context::BeginTextureUpload
+    struct TextureUpload {
+        TextureDesc desc;
+        void* pData;            // width * height * Context::GetFormatSize(format) bytes, persistently mapped
+        ResourceID staging;
+    };
+
     struct SamplerDesc {
         VkFilter minFilter, magFilter;
         VkSamplerAddressMode addressMode;
@@ -52,14 +78,183 @@ namespace vkr {
         VkFormat format;
     };
 
+    struct DepthStencilDesc {
+        bool depthTest = true;
+        bool depthWrite = true;
+        VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+        // Only used when the context's depth format has a stencil component
+        bool stencilTest = false;
+        VkStencilOpState front = {};
+        VkStencilOpState back = {};
+    };
+
     struct GraphicsPipelineDesc {
         std::vector<VertexAttrib> vertexAttribs;
         VkShaderModule vertexShader;
         VkShaderModule fragmentShader;
+        DepthStencilDesc depthStencil = {};
+
+        // Specialization constants per stage, optional
+        const VkSpecializationInfo* vertexSpecialization = nullptr;
+        const VkSpecializationInfo* fragmentSpecialization = nullptr;
+
+        // Pipeline for BeginDepthPrepass: no color output, fragmentShader may be null
+        bool depthOnly = false;
     };
 
     using GraphicsPipelineHandle = ResourceID;
 
+    struct ComputePipelineDesc {
+        VkShaderModule computeShader;
+        const VkSpecializationInfo* specialization = nullptr;
+    };
+
+    using ComputePipelineHandle = ResourceID;
+
+    struct FramePacingDesc {
+        uint32_t framesInFlight = 2;    // 1 to MAX_FRAMES_IN_FLIGHT
+
+        // Preferred present mode, falls back by capability (MAILBOX <-> IMMEDIATE, then FIFO)
+        VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+
+        // Wait for the previous present (VK_KHR_present_wait) before starting CPU work on a frame
+        bool lowLatency = false;
+    };
+
+    struct FrameStats {
+        double cpuFrameMs;              // BeginFrame to EndFrame, on the render thread if there is one
+        double inputToPhotonMs;         // Most recent frame's BeginFrame to presentation, 0 without VK_KHR_present_wait
+        double averageInputToPhotonMs;
+
+        // Without VK_KHR_present_wait: BeginFrame until the frame's slot is reused, which waits for the GPU to finish it
+        // An upper bound on BeginFrame to GPU completion that includes the other frames in flight, not a presentation time
+        double estimatedLatencyMs;
+        double averageEstimatedLatencyMs;
+
+        // Start to end of a frame's commands on the GPU, from timestamps. Trails by the frames in flight
+        double gpuFrameMs;
+
+        // Per-axis scale BeginRendering applies to the viewport, 1 without dynamic resolution
+        float renderScale;
+
+        VkPresentModeKHR presentMode;
+        uint32_t framesInFlight;
+    };
+
+    struct DynamicResolutionDesc {
+        bool enabled = false;
+        double targetGpuFrameMs = 1000.0 / 60.0;   // GPU time the render scale is adjusted to meet
+
+        // Per-axis render scale bounds, at most 1. The offscreen target is allocated at maxScale
+        float minScale = 0.5f;
+        float maxScale = 1.0f;
+
+        float sharpness = 0.5f;                     // 0 to 1, sharpening applied while upscaling
+
+        // Upscale pass to the swapchain: upscale.vs.spv, upscale.fs.spv
+        VkShaderModule upscaleVertexShader = nullptr;
+        VkShaderModule upscaleFragmentShader = nullptr;
+    };
+
+    struct TextureStreamingDesc {
+        uint32_t residentTailSize = 64;                 // Levels this size and smaller are uploaded once the mip chain is built
+        VkDeviceSize uploadBudgetPerFrame = 4 << 20;    // Bytes of mip data uploaded per frame
+        uint32_t dropAfterFrames = 120;                 // Unrequested textures fall back to their tail after this
+    };
+
+    struct TextureStreamingStats {
+        VkDeviceSize residentBytes;     // Device memory held by streamed textures
+        VkDeviceSize uploadedBytes;     // Mip data uploaded during the last frame
+        uint32_t pendingTextures;       // Textures still short of their requested level
+    };
+
+    enum class ResourceType {
+        Buffer,
+        Texture
+    };
+
+    struct MemoryBudgetDesc {
+        // Fraction of a device-local heap's budget at which least-recently-used resources are evicted
+        float evictionThreshold = 0.9f;
+
+        // Resources bound within this many frames are never evicted
+        uint32_t minIdleFrames = 16;
+    };
+
+    struct EvictionCandidate {
+        ResourceType type;
+        ResourceID handle;
+        VkDeviceSize size;
+        uint64_t lastUsedFrame;
+    };
+
+    // Called in least-recently-used order when over budget, return false to keep the resource resident
+    // Runs from BeginFrame, on the render thread when the context has one
+    using EvictionCallback = std::function<bool(const EvictionCandidate& candidate)>;
+
+    struct MemoryHeapStats {
+        VkDeviceSize usage;
+        VkDeviceSize budget;
+        bool deviceLocal;
+    };
+
+    struct MemoryStats {
+        std::vector<MemoryHeapStats> heaps;
+        VkDeviceSize evictedBytes;          // Currently demoted to host memory / a lower mip
+        uint32_t evictedBuffers;
+        uint32_t evictedTextures;
+    };
+
+    struct DefragmentationDesc {
+        bool enabled = false;
+
+        // GPU copy work started per frame, a pass stays in flight until the frames using the old places finish
+        VkDeviceSize maxBytesPerFrame = 16 * 1024 * 1024;
+        uint32_t maxAllocationsPerFrame = 64;
+
+        // Start defragmenting once this fraction of a device-local heap's memory blocks is unused
+        float fragmentationThreshold = 0.25f;
+
+        // Frames to wait after a defragmentation finishes before checking again
+        uint32_t minIdleFrames = 600;
+    };
+
+    // Totals since the context was created
+    struct DefragmentationStats {
+        VkDeviceSize bytesMoved;
+        VkDeviceSize bytesReclaimed;        // Device memory blocks released back to the driver
+        uint32_t allocationsMoved;
+        uint32_t blocksReclaimed;
+        uint32_t defragmentations;          // Finished runs
+        bool active;                        // A defragmentation is in progress
+    };
+
+    struct DeviceSelectionDesc {
+        // Use this device instead of the highest scoring one: a substring of its name, or its deviceUUID in hex
+        // Falls back to the VKR_DEVICE environment variable. A device that matches but is unusable is reported on stderr
+        const char* device = nullptr;
+    };
+
+    // Queue families picked on the selected device, UINT32_MAX where the device has no such family
+    // Only detection is done for the transfer family: no queue is created on it, and texture uploads, restores and
+    // defragmentation copies are all recorded on the graphics queue, so no ownership transfers are needed
+    struct QueueTopology {
+        uint32_t graphicsFamily = UINT32_MAX;
+        uint32_t computeFamily = UINT32_MAX;    // Compute without graphics, runs alongside the graphics queue
+        uint32_t transferFamily = UINT32_MAX;   // Transfer only, usually a dedicated copy engine. Reported, not used
+    };
+
+    class Context;
+
+    // Defined in capture.hpp
+    class CaptureWriter;
+    class CaptureCall;
+    enum class CaptureOp : uint16_t;
+
+    // Defined in render_thread.hpp
+    class RenderThread;
+
     struct PresentationParameters {
         #if defined(VK_USE_PLATFORM_WIN32_KHR)
         HWND hWnd;
@@ -67,9 +262,34 @@ namespace vkr {
         _XDisplay* dpy;
         XID window;
         #endif
+
+        // Render into an offscreen target instead of a window surface (benchmarks, tools)
+        bool headless = false;
+        VkExtent2D headlessExtent = { 1024, 768 };
+
+        FramePacingDesc framePacing = {};
+
+        // Submit BeginAsyncCompute batches to a dedicated compute queue family when the device has one
+        bool asyncCompute = false;
+
+        DeviceSelectionDesc deviceSelection = {};
+
+        // Translate Set*, Draw*, Dispatch* and Destroy* calls into Vulkan commands on a thread of its own, a frame
+        // behind the calls. Create* and Set*Desc calls wait for the render thread to finish the previous frame,
+        // stats and the render extent are those of the last frame it finished
+        bool renderThread = false;
+
+        // Render with another context's device, e.g. one context per window. Buffers, textures, samplers and
+        // pipelines are shared, handles from either context are valid in both. Device selection and async compute
+        // come from the first context, pipelines expect every context to use the same swapchain format.
+        // Contexts sharing a device cannot use a render thread
+        const Context* sharedContext = nullptr;
     };
     
     class Context {
+        // Records passes straight into the frame's command buffer and owns transient textures
+        friend class RenderGraph;
+
     public:
         Context(const PresentationParameters& params);
         ~Context();
@@ -77,56 +297,348 @@ namespace vkr {
         void BeginFrame();
         void EndFrame();
 
+        // With dynamic resolution, the viewport is scaled by FrameStats::renderScale
         void BeginRendering(const VkViewport& viewport);
         void EndRendering();
 
+        // Depth-only pass ahead of BeginRendering, which then keeps its depth instead of clearing it
+        // Close with EndRendering, draw with depthOnly pipelines
+        void BeginDepthPrepass(const VkViewport& viewport);
+
         void SetVertexBuffers(std::span<BufferHandle> buffers);
         void SetIndexBuffer(BufferHandle bufferHandle, VkIndexType indexType);
         void SetUniformBuffer(BufferHandle bufferHandle, uint32_t binding);
         void SetTexture(TextureHandle textureHandle, SamplerHandle samplerHandle, uint32_t binding);
 
+        // Storage bindings for the bound pipeline, storage images bind a single mip level
+        void SetStorageBuffer(BufferHandle bufferHandle, uint32_t binding);
+        void SetStorageImage(TextureHandle textureHandle, uint32_t mipLevel, uint32_t binding);
+
+        // Bind this frame's depth for sampling, only valid outside BeginRendering/EndRendering
+        void SetDepthTexture(SamplerHandle samplerHandle, uint32_t binding);
+
         void SetGraphicsPipeline(GraphicsPipelineHandle pipelineHandle);
+        void SetComputePipeline(ComputePipelineHandle pipelineHandle);
         void SetPushConstants(void* pData, size_t size, size_t offset);
         void SetPrimitiveTopology(VkPrimitiveTopology topology);
         void SetCullMode(VkCullModeFlags cullMode);
 
         void Draw(uint32_t offset, uint32_t count);
-        void DrawIndexed(uint32_t offset, uint32_t count);
+        // firstInstance reaches shaders as gl_InstanceIndex, e.g. an object index and LOD fade (see EncodeDrawInstance)
+        void DrawIndexed(uint32_t offset, uint32_t count, uint32_t firstInstance = 0);
+
+        // Draw arguments come from a VkDrawIndexedIndirectCommand array in a buffer
+        void DrawIndexedIndirect(BufferHandle bufferHandle, size_t offset, uint32_t drawCount, uint32_t stride);
+
+        void Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ);
+
+        // Group counts come from a VkDispatchIndirectCommand in a buffer
+        void DispatchIndirect(BufferHandle bufferHandle, size_t offset);
+
+        // Record compute work into a batch for the async compute queue, at most one batch per frame
+        // Without a dedicated compute family the batch is recorded inline on the graphics queue
+        void BeginAsyncCompute();
+
+        // Submit the batch, this frame's graphics work waits for its results at consumerStages
+        // The batch starts once earlier frames and this frame's BeginFrame copies are done, and sees none of
+        // the frame's other graphics commands. Barriers recorded in it only apply to compute and transfer stages
+        void EndAsyncCompute(VkPipelineStageFlags2 consumerStages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+
+        // Make writes from srcStage visible to dstStage, e.g. compute results read by a later draw
+        void PipelineBarrier(VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess);
 
         BufferHandle CreateBuffer(const BufferDesc& desc);
-        VkShaderModule CreateShader(const ShaderDesc& desc);
+        VkShaderModule CreateShader(const ShaderDesc& desc);     // nullptr if the data is not well-formed SPIR-V
         SamplerHandle CreateSampler(const SamplerDesc& desc);
         TextureHandle CreateTexture(const TextureDesc& desc);
+        // 0 if a shader is not one returned by CreateShader, e.g. nullptr for SPIR-V that was rejected
         GraphicsPipelineHandle CreateGraphicsPipeline(const GraphicsPipelineDesc& desc);
+        ComputePipelineHandle CreateComputePipeline(const ComputePipelineDesc& desc);
 
+        // Create a texture from texels written straight into mapped staging memory, e.g. by decoder threads
+        // Begin and End are called like the other Create* calls, the memory may be written from any thread in between
+        // The texels fill the first mip level, the others are generated from it. Like CreateTexture with data, the
+        // copy is batched with other uploads and submitted ahead of the next frame or immediate work, without a wait
+        TextureUpload BeginTextureUpload(const TextureDesc& desc);
+        TextureHandle EndTextureUpload(const TextureUpload& upload);
+
+        // Destruction is deferred until the GPU has finished every frame submitted so far
+        void DestroyBuffer(BufferHandle bufferHandle);
+        void DestroyShader(VkShaderModule shader);
+        void DestroySampler(SamplerHandle samplerHandle);
+        void DestroyTexture(TextureHandle textureHandle);
+        void DestroyGraphicsPipeline(GraphicsPipelineHandle pipelineHandle);
+        void DestroyComputePipeline(ComputePipelineHandle pipelineHandle);
+
+        // Write size bytes from pData to offset bytes into a buffer. Device local buffers are written through a
+        // staging copy, which during a frame is recorded with its commands and must be outside a rendering scope
         void CopyBufferData(BufferHandle bufferHandle, void* pData, size_t offset, size_t size);
+
+        // Change frames in flight / present mode / latency mode, recreates the swapchain if needed
+        void SetFramePacing(const FramePacingDesc& desc);
+        const FramePacingDesc& GetFramePacing() const { return m_framePacing; }
+        const FrameStats& GetFrameStats() const { return m_renderThread != nullptr ? m_publishedFrameStats : m_frameStats; }
+
+        // Render BeginRendering passes into an offscreen target at a scale that tracks a GPU time budget,
+        // upscaled to the swapchain by EndFrame. Depth shares the scaled area of the depth target
+        void SetDynamicResolution(const DynamicResolutionDesc& desc);
+        const DynamicResolutionDesc& GetDynamicResolution() const { return m_dynamicResolution; }
+
+        // Budget-aware residency: evicted resources stay bindable and are restored on next use
+        void SetMemoryBudget(const MemoryBudgetDesc& desc);
+        // Waits for the render thread, which may be calling the previous callback
+        void SetEvictionCallback(EvictionCallback callback);
+        const MemoryStats& GetMemoryStats() const { return m_renderThread != nullptr ? m_publishedMemoryStats : m_memoryStats; }
+
+        // Incrementally compact device memory, moved resources keep their handles
+        void SetDefragmentation(const DefragmentationDesc& desc);
+        const DefragmentationDesc& GetDefragmentation() const { return m_defragmentation; }
+        const DefragmentationStats& GetDefragmentationStats() const {
+            return m_renderThread != nullptr ? m_publishedDefragmentationStats : m_defragmentationStats;
+        }
+
+        // Request enough detail for a streamed texture covering screenSize pixels along its longest axis
+        void RequestTextureResolution(TextureHandle textureHandle, float screenSize);
+        void SetTextureStreaming(const TextureStreamingDesc& desc);
+
+        // Build the host mip chains of streamed textures and the optimized links of graphics pipelines as jobs, the job
+        // system must outlive the context. Without one they are done on the thread creating the texture or pipeline
+        void SetJobSystem(JobSystem* pJobSystem);
+        const TextureStreamingStats& GetTextureStreamingStats() const {
+            return m_renderThread != nullptr ? m_publishedTextureStreamingStats : m_textureStreamingStats;
+        }
+
+        // Block until the device has finished all submitted work
+        void WaitIdle();
+
+        // Record every call made on this context to a file until EndCapture, for replay by vkr-replay
+        // Call between frames, before creating the resources the captured frames use
+        bool BeginCapture(const char* path);
+        void EndCapture();
+
+        const VkPhysicalDeviceProperties& GetPhysicalDeviceProperties() const { return m_physicalDeviceProperties; }
+        const QueueTopology& GetQueueTopology() const { return m_queueTopology; }
+        bool IsHeadless() const { return m_presentParams.headless; }
+        VkFormat GetDepthFormat() const { return m_depthFormat; }
+        VkExtent2D GetRenderExtent() const { return m_renderThread != nullptr ? m_publishedRenderExtent : m_swapchainExtent; }
+        bool HasAsyncCompute() const { return m_computeQueue != nullptr; }
+
+        // Bytes per texel of an uncompressed color format, 0 if unknown
+        static uint32_t GetFormatSize(VkFormat format);
         
     private:
-        // Find a suitable queue family index based on flags
-        uint32_t FindQueueFamilyIndex(VkPhysicalDevice pd, VkQueueFlags flags);
+        // Defined with the other allocations below
+        struct PipelineLayout;
+        struct BufferAllocation;
+        struct TextureAllocation;
+
+        static bool HasStencilComponent(VkFormat format);
+
+        // Aspects covering every component of the format, e.g. depth and stencil
+        static VkImageAspectFlags GetImageAspect(VkFormat format);
+
+        // Pick the highest scoring device that supports everything required, unless one is forced by name or UUID
+        VkPhysicalDevice SelectPhysicalDevice(std::span<const char* const> requiredExtensions);
+
+        // Rank a device by type, then by device-local memory, -1 if it lacks a required extension, feature or queue
+        int64_t ScorePhysicalDevice(VkPhysicalDevice pd, std::span<const char* const> requiredExtensions);
+
+        // Select the physical device and create the device, allocator, queues and timeline shared with other contexts
+        void CreateDevice();
+
+        // Find a suitable queue family index based on flags, skipping families that have any of excludeFlags
+        uint32_t FindQueueFamilyIndex(VkPhysicalDevice pd, VkQueueFlags flags, VkQueueFlags excludeFlags = 0);
+
+        // Record a public call to the active capture, nothing if there is none or the call comes from the context
+        CaptureCall Capture(CaptureOp op);
+
+        // With a render thread, true on the application thread, whose calls are recorded for the render thread
+        bool DefersToRenderThread() const;
+
+        // Wait for the render thread to finish the submitted frame and publish its stats, before touching what it owns
+        void SyncRenderThread();
+
+        // Command buffer the Set*, Draw* and Dispatch* calls record into
+        VkCommandBuffer GetCommandBuffer() const;
+
+        // Share buffers and images between the graphics and async compute families
+        template <typename TCreateInfo>
+        void SetSharingMode(TCreateInfo& ci) const {
+            bool shared = m_sharedQueueFamilies.size() > 1;
+            ci.sharingMode = shared ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+            ci.queueFamilyIndexCount = shared ? static_cast<uint32_t>(m_sharedQueueFamilies.size()) : 0;
+            ci.pQueueFamilyIndices = shared ? m_sharedQueueFamilies.data() : nullptr;
+        }
         
-        // (Re)create the swapchain
+        // (Re)create the swapchain at the window's size, the old one is retired through DeferDestroy
         void ValidateSwapchain();
+
+        // Create the offscreen color target used in place of a swapchain when headless
+        void CreateHeadlessTarget();
+
+        // (Re)create the depth target to match the swapchain extent
+        void CreateDepthTarget();
+
+        // Pick the best supported depth(/stencil) attachment format
+        VkFormat SelectDepthFormat();
+
+        // (Re)create the dynamic resolution target at the largest render scale, or release it when disabled
+        void CreateSceneTarget();
+
+        // Move the render scale toward the GPU time budget, from a frame rendered at frameScale
+        void UpdateRenderScale(float frameScale);
+
+        // Resample the rendered part of the scene target to the swapchain image, sharpening as it goes
+        void UpscaleSceneTarget();
+
+        void BeginRenderingPass(const VkViewport& viewport, bool depthOnly);
+
+        // Pick the closest supported present mode to the requested one
+        VkPresentModeKHR SelectPresentMode(VkSurfaceKHR surface, VkPresentModeKHR requested);
+
+        // Collect input-to-photon latency of frames that have been presented since the last call
+        void UpdateLatencyStats(bool block);
+
+        // Present wait samples go to the input-to-photon stats, others to the estimated ones
+        void RecordLatency(double ms, bool presentWaitMeasured);
+
+        // Queue Vulkan objects for destruction once the GPU is done with every submission that may use them
+        void DeferDestroy(std::function<void()>&& destroy);
+
+        // Find or create the layout for the reflected shaders, stages are widened to every stage of the bind point
+        // nullptr if a shader has no reflection, i.e. was not created by CreateShader
+        const PipelineLayout* AcquirePipelineLayout(std::span<const VkShaderModule> shaders, VkShaderStageFlags stages);
+        void ReleasePipelineLayout(VkPipelineLayout layout);
+
+        // Find or create the library for one state subset of a graphics pipeline, keyed by the state it was built from
+        VkPipeline GetPipelineLibrary(VkGraphicsPipelineLibraryFlagsEXT subset, std::string&& key,
+            VkGraphicsPipelineCreateInfo gpci, VkShaderModule shader = nullptr, VkPipelineLayout layout = nullptr);
+
+        // Drop libraries built from a shader or layout that is going away
+        void EvictPipelineLibraries(VkShaderModule shader, VkPipelineLayout layout);
+
+        // Swap in optimized pipelines whose background link has finished, or wait for all of them
+        void UpdatePipelineLinks(bool wait);
+
+        // Destroy every deferred object whose timeline value the GPU has reached
+        void CollectDeferredDestroys();
+
+        // Block until the frame timeline reaches value
+        void WaitTimeline(uint64_t value);
+
+        // Query per-heap usage and budget from the allocator
+        void UpdateMemoryBudget();
+
+        // Record restores of evicted resources that were used, then evict if any heap is over budget
+        void UpdateResidency(VkCommandBuffer cmds);
         
         // Return a transient command buffer used for immediate execution
         VkCommandBuffer BeginImmediateCommands();
         
         // End commands and submit them for immediate execution
         void EndImmediateCommands(VkCommandBuffer cmds);
+
+        // End transient commands and submit them, returns the timeline value they signal
+        uint64_t SubmitTransientCommands(VkCommandBuffer cmds);
+
+        // Texture uploads are recorded into one batch, submitted without a host wait before the next submission
+        // that may use them. Objects destroyed meanwhile are released once the batch has executed
+        VkCommandBuffer GetUploadCommands();
+        void FlushUploads();
+
+        // Filter every level below the first from the one above it, all levels go from TRANSFER_DST to TRANSFER_SRC
+        void RecordMipChain(VkCommandBuffer cmds, const TextureAllocation& ta);
         
-        void TransitionImageLayout(VkCommandBuffer cmds, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
+        void TransitionImageLayout(VkCommandBuffer cmds, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
+
+        // Create a sampled 2D image and its view, plus per-level views if usage includes storage
+        void AllocateTextureImage(TextureAllocation& ta, VkExtent2D extent, VkFormat format, uint32_t mipLevels = 1, VkImageUsageFlags usage = 0);
+        VkImageCreateInfo GetTextureImageInfo(VkExtent2D extent, VkFormat format, uint32_t mipLevels, VkImageUsageFlags usage);
+        void CreateTextureViews(TextureAllocation& ta);
+
+        // Move the depth target between attachment and sampled use
+        void TransitionDepth(VkImageLayout layout);
+
+        // Mark a resource as used this frame, requesting a restore if it was evicted
+        BufferAllocation& TouchBuffer(BufferHandle bufferHandle);
+        TextureAllocation& TouchTexture(TextureHandle textureHandle);
+
+        bool IsDeviceLocal(const VmaAllocationInfo& allocInfo) const;
+
+        bool EvictBuffer(VkCommandBuffer cmds, BufferAllocation& ba);
+        void RestoreBuffer(VkCommandBuffer cmds, BufferAllocation& ba);
+        bool EvictTexture(VkCommandBuffer cmds, TextureAllocation& ta);
+        void RestoreTexture(VkCommandBuffer cmds, TextureAllocation& ta);
+
+        // Finish the defragmentation pass in flight once its frames are done, then record the next one
+        void UpdateDefragmentation(VkCommandBuffer cmds);
+        bool IsFragmented() const;
+        void BeginDefragmentationPass(VkCommandBuffer cmds);
+        void EndDefragmentationPass();
+        void EndDefragmentation();
+        bool MoveBuffer(VkCommandBuffer cmds, BufferAllocation& ba, VmaAllocation dst);
+        bool MoveTexture(VkCommandBuffer cmds, TextureAllocation& ta, VmaAllocation dst);
+
+        // Give up the move of a resource destroyed while its pass is in flight, the pass frees its memory
+        void AbandonMove(VmaAllocation alloc, std::function<void()>&& destroy);
+
+        // Host copy of every level of a streamed texture, 0 is full resolution
+        struct MipChain {
+            std::vector<std::vector<uint8_t>> mips;
+            std::atomic<bool> built = false;
+        };
+
+        struct StreamedTexture {
+            std::shared_ptr<MipChain> chain;            // Shared with the job building it
+            VkExtent2D extent;                          // Level 0 extent
+            uint32_t mipCount;
+            uint32_t residentMip;                       // Finest level on the device, mipCount while a placeholder is bound
+            uint32_t requestedMip;
+            uint64_t lastRequestFrame;
+        };
+
+        TextureHandle CreateStreamedTexture(const TextureDesc& desc);
+
+        // Upload requested levels within the frame budget and drop levels nobody asked for
+        void UpdateTextureStreaming(VkCommandBuffer cmds);
+
+        // Reallocate a streamed texture to hold levels [residentMip, mipCount), copying what is already resident
+        void SetStreamedTextureResidency(VkCommandBuffer cmds, TextureAllocation& ta, StreamedTexture& st, uint32_t residentMip);
         
     private:
+        // Shared by every pipeline whose shaders reflect to the same bindings and push constant size
+        struct PipelineLayout {
+            VkPipelineLayout layout;
+            VkDescriptorSetLayout pushDescriptorSetLayout;
+            VkShaderStageFlags pushConstantStages;
+            uint32_t refCount;
+        };
+
         struct GraphicsPipelineAllocation {
             VkPipeline pipeline;
             VkPipelineLayout layout;
-            VkDescriptorSetLayout pushDescriptorSetLayout;
+            VkShaderStageFlags pushConstantStages;
+        };
+
+        struct ComputePipelineAllocation {
+            VkPipeline pipeline;
+            VkPipelineLayout layout;
+            VkShaderStageFlags pushConstantStages;
         };
 
         struct BufferAllocation {
             VkBuffer buffer;
             VmaAllocation alloc;
             VmaAllocationInfo allocInfo;
+            VkDeviceSize size;      // As requested, the allocation may be larger
+
+            // Residency
+            VkBufferUsageFlags usage;
+            uint64_t lastUsedFrame;
+            bool evicted;           // Demoted to a host memory buffer
+            VkDeviceSize evictedSize;   // Device memory freed by the eviction
+            bool restoreRequested;
+            bool moving;            // Copied by the defragmentation pass in flight
         };
         
         struct TextureAllocation {
@@ -135,47 +647,268 @@ namespace vkr {
             VkFormat format;
             VmaAllocation alloc;
             VmaAllocationInfo allocInfo;
+            VkImageLayout layout;                   // Layout the texture is kept in between uses
+            uint32_t mipLevels;
+            VkImageUsageFlags usage;
+            std::vector<VkImageView> mipViews;      // Storage textures only
+            bool aliased;                           // Render graph transient, memory is owned by the graph
+
+            // Residency
+            VkExtent2D extent;
+            uint64_t lastUsedFrame;
+            bool evicted;           // Demoted to a lower mip, full image kept in hostCopy
+            VkDeviceSize evictedSize;   // Device memory freed by the eviction
+            bool restoreRequested;
+            bool moving;
+            BufferAllocation hostCopy;
+        };
+
+        // A resource moved by the defragmentation pass in flight, its old object is destroyed when the pass ends
+        struct DefragmentationMove {
+            ResourceType type;
+            ResourceID handle;
+            BufferAllocation oldBuffer;
+            TextureAllocation oldTexture;
+        };
+
+        struct DeferredDestroy {
+            uint64_t timelineValue;
+            std::function<void()> destroy;
+        };
+
+        // Graphics pipeline libraries, pipelines are fast-linked from them and later replaced by an optimized link
+        struct PipelineLibrary {
+            VkPipeline library;
+            VkShaderModule shader;      // Pre-rasterization and fragment shader subsets
+            VkPipelineLayout layout;
+        };
+
+        // Optimized link of a pipeline, written by the job linking it
+        struct OptimizedLink {
+            VkPipeline pipeline = nullptr;
+            std::atomic<bool> linked = false;
+        };
+
+        struct PipelineLink {
+            GraphicsPipelineHandle handle;
+            std::shared_ptr<OptimizedLink> optimized;   // Shared with the job linking it
+            bool discarded;                             // The pipeline was destroyed first, the link is released once done
+        };
+
+        // Everything contexts created with PresentationParameters::sharedContext have in common, released with the
+        // last of them. Frames of every context submit to the same queue and signal the same timeline, so deferred
+        // destruction waits for each context's use of a shared resource
+        struct SharedDevice {
+            VkPhysicalDevice physicalDevice = nullptr;
+            VkPhysicalDeviceProperties physicalDeviceProperties = {};
+            VkDevice device = nullptr;
+            VkQueue graphicsQueue = nullptr;
+            VkQueue computeQueue = nullptr;
+            QueueTopology queueTopology = {};
+            std::vector<uint32_t> sharedQueueFamilies;
+            bool swapchainEnabled = false;
+            bool presentWaitSupported = false;
+            bool pipelineLibrarySupported = false;
+            bool evictionSupported = false;
+            VkCommandPool transientCommandPool = nullptr;
+            VkCommandBuffer uploadCommands = nullptr;
+            std::vector<std::function<void()>> uploadDestroys;
+
+            VkSemaphore timeline = nullptr;
+            uint64_t timelineValue = 0;
+            std::deque<DeferredDestroy> deferredDestroys;
+
+            VmaAllocator allocator = nullptr;
+            uint64_t frameNumber = 0;
+
+            MemoryBudgetDesc memoryBudget = {};
+            MemoryStats memoryStats = {};
+            EvictionCallback evictionCallback;
+            std::vector<BufferHandle> bufferRestores;
+            std::vector<TextureHandle> textureRestores;
+
+            TextureStreamingDesc textureStreaming = {};
+            TextureStreamingStats textureStreamingStats = {};
+            std::unordered_map<TextureHandle, StreamedTexture> streamedTextures;
+
+            DefragmentationDesc defragmentation = {};
+            DefragmentationStats defragmentationStats = {};
+            VmaDefragmentationContext defragmentationContext = nullptr;
+            VmaDefragmentationPassMoveInfo defragmentationPass = {};
+            std::vector<DefragmentationMove> defragmentationMoves;
+            bool defragmentationPassActive = false;
+            uint32_t defragmentationHolds = 0;
+            uint64_t defragmentationIdleUntil = 0;
+
+            std::unordered_map<VkShaderModule, ShaderReflection> shaderReflections;
+            std::unordered_map<std::string, PipelineLayout> pipelineLayouts;
+            std::unordered_map<std::string, PipelineLibrary> pipelineLibraries;
+            std::vector<PipelineLink> pipelineLinks;
+            JobCounter pipelineLinkJobs;        // Links of every sharing context, on their job systems
+
+            ResourceRegistry<GraphicsPipelineAllocation> graphicsPipelines;
+            ResourceRegistry<ComputePipelineAllocation> computePipelines;
+            ResourceRegistry<BufferAllocation> buffers;
+            ResourceRegistry<BufferAllocation> textureUploads;
+            ResourceRegistry<VkSampler> samplers;
+            ResourceRegistry<TextureAllocation> textures;
         };
 
         // Core
         inline static uint32_t s_contextCount = 0;
         inline static VkInstance s_vkInstance = nullptr;
-        VkPhysicalDevice m_physicalDevice = nullptr;
-        VkDevice m_device = nullptr;
-        VkQueue m_graphicsQueue = nullptr;
-        VkQueue m_transferQueue = nullptr;
-        VkFence m_frameInFlightFences[MAX_FRAMES_IN_FLIGHT] = {};
+        std::shared_ptr<SharedDevice> m_shared;
+
+        // Device state lives in m_shared, these name it where it is used
+        VkPhysicalDevice& m_physicalDevice = m_shared->physicalDevice;
+        VkPhysicalDeviceProperties& m_physicalDeviceProperties = m_shared->physicalDeviceProperties;
+        VkDevice& m_device = m_shared->device;
+        VkQueue& m_graphicsQueue = m_shared->graphicsQueue;
+        QueueTopology& m_queueTopology = m_shared->queueTopology;
+        std::vector<uint32_t>& m_sharedQueueFamilies = m_shared->sharedQueueFamilies;    // Graphics, plus compute with async compute
         uint32_t m_frameIndex = 0;
+
+        // Device timeline, every submission signals the next value
+        VkSemaphore& m_timeline = m_shared->timeline;
+        uint64_t& m_timelineValue = m_shared->timelineValue;
+        uint64_t m_frameSlotTimelineValues[MAX_FRAMES_IN_FLIGHT] = {};
+        std::deque<DeferredDestroy>& m_deferredDestroys = m_shared->deferredDestroys;
+
+        std::vector<std::function<void()>> m_frameDestroys;
+        bool m_frameRecording = false;
+
+        // Frame pacing
+        using Clock = std::chrono::steady_clock;
+        static constexpr uint32_t PRESENT_HISTORY_SIZE = 8;
+
+        FramePacingDesc m_framePacing = {};
+        FrameStats m_frameStats = {};
+        bool& m_presentWaitSupported = m_shared->presentWaitSupported;
+        uint64_t m_presentID = 0;
+        uint64_t m_lastMeasuredPresentID = 0;
+        Clock::time_point m_frameBeginTime = {};
+        Clock::time_point m_frameSlotBeginTimes[MAX_FRAMES_IN_FLIGHT] = {};
+        Clock::time_point m_presentBeginTimes[PRESENT_HISTORY_SIZE] = {};
+
+        // GPU frame timing, a begin and end timestamp per frame slot
+        VkQueryPool m_timestampQueries = nullptr;
+        bool m_timestampsWritten[MAX_FRAMES_IN_FLIGHT] = {};
         
         // Presentation
         PresentationParameters m_presentParams;
         VkSurfaceKHR m_surface = nullptr;
         VkSwapchainKHR m_swapchain = nullptr;
-        VkFence m_imageAcquiredFence = nullptr;
         std::vector<VkSemaphore> m_imageAcquiredSignals;
         std::vector<VkImage> m_swapchainImages;
         std::vector<VkImageView> m_swapchainImageViews;
         uint32_t m_swapchainImageIndex = 0;
         VkFormat m_swapchainFormat = VK_FORMAT_UNDEFINED;
+        VkExtent2D m_swapchainExtent = {};
         std::vector<VkSemaphore> m_presentReadySignals;
+        bool m_swapchainOutOfDate = false;          // Resized or suboptimal, recreated before the next acquire
+        TextureAllocation m_headlessTarget = {};
+
+        // Depth, shared by every frame in flight since frames execute in submission order
+        TextureAllocation m_depthTarget = {};
+        VkImageView m_depthSampledView = nullptr;   // Depth aspect only
+        VkFormat m_depthFormat = VK_FORMAT_UNDEFINED;
+        VkImageLayout m_depthLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        // Dynamic resolution, passes render into the top-left renderScale part of the scene target
+        DynamicResolutionDesc m_dynamicResolution = {};
+        TextureAllocation m_sceneTarget = {};
+        GraphicsPipelineHandle m_upscalePipeline = 0;
+        SamplerHandle m_upscaleSampler = 0;
+        float m_renderScale = 1.0f;
+        float m_frameSlotRenderScales[MAX_FRAMES_IN_FLIGHT] = {};
+
+        // Later passes in a frame keep what earlier ones rendered instead of clearing
+        bool m_colorWritten = false;
+        bool m_depthWritten = false;
         
         // Ext
-        VkCommandPool m_transientCommandPool = nullptr;
+        VkCommandPool& m_transientCommandPool = m_shared->transientCommandPool;
+
+        // Pending texture upload batch, see FlushUploads
+        VkCommandBuffer& m_uploadCommands = m_shared->uploadCommands;
+        std::vector<std::function<void()>>& m_uploadDestroys = m_shared->uploadDestroys;
         
         // Render commands
         VkCommandPool m_graphicsCommandPool = nullptr;
         VkCommandBuffer m_graphicsCommandBuffers[MAX_FRAMES_IN_FLIGHT] = {};
-        GraphicsPipelineAllocation* m_pBoundGraphicsPipeline = nullptr;
+        VkPipelineBindPoint m_boundBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        VkPipelineLayout m_boundPipelineLayout = nullptr;
+        VkShaderStageFlags m_boundPushConstantStages = 0;
+
+        // Async compute, batches signal their own timeline which the frame's graphics submission waits on
+        VkQueue& m_computeQueue = m_shared->computeQueue;
+        VkCommandPool m_computeCommandPool = nullptr;
+        VkCommandBuffer m_computeCommandBuffers[MAX_FRAMES_IN_FLIGHT] = {};
+        VkCommandBuffer m_setupCommandBuffers[MAX_FRAMES_IN_FLIGHT] = {};  // BeginFrame's memory copies, graphics queue
+        VkSemaphore m_computeTimeline = nullptr;
+        uint64_t m_computeTimelineValue = 0;
+        VkPipelineStageFlags2 m_computeConsumerStages = 0;    // Non-zero once this frame's batch is submitted
+        bool m_asyncComputeRecording = false;
+
+        // Capture, see BeginCapture
+        std::unique_ptr<CaptureWriter> m_capture;
+        uint32_t m_captureDepth = 0;        // Public calls in progress, only the outermost one is recorded
+        uint32_t m_renderThreadCaptureDepth = 0;
+
+        // Render thread, see PresentationParameters::renderThread
+        std::unique_ptr<RenderThread> m_renderThread;
+        FrameStats m_publishedFrameStats = {};
+        VkExtent2D m_publishedRenderExtent = {};
+        MemoryStats m_publishedMemoryStats = {};
+        TextureStreamingStats m_publishedTextureStreamingStats = {};
+        DefragmentationStats m_publishedDefragmentationStats = {};
         
         // Resources
-        VmaAllocator m_allocator = nullptr;
+        VmaAllocator& m_allocator = m_shared->allocator;
+        uint64_t& m_frameNumber = m_shared->frameNumber;     // Furthest frame of any sharing context
+        uint64_t m_contextFrameNumber = m_frameNumber;       // This context's frames, starting where the device is
+
+        // Residency
+        MemoryBudgetDesc& m_memoryBudget = m_shared->memoryBudget;
+        MemoryStats& m_memoryStats = m_shared->memoryStats;
+        EvictionCallback& m_evictionCallback = m_shared->evictionCallback;
+        bool& m_evictionSupported = m_shared->evictionSupported;
+        std::vector<BufferHandle>& m_bufferRestores = m_shared->bufferRestores;
+        std::vector<TextureHandle>& m_textureRestores = m_shared->textureRestores;
 
+        // Texture streaming
+        TextureStreamingDesc& m_textureStreaming = m_shared->textureStreaming;
+        TextureStreamingStats& m_textureStreamingStats = m_shared->textureStreamingStats;
+        std::unordered_map<TextureHandle, StreamedTexture>& m_streamedTextures = m_shared->streamedTextures;
+        JobSystem* m_jobSystem = nullptr;
+        JobCounter m_mipChainBuilds;        // Waited on before the context goes away
 
+        // Defragmentation, one pass at a time for every sharing context. Holds count the frames and
+        // destroys that still reference the pass's old places
+        DefragmentationDesc& m_defragmentation = m_shared->defragmentation;
+        DefragmentationStats& m_defragmentationStats = m_shared->defragmentationStats;
+        VmaDefragmentationContext& m_defragmentationContext = m_shared->defragmentationContext;
+        VmaDefragmentationPassMoveInfo& m_defragmentationPass = m_shared->defragmentationPass;
+        std::vector<DefragmentationMove>& m_defragmentationMoves = m_shared->defragmentationMoves;
+        bool& m_defragmentationPassActive = m_shared->defragmentationPassActive;
+        uint32_t& m_defragmentationHolds = m_shared->defragmentationHolds;
+        uint64_t& m_defragmentationIdleUntil = m_shared->defragmentationIdleUntil;
         
-        ResourceRegistry<GraphicsPipelineAllocation> m_graphicsPipelines;
-        ResourceRegistry<BufferAllocation> m_buffers;
-        ResourceRegistry<VkSampler> m_samplers;
-        ResourceRegistry<TextureAllocation> m_textures;
+        // Pipeline layouts, from the reflection of each live shader module
+        std::unordered_map<VkShaderModule, ShaderReflection>& m_shaderReflections = m_shared->shaderReflections;
+        std::unordered_map<std::string, PipelineLayout>& m_pipelineLayouts = m_shared->pipelineLayouts;
+
+        bool& m_pipelineLibrarySupported = m_shared->pipelineLibrarySupported;
+        std::unordered_map<std::string, PipelineLibrary>& m_pipelineLibraries = m_shared->pipelineLibraries;
+        std::vector<PipelineLink>& m_pipelineLinks = m_shared->pipelineLinks;
+        JobCounter& m_pipelineLinkJobs = m_shared->pipelineLinkJobs;
+
+        ResourceRegistry<GraphicsPipelineAllocation>& m_graphicsPipelines = m_shared->graphicsPipelines;
+        ResourceRegistry<ComputePipelineAllocation>& m_computePipelines = m_shared->computePipelines;
+        ResourceRegistry<BufferAllocation>& m_buffers = m_shared->buffers;
+        ResourceRegistry<BufferAllocation>& m_textureUploads = m_shared->textureUploads;
+        ResourceRegistry<VkSampler>& m_samplers = m_shared->samplers;
+        ResourceRegistry<TextureAllocation>& m_textures = m_shared->textures;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,101 @@
+#version 450
+
+layout (local_size_x = 64) in;
+
+struct DrawCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout (set = 0, binding = 0) uniform sampler2D depthPyramid;
+layout (set = 0, binding = 1) readonly buffer Bounds { vec4 bounds[]; };
+layout (set = 0, binding = 2) readonly buffer Draws { DrawCommand draws[]; };
+layout (set = 0, binding = 3) writeonly buffer EarlyDraws { DrawCommand earlyDraws[]; };
+layout (set = 0, binding = 4) writeonly buffer LateDraws { DrawCommand lateDraws[]; };
+layout (set = 0, binding = 5) buffer Visibility { uint visibility[]; };
+
+layout (push_constant) uniform constants {
+    mat4 cullMatrix;
+    vec2 pyramidSize;
+    uint objectCount;
+    uint phase;         // 0: early, 1: late
+} PushConstants;
+
+// Screen rect (uv min, uv max) and nearest depth of a bounding sphere, false if it crosses the camera plane
+bool ProjectSphere(vec4 sphere, out vec4 rect, out float nearestDepth) {
+    rect = vec4(1.0, 1.0, 0.0, 0.0);
+    nearestDepth = 1.0;
+
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = sphere.xyz + sphere.w * vec3(
+            (i & 1) != 0 ? 1.0 : -1.0,
+            (i & 2) != 0 ? 1.0 : -1.0,
+            (i & 4) != 0 ? 1.0 : -1.0);
+
+        vec4 clip = PushConstants.cullMatrix * vec4(corner, 1.0);
+        if (clip.w <= 0.0)
+            return false;
+
+        // The viewport is flipped so that +y points up, see Context::BeginRendering
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 uv = vec2(ndc.x * 0.5 + 0.5, 0.5 - ndc.y * 0.5);
+
+        rect.xy = min(rect.xy, uv);
+        rect.zw = max(rect.zw, uv);
+        nearestDepth = min(nearestDepth, ndc.z);
+    }
+
+    return true;
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= PushConstants.objectCount)
+        return;
+
+    vec4 rect;
+    float nearestDepth;
+    bool projected = ProjectSphere(bounds[i], rect, nearestDepth);
+
+    // Spheres crossing the camera plane are kept, everything else must overlap the screen
+    bool visible = !projected ||
+        (rect.x < 1.0 && rect.y < 1.0 && rect.z > 0.0 && rect.w > 0.0 && nearestDepth <= 1.0);
+
+    DrawCommand draw = draws[i];
+
+    // Early: redraw what was visible last frame, it is the best occluder set available
+    if (PushConstants.phase == 0) {
+        draw.instanceCount = (visible && visibility[i] != 0) ? draw.instanceCount : 0;
+        earlyDraws[i] = draw;
+        return;
+    }
+
+    // Late: test against the pyramid built from the early pass' depth
+    if (visible && projected) {
+        rect = clamp(rect, 0.0, 1.0);
+        vec2 size = (rect.zw - rect.xy) * PushConstants.pyramidSize;
+
+        // Level at which the rect spans at most 2x2 texels
+        int level = int(ceil(log2(max(max(size.x, size.y), 1.0))));
+        level = min(level, textureQueryLevels(depthPyramid) - 1);
+
+        ivec2 levelSize = textureSize(depthPyramid, level);
+        ivec2 p0 = clamp(ivec2(rect.xy * vec2(levelSize)), ivec2(0), levelSize - 1);
+        ivec2 p1 = clamp(ivec2(rect.zw * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+        float farthest = max(
+            max(texelFetch(depthPyramid, p0, level).r, texelFetch(depthPyramid, ivec2(p1.x, p0.y), level).r),
+            max(texelFetch(depthPyramid, ivec2(p0.x, p1.y), level).r, texelFetch(depthPyramid, p1, level).r));
+
+        visible = nearestDepth <= farthest;
+    }
+
+    // Only objects the early pass skipped are drawn now, the rest are already on screen
+    draw.instanceCount = (visible && visibility[i] == 0) ? draw.instanceCount : 0;
+    lateDraws[i] = draw;
+
+    visibility[i] = visible ? 1 : 0;
+}
\ No newline at end of file
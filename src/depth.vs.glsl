@@ -0,0 +1,27 @@
+#version 450
+
+layout (location = 0) in vec3 aPos;
+
+// Must match test.vs.glsl exactly so the main pass can depth test with EQUAL
+invariant gl_Position;
+
+struct ObjectData {
+    mat4 modelMatrix;
+    uint material;
+};
+
+layout (set = 0, binding = 0) readonly buffer ObjectTable { ObjectData objects[]; };
+
+// vkr::LOD_FADE_BITS, see vkr::GetDrawInstanceSpecialization
+layout (constant_id = 0) const uint LOD_FADE_BITS = 9u;
+
+layout (push_constant) uniform constants {
+    mat4 viewProjectionMatrix;
+} PushConstants;
+
+void main() {
+    uint instance = uint(gl_InstanceIndex);
+    ObjectData object = objects[instance >> LOD_FADE_BITS];
+
+    gl_Position = PushConstants.viewProjectionMatrix * object.modelMatrix * vec4(aPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#version 450
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// The depth buffer for level 0, the pyramid itself for every other level
+layout (set = 0, binding = 0) uniform sampler2D srcDepth;
+layout (set = 0, binding = 1, r32f) uniform writeonly image2D dstLevel;
+
+layout (push_constant) uniform constants {
+    ivec2 srcSize;
+    ivec2 dstSize;
+    int srcLevel;
+} PushConstants;
+
+void main() {
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(texel, PushConstants.dstSize)))
+        return;
+
+    // Cover every source texel under this one so non-power-of-two sizes stay conservative
+    ivec2 begin = (texel * PushConstants.srcSize) / PushConstants.dstSize;
+    ivec2 end = ((texel + 1) * PushConstants.srcSize + PushConstants.dstSize - 1) / PushConstants.dstSize;
+    end = min(max(end, begin + 1), PushConstants.srcSize);
+
+    // Keep the farthest depth: anything behind it is behind every occluder in the footprint
+    float depth = 0.0;
+    for (int y = begin.y; y < end.y; y++)
+        for (int x = begin.x; x < end.x; x++)
+            depth = max(depth, texelFetch(srcDepth, ivec2(x, y), PushConstants.srcLevel).r);
+
+    imageStore(dstLevel, texel, vec4(depth));
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <volk/volk.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace vkr {
+
+    // What the sample and the benchmarks share with the object shaders, kept apart from the renderer core
+
+    // Per-object data of test.vs.glsl and depth.vs.glsl, std430 layout
+    struct ObjectData {
+        glm::mat4 modelMatrix;
+        uint32_t material;          // Index into the material table
+        uint32_t padding[3];
+    };
+
+    // Material parameters of test.fs.glsl, std430 layout
+    struct MaterialData {
+        glm::vec4 baseColor;
+    };
+
+    // Instance index of a draw of an object: the object's index into the object table above the low
+    // LOD_FADE_BITS, which carry a LOD fade (see EncodeLodFade). The object shaders split it back up
+    constexpr uint32_t LOD_FADE_BITS = 9;
+
+    inline uint32_t EncodeDrawInstance(uint32_t object, uint32_t lodFade = 0) {
+        return (object << LOD_FADE_BITS) | lodFade;
+    }
+
+    // Vertex specialization passing LOD_FADE_BITS to the object shaders (constant_id 0)
+    inline const VkSpecializationInfo* GetDrawInstanceSpecialization() {
+        static const uint32_t lodFadeBits = LOD_FADE_BITS;
+        static const VkSpecializationMapEntry entry = { 0, 0, sizeof(lodFadeBits) };
+        static const VkSpecializationInfo specialization = {
+            .mapEntryCount = 1,
+            .pMapEntries = &entry,
+            .dataSize = sizeof(lodFadeBits),
+            .pData = &lodFadeBits
+        };
+
+        return &specialization;
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "job_system.hpp"
+
+#include <cassert>
+
+namespace vkr {
+
+    namespace {
+
+        // The job system and queue of the current worker thread
+        thread_local const JobSystem* t_pJobSystem = nullptr;
+        thread_local uint32_t t_queue = 0;
+
+        // Attempts at finding a job before an idle worker goes to sleep
+        constexpr uint32_t IDLE_SPIN_COUNT = 64;
+
+    }
+
+    JobSystem::JobSystem(uint32_t threadCount) {
+        if (threadCount == 0)
+            threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+        m_queueCount = threadCount;
+        m_queues = std::make_unique<Queue[]>(m_queueCount);
+
+        for (uint32_t queue = 1; queue < m_queueCount; queue++)
+            m_threads.emplace_back(&JobSystem::WorkerMain, this, queue);
+    }
+
+    JobSystem::~JobSystem() {
+        {
+            std::lock_guard lock(m_sleepMutex);
+            m_exit = true;
+        }
+
+        m_wake.notify_all();
+
+        for (std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    void JobSystem::Run(std::function<void()>&& job, JobCounter& counter) {
+        counter.m_pending.fetch_add(1, std::memory_order_relaxed);
+
+        // Counted before it is queued, so a worker that sees no queued jobs has really nothing to take
+        m_queuedJobs.fetch_add(1);
+
+        Queue& queue = m_queues[GetQueue()];
+        {
+            std::lock_guard lock(queue.mutex);
+            queue.jobs.push_back({ std::move(job), &counter });
+        }
+
+        // Taking the lock orders this against a worker that is about to sleep
+        if (m_sleepingWorkers.load() > 0) {
+            { std::lock_guard lock(m_sleepMutex); }
+            m_wake.notify_one();
+        }
+    }
+
+    void JobSystem::Wait(const JobCounter& counter) {
+        uint32_t queue = GetQueue();
+
+        while (!counter.IsDone()) {
+            if (!TryRunJob(queue))
+                std::this_thread::yield();
+        }
+    }
+
+    void JobSystem::WorkerMain(uint32_t queue) {
+        t_pJobSystem = this;
+        t_queue = queue;
+
+        while (true) {
+            bool ran = false;
+            for (uint32_t spin = 0; spin < IDLE_SPIN_COUNT && !ran; spin++) {
+                ran = TryRunJob(queue);
+                if (!ran)
+                    std::this_thread::yield();
+            }
+
+            if (ran)
+                continue;
+
+            std::unique_lock lock(m_sleepMutex);
+            m_sleepingWorkers++;
+            m_wake.wait(lock, [this]() { return m_queuedJobs.load() > 0 || m_exit; });
+            m_sleepingWorkers--;
+
+            if (m_exit)
+                return;
+        }
+    }
+
+    bool JobSystem::TryRunJob(uint32_t queue) {
+        Job job;
+        if (!TryPop(queue, job) && !TrySteal(queue, job))
+            return false;
+
+        job.function();
+
+        // The counter may be gone as soon as it reaches zero
+        job.pCounter->m_pending.fetch_sub(1, std::memory_order_acq_rel);
+        return true;
+    }
+
+    bool JobSystem::TryPop(uint32_t queue, Job& job) {
+        Queue& own = m_queues[queue];
+        std::lock_guard lock(own.mutex);
+
+        if (own.jobs.empty())
+            return false;
+
+        // Newest first, its data is most likely still in cache
+        job = std::move(own.jobs.back());
+        own.jobs.pop_back();
+        m_queuedJobs.fetch_sub(1);
+        return true;
+    }
+
+    bool JobSystem::TrySteal(uint32_t queue, Job& job) {
+        // Victims are visited starting after the thief's own queue, so thieves spread over the workers
+        for (uint32_t i = 1; i < m_queueCount; i++) {
+            Queue& victim = m_queues[(queue + i) % m_queueCount];
+            std::lock_guard lock(victim.mutex);
+
+            if (victim.jobs.empty())
+                continue;
+
+            // Oldest first, parallel-for ranges and graph roots are queued in order, so this takes the furthest work
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            m_queuedJobs.fetch_sub(1);
+            return true;
+        }
+
+        return false;
+    }
+
+    uint32_t JobSystem::GetQueue() const {
+        return t_pJobSystem == this ? t_queue : 0;
+    }
+
+    TaskId TaskGraph::Add(std::function<void()>&& task, std::initializer_list<TaskId> dependencies) {
+        TaskId id = static_cast<TaskId>(m_tasks.size());
+
+        for (TaskId dependency : dependencies) {
+            assert(dependency < id && "tasks can only depend on tasks added before them");
+            m_tasks[dependency].dependents.push_back(id);
+        }
+
+        Task& added = m_tasks.emplace_back();
+        added.function = std::move(task);
+        added.dependencyCount = static_cast<uint32_t>(dependencies.size());
+
+        return id;
+    }
+
+    void TaskGraph::Execute(JobSystem& jobs) {
+        JobCounter counter;
+
+        for (Task& task : m_tasks)
+            task.remainingDependencies.store(task.dependencyCount, std::memory_order_relaxed);
+
+        for (TaskId id = 0; id < m_tasks.size(); id++) {
+            if (m_tasks[id].dependencyCount == 0)
+                Schedule(jobs, counter, id);
+        }
+
+        jobs.Wait(counter);
+    }
+
+    void TaskGraph::Schedule(JobSystem& jobs, JobCounter& counter, TaskId id) {
+        jobs.Run([this, &jobs, &counter, id]() {
+            Task& task = m_tasks[id];
+            task.function();
+
+            // Dependents are queued before this task counts as finished, so the counter never drops to zero early
+            for (TaskId dependent : task.dependents) {
+                if (m_tasks[dependent].remainingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    Schedule(jobs, counter, dependent);
+            }
+        }, counter);
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vkr {
+
+    // Jobs still running under a counter, waiting on it runs other jobs meanwhile
+    class JobCounter {
+    public:
+        JobCounter() = default;
+        JobCounter(const JobCounter&) = delete;
+        JobCounter& operator=(const JobCounter&) = delete;
+
+        bool IsDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class JobSystem;
+
+        std::atomic<uint32_t> m_pending = 0;
+    };
+
+    // Work-stealing scheduler: every worker owns a deque, takes its newest job first and steals the oldest
+    // job of another worker when it runs out. Threads that are not workers push into a shared deque
+    class JobSystem {
+    public:
+        // threadCount counts the calling thread, 0 uses every hardware thread
+        explicit JobSystem(uint32_t threadCount = 0);
+        ~JobSystem();
+
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        // Workers plus the thread that waits
+        uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+        void Run(std::function<void()>&& job, JobCounter& counter);
+
+        // Run fn(begin, end) over [0, count) in ranges of up to grainSize items
+        template <typename TFn>
+        void ParallelFor(uint32_t count, uint32_t grainSize, JobCounter& counter, TFn&& fn) {
+            grainSize = std::max(grainSize, 1u);
+
+            for (uint32_t begin = 0; begin < count; begin += grainSize) {
+                uint32_t end = std::min(begin + grainSize, count);
+                Run([fn, begin, end]() { fn(begin, end); }, counter);
+            }
+        }
+
+        // As above, returns once every range has run
+        template <typename TFn>
+        void ParallelFor(uint32_t count, uint32_t grainSize, TFn&& fn) {
+            JobCounter counter;
+            ParallelFor(count, grainSize, counter, std::forward<TFn>(fn));
+            Wait(counter);
+        }
+
+        // Run jobs until the counter's jobs have finished, safe to call from inside a job
+        void Wait(const JobCounter& counter);
+
+    private:
+        struct Job {
+            std::function<void()> function;
+            JobCounter* pCounter;
+        };
+
+        // Padded to a cache line so that workers taking from their own deques do not contend
+        struct alignas(64) Queue {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        void WorkerMain(uint32_t queue);
+        bool TryRunJob(uint32_t queue);
+        bool TryPop(uint32_t queue, Job& job);
+        bool TrySteal(uint32_t queue, Job& job);
+
+        uint32_t GetQueue() const;
+
+        // Queue 0 is shared by threads that are not workers, worker i owns queue i + 1
+        std::unique_ptr<Queue[]> m_queues;
+        uint32_t m_queueCount;
+
+        std::atomic<uint32_t> m_queuedJobs = 0;
+
+        // Idle workers sleep until a job is queued
+        std::mutex m_sleepMutex;
+        std::condition_variable m_wake;
+        std::atomic<uint32_t> m_sleepingWorkers = 0;
+        bool m_exit = false;
+
+        std::vector<std::thread> m_threads;     // Last, so workers start after everything they use
+    };
+
+    using TaskId = uint32_t;
+
+    // A frame's jobs and the order between them. Build it once, or again every frame after Clear,
+    // and Execute it as many times as needed
+    class TaskGraph {
+    public:
+        // Dependencies are tasks added earlier, a task starts once all of them have finished
+        TaskId Add(std::function<void()>&& task, std::initializer_list<TaskId> dependencies = {});
+
+        // Run every task on the job system, returns once all of them have finished
+        void Execute(JobSystem& jobs);
+
+        void Clear() { m_tasks.clear(); }
+
+    private:
+        struct Task {
+            std::function<void()> function;
+            std::vector<TaskId> dependents;
+            uint32_t dependencyCount = 0;
+            std::atomic<uint32_t> remainingDependencies = 0;
+        };
+
+        void Schedule(JobSystem& jobs, JobCounter& counter, TaskId id);
+
+        std::deque<Task> m_tasks;               // Deque, so tasks stay in place as more are added
+    };
+
+}
\ No newline at end of file
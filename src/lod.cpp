@@ -0,0 +1,311 @@
+#include "lod.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace vkr {
+
+    // Symmetric 4x4 matrix summing the squared distance to a set of planes
+    struct Quadric {
+        double xx = 0.0, xy = 0.0, xz = 0.0, xw = 0.0;
+        double yy = 0.0, yz = 0.0, yw = 0.0;
+        double zz = 0.0, zw = 0.0;
+        double ww = 0.0;
+        double planeCount = 0.0;
+
+        void AddPlane(const glm::dvec3& n, double d) {
+            xx += n.x * n.x; xy += n.x * n.y; xz += n.x * n.z; xw += n.x * d;
+            yy += n.y * n.y; yz += n.y * n.z; yw += n.y * d;
+            zz += n.z * n.z; zw += n.z * d;
+            ww += d * d;
+            planeCount += 1.0;
+        }
+
+        void Add(const Quadric& q) {
+            xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+            yy += q.yy; yz += q.yz; yw += q.yw;
+            zz += q.zz; zw += q.zw;
+            ww += q.ww;
+            planeCount += q.planeCount;
+        }
+
+        double Evaluate(const glm::dvec3& p) const {
+            double error = xx * p.x * p.x + yy * p.y * p.y + zz * p.z * p.z + ww
+                + 2.0 * (xy * p.x * p.y + xz * p.x * p.z + yz * p.y * p.z + xw * p.x + yw * p.y + zw * p.z);
+            return std::max(error, 0.0);
+        }
+
+        // Root mean square distance to the planes
+        double Distance(const glm::dvec3& p) const {
+            return planeCount > 0.0 ? std::sqrt(Evaluate(p) / planeCount) : 0.0;
+        }
+    };
+
+    struct Collapse {
+        uint32_t from;
+        uint32_t to;
+        double cost;
+    };
+
+    static glm::vec3 TriangleNormal(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+        return glm::cross(p1 - p0, p2 - p0);
+    }
+
+    // Moving from onto to turns a triangle around from over, or collapses it to a line
+    static bool CollapseFlips(std::span<const uint32_t> indices, std::span<const uint32_t> triangles,
+        std::span<const glm::vec3> positions, uint32_t from, uint32_t to) {
+        for (uint32_t triangle : triangles) {
+            const uint32_t* pTriangle = &indices[triangle * 3];
+            if (pTriangle[0] == to || pTriangle[1] == to || pTriangle[2] == to)
+                continue;   // Becomes degenerate and is removed
+
+            glm::vec3 p[3], moved[3];
+            for (uint32_t v = 0; v < 3; v++) {
+                p[v] = positions[pTriangle[v]];
+                moved[v] = pTriangle[v] == from ? positions[to] : p[v];
+            }
+
+            glm::vec3 before = TriangleNormal(p[0], p[1], p[2]);
+            glm::vec3 after = TriangleNormal(moved[0], moved[1], moved[2]);
+            if (glm::dot(before, after) <= 0.0f)
+                return true;
+        }
+
+        return false;
+    }
+
+    // One round of edge collapses, vertices are moved onto a neighbour and no neighbourhood changes twice
+    // Returns the number of collapses, error grows to the largest collapse error
+    static size_t CollapseEdges(std::vector<uint32_t>& indices, std::span<const glm::vec3> positions,
+        std::vector<Quadric>& quadrics, size_t maxCollapses, float& error) {
+        size_t vertexCount = positions.size();
+        size_t triangleCount = indices.size() / 3;
+
+        // Edges shared by one triangle are borders, edges shared by more than two are non-manifold. Both are locked
+        std::vector<std::pair<uint32_t, uint32_t>> edges;
+        edges.reserve(indices.size());
+
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (uint32_t e = 0; e < 3; e++) {
+                uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+                edges.push_back({ std::min(a, b), std::max(a, b) });
+            }
+        }
+
+        std::sort(edges.begin(), edges.end());
+
+        std::vector<bool> locked(vertexCount, false);
+        std::vector<std::pair<uint32_t, uint32_t>> interiorEdges;
+
+        for (size_t i = 0; i < edges.size();) {
+            size_t shared = 1;
+            while (i + shared < edges.size() && edges[i + shared] == edges[i])
+                shared++;
+
+            if (shared == 2) {
+                interiorEdges.push_back(edges[i]);
+            }
+            else {
+                locked[edges[i].first] = true;
+                locked[edges[i].second] = true;
+            }
+
+            i += shared;
+        }
+
+        // Cheapest direction of every collapsible edge
+        std::vector<Collapse> collapses;
+
+        for (auto [a, b] : interiorEdges) {
+            if (locked[a] && locked[b])
+                continue;
+
+            auto cost = [&](uint32_t from, uint32_t to) {
+                if (locked[from])
+                    return std::numeric_limits<double>::infinity();
+
+                Quadric q = quadrics[from];
+                q.Add(quadrics[to]);
+                return q.Distance(glm::dvec3(positions[to]));
+            };
+
+            double costAB = cost(a, b), costBA = cost(b, a);
+            if (costAB <= costBA)
+                collapses.push_back({ a, b, costAB });
+            else
+                collapses.push_back({ b, a, costBA });
+        }
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& lhs, const Collapse& rhs) {
+            return lhs.cost < rhs.cost;
+        });
+
+        // Triangles around each vertex
+        std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+        for (uint32_t index : indices)
+            triangleOffsets[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            triangleOffsets[v + 1] += triangleOffsets[v];
+
+        std::vector<uint32_t> vertexTriangles(indices.size());
+        std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            vertexTriangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+        std::vector<uint32_t> remap(vertexCount);
+        std::iota(remap.begin(), remap.end(), 0);
+
+        std::vector<bool> touched(vertexCount, false);
+        size_t collapseCount = 0;
+
+        for (auto& collapse : collapses) {
+            if (collapseCount == maxCollapses)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            std::span<const uint32_t> triangles(vertexTriangles.data() + triangleOffsets[collapse.from],
+                triangleOffsets[collapse.from + 1] - triangleOffsets[collapse.from]);
+
+            if (CollapseFlips(indices, triangles, positions, collapse.from, collapse.to))
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].Add(quadrics[collapse.from]);
+            error = std::max(error, static_cast<float>(collapse.cost));
+
+            // Flip tests assume the neighbourhood is unchanged, so it is left alone until the next round
+            for (uint32_t triangle : triangles) {
+                for (uint32_t v = 0; v < 3; v++)
+                    touched[indices[triangle * 3 + v]] = true;
+            }
+
+            collapseCount++;
+        }
+
+        // Remap, dropping the triangles that lost a vertex
+        size_t writeIndex = 0;
+
+        for (size_t t = 0; t < triangleCount; t++) {
+            uint32_t a = remap[indices[t * 3]], b = remap[indices[t * 3 + 1]], c = remap[indices[t * 3 + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+
+            indices[writeIndex++] = a;
+            indices[writeIndex++] = b;
+            indices[writeIndex++] = c;
+        }
+
+        indices.resize(writeIndex);
+
+        return collapseCount;
+    }
+
+    LodChain BuildLodChain(std::span<const glm::vec3> positions, std::span<const uint32_t> indices, const LodChainDesc& desc) {
+        LodChain chain;
+        chain.indices.assign(indices.begin(), indices.end());
+        chain.levels.push_back({
+            .indexOffset = 0,
+            .indexCount = static_cast<uint32_t>(indices.size()),
+            .error = 0.0f
+        });
+
+        // Each vertex starts out with the planes of its triangles
+        std::vector<Quadric> quadrics(positions.size());
+
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            glm::dvec3 p0 = positions[indices[i]], p1 = positions[indices[i + 1]], p2 = positions[indices[i + 2]];
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+
+            double length = glm::length(normal);
+            if (length == 0.0)
+                continue;
+
+            normal /= length;
+            for (uint32_t v = 0; v < 3; v++)
+                quadrics[indices[i + v]].AddPlane(normal, -glm::dot(normal, p0));
+        }
+
+        std::vector<uint32_t> current(indices.begin(), indices.end());
+        float error = 0.0f;
+
+        while (chain.levels.size() < desc.maxLevels) {
+            size_t targetTriangles = static_cast<size_t>(current.size() / 3 * desc.reduction);
+            if (targetTriangles < desc.minTriangles)
+                break;
+
+            size_t previousCount = current.size();
+
+            // An interior collapse removes two triangles
+            while (current.size() > targetTriangles * 3) {
+                size_t excessTriangles = current.size() / 3 - targetTriangles;
+                if (CollapseEdges(current, positions, quadrics, std::max<size_t>(excessTriangles / 2, 1), error) == 0)
+                    break;
+            }
+
+            // Locked borders keep the mesh from shrinking any further
+            if (current.size() > previousCount * 9 / 10)
+                break;
+
+            chain.levels.push_back({
+                .indexOffset = static_cast<uint32_t>(chain.indices.size()),
+                .indexCount = static_cast<uint32_t>(current.size()),
+                .error = error
+            });
+            chain.indices.insert(chain.indices.end(), current.begin(), current.end());
+        }
+
+        return chain;
+    }
+
+    uint32_t EncodeLodFade(float fade, bool incoming) {
+        // Low 8 bits: fade in 1/256 steps, bit 8: incoming level
+        uint32_t step = std::clamp(static_cast<uint32_t>(fade * 256.0f), 1u, 255u);
+        return incoming ? (step | 0x100) : step;
+    }
+
+    LodSelector::LodSelector(const LodSelectorDesc& desc)
+        : m_desc(desc) {
+    }
+
+    LodSelection LodSelector::Select(uint32_t object, std::span<const LodLevel> levels, float distance, float projectionScale) {
+        constexpr uint32_t NO_LEVEL = ~0u;
+
+        if (m_objects.size() <= object)
+            m_objects.resize(object + 1, { NO_LEVEL, NO_LEVEL, 0.0f });
+
+        ObjectLod& lod = m_objects[object];
+        float pixelsPerUnit = projectionScale / std::max(distance, 1e-4f);
+
+        // Coarsest level within the threshold, levels up to the current one get the hysteresis allowance
+        uint32_t target = 0;
+        for (uint32_t level = 1; level < levels.size(); level++) {
+            float threshold = m_desc.errorThreshold;
+            if (lod.level != NO_LEVEL && level <= lod.level)
+                threshold *= 1.0f + m_desc.hysteresis;
+
+            if (levels[level].error * pixelsPerUnit > threshold)
+                break;
+
+            target = level;
+        }
+
+        // New objects start at their level, a fade in progress finishes before the next one starts
+        if (lod.level == NO_LEVEL || lod.level >= levels.size()) {
+            lod = { target, target, 0.0f };
+        }
+        else if (lod.previousLevel != lod.level) {
+            lod.fade += 1.0f / m_desc.fadeFrames;
+            if (lod.fade >= 1.0f)
+                lod = { lod.level, lod.level, 0.0f };
+        }
+        else if (target != lod.level) {
+            lod = { target, m_desc.fadeFrames > 0 ? lod.level : target, 0.0f };
+        }
+
+        return { lod.level, lod.previousLevel, lod.fade };
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace vkr {
+
+    constexpr uint32_t MAX_LOD_LEVELS = 8;
+
+    struct LodLevel {
+        uint32_t indexOffset;
+        uint32_t indexCount;
+        float error;                // Geometric error against the full detail mesh, in model space units
+    };
+
+    // Levels of detail over one vertex buffer, level 0 is the full detail mesh
+    struct LodChain {
+        std::vector<uint32_t> indices;      // Every level's triangle list, back to back
+        std::vector<LodLevel> levels;       // Finest to coarsest, errors never decrease
+    };
+
+    struct LodChainDesc {
+        uint32_t maxLevels = MAX_LOD_LEVELS;
+        float reduction = 0.5f;             // Target triangle count of each level relative to the previous one
+        uint32_t minTriangles = 32;         // No level goes below this
+    };
+
+    // Simplify a triangle list into a LOD chain by quadric error edge collapses
+    // Open borders, including UV and normal seams split into separate vertices, are kept in place
+    LodChain BuildLodChain(std::span<const glm::vec3> positions, std::span<const uint32_t> indices, const LodChainDesc& desc = {});
+
+    struct LodSelectorDesc {
+        float errorThreshold = 1.0f;        // Largest acceptable projected error in pixels
+        float hysteresis = 0.25f;           // The current level is kept until its error exceeds the threshold by this fraction
+        uint32_t fadeFrames = 16;           // Cross-fade length of a level change, 0 switches instantly
+    };
+
+    struct LodSelection {
+        uint32_t level;
+        uint32_t previousLevel;             // Level being faded out, equal to level when not fading
+        float fade;                         // Progress of the fade to level in [0, 1)
+    };
+
+    // Low instance index bits (see EncodeDrawInstance) telling test.fs.glsl (LOD_FADE) which pixels of a fading
+    // level to keep, the previous and the new level keep complementary pixels. 0 draws every pixel
+    uint32_t EncodeLodFade(float fade, bool incoming);
+
+    // Per-object LOD choice from projected screen-space error, objects are identified by index
+    class LodSelector {
+    public:
+        explicit LodSelector(const LodSelectorDesc& desc = {});
+
+        // Call once per object per frame
+        // distance is from the camera to the object's bounds, projectionScale is viewport height / (2 * tan(fovY / 2))
+        LodSelection Select(uint32_t object, std::span<const LodLevel> levels, float distance, float projectionScale);
+
+    private:
+        struct ObjectLod {
+            uint32_t level;
+            uint32_t previousLevel;
+            float fade;
+        };
+
+        LodSelectorDesc m_desc;
+        std::vector<ObjectLod> m_objects;
+    };
+
+}
\ No newline at end of file
@@ -1,4 +1,14 @@
+#include "animation.hpp"
 #include "context.hpp"
+#include "draw_instance.hpp"
+#include "job_system.hpp"
+#include "lod.hpp"
+#include "meshlet.hpp"
+#include "occlusion.hpp"
+#include "render_graph.hpp"
+#include "shader_manifest.hpp"
+#include "skinning.hpp"
+#include "storage_table.hpp"
 #include "util.hpp"
 
 #if defined(VKR_WIN32)
@@ -14,7 +24,14 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <tiny_gltf.h>
+#include <stb_image.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 
 constexpr uint32_t WINDOW_WIDTH = 1024;
@@ -22,32 +39,218 @@ constexpr uint32_t WINDOW_HEIGHT = 768;
 
 struct MeshPart {
     vkr::BufferHandle vbo, nbo, uvbo, ibo;
-    vkr::BufferHandle mbo; // TODO: material buffer- testing only
     uint32_t indexOffset, indexCount;
     VkIndexType indexType;
     uint32_t colorTextureIndex;
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    std::vector<vkr::LodLevel> lods;    // Index ranges into ibo, empty without LOD selection
+
+    // Skinned parts draw from their skinning instance's vertex buffers, vbo and nbo name them
+    int32_t skin = -1;
+    uint32_t skinInstance;
 };
 
 struct Mesh {
     std::vector<MeshPart> parts;
 };
 
-struct Material {
-    glm::vec4 baseColor;
+// A glTF skin, posed on the CPU every frame
+struct Skin {
+    vkr::Skeleton skeleton;
+    std::vector<vkr::AnimationClip> clips;      // Animations that drive the skin's joints, the first one plays
+    std::vector<vkr::JointTransform> pose;
+    std::vector<glm::mat4> jointMatrices;
+};
+
+// What a frame's passes draw with
+struct FrameState {
+    glm::mat4 viewMatrix;
+    glm::mat4 viewProjectionMatrix;
+    glm::mat4 modelMatrix;
+    VkExtent2D renderExtent;
+    std::vector<vkr::LodSelection> lodSelections;
+};
+
+// Specialization constants of test.fs.glsl, in constant_id order
+struct TestLighting {
+    float ambient;
+    float lightIntensity;
+    glm::vec3 lightDirection;
+    float alphaCutoff;
 };
 
+// glTF image loader that only reads the header, the texels are decoded later as jobs
+static bool DeferImageDecode(tinygltf::Image* pImage, const int imageIndex, std::string* pErr, std::string* pWarn,
+    int reqWidth, int reqHeight, const unsigned char* pBytes, int size, void* pUserData) {
+    auto& encodedImages = *static_cast<std::vector<std::vector<unsigned char>>*>(pUserData);
+
+    int width = 0, height = 0, components = 0;
+    if (!stbi_info_from_memory(pBytes, size, &width, &height, &components)) {
+        if (pErr)
+            *pErr += "Unknown image format\n";
+        return false;
+    }
+
+    pImage->width = width;
+    pImage->height = height;
+    pImage->component = 4;
+    pImage->bits = 8;
+    pImage->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+
+    if (encodedImages.size() <= size_t(imageIndex))
+        encodedImages.resize(imageIndex + 1);
+    encodedImages[imageIndex].assign(pBytes, pBytes + size);
+
+    return true;
+}
+
+// Element i of an accessor, following the buffer view's stride
+static const uint8_t* AccessorElement(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t i) {
+    const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+    size_t stride = static_cast<size_t>(accessor.ByteStride(view));
+    return model.buffers[view.buffer].data.data() + view.byteOffset + accessor.byteOffset + i * stride;
+}
+
+// Float or normalized integer component c of accessor element i
+static float AccessorFloat(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t i, size_t c) {
+    const uint8_t* pElement = AccessorElement(model, accessor, i);
+
+    switch (accessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_BYTE:              return std::max(reinterpret_cast<const int8_t*>(pElement)[c] / 127.0f, -1.0f);
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:     return pElement[c] / 255.0f;
+    case TINYGLTF_COMPONENT_TYPE_SHORT:             return std::max(reinterpret_cast<const int16_t*>(pElement)[c] / 32767.0f, -1.0f);
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:    return reinterpret_cast<const uint16_t*>(pElement)[c] / 65535.0f;
+    default:                                        return reinterpret_cast<const float*>(pElement)[c];
+    }
+}
+
+static glm::mat4 NodeMatrix(const tinygltf::Node& node) {
+    if (node.matrix.size() == 16) {
+        glm::mat4 matrix;
+        for (int i = 0; i < 16; i++)
+            matrix[i / 4][i % 4] = static_cast<float>(node.matrix[i]);
+        return matrix;
+    }
+
+    glm::mat4 matrix(1.0f);
+    if (node.translation.size() == 3)
+        matrix = glm::translate(matrix, glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+    if (node.rotation.size() == 4)
+        matrix *= glm::mat4_cast(glm::quat(float(node.rotation[3]), float(node.rotation[0]), float(node.rotation[1]), float(node.rotation[2])));
+    if (node.scale.size() == 3)
+        matrix = glm::scale(matrix, glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+
+    return matrix;
+}
+
+// Local transform of a joint node, node matrices are split into translation, rotation and scale
+static vkr::JointTransform NodeTransform(const tinygltf::Node& node) {
+    glm::mat4 matrix = NodeMatrix(node);
+
+    vkr::JointTransform transform;
+    transform.translation = glm::vec3(matrix[3]);
+    transform.scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+    transform.rotation = glm::normalize(glm::quat_cast(glm::mat3(
+        glm::vec3(matrix[0]) / transform.scale.x,
+        glm::vec3(matrix[1]) / transform.scale.y,
+        glm::vec3(matrix[2]) / transform.scale.z)));
+
+    return transform;
+}
+
+// Skeleton of a glTF skin and the animation channels that target its joints
+static Skin LoadSkin(const tinygltf::Model& model, const tinygltf::Skin& gltfSkin, std::span<const int> nodeParents) {
+    Skin skin = {};
+    uint32_t jointCount = static_cast<uint32_t>(gltfSkin.joints.size());
+
+    std::vector<int32_t> nodeJoints(model.nodes.size(), -1);
+    for (uint32_t joint = 0; joint < jointCount; joint++)
+        nodeJoints[gltfSkin.joints[joint]] = static_cast<int32_t>(joint);
+
+    for (uint32_t joint = 0; joint < jointCount; joint++) {
+        int node = gltfSkin.joints[joint];
+        int parentNode = nodeParents[node];
+
+        skin.skeleton.parents.push_back(parentNode >= 0 ? nodeJoints[parentNode] : -1);
+        skin.skeleton.restPose.push_back(NodeTransform(model.nodes[node]));
+
+        glm::mat4 inverseBindMatrix(1.0f);
+        if (gltfSkin.inverseBindMatrices >= 0)
+            memcpy(&inverseBindMatrix, AccessorElement(model, model.accessors[gltfSkin.inverseBindMatrices], joint), sizeof(glm::mat4));
+        skin.skeleton.inverseBindMatrices.push_back(inverseBindMatrix);
+
+        // Nodes above the skeleton are not animated, their transform is baked in once
+        if (skin.skeleton.parents.back() < 0 && parentNode >= 0) {
+            glm::mat4 rootTransform(1.0f);
+            for (int ancestor = parentNode; ancestor >= 0; ancestor = nodeParents[ancestor])
+                rootTransform = NodeMatrix(model.nodes[ancestor]) * rootTransform;
+            skin.skeleton.rootTransform = rootTransform;
+        }
+    }
+
+    for (const tinygltf::Animation& animation : model.animations) {
+        vkr::AnimationClip clip = {};
+        clip.duration = 0.0f;
+
+        for (const tinygltf::AnimationChannel& gltfChannel : animation.channels) {
+            if (gltfChannel.target_node < 0 || nodeJoints[gltfChannel.target_node] < 0)
+                continue;
+
+            vkr::AnimationChannel channel = {};
+            channel.joint = static_cast<uint32_t>(nodeJoints[gltfChannel.target_node]);
+
+            if (gltfChannel.target_path == "translation")   channel.path = vkr::AnimationPath::Translation;
+            else if (gltfChannel.target_path == "rotation") channel.path = vkr::AnimationPath::Rotation;
+            else if (gltfChannel.target_path == "scale")    channel.path = vkr::AnimationPath::Scale;
+            else                                            continue;   // Morph target weights
+
+            const tinygltf::AnimationSampler& sampler = animation.samplers[gltfChannel.sampler];
+            const tinygltf::Accessor& input = model.accessors[sampler.input];
+            const tinygltf::Accessor& output = model.accessors[sampler.output];
+
+            // Cubic spline keys are (in-tangent, value, out-tangent), only the values are kept and interpolated linearly
+            bool cubicSpline = sampler.interpolation == "CUBICSPLINE";
+            channel.interpolation = sampler.interpolation == "STEP" ? vkr::AnimationInterpolation::Step : vkr::AnimationInterpolation::Linear;
+
+            size_t componentCount = channel.path == vkr::AnimationPath::Rotation ? 4 : 3;
+
+            for (size_t key = 0; key < input.count; key++) {
+                size_t element = cubicSpline ? key * 3 + 1 : key;
+
+                glm::vec4 value(0.0f);
+                for (size_t c = 0; c < componentCount; c++)
+                    value[c] = AccessorFloat(model, output, element, c);
+
+                channel.times.push_back(AccessorFloat(model, input, key, 0));
+                channel.values.push_back(value);
+            }
+
+            if (channel.times.empty())
+                continue;
+
+            clip.duration = std::max(clip.duration, channel.times.back());
+            clip.channels.push_back(std::move(channel));
+        }
+
+        if (!clip.channels.empty())
+            skin.clips.push_back(std::move(clip));
+    }
+
+    skin.pose = skin.skeleton.restPose;
+    skin.jointMatrices.resize(jointCount);
+
+    return skin;
+}
+
 int main(int argc, char** argv) {
     // Setup window
     glfwInit();
 
     GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "vkr", nullptr, nullptr);
 
-    // Load GLTF
-    tinygltf::TinyGLTF gltfLoader;
-    tinygltf::Model gltfModel;
-
-    bool gltfLoadResult = gltfLoader.LoadBinaryFromFile(&gltfModel, nullptr, nullptr, "../res/Avocado.glb");
-    assert(gltfLoadResult != false);
+    // One scheduler for the sample's CPU work, the main thread helps out whenever it waits on it
+    vkr::JobSystem jobs;
 
     vkr::PresentationParameters params = {};
     #if defined(VKR_LINUX)
@@ -55,11 +258,133 @@ int main(int argc, char** argv) {
         params.window = glfwGetX11Window(window);
     #endif
 
+    // Frame pacing options: --frames-in-flight <1-3> --present-mode <fifo|relaxed|mailbox|immediate> --low-latency
+    //                       --render-thread
+    // Rendering options: --depth-prepass --occlusion-culling --meshlet-culling --lod --alpha-test --dynamic-resolution
+    // Device options: --device <name substring|uuid>
+    // Memory options: --defragment
+    // Capture options: --capture <file>, replayed with vkr-replay
+    // Scene options: --model <file.glb>
+    bool depthPrepass = false;
+    bool occlusionCulling = false;
+    bool meshletCulling = false;
+    bool lodSelection = false;
+    bool alphaTest = false;
+    bool dynamicResolution = false;
+    bool defragment = false;
+    const char* capturePath = nullptr;
+    const char* modelPath = "../res/Avocado.glb";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--depth-prepass") == 0) {
+            depthPrepass = true;
+        }
+        else if (strcmp(argv[i], "--occlusion-culling") == 0) {
+            occlusionCulling = true;
+        }
+        else if (strcmp(argv[i], "--meshlet-culling") == 0) {
+            meshletCulling = true;
+        }
+        else if (strcmp(argv[i], "--lod") == 0) {
+            lodSelection = true;
+        }
+        else if (strcmp(argv[i], "--alpha-test") == 0) {
+            alphaTest = true;
+        }
+        else if (strcmp(argv[i], "--dynamic-resolution") == 0) {
+            dynamicResolution = true;
+        }
+        else if (strcmp(argv[i], "--defragment") == 0) {
+            defragment = true;
+        }
+        else if (strcmp(argv[i], "--low-latency") == 0) {
+            params.framePacing.lowLatency = true;
+        }
+        else if (strcmp(argv[i], "--render-thread") == 0) {
+            params.renderThread = true;
+        }
+        else if (strcmp(argv[i], "--async-compute") == 0) {
+            params.asyncCompute = true;
+        }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capturePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            modelPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+            params.deviceSelection.device = argv[++i];
+        }
+        else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+            params.framePacing.framesInFlight = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "relaxed") == 0)           params.framePacing.presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+            else if (strcmp(mode, "mailbox") == 0)      params.framePacing.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+            else if (strcmp(mode, "immediate") == 0)    params.framePacing.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            else                                        params.framePacing.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        }
+    }
+
+    // The depth pyramid is built from the full depth extent, which a scaled frame only partly covers
+    if (dynamicResolution)
+        occlusionCulling = false;
+
+    // The early occlusion pass already lays down depth for the late pass
+    if (occlusionCulling)
+        depthPrepass = false;
+
+    // The depth pipeline has no fragment shader to discard cut-out pixels, the pre-pass would write their depth
+    if (alphaTest)
+        depthPrepass = false;
+
+    // The cullers build their own draws at full detail, LODs are picked for CPU-issued draws only
+    if (occlusionCulling || meshletCulling)
+        lodSelection = false;
+
+    // Cross-fading LODs discard pixels the depth pre-pass has already written, so pre-pass LODs switch instantly
+    bool lodFade = lodSelection && !depthPrepass;
+
+    // Load GLTF
+    tinygltf::TinyGLTF gltfLoader;
+    tinygltf::Model gltfModel;
+
+    std::vector<std::vector<unsigned char>> encodedImages;
+    gltfLoader.SetImageLoader(DeferImageDecode, &encodedImages);
+
+    bool gltfLoadResult = gltfLoader.LoadBinaryFromFile(&gltfModel, nullptr, nullptr, modelPath);
+    assert(gltfLoadResult != false);
+
     // Setup context and pipeline
     std::shared_ptr<vkr::Context> context = std::make_shared<vkr::Context>(params);
 
-    FileReader vsFile("test.vs.spv");
-    FileReader fsFile("test.fs.spv");
+    // Streamed textures filter their mip chains on the workers, the first frames bind placeholders meanwhile
+    context->SetJobSystem(&jobs);
+
+    // Record from before the first resource is created so the capture replays on its own, until the context is destroyed
+    if (capturePath != nullptr) {
+        [[maybe_unused]] bool captureStarted = context->BeginCapture(capturePath);
+        assert(captureStarted && "failed to open the capture file");
+    }
+
+    // Shader variants come from the manifest written by the shader build
+    vkr::ShaderManifest shaderManifest;
+    if (!shaderManifest) {
+        fprintf(stderr, "vkr: shaders.manifest not found, build the shaders first\n");
+        context.reset();
+        glfwTerminate();
+        return 1;
+    }
+
+    std::vector<const char*> fsKeywords;
+    if (alphaTest)
+        fsKeywords.push_back("ALPHA_TEST");
+    if (lodFade)
+        fsKeywords.push_back("LOD_FADE");
+
+    FileReader vsFile(shaderManifest.GetVariant("test.vs"));
+    FileReader fsFile(shaderManifest.GetVariant("test.fs", fsKeywords));
     
     vkr::ShaderDesc sd;
     sd.pData = vsFile.Data();
@@ -89,9 +414,93 @@ int main(int argc, char** argv) {
 
     gpd.vertexShader = vs;
     gpd.fragmentShader = fs;
+    gpd.vertexSpecialization = vkr::GetDrawInstanceSpecialization();
+
+    // Lighting is baked into the fragment shader when the pipeline is compiled
+    TestLighting lighting = {
+        .ambient = 0.27f,
+        .lightIntensity = 1.0f,
+        .lightDirection = glm::vec3(0.5f, 0.75f, 0.0f),
+        .alphaCutoff = 0.5f
+    };
+
+    VkSpecializationMapEntry lightingEntries[] = {
+        { 0, offsetof(TestLighting, ambient), sizeof(float) },
+        { 1, offsetof(TestLighting, lightIntensity), sizeof(float) },
+        { 2, offsetof(TestLighting, lightDirection), sizeof(float) },
+        { 3, offsetof(TestLighting, lightDirection) + sizeof(float), sizeof(float) },
+        { 4, offsetof(TestLighting, lightDirection) + sizeof(float) * 2, sizeof(float) },
+        { 5, offsetof(TestLighting, alphaCutoff), sizeof(float) }
+    };
+
+    VkSpecializationInfo lightingSpecialization = {
+        .mapEntryCount = static_cast<uint32_t>(std::size(lightingEntries)),
+        .pMapEntries = lightingEntries,
+        .dataSize = sizeof(lighting),
+        .pData = &lighting
+    };
+
+    gpd.fragmentSpecialization = &lightingSpecialization;
+
+    // With a pre-pass, depth is already final: only shade the visible fragment
+    if (depthPrepass) {
+        gpd.depthStencil.depthWrite = false;
+        gpd.depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
 
     vkr::GraphicsPipelineHandle pipeline = context->CreateGraphicsPipeline(gpd);
 
+    // Position-only pipeline for the depth pre-pass
+    vkr::GraphicsPipelineHandle depthPipeline = 0;
+
+    if (depthPrepass) {
+        FileReader depthVsFile(shaderManifest.GetVariant("depth.vs"));
+
+        sd.pData = depthVsFile.Data();
+        sd.size = depthVsFile.Size();
+        VkShaderModule depthVs = context->CreateShader(sd);
+
+        vkr::GraphicsPipelineDesc depthGpd = {};
+        depthGpd.vertexAttribs.push_back(gpd.vertexAttribs[0]);
+        depthGpd.vertexShader = depthVs;
+        depthGpd.vertexSpecialization = vkr::GetDrawInstanceSpecialization();
+        depthGpd.fragmentShader = nullptr;
+        depthGpd.depthOnly = true;
+
+        depthPipeline = context->CreateGraphicsPipeline(depthGpd);
+        context->DestroyShader(depthVs);
+    }
+
+    // Shader modules are baked into the pipeline and no longer needed
+    context->DestroyShader(vs);
+    context->DestroyShader(fs);
+
+    if (dynamicResolution) {
+        FileReader upscaleVsFile(shaderManifest.GetVariant("upscale.vs"));
+        FileReader upscaleFsFile(shaderManifest.GetVariant("upscale.fs"));
+
+        sd.pData = upscaleVsFile.Data();
+        sd.size = upscaleVsFile.Size();
+        VkShaderModule upscaleVs = context->CreateShader(sd);
+
+        sd.pData = upscaleFsFile.Data();
+        sd.size = upscaleFsFile.Size();
+        VkShaderModule upscaleFs = context->CreateShader(sd);
+
+        context->SetDynamicResolution({
+            .enabled = true,
+            .upscaleVertexShader = upscaleVs,
+            .upscaleFragmentShader = upscaleFs
+        });
+
+        context->DestroyShader(upscaleVs);
+        context->DestroyShader(upscaleFs);
+    }
+
+    // Long-running sessions compact device memory as resources come and go
+    if (defragment)
+        context->SetDefragmentation({ .enabled = true });
+
     // Create default sampler
     vkr::SamplerDesc smpd = {
         .addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
@@ -101,11 +510,92 @@ int main(int argc, char** argv) {
 
     vkr::SamplerHandle sampler = context->CreateSampler(smpd); 
 
+    // Decode images as jobs straight into their staging memory, overlapping the mesh uploads below
+    std::vector<vkr::TextureUpload> textureUploads;
+
+    for (auto& gltfImage : gltfModel.images) {
+        vkr::TextureDesc td = {
+            .width = (uint32_t)gltfImage.width,
+            .height = (uint32_t)gltfImage.height,
+            .format = VK_FORMAT_R8G8B8A8_SRGB,
+            .streamed = true
+        };
+
+        textureUploads.push_back(context->BeginTextureUpload(td));
+    }
+
+    vkr::JobCounter imageDecodes;
+    jobs.ParallelFor(static_cast<uint32_t>(textureUploads.size()), 1, imageDecodes, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t image = begin; image < end; image++) {
+            auto& encoded = encodedImages[image];
+            auto& upload = textureUploads[image];
+
+            // stb_image allocates its own output, copy it over while it is hot in cache
+            int width = 0, height = 0, components = 0;
+            stbi_uc* pTexels = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()),
+                &width, &height, &components, 4);
+            assert(pTexels != nullptr);
+
+            memcpy(upload.pData, pTexels, size_t(width) * height * 4);
+            stbi_image_free(pTexels);
+        }
+    });
+
     // Build GLTF scene buffers
     std::vector<Mesh> sceneMeshes;
     std::vector<vkr::TextureHandle> sceneTextures;
+    std::vector<vkr::MeshletMesh> sceneMeshlets;   // One per mesh part, in scene draw order
+
+    // Culling bounds come from the bind pose, which skinned parts are animated away from. They get a sphere so large
+    // it always crosses the camera plane, which the cullers keep, and meshlet cones that never cull
+    const glm::vec4 skinnedCullBounds = glm::vec4(0.0f, 0.0f, 0.0f, 1e18f);
+    const glm::vec4 skinnedCullCone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    // Skins and their animations, skinned parts are deformed by a compute pass every frame
+    std::vector<Skin> skins;
+    std::vector<int> meshSkins(gltfModel.meshes.size(), -1);    // Skin of the first node that instances each mesh
+    std::unique_ptr<vkr::SkinningPass> skinningPass;
+
+    if (!gltfModel.skins.empty()) {
+        std::vector<int> nodeParents(gltfModel.nodes.size(), -1);
+
+        for (size_t node = 0; node < gltfModel.nodes.size(); node++) {
+            auto& gltfNode = gltfModel.nodes[node];
+
+            for (int child : gltfNode.children)
+                nodeParents[child] = static_cast<int>(node);
+
+            if (gltfNode.mesh >= 0 && meshSkins[gltfNode.mesh] < 0)
+                meshSkins[gltfNode.mesh] = gltfNode.skin;
+        }
+
+        for (auto& gltfSkin : gltfModel.skins)
+            skins.push_back(LoadSkin(gltfModel, gltfSkin, nodeParents));
 
-    for (auto& gltfMesh : gltfModel.meshes) {
+        FileReader skinFile(shaderManifest.GetVariant("skin.cs"));
+
+        sd.pData = skinFile.Data();
+        sd.size = skinFile.Size();
+        VkShaderModule skinCs = context->CreateShader(sd);
+
+        skinningPass = std::make_unique<vkr::SkinningPass>(*context, vkr::SkinningPassDesc{ .skinShader = skinCs });
+        context->DestroyShader(skinCs);
+    }
+
+    // Materials and per-part transforms live in a storage buffer table each, indexed by the shaders
+    // Parts are objects in scene draw order, materials keep their glTF index
+    vkr::StorageTable objectTable(*context, sizeof(vkr::ObjectData));
+    vkr::StorageTable materialTable(*context, sizeof(vkr::MaterialData));
+
+    for (auto& material : gltfModel.materials) {
+        auto& baseColorFactor = material.pbrMetallicRoughness.baseColorFactor;
+        materialTable.Add(vkr::MaterialData{
+            .baseColor = { baseColorFactor[0], baseColorFactor[1], baseColorFactor[2], baseColorFactor[3] }
+        });
+    }
+
+    for (size_t meshIndex = 0; meshIndex < gltfModel.meshes.size(); meshIndex++) {
+        auto& gltfMesh = gltfModel.meshes[meshIndex];
         Mesh mesh = {};
 
         for (auto& primitive : gltfMesh.primitives) {
@@ -128,113 +618,511 @@ int main(int argc, char** argv) {
 
             
             meshPart.indexCount = vertexIndicesAccessor.count;
+
+            // Bounding sphere from the POSITION accessor's min/max, used to size texture requests
+            glm::vec3 boundsMin = { vertexPositionsAccessor.minValues[0], vertexPositionsAccessor.minValues[1], vertexPositionsAccessor.minValues[2] };
+            glm::vec3 boundsMax = { vertexPositionsAccessor.maxValues[0], vertexPositionsAccessor.maxValues[1], vertexPositionsAccessor.maxValues[2] };
+            meshPart.boundsCenter = (boundsMin + boundsMax) * 0.5f;
+            meshPart.boundsRadius = glm::length(boundsMax - boundsMin) * 0.5f;
+
+            // Parts of a mesh instanced by a skinned node are skinned if they have joints and weights
+            bool skinned = meshSkins[meshIndex] >= 0 &&
+                primitive.attributes.count("JOINTS_0") != 0 && primitive.attributes.count("WEIGHTS_0") != 0;
             
-            // Build vertex buffer
+            // Build vertex buffer, skinned parts get theirs from the skinning pass below
             vkr::BufferDesc bd = {};
-            bd.pData = reinterpret_cast<void*>(vertexPositionsBuffer.data.data() + vertexPositionsView.byteOffset + vertexPositionsAccessor.byteOffset);
-            bd.size = vertexPositionsView.byteLength;
-            bd.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            meshPart.vbo = context->CreateBuffer(bd);
-            
-            bd.pData = reinterpret_cast<void*>(vertexNormalsBuffer.data.data() + vertexNormalsView.byteOffset + vertexNormalsAccessor.byteOffset);
-            bd.size = vertexNormalsView.byteLength;
-            bd.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            meshPart.nbo = context->CreateBuffer(bd);
+
+            if (!skinned) {
+                bd.pData = reinterpret_cast<void*>(vertexPositionsBuffer.data.data() + vertexPositionsView.byteOffset + vertexPositionsAccessor.byteOffset);
+                bd.size = vertexPositionsView.byteLength;
+                bd.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+                meshPart.vbo = context->CreateBuffer(bd);
+
+                bd.pData = reinterpret_cast<void*>(vertexNormalsBuffer.data.data() + vertexNormalsView.byteOffset + vertexNormalsAccessor.byteOffset);
+                bd.size = vertexNormalsView.byteLength;
+                bd.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+                meshPart.nbo = context->CreateBuffer(bd);
+            }
 
             bd.pData = reinterpret_cast<void*>(vertexTexCoordsBuffer.data.data() + vertexTexCoordsView.byteOffset + vertexTexCoordsAccessor.byteOffset);
             bd.size = vertexTexCoordsView.byteLength;
             bd.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
             meshPart.uvbo = context->CreateBuffer(bd);
 
-            // Build index buffer
-            bd.pData = reinterpret_cast<void*>(vertexIndicesBuffer.data.data() + vertexIndicesView.byteOffset + vertexIndicesAccessor.byteOffset);
-            bd.size = vertexIndicesView.byteLength;
-            bd.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-            meshPart.ibo = context->CreateBuffer(bd);
-            
-            // Build material buffer
-            auto& material = gltfModel.materials[primitive.material];
-
-            auto& baseColorFactor = material.pbrMetallicRoughness.baseColorFactor;
-            Material materialData = {
-                .baseColor = { baseColorFactor[0], baseColorFactor[1], baseColorFactor[2], baseColorFactor[3] }
-            };
-
-            bd.pData = &materialData;
-            bd.size = sizeof(materialData);
-            bd.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-            meshPart.mbo = context->CreateBuffer(bd);
-
             // Resolve index type
             switch (vertexIndicesAccessor.componentType) {
             case GL_UNSIGNED_SHORT: meshPart.indexType = VK_INDEX_TYPE_UINT16; break;
             case GL_UNSIGNED_INT: meshPart.indexType = VK_INDEX_TYPE_UINT32; break;
             }
 
+            // Positions and 32-bit indices for the mesh processing below, positions are assumed tightly packed like the vertex buffers above
+            uint8_t* pPositions = vertexPositionsBuffer.data.data() + vertexPositionsView.byteOffset + vertexPositionsAccessor.byteOffset;
+            uint8_t* pIndices = vertexIndicesBuffer.data.data() + vertexIndicesView.byteOffset + vertexIndicesAccessor.byteOffset;
+
+            std::span<const glm::vec3> positions(reinterpret_cast<const glm::vec3*>(pPositions), vertexPositionsAccessor.count);
+
+            // Bind pose vertices go to the skinning pass, whose instance buffers the part draws from
+            if (skinned) {
+                auto& jointsAccessor = gltfModel.accessors[primitive.attributes["JOINTS_0"]];
+                auto& weightsAccessor = gltfModel.accessors[primitive.attributes["WEIGHTS_0"]];
+
+                uint8_t* pNormals = vertexNormalsBuffer.data.data() + vertexNormalsView.byteOffset + vertexNormalsAccessor.byteOffset;
+                std::span<const glm::vec3> normals(reinterpret_cast<const glm::vec3*>(pNormals), vertexNormalsAccessor.count);
+
+                std::vector<glm::u16vec4> joints(jointsAccessor.count);
+                std::vector<glm::vec4> weights(weightsAccessor.count);
+
+                for (size_t v = 0; v < joints.size(); v++) {
+                    const uint8_t* pJoints = AccessorElement(gltfModel, jointsAccessor, v);
+
+                    for (int c = 0; c < 4; c++) {
+                        joints[v][c] = jointsAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE
+                            ? pJoints[c]
+                            : reinterpret_cast<const uint16_t*>(pJoints)[c];
+                        weights[v][c] = AccessorFloat(gltfModel, weightsAccessor, v, c);
+                    }
+                }
+
+                meshPart.skin = meshSkins[meshIndex];
+                uint32_t skinMesh = skinningPass->AddMesh(positions, normals, joints, weights);
+                uint32_t jointCount = static_cast<uint32_t>(skins[meshPart.skin].jointMatrices.size());
+
+                meshPart.skinInstance = skinningPass->AddInstance(skinMesh, jointCount);
+                meshPart.vbo = skinningPass->GetPositions(meshPart.skinInstance);
+                meshPart.nbo = skinningPass->GetNormals(meshPart.skinInstance);
+            }
+            std::vector<uint32_t> indices;
+
+            if (meshletCulling || lodSelection) {
+                indices.resize(vertexIndicesAccessor.count);
+                for (size_t i = 0; i < indices.size(); i++) {
+                    indices[i] = meshPart.indexType == VK_INDEX_TYPE_UINT16
+                        ? reinterpret_cast<const uint16_t*>(pIndices)[i]
+                        : reinterpret_cast<const uint32_t*>(pIndices)[i];
+                }
+            }
+
+            // Build index buffer, the LOD chain shares the vertex buffers and follows the full detail indices
+            bd.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+
+            if (lodSelection) {
+                vkr::LodChain lodChain = vkr::BuildLodChain(positions, indices);
+
+                bd.pData = lodChain.indices.data();
+                bd.size = lodChain.indices.size() * sizeof(uint32_t);
+                meshPart.ibo = context->CreateBuffer(bd);
+                meshPart.indexType = VK_INDEX_TYPE_UINT32;
+                meshPart.lods = std::move(lodChain.levels);
+            }
+            else {
+                bd.pData = pIndices;
+                bd.size = vertexIndicesView.byteLength;
+                meshPart.ibo = context->CreateBuffer(bd);
+            }
+            
+            // One object per part, its transform is written every frame
+            objectTable.Add(vkr::ObjectData{
+                .modelMatrix = glm::mat4(1.0f),
+                .material = static_cast<uint32_t>(primitive.material)
+            });
+
             // Get texture index
+            auto& material = gltfModel.materials[primitive.material];
             meshPart.colorTextureIndex = material.pbrMetallicRoughness.baseColorTexture.index;
 
+            // Split the part into meshlets
+            if (meshletCulling) {
+                vkr::MeshletMesh meshlets = vkr::BuildMeshlets(positions, indices);
+
+                if (skinned) {
+                    for (auto& meshlet : meshlets.meshlets) {
+                        meshlet.bounds = skinnedCullBounds;
+                        meshlet.cone = skinnedCullCone;
+                    }
+                }
+
+                sceneMeshlets.push_back(std::move(meshlets));
+            }
+
             mesh.parts.push_back(meshPart);
         }
 
         sceneMeshes.push_back(mesh);
     }
 
-    for (auto& gltfImage : gltfModel.images) {
-        vkr::TextureDesc td = {
-            .width = (uint32_t)gltfImage.width,
-            .height = (uint32_t)gltfImage.height,
-            .format = VK_FORMAT_R8G8B8A8_SRGB
+    jobs.Wait(imageDecodes);
+
+    for (auto& upload : textureUploads)
+        sceneTextures.push_back(context->EndTextureUpload(upload));
+
+    // Occlusion culling treats every mesh part as one object, in scene draw order
+    std::unique_ptr<vkr::OcclusionCuller> occlusionCuller;
+
+    if (occlusionCulling) {
+        FileReader depthPyramidFile(shaderManifest.GetVariant("depth_pyramid.cs"));
+        FileReader cullFile(shaderManifest.GetVariant("cull.cs"));
+
+        sd.pData = depthPyramidFile.Data();
+        sd.size = depthPyramidFile.Size();
+        VkShaderModule depthPyramidCs = context->CreateShader(sd);
+
+        sd.pData = cullFile.Data();
+        sd.size = cullFile.Size();
+        VkShaderModule cullCs = context->CreateShader(sd);
+
+        vkr::OcclusionCullerDesc ocd = {
+            .depthPyramidShader = depthPyramidCs,
+            .cullShader = cullCs
         };
-        td.pData = reinterpret_cast<void*>(gltfImage.image.data());
+        occlusionCuller = std::make_unique<vkr::OcclusionCuller>(*context, ocd);
+
+        context->DestroyShader(depthPyramidCs);
+        context->DestroyShader(cullCs);
+
+        std::vector<glm::vec4> bounds;
+        std::vector<VkDrawIndexedIndirectCommand> draws;
 
-        sceneTextures.push_back(context->CreateTexture(td));
+        for (auto& mesh : sceneMeshes) {
+            for (auto& meshPart : mesh.parts) {
+                bounds.push_back(meshPart.skin >= 0 ? skinnedCullBounds : glm::vec4(meshPart.boundsCenter, meshPart.boundsRadius));
+                draws.push_back({
+                    .indexCount = meshPart.indexCount,
+                    .instanceCount = 1,
+                    .firstIndex = meshPart.indexOffset,
+                    .firstInstance = vkr::EncodeDrawInstance(static_cast<uint32_t>(draws.size()))
+                });
+            }
+        }
+
+        occlusionCuller->SetObjects(bounds, draws);
     }
 
-    float dt = 0.0f;
-    while(!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+    std::unique_ptr<vkr::MeshletCuller> meshletCuller;
 
-        // Update delta time
-        dt += 1.0f / 60.0f;
+    if (meshletCulling) {
+        FileReader meshletCullFile(shaderManifest.GetVariant("meshlet_cull.cs"));
 
-        context->BeginFrame();
-        
-        VkViewport viewport = {
-            .width = WINDOW_WIDTH,
-            .height = WINDOW_HEIGHT,
-            .minDepth = 0.0f,
-            .maxDepth = 1.0f
-        };
+        sd.pData = meshletCullFile.Data();
+        sd.size = meshletCullFile.Size();
+        VkShaderModule meshletCullCs = context->CreateShader(sd);
 
-        context->BeginRendering(viewport);
+        meshletCuller = std::make_unique<vkr::MeshletCuller>(*context, vkr::MeshletCullerDesc{ .cullShader = meshletCullCs });
+        context->DestroyShader(meshletCullCs);
 
-        context->SetGraphicsPipeline(pipeline);
+        for (uint32_t object = 0; object < sceneMeshlets.size(); object++)
+            sceneMeshlets[object].firstInstance = vkr::EncodeDrawInstance(object);
+
+        meshletCuller->SetMeshes(sceneMeshlets);
+    }
+
+    // Projected error of a LOD in pixels is error * projectionScale / distance
+    vkr::LodSelector lodSelector({ .fadeFrames = lodFade ? 16u : 0u });
+
+    // Two frame states, with a render thread the passes of one frame record while the next one is filled in
+    const float fov = glm::radians(75.0f);
+    FrameState frameStates[2];
+    uint64_t frameCount = 0;
+
+    // Draw a part at its LOD, both levels draw while fading from one to the other
+    auto drawPart = [&](const FrameState& state, const MeshPart& meshPart, uint32_t object) {
+        if (state.lodSelections.empty()) {
+            context->DrawIndexed(meshPart.indexOffset, meshPart.indexCount, vkr::EncodeDrawInstance(object));
+            return;
+        }
+
+        const vkr::LodSelection& selection = state.lodSelections[object];
+        const vkr::LodLevel& level = meshPart.lods[selection.level];
+
+        if (selection.previousLevel != selection.level) {
+            const vkr::LodLevel& previousLevel = meshPart.lods[selection.previousLevel];
+            context->DrawIndexed(previousLevel.indexOffset, previousLevel.indexCount,
+                vkr::EncodeDrawInstance(object, vkr::EncodeLodFade(selection.fade, false)));
+            context->DrawIndexed(level.indexOffset, level.indexCount,
+                vkr::EncodeDrawInstance(object, vkr::EncodeLodFade(selection.fade, true)));
+        }
+        else {
+            context->DrawIndexed(level.indexOffset, level.indexCount, vkr::EncodeDrawInstance(object));
+        }
+    };
+
+    // Depth only, so the main pass shades each pixel once
+    auto drawDepth = [&](const FrameState& state) {
+        context->SetGraphicsPipeline(depthPipeline);
         context->SetPrimitiveTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
         context->SetCullMode(VK_CULL_MODE_FRONT_BIT);
+        context->SetStorageBuffer(objectTable.GetBuffer(), 0);
+        context->SetPushConstants(&state.viewProjectionMatrix, sizeof(glm::mat4), 0);
 
-        // Build and push MVP matrix
-        glm::mat4 viewProjectionMatrix = glm::perspectiveLH(glm::radians(75.0f), 800.0f / 600.0f, 0.01f, 1000.0f) *
-            glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.025f, 0.075f));
+        uint32_t object = 0;
+        for (auto& mesh : sceneMeshes) {
+            for (auto& meshPart : mesh.parts) {
+                vkr::BufferHandle vbos[] = { meshPart.vbo };
+                context->SetVertexBuffers(vbos);
+                context->SetIndexBuffer(meshPart.ibo, meshPart.indexType);
+                drawPart(state, meshPart, object++);
+            }
+        }
+    };
 
-        glm::mat4 modelMatrix = glm::rotate(glm::mat4(1.0f), dt, glm::vec3(0.0f, 1.0f, 0.0f));
+    // Draw GLTF scene, with indirect arguments per part if they come from a culler
+    // Culled indices replace the parts' own index buffers when given
+    auto drawScene = [&](const FrameState& state, vkr::BufferHandle indirectDraws, vkr::BufferHandle culledIndices) {
+        context->SetGraphicsPipeline(pipeline);
+        context->SetPrimitiveTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        context->SetCullMode(VK_CULL_MODE_FRONT_BIT);
 
-        context->SetPushConstants(&modelMatrix, sizeof(glm::mat4), 0);
-        context->SetPushConstants(&viewProjectionMatrix, sizeof(glm::mat4), sizeof(glm::mat4));
+        // Bound once per pass, draws find their object and material through the instance index
+        context->SetStorageBuffer(objectTable.GetBuffer(), 0);
+        context->SetStorageBuffer(materialTable.GetBuffer(), 2);
+        context->SetPushConstants(&state.viewProjectionMatrix, sizeof(glm::mat4), 0);
 
-        // Draw GLTF scene
+        uint32_t object = 0;
         for (auto& mesh : sceneMeshes) {
             for (auto& meshPart : mesh.parts) {
+                // Request texture detail by the part's projected size in pixels
+                glm::vec4 viewCenter = state.viewMatrix * state.modelMatrix * glm::vec4(meshPart.boundsCenter, 1.0f);
+                float distance = std::max(viewCenter.z, 0.001f);
+                float screenSize = (meshPart.boundsRadius * 2.0f) / (distance * std::tan(fov * 0.5f) * 2.0f) * state.renderExtent.height;
+                context->RequestTextureResolution(sceneTextures[meshPart.colorTextureIndex], screenSize);
+
                 vkr::BufferHandle vbos[] = { meshPart.vbo, meshPart.nbo, meshPart.uvbo };
                 context->SetVertexBuffers(vbos);
-                context->SetIndexBuffer(meshPart.ibo, meshPart.indexType);
-                context->SetUniformBuffer(meshPart.mbo, 0);
+
+                if (culledIndices != 0)
+                    context->SetIndexBuffer(culledIndices, VK_INDEX_TYPE_UINT32);
+                else
+                    context->SetIndexBuffer(meshPart.ibo, meshPart.indexType);
+
                 context->SetTexture(sceneTextures[meshPart.colorTextureIndex], sampler, 1);
-                context->DrawIndexed(meshPart.indexOffset, meshPart.indexCount);
+
+                if (indirectDraws != 0) {
+                    constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+                    context->DrawIndexedIndirect(indirectDraws, object * stride, 1, stride);
+                }
+                else {
+                    drawPart(state, meshPart, object);
+                }
+
+                object++;
+            }
+        }
+    };
+
+    // Bounds and meshlets are in model space
+    auto cullMatrix = [](const FrameState& state) { return state.viewProjectionMatrix * state.modelMatrix; };
+    auto cullEye = [](const FrameState& state) {
+        return glm::vec3(glm::inverse(state.viewMatrix * state.modelMatrix) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    };
+
+    // The frame's passes, barriers between them follow from what each one declares
+    vkr::RenderGraph renderGraph(*context);
+    vkr::RenderGraphResource backbuffer = renderGraph.ImportBackbuffer();
+    vkr::RenderGraphResource depth = renderGraph.ImportDepth();
+
+    auto graphFrame = [&]() -> const FrameState& { return frameStates[(renderGraph.GetExecuteCount() - 1) % 2]; };
+
+    if (depthPrepass) {
+        renderGraph.AddPass("depth prepass", [&](vkr::Context&) { drawDepth(graphFrame()); })
+            .WriteDepth(depth);
+    }
+
+    // Two-phase occlusion culling: last frame's visible set, then whatever it revealed
+    if (occlusionCuller) {
+        vkr::RenderGraphResource earlyDraws = renderGraph.ImportBuffer(occlusionCuller->GetEarlyDraws());
+        vkr::RenderGraphResource lateDraws = renderGraph.ImportBuffer(occlusionCuller->GetLateDraws());
+
+        renderGraph.AddPass("cull early", [&](vkr::Context&) { occlusionCuller->CullEarly(cullMatrix(graphFrame())); })
+            .Write(earlyDraws, vkr::RenderGraphAccess::StorageWrite);
+
+        renderGraph.AddPass("early", [&](vkr::Context&) { drawScene(graphFrame(), occlusionCuller->GetEarlyDraws(), 0); })
+            .WriteColor(backbuffer)
+            .WriteDepth(depth)
+            .Read(earlyDraws, vkr::RenderGraphAccess::IndirectRead);
+
+        // The depth pyramid is built from what the early pass drew
+        renderGraph.AddPass("cull late", [&](vkr::Context&) { occlusionCuller->CullLate(cullMatrix(graphFrame())); })
+            .Read(depth, vkr::RenderGraphAccess::Sampled)
+            .Write(lateDraws, vkr::RenderGraphAccess::StorageWrite);
+
+        // With meshlet culling, the pass after the pyramid draws meshlets instead of whole objects
+        if (!meshletCuller) {
+            renderGraph.AddPass("late", [&](vkr::Context&) { drawScene(graphFrame(), occlusionCuller->GetLateDraws(), 0); })
+                .WriteColor(backbuffer, VK_ATTACHMENT_LOAD_OP_LOAD)
+                .WriteDepth(depth, VK_ATTACHMENT_LOAD_OP_LOAD)
+                .Read(lateDraws, vkr::RenderGraphAccess::IndirectRead);
+        }
+    }
+
+    // Cluster culling: only the triangles of meshlets in view and facing the camera are drawn. After an early
+    // occlusion pass, meshlets hidden behind its depth pyramid are dropped too. Meshlets the early pass already
+    // drew pass the test and draw again, failing the depth test
+    if (meshletCuller) {
+        vkr::RenderGraphResource meshletDraws = renderGraph.ImportBuffer(meshletCuller->GetDraws());
+        vkr::RenderGraphResource meshletIndices = renderGraph.ImportBuffer(meshletCuller->GetIndices());
+
+        renderGraph.AddPass("meshlet cull", [&](vkr::Context&) {
+            const FrameState& state = graphFrame();
+            meshletCuller->Cull(cullMatrix(state), cullEye(state), occlusionCuller.get());
+        })
+            .Write(meshletDraws, vkr::RenderGraphAccess::StorageWrite)
+            .Write(meshletIndices, vkr::RenderGraphAccess::StorageWrite);
+
+        VkAttachmentLoadOp depthLoadOp = occlusionCuller || depthPrepass ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+
+        renderGraph.AddPass("main", [&](vkr::Context&) {
+            drawScene(graphFrame(), meshletCuller->GetDraws(), meshletCuller->GetIndices());
+        })
+            .WriteColor(backbuffer, occlusionCuller ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR)
+            .WriteDepth(depth, depthLoadOp)
+            .Read(meshletDraws, vkr::RenderGraphAccess::IndirectRead)
+            .Read(meshletIndices, vkr::RenderGraphAccess::VertexRead);
+    }
+    else if (!occlusionCuller) {
+        renderGraph.AddPass("main", [&](vkr::Context&) { drawScene(graphFrame(), 0, 0); })
+            .WriteColor(backbuffer)
+            .WriteDepth(depth, depthPrepass ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR);
+    }
+
+    renderGraph.Compile();
+
+    // Captures hold context calls only, without the graph's rendering scopes and barriers. Captured runs draw
+    // the same passes through the context, so that the capture replays on its own
+    auto recordCapturedFrame = [&](const FrameState& state) {
+        VkViewport viewport = {
+            .width = static_cast<float>(state.renderExtent.width),
+            .height = static_cast<float>(state.renderExtent.height),
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f
+        };
+
+        if (depthPrepass) {
+            context->BeginDepthPrepass(viewport);
+            drawDepth(state);
+            context->EndRendering();
+        }
+
+        auto renderScene = [&](vkr::BufferHandle indirectDraws, vkr::BufferHandle culledIndices) {
+            context->BeginRendering(viewport);
+            drawScene(state, indirectDraws, culledIndices);
+            context->EndRendering();
+        };
+
+        if (occlusionCuller) {
+            occlusionCuller->CullEarly(cullMatrix(state));
+            renderScene(occlusionCuller->GetEarlyDraws(), 0);
+
+            occlusionCuller->CullLate(cullMatrix(state));
+            if (!meshletCuller)
+                renderScene(occlusionCuller->GetLateDraws(), 0);
+        }
+
+        if (meshletCuller) {
+            meshletCuller->Cull(cullMatrix(state), cullEye(state), occlusionCuller.get());
+            renderScene(meshletCuller->GetDraws(), meshletCuller->GetIndices());
+        }
+        else if (!occlusionCuller) {
+            renderScene(0, 0);
+        }
+    };
+
+    float dt = 0.0f;
+    uint32_t statsFrameCounter = 0;
+    while(!glfwWindowShouldClose(window)) {
+        context->BeginFrame();
+
+        // Sample input after BeginFrame so that low-latency pacing gets the freshest input
+        glfwPollEvents();
+
+        // Update delta time
+        dt += 1.0f / 60.0f;
+
+        // Report frame pacing stats in the window title
+        if (++statsFrameCounter % 30 == 0) {
+            const vkr::FrameStats& stats = context->GetFrameStats();
+
+            // Input-to-photon needs present wait, otherwise show the upper bound from frame slot reuse
+            bool measured = stats.averageInputToPhotonMs > 0.0;
+
+            char title[192];
+            snprintf(title, sizeof(title), "vkr | cpu %.2f ms | gpu %.2f ms @ %.0f%% | %s %.2f ms",
+                stats.cpuFrameMs, stats.gpuFrameMs, stats.renderScale * 100.0f,
+                measured ? "input-to-photon" : "latency <=",
+                measured ? stats.averageInputToPhotonMs : stats.averageEstimatedLatencyMs);
+            glfwSetWindowTitle(window, title);
+        }
+
+        FrameState& state = frameStates[frameCount++ % 2];
+
+        // The swapchain follows the window, which may have been resized since the last frame
+        state.renderExtent = context->GetRenderExtent();
+        float aspectRatio = static_cast<float>(state.renderExtent.width) / static_cast<float>(state.renderExtent.height);
+
+        // Build MVP matrix
+        state.viewMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.025f, 0.075f));
+        state.viewProjectionMatrix = glm::perspectiveLH(fov, aspectRatio, 0.01f, 1000.0f) * state.viewMatrix;
+
+        state.modelMatrix = glm::rotate(glm::mat4(1.0f), dt, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        // Pose the skins across the job system, then skin the parts whose pose changed before any pass draws them
+        if (skinningPass) {
+            jobs.ParallelFor(static_cast<uint32_t>(skins.size()), 1, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; i++) {
+                    Skin& skin = skins[i];
+
+                    if (!skin.clips.empty()) {
+                        const vkr::AnimationClip& clip = skin.clips[0];
+                        float time = clip.duration > 0.0f ? std::fmod(dt, clip.duration) : 0.0f;
+                        vkr::SampleAnimation(clip, skin.skeleton, time, skin.pose);
+                    }
+
+                    vkr::ComputeJointMatrices(skin.skeleton, skin.pose, skin.jointMatrices);
+                }
+            });
+
+            for (auto& mesh : sceneMeshes) {
+                for (auto& meshPart : mesh.parts) {
+                    if (meshPart.skin >= 0)
+                        skinningPass->SetPose(meshPart.skinInstance, skins[meshPart.skin].jointMatrices);
+                }
             }
+
+            // Skinning only reads bind-pose vertices and joint matrices, so it can run on the async compute queue
+            // alongside the rest of the frame. Only vertex input waits for it
+            context->BeginAsyncCompute();
+            skinningPass->Skin();
+            context->EndAsyncCompute(VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT);
         }
 
-        context->EndRendering();
+        // Every part turns with the model, so the whole object table goes up in one copy
+        for (uint32_t object = 0; object < objectTable.GetCount(); object++)
+            objectTable.Modify<vkr::ObjectData>(object).modelMatrix = state.modelMatrix;
+
+        objectTable.Flush();
+        materialTable.Flush();
+
+        // Pick every part's LOD once, so that the depth pre-pass and the main pass draw the same triangles
+        state.lodSelections.clear();
+
+        if (lodSelection) {
+            float projectionScale = state.renderExtent.height * context->GetFrameStats().renderScale / (2.0f * std::tan(fov * 0.5f));
+
+            for (auto& mesh : sceneMeshes) {
+                for (auto& meshPart : mesh.parts) {
+                    glm::vec4 viewCenter = state.viewMatrix * state.modelMatrix * glm::vec4(meshPart.boundsCenter, 1.0f);
+                    float distance = std::max(glm::length(glm::vec3(viewCenter)) - meshPart.boundsRadius, 0.01f);
+
+                    uint32_t object = static_cast<uint32_t>(state.lodSelections.size());
+                    state.lodSelections.push_back(lodSelector.Select(object, meshPart.lods, distance, projectionScale));
+                }
+            }
+        }
+
+        // Culling and drawing record when the render thread gets to this point of the frame
+        if (capturePath != nullptr)
+            recordCapturedFrame(state);
+        else
+            renderGraph.Execute();
+
         context->EndFrame();
     }
 
@@ -0,0 +1,285 @@
+#include "meshlet.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace vkr {
+
+    // Must match the push constants in meshlet_cull.cs.glsl
+    struct MeshletCullConstants {
+        glm::mat4 cullMatrix;
+        glm::vec4 eye;
+        glm::vec2 pyramidSize;
+        uint32_t count;
+        uint32_t phase;         // 0: reset draws, 1: cull meshlets
+        uint32_t occlusion;
+    };
+
+    static void ComputeMeshletBounds(Meshlet& meshlet, std::span<const glm::vec3> positions, const MeshletMesh& mesh) {
+        auto position = [&](uint32_t localIndex) {
+            return positions[mesh.vertices[meshlet.vertexOffset + localIndex]];
+        };
+
+        // Sphere around the center of the bounding box
+        glm::vec3 boundsMin = position(0), boundsMax = position(0);
+        for (uint32_t i = 1; i < meshlet.vertexCount; i++) {
+            boundsMin = glm::min(boundsMin, position(i));
+            boundsMax = glm::max(boundsMax, position(i));
+        }
+
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        float radius = 0.0f;
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+            radius = std::max(radius, glm::length(position(i) - center));
+
+        meshlet.bounds = glm::vec4(center, radius);
+
+        // Cone around the average triangle normal, its half-angle reaches the normal furthest from the axis
+        std::vector<glm::vec3> normals;
+        glm::vec3 axis(0.0f);
+
+        for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+            uint32_t triangle = mesh.triangles[meshlet.triangleOffset + t];
+            glm::vec3 p0 = position(triangle & 0xFF);
+            glm::vec3 p1 = position((triangle >> 8) & 0xFF);
+            glm::vec3 p2 = position((triangle >> 16) & 0xFF);
+
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+            if (area == 0.0f)
+                continue;
+
+            normals.push_back(normal / area);
+            axis += normal / area;
+        }
+
+        float axisLength = glm::length(axis);
+        float minDot = 1.0f;
+
+        if (axisLength > 0.0f) {
+            axis /= axisLength;
+            for (auto& normal : normals)
+                minDot = std::min(minDot, glm::dot(axis, normal));
+        }
+
+        // Normals spread over a hemisphere or more can always face the camera, a cutoff of 1 never culls
+        float cutoff = (axisLength > 0.0f && minDot > 0.0f) ? std::sqrt(1.0f - minDot * minDot) : 1.0f;
+        meshlet.cone = glm::vec4(axis, cutoff);
+    }
+
+    MeshletMesh BuildMeshlets(std::span<const glm::vec3> positions, std::span<const uint32_t> indices) {
+        MeshletMesh mesh;
+
+        // Meshlet-local index of each vertex in the meshlet being built, 0xFF if not in it
+        std::vector<uint8_t> localIndices(positions.size(), 0xFF);
+        Meshlet meshlet = {};
+
+        auto finishMeshlet = [&]() {
+            if (meshlet.triangleCount == 0)
+                return;
+
+            for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+                localIndices[mesh.vertices[meshlet.vertexOffset + i]] = 0xFF;
+
+            ComputeMeshletBounds(meshlet, positions, mesh);
+            mesh.meshlets.push_back(meshlet);
+
+            meshlet = {
+                .vertexOffset = static_cast<uint32_t>(mesh.vertices.size()),
+                .triangleOffset = static_cast<uint32_t>(mesh.triangles.size())
+            };
+        };
+
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            const uint32_t* pTriangle = &indices[i];
+
+            uint32_t newVertices = 0;
+            for (uint32_t v = 0; v < 3; v++) {
+                // Degenerate triangles may repeat a vertex, count it once
+                bool repeated = (v > 0 && pTriangle[v] == pTriangle[0]) || (v > 1 && pTriangle[v] == pTriangle[1]);
+                if (localIndices[pTriangle[v]] == 0xFF && !repeated)
+                    newVertices++;
+            }
+
+            if (meshlet.vertexCount + newVertices > MAX_MESHLET_VERTICES || meshlet.triangleCount == MAX_MESHLET_TRIANGLES)
+                finishMeshlet();
+
+            uint32_t triangle = 0;
+            for (uint32_t v = 0; v < 3; v++) {
+                uint8_t& localIndex = localIndices[pTriangle[v]];
+
+                if (localIndex == 0xFF) {
+                    localIndex = static_cast<uint8_t>(meshlet.vertexCount++);
+                    mesh.vertices.push_back(pTriangle[v]);
+                }
+
+                triangle |= uint32_t(localIndex) << (v * 8);
+            }
+
+            mesh.triangles.push_back(triangle);
+            meshlet.triangleCount++;
+        }
+
+        finishMeshlet();
+
+        return mesh;
+    }
+
+    MeshletCuller::MeshletCuller(Context& context, const MeshletCullerDesc& desc)
+        : m_context(context) {
+        ComputePipelineDesc cpd = {
+            .computeShader = desc.cullShader
+        };
+        m_cullPipeline = m_context.CreateComputePipeline(cpd);
+
+        SamplerDesc sd = {
+            .minFilter = VK_FILTER_NEAREST,
+            .magFilter = VK_FILTER_NEAREST,
+            .addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+        };
+        m_sampler = m_context.CreateSampler(sd);
+
+        // Never sampled, the pyramid binding only has to be valid
+        TextureDesc td = {
+            .pData = nullptr,
+            .width = 1,
+            .height = 1,
+            .format = VK_FORMAT_R32_SFLOAT
+        };
+        m_emptyPyramid = m_context.CreateTexture(td);
+    }
+
+    MeshletCuller::~MeshletCuller() {
+        DestroyMeshes();
+
+        m_context.DestroyTexture(m_emptyPyramid);
+        m_context.DestroySampler(m_sampler);
+        m_context.DestroyComputePipeline(m_cullPipeline);
+    }
+
+    void MeshletCuller::SetMeshes(std::span<const MeshletMesh> meshes) {
+        DestroyMeshes();
+
+        // Concatenate the meshes, each draw gets as many output indices as its mesh has triangles
+        std::vector<Meshlet> meshlets;
+        std::vector<uint32_t> vertices;
+        std::vector<uint32_t> triangles;
+        std::vector<VkDrawIndexedIndirectCommand> draws;
+
+        for (auto& mesh : meshes) {
+            VkDrawIndexedIndirectCommand draw = {
+                .indexCount = 0,
+                .instanceCount = 1,
+                .firstIndex = static_cast<uint32_t>(triangles.size() * 3),
+                .firstInstance = mesh.firstInstance
+            };
+
+            for (Meshlet meshlet : mesh.meshlets) {
+                meshlet.vertexOffset += static_cast<uint32_t>(vertices.size());
+                meshlet.triangleOffset += static_cast<uint32_t>(triangles.size());
+                meshlet.draw = static_cast<uint32_t>(draws.size());
+                meshlets.push_back(meshlet);
+            }
+
+            vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            triangles.insert(triangles.end(), mesh.triangles.begin(), mesh.triangles.end());
+            draws.push_back(draw);
+        }
+
+        m_meshletCount = static_cast<uint32_t>(meshlets.size());
+        m_drawCount = static_cast<uint32_t>(draws.size());
+        if (m_meshletCount == 0)
+            return;
+
+        BufferDesc bd = {
+            .pData = meshlets.data(),
+            .size = meshlets.size() * sizeof(Meshlet),
+            .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        };
+        m_meshlets = m_context.CreateBuffer(bd);
+
+        bd.pData = vertices.data();
+        bd.size = vertices.size() * sizeof(uint32_t);
+        m_meshletVertices = m_context.CreateBuffer(bd);
+
+        bd.pData = triangles.data();
+        bd.size = triangles.size() * sizeof(uint32_t);
+        m_meshletTriangles = m_context.CreateBuffer(bd);
+
+        bd.pData = draws.data();
+        bd.size = draws.size() * sizeof(VkDrawIndexedIndirectCommand);
+        m_draws = m_context.CreateBuffer(bd);
+
+        // Written by the cull shader every frame
+        bd.pData = nullptr;
+        bd.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        m_culledDraws = m_context.CreateBuffer(bd);
+
+        bd.size = triangles.size() * 3 * sizeof(uint32_t);
+        bd.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+        m_indices = m_context.CreateBuffer(bd);
+    }
+
+    void MeshletCuller::Cull(const glm::mat4& cullMatrix, const glm::vec3& eye, const OcclusionCuller* pOcclusion) {
+        if (m_meshletCount == 0)
+            return;
+
+        // The previous frame must be done drawing from the outputs before they are rewritten
+        m_context.PipelineBarrier(
+            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, 0,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+
+        m_context.SetComputePipeline(m_cullPipeline);
+
+        m_context.SetTexture(pOcclusion ? pOcclusion->GetDepthPyramid() : m_emptyPyramid, m_sampler, 0);
+        m_context.SetStorageBuffer(m_meshlets, 1);
+        m_context.SetStorageBuffer(m_meshletVertices, 2);
+        m_context.SetStorageBuffer(m_meshletTriangles, 3);
+        m_context.SetStorageBuffer(m_draws, 4);
+        m_context.SetStorageBuffer(m_culledDraws, 5);
+        m_context.SetStorageBuffer(m_indices, 6);
+
+        VkExtent2D pyramidExtent = pOcclusion ? pOcclusion->GetDepthPyramidExtent() : VkExtent2D{ 1, 1 };
+
+        // Reset the index count of every draw, surviving meshlets append to them
+        MeshletCullConstants constants = {
+            .cullMatrix = cullMatrix,
+            .eye = glm::vec4(eye, 1.0f),
+            .pyramidSize = { float(pyramidExtent.width), float(pyramidExtent.height) },
+            .count = m_drawCount,
+            .phase = 0,
+            .occlusion = pOcclusion != nullptr
+        };
+        m_context.SetPushConstants(&constants, sizeof(constants), 0);
+        m_context.Dispatch((m_drawCount + 63) / 64, 1, 1);
+
+        m_context.PipelineBarrier(
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+
+        // One workgroup per meshlet
+        constants.count = m_meshletCount;
+        constants.phase = 1;
+        m_context.SetPushConstants(&constants, sizeof(constants), 0);
+        m_context.Dispatch(m_meshletCount, 1, 1);
+
+        m_context.PipelineBarrier(
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+            VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT);
+    }
+
+    void MeshletCuller::DestroyMeshes() {
+        if (m_meshletCount == 0)
+            return;
+
+        m_context.DestroyBuffer(m_meshlets);
+        m_context.DestroyBuffer(m_meshletVertices);
+        m_context.DestroyBuffer(m_meshletTriangles);
+        m_context.DestroyBuffer(m_draws);
+        m_context.DestroyBuffer(m_culledDraws);
+        m_context.DestroyBuffer(m_indices);
+        m_meshletCount = 0;
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "context.hpp"
+#include "occlusion.hpp"
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <vector>
+
+namespace vkr {
+
+    constexpr uint32_t MAX_MESHLET_VERTICES = 64;
+    constexpr uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+    // Cluster of up to MAX_MESHLET_TRIANGLES triangles over up to MAX_MESHLET_VERTICES vertices
+    // Laid out to match meshlet_cull.cs.glsl
+    struct Meshlet {
+        glm::vec4 bounds;           // xyz center, w radius
+        glm::vec4 cone;             // xyz axis, w cutoff: backfacing when dot(normalize(center - eye), axis) > cutoff + radius / distance
+        uint32_t vertexOffset;      // First entry in MeshletMesh::vertices
+        uint32_t triangleOffset;    // First entry in MeshletMesh::triangles
+        uint32_t vertexCount;
+        uint32_t triangleCount;
+        uint32_t draw;              // Set by MeshletCuller::SetMeshes
+        uint32_t padding[3];
+    };
+
+    struct MeshletMesh {
+        std::vector<Meshlet> meshlets;
+        std::vector<uint32_t> vertices;     // Index into the mesh's vertex buffers per meshlet vertex
+        std::vector<uint32_t> triangles;    // Three 8-bit meshlet vertex indices per triangle
+        uint32_t firstInstance = 0;         // Of the mesh's draw, reaches shaders as gl_InstanceIndex
+    };
+
+    // Split a triangle list into meshlets in index order, computing bounding spheres and normal cones
+    MeshletMesh BuildMeshlets(std::span<const glm::vec3> positions, std::span<const uint32_t> indices);
+
+    struct MeshletCullerDesc {
+        VkShaderModule cullShader;          // meshlet_cull.cs.spv
+    };
+
+    // GPU cluster culling against the frustum, normal cones and optionally an occlusion pyramid
+    //
+    // Each frame, Cull() then draw mesh i with GetIndices() as a UINT32 index buffer and
+    // DrawIndexedIndirect(GetDraws(), i * sizeof(VkDrawIndexedIndirectCommand), 1, ...).
+    // The draws only cover the triangles of meshlets that survived
+    class MeshletCuller {
+    public:
+        MeshletCuller(Context& context, const MeshletCullerDesc& desc);
+        ~MeshletCuller();
+
+        // One mesh per draw, in draw order
+        void SetMeshes(std::span<const MeshletMesh> meshes);
+
+        // cullMatrix takes meshlet bounds to clip space, eye is the camera position in the same space as the bounds
+        // With an occlusion culler, meshlets are also tested against the pyramid built by its last CullLate
+        void Cull(const glm::mat4& cullMatrix, const glm::vec3& eye, const OcclusionCuller* pOcclusion = nullptr);
+
+        BufferHandle GetIndices() const { return m_indices; }
+        BufferHandle GetDraws() const { return m_culledDraws; }
+
+    private:
+        void DestroyMeshes();
+
+        Context& m_context;
+        ComputePipelineHandle m_cullPipeline = 0;
+        SamplerHandle m_sampler = 0;
+        TextureHandle m_emptyPyramid = 0;   // Bound when culling without occlusion
+
+        uint32_t m_meshletCount = 0;
+        uint32_t m_drawCount = 0;
+        BufferHandle m_meshlets = 0;
+        BufferHandle m_meshletVertices = 0;
+        BufferHandle m_meshletTriangles = 0;
+        BufferHandle m_draws = 0;
+        BufferHandle m_culledDraws = 0;
+        BufferHandle m_indices = 0;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+#version 450
+
+layout (local_size_x = 64) in;
+
+struct DrawCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+struct Meshlet {
+    vec4 bounds;            // xyz center, w radius
+    vec4 cone;              // xyz axis, w cutoff
+    uint vertexOffset;
+    uint triangleOffset;
+    uint vertexCount;
+    uint triangleCount;
+    uint draw;
+    uint padding[3];
+};
+
+layout (set = 0, binding = 0) uniform sampler2D depthPyramid;
+layout (set = 0, binding = 1) readonly buffer Meshlets { Meshlet meshlets[]; };
+layout (set = 0, binding = 2) readonly buffer MeshletVertices { uint meshletVertices[]; };
+layout (set = 0, binding = 3) readonly buffer MeshletTriangles { uint meshletTriangles[]; };
+layout (set = 0, binding = 4) readonly buffer Draws { DrawCommand draws[]; };
+layout (set = 0, binding = 5) buffer CulledDraws { DrawCommand culledDraws[]; };
+layout (set = 0, binding = 6) writeonly buffer Indices { uint indices[]; };
+
+layout (push_constant) uniform constants {
+    mat4 cullMatrix;
+    vec4 eye;
+    vec2 pyramidSize;
+    uint count;
+    uint phase;         // 0: reset draws, 1: cull meshlets
+    uint occlusion;
+} PushConstants;
+
+shared bool sVisible;
+shared uint sFirstIndex;
+
+// Screen rect (uv min, uv max) and nearest depth of a bounding sphere, false if it crosses the camera plane
+bool ProjectSphere(vec4 sphere, out vec4 rect, out float nearestDepth) {
+    rect = vec4(1.0, 1.0, 0.0, 0.0);
+    nearestDepth = 1.0;
+
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = sphere.xyz + sphere.w * vec3(
+            (i & 1) != 0 ? 1.0 : -1.0,
+            (i & 2) != 0 ? 1.0 : -1.0,
+            (i & 4) != 0 ? 1.0 : -1.0);
+
+        vec4 clip = PushConstants.cullMatrix * vec4(corner, 1.0);
+        if (clip.w <= 0.0)
+            return false;
+
+        // The viewport is flipped so that +y points up, see Context::BeginRendering
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 uv = vec2(ndc.x * 0.5 + 0.5, 0.5 - ndc.y * 0.5);
+
+        rect.xy = min(rect.xy, uv);
+        rect.zw = max(rect.zw, uv);
+        nearestDepth = min(nearestDepth, ndc.z);
+    }
+
+    return true;
+}
+
+bool IsVisible(Meshlet meshlet) {
+    // Every triangle faces away when the eye sits inside the cone's backfacing region
+    vec3 toMeshlet = meshlet.bounds.xyz - PushConstants.eye.xyz;
+    float distance = length(toMeshlet);
+
+    if (dot(toMeshlet, meshlet.cone.xyz) > meshlet.cone.w * distance + meshlet.bounds.w)
+        return false;
+
+    vec4 rect;
+    float nearestDepth;
+    if (!ProjectSphere(meshlet.bounds, rect, nearestDepth))
+        return true;
+
+    if (rect.x >= 1.0 || rect.y >= 1.0 || rect.z <= 0.0 || rect.w <= 0.0 || nearestDepth > 1.0)
+        return false;
+
+    if (PushConstants.occlusion == 0)
+        return true;
+
+    // Same test as cull.cs.glsl, at the level where the rect spans at most 2x2 texels
+    rect = clamp(rect, 0.0, 1.0);
+    vec2 size = (rect.zw - rect.xy) * PushConstants.pyramidSize;
+
+    int level = int(ceil(log2(max(max(size.x, size.y), 1.0))));
+    level = min(level, textureQueryLevels(depthPyramid) - 1);
+
+    ivec2 levelSize = textureSize(depthPyramid, level);
+    ivec2 p0 = clamp(ivec2(rect.xy * vec2(levelSize)), ivec2(0), levelSize - 1);
+    ivec2 p1 = clamp(ivec2(rect.zw * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+    float farthest = max(
+        max(texelFetch(depthPyramid, p0, level).r, texelFetch(depthPyramid, ivec2(p1.x, p0.y), level).r),
+        max(texelFetch(depthPyramid, ivec2(p0.x, p1.y), level).r, texelFetch(depthPyramid, p1, level).r));
+
+    return nearestDepth <= farthest;
+}
+
+void main() {
+    if (PushConstants.phase == 0) {
+        uint i = gl_GlobalInvocationID.x;
+        if (i < PushConstants.count) {
+            DrawCommand draw = draws[i];
+            draw.indexCount = 0;
+            culledDraws[i] = draw;
+        }
+        return;
+    }
+
+    Meshlet meshlet = meshlets[gl_WorkGroupID.x];
+
+    // One invocation tests the meshlet and reserves room for its triangles in its draw
+    if (gl_LocalInvocationIndex == 0) {
+        sVisible = IsVisible(meshlet);
+
+        if (sVisible) {
+            uint offset = atomicAdd(culledDraws[meshlet.draw].indexCount, meshlet.triangleCount * 3);
+            sFirstIndex = draws[meshlet.draw].firstIndex + offset;
+        }
+    }
+
+    barrier();
+
+    if (!sVisible)
+        return;
+
+    // Compact the surviving triangles, resolving meshlet-local indices to vertex buffer indices
+    for (uint t = gl_LocalInvocationIndex; t < meshlet.triangleCount; t += gl_WorkGroupSize.x) {
+        uint triangle = meshletTriangles[meshlet.triangleOffset + t];
+        uint index = sFirstIndex + t * 3;
+
+        indices[index + 0] = meshletVertices[meshlet.vertexOffset + (triangle & 0xFF)];
+        indices[index + 1] = meshletVertices[meshlet.vertexOffset + ((triangle >> 8) & 0xFF)];
+        indices[index + 2] = meshletVertices[meshlet.vertexOffset + ((triangle >> 16) & 0xFF)];
+    }
+}
\ No newline at end of file
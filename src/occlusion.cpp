@@ -0,0 +1,209 @@
+#include "occlusion.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+namespace vkr {
+
+    // Must match the push constants in cull.cs.glsl
+    struct CullConstants {
+        glm::mat4 cullMatrix;
+        glm::vec2 pyramidSize;
+        uint32_t objectCount;
+        uint32_t phase;
+    };
+
+    // Must match the push constants in depth_pyramid.cs.glsl
+    struct PyramidConstants {
+        glm::ivec2 srcSize;
+        glm::ivec2 dstSize;
+        int32_t srcLevel;
+    };
+
+    OcclusionCuller::OcclusionCuller(Context& context, const OcclusionCullerDesc& desc)
+        : m_context(context) {
+        ComputePipelineDesc cpd = {
+            .computeShader = desc.depthPyramidShader
+        };
+        m_depthPyramidPipeline = m_context.CreateComputePipeline(cpd);
+
+        cpd = {
+            .computeShader = desc.cullShader
+        };
+        m_cullPipeline = m_context.CreateComputePipeline(cpd);
+
+        // Pyramid levels are read with texelFetch, filtering never applies
+        SamplerDesc sd = {
+            .minFilter = VK_FILTER_NEAREST,
+            .magFilter = VK_FILTER_NEAREST,
+            .addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+        };
+        m_sampler = m_context.CreateSampler(sd);
+
+        CreatePyramid(m_context.GetRenderExtent());
+    }
+
+    OcclusionCuller::~OcclusionCuller() {
+        DestroyObjects();
+
+        m_context.DestroyTexture(m_pyramid);
+        m_context.DestroySampler(m_sampler);
+        m_context.DestroyComputePipeline(m_cullPipeline);
+        m_context.DestroyComputePipeline(m_depthPyramidPipeline);
+    }
+
+    void OcclusionCuller::SetObjects(std::span<const glm::vec4> bounds, std::span<const VkDrawIndexedIndirectCommand> draws) {
+        DestroyObjects();
+
+        m_objectCount = static_cast<uint32_t>(std::min(bounds.size(), draws.size()));
+        if (m_objectCount == 0)
+            return;
+
+        BufferDesc bd = {
+            .pData = const_cast<glm::vec4*>(bounds.data()),
+            .size = m_objectCount * sizeof(glm::vec4),
+            .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        };
+        m_bounds = m_context.CreateBuffer(bd);
+
+        bd.pData = const_cast<VkDrawIndexedIndirectCommand*>(draws.data());
+        bd.size = m_objectCount * sizeof(VkDrawIndexedIndirectCommand);
+        m_draws = m_context.CreateBuffer(bd);
+
+        // Written by the cull shader every frame
+        bd.pData = nullptr;
+        bd.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        m_earlyDraws = m_context.CreateBuffer(bd);
+        m_lateDraws = m_context.CreateBuffer(bd);
+
+        // Nothing was visible last frame, the first late pass draws everything in view
+        std::vector<uint32_t> visibility(m_objectCount, 0);
+        bd.pData = visibility.data();
+        bd.size = visibility.size() * sizeof(uint32_t);
+        bd.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        m_visibility = m_context.CreateBuffer(bd);
+    }
+
+    void OcclusionCuller::CullEarly(const glm::mat4& cullMatrix) {
+        if (m_objectCount == 0)
+            return;
+
+        // The previous frame must be done reading arguments and the pyramid before they are rewritten
+        m_context.PipelineBarrier(
+            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+
+        Cull(cullMatrix, 0);
+
+        m_context.PipelineBarrier(
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+    }
+
+    void OcclusionCuller::CullLate(const glm::mat4& cullMatrix) {
+        if (m_objectCount == 0)
+            return;
+
+        VkExtent2D renderExtent = m_context.GetRenderExtent();
+        if (renderExtent.width != m_renderExtent.width || renderExtent.height != m_renderExtent.height)
+            CreatePyramid(renderExtent);
+
+        BuildPyramid();
+        Cull(cullMatrix, 1);
+
+        m_context.PipelineBarrier(
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+    }
+
+    void OcclusionCuller::CreatePyramid(VkExtent2D renderExtent) {
+        if (m_pyramid != 0)
+            m_context.DestroyTexture(m_pyramid);
+
+        // Power of two so that every level halves exactly, level 0 is at most the render size
+        m_renderExtent = renderExtent;
+        m_pyramidExtent = {
+            std::bit_floor(std::max(renderExtent.width, 1u)),
+            std::bit_floor(std::max(renderExtent.height, 1u))
+        };
+        m_pyramidLevels = std::bit_width(std::max(m_pyramidExtent.width, m_pyramidExtent.height));
+
+        TextureDesc td = {
+            .pData = nullptr,
+            .width = m_pyramidExtent.width,
+            .height = m_pyramidExtent.height,
+            .format = VK_FORMAT_R32_SFLOAT,
+            .usage = VK_IMAGE_USAGE_STORAGE_BIT,
+            .mipLevels = m_pyramidLevels
+        };
+        m_pyramid = m_context.CreateTexture(td);
+    }
+
+    void OcclusionCuller::BuildPyramid() {
+        m_context.SetComputePipeline(m_depthPyramidPipeline);
+
+        glm::ivec2 srcSize(m_renderExtent.width, m_renderExtent.height);
+
+        for (uint32_t level = 0; level < m_pyramidLevels; level++) {
+            glm::ivec2 dstSize(
+                std::max(m_pyramidExtent.width >> level, 1u),
+                std::max(m_pyramidExtent.height >> level, 1u));
+
+            // Level 0 reduces the depth buffer, every other level the one above it
+            if (level == 0)
+                m_context.SetDepthTexture(m_sampler, 0);
+            else
+                m_context.SetTexture(m_pyramid, m_sampler, 0);
+
+            m_context.SetStorageImage(m_pyramid, level, 1);
+
+            PyramidConstants constants = {
+                .srcSize = srcSize,
+                .dstSize = dstSize,
+                .srcLevel = level == 0 ? 0 : static_cast<int32_t>(level - 1)
+            };
+            m_context.SetPushConstants(&constants, sizeof(constants), 0);
+            m_context.Dispatch((dstSize.x + 7) / 8, (dstSize.y + 7) / 8, 1);
+
+            m_context.PipelineBarrier(
+                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+
+            srcSize = dstSize;
+        }
+    }
+
+    void OcclusionCuller::Cull(const glm::mat4& cullMatrix, uint32_t phase) {
+        m_context.SetComputePipeline(m_cullPipeline);
+
+        m_context.SetTexture(m_pyramid, m_sampler, 0);
+        m_context.SetStorageBuffer(m_bounds, 1);
+        m_context.SetStorageBuffer(m_draws, 2);
+        m_context.SetStorageBuffer(m_earlyDraws, 3);
+        m_context.SetStorageBuffer(m_lateDraws, 4);
+        m_context.SetStorageBuffer(m_visibility, 5);
+
+        CullConstants constants = {
+            .cullMatrix = cullMatrix,
+            .pyramidSize = { float(m_pyramidExtent.width), float(m_pyramidExtent.height) },
+            .objectCount = m_objectCount,
+            .phase = phase
+        };
+        m_context.SetPushConstants(&constants, sizeof(constants), 0);
+        m_context.Dispatch((m_objectCount + 63) / 64, 1, 1);
+    }
+
+    void OcclusionCuller::DestroyObjects() {
+        if (m_objectCount == 0)
+            return;
+
+        m_context.DestroyBuffer(m_bounds);
+        m_context.DestroyBuffer(m_draws);
+        m_context.DestroyBuffer(m_earlyDraws);
+        m_context.DestroyBuffer(m_lateDraws);
+        m_context.DestroyBuffer(m_visibility);
+        m_objectCount = 0;
+    }
+
+}
\ No newline at end of file
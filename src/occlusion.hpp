@@ -0,0 +1,70 @@
+#pragma once
+
+#include "context.hpp"
+
+#include <glm/glm.hpp>
+
+#include <span>
+
+namespace vkr {
+
+    struct OcclusionCullerDesc {
+        VkShaderModule depthPyramidShader;  // depth_pyramid.cs.spv
+        VkShaderModule cullShader;          // cull.cs.spv
+    };
+
+    // Two-phase GPU occlusion culling against a hierarchical depth pyramid
+    //
+    // Each frame:
+    //   CullEarly(), then render the early draws     (objects visible last frame)
+    //   CullLate(), then render the late draws       (objects that became visible this frame)
+    //
+    // Object i draws with DrawIndexedIndirect(buffer, i * sizeof(VkDrawIndexedIndirectCommand), 1, ...),
+    // culled objects have an instance count of 0
+    class OcclusionCuller {
+    public:
+        OcclusionCuller(Context& context, const OcclusionCullerDesc& desc);
+        ~OcclusionCuller();
+
+        // One bounding sphere (xyz center, w radius) and draw per object, resets visibility
+        void SetObjects(std::span<const glm::vec4> bounds, std::span<const VkDrawIndexedIndirectCommand> draws);
+
+        // Before the early pass: frustum test the objects that were visible last frame
+        // cullMatrix takes bounds to clip space, e.g. view-projection for world-space bounds
+        void CullEarly(const glm::mat4& cullMatrix);
+
+        // After the early pass: build the depth pyramid from its depth and test every object against it
+        void CullLate(const glm::mat4& cullMatrix);
+
+        BufferHandle GetEarlyDraws() const { return m_earlyDraws; }
+        BufferHandle GetLateDraws() const { return m_lateDraws; }
+
+        // Max-depth pyramid of the last CullLate, level 0 covers the render extent scaled to a power of two
+        TextureHandle GetDepthPyramid() const { return m_pyramid; }
+        VkExtent2D GetDepthPyramidExtent() const { return m_pyramidExtent; }
+
+    private:
+        void CreatePyramid(VkExtent2D renderExtent);
+        void BuildPyramid();
+        void Cull(const glm::mat4& cullMatrix, uint32_t phase);
+        void DestroyObjects();
+
+        Context& m_context;
+        ComputePipelineHandle m_depthPyramidPipeline = 0;
+        ComputePipelineHandle m_cullPipeline = 0;
+        SamplerHandle m_sampler = 0;
+
+        TextureHandle m_pyramid = 0;
+        VkExtent2D m_pyramidExtent = {};
+        VkExtent2D m_renderExtent = {};
+        uint32_t m_pyramidLevels = 0;
+
+        uint32_t m_objectCount = 0;
+        BufferHandle m_bounds = 0;
+        BufferHandle m_draws = 0;
+        BufferHandle m_earlyDraws = 0;
+        BufferHandle m_lateDraws = 0;
+        BufferHandle m_visibility = 0;
+    };
+
+}
\ No newline at end of file
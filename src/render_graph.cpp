@@ -0,0 +1,841 @@
+#include "render_graph.hpp"
+#include "render_thread.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#define VK_ASSERT_RESULT(exp, r) { VkResult vkResult = exp; assert(vkResult == r); }
+#define VK_ASSERT(exp) VK_ASSERT_RESULT(exp, VK_SUCCESS)
+
+namespace vkr {
+
+    RenderGraphPass& RenderGraphPass::WriteColor(RenderGraphResource texture, VkAttachmentLoadOp loadOp, VkClearColorValue clear) {
+        Attachment attachment = {
+            .texture = texture,
+            .loadOp = loadOp,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE
+        };
+        attachment.clear.color = clear;
+
+        m_colorAttachments.push_back(attachment);
+        return *this;
+    }
+
+    RenderGraphPass& RenderGraphPass::WriteDepth(RenderGraphResource texture, VkAttachmentLoadOp loadOp, float clear) {
+        m_depthAttachment = {
+            .texture = texture,
+            .loadOp = loadOp,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE
+        };
+        m_depthAttachment.clear.depthStencil = { clear, 0 };
+
+        return *this;
+    }
+
+    RenderGraphPass& RenderGraphPass::Read(RenderGraphResource resource, RenderGraphAccess access) {
+        m_accesses.push_back({ resource, access, false });
+        return *this;
+    }
+
+    RenderGraphPass& RenderGraphPass::Write(RenderGraphResource resource, RenderGraphAccess access) {
+        m_accesses.push_back({ resource, access, true });
+        return *this;
+    }
+
+    RenderGraph::RenderGraph(Context& context)
+        : m_context(context) {
+    }
+
+    RenderGraph::~RenderGraph() {
+        m_context.SyncRenderThread();
+        DestroyTransients();
+    }
+
+    RenderGraphResource RenderGraph::CreateTexture(const char* name, const RenderGraphTextureDesc& desc) {
+        return AddResource({ .name = name, .kind = ResourceKind::Transient, .desc = desc });
+    }
+
+    RenderGraphResource RenderGraph::ImportTexture(TextureHandle textureHandle) {
+        return AddResource({ .name = "texture", .kind = ResourceKind::Texture, .texture = textureHandle });
+    }
+
+    RenderGraphResource RenderGraph::ImportBuffer(BufferHandle bufferHandle) {
+        return AddResource({ .name = "buffer", .kind = ResourceKind::Buffer, .buffer = bufferHandle });
+    }
+
+    RenderGraphResource RenderGraph::ImportBackbuffer() {
+        return AddResource({ .name = "backbuffer", .kind = ResourceKind::Backbuffer });
+    }
+
+    RenderGraphResource RenderGraph::ImportDepth() {
+        return AddResource({ .name = "depth", .kind = ResourceKind::Depth });
+    }
+
+    RenderGraphResource RenderGraph::AddResource(Resource&& resource) {
+        m_resources.push_back(std::move(resource));
+        m_compiled = false;
+
+        return static_cast<RenderGraphResource>(m_resources.size());
+    }
+
+    RenderGraphPass& RenderGraph::AddPass(const char* name, std::function<void(Context&)> execute) {
+        RenderGraphPass& pass = m_passes.emplace_back();
+        pass.m_name = name;
+        pass.m_execute = std::move(execute);
+        m_compiled = false;
+
+        return pass;
+    }
+
+    TextureHandle RenderGraph::GetTexture(RenderGraphResource texture) const {
+        return m_resources[texture - 1].texture;
+    }
+
+    void RenderGraph::Compile() {
+        // Transients are created in the context's registries, which the render thread must not be using
+        m_context.SyncRenderThread();
+
+        DestroyTransients();
+
+        m_stats = {};
+        m_stats.passes = static_cast<uint32_t>(m_passes.size());
+
+        CullPasses();
+        AllocateTransients();
+
+        // Attachments nobody reads after the pass are not written back to memory
+        for (uint32_t i = 0; i < m_passes.size(); i++) {
+            auto& pass = m_passes[i];
+
+            auto resolveStore = [&](RenderGraphPass::Attachment& attachment) {
+                if (attachment.texture == 0)
+                    return;
+
+                Resource& resource = m_resources[attachment.texture - 1];
+                bool readLater = resource.kind != ResourceKind::Transient || resource.lastPass > i;
+                attachment.storeOp = readLater ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            };
+
+            for (auto& attachment : pass.m_colorAttachments)
+                resolveStore(attachment);
+            resolveStore(pass.m_depthAttachment);
+        }
+
+        m_compiledExtent = m_context.m_swapchainExtent;
+        m_compiled = true;
+    }
+
+    void RenderGraph::CullPasses() {
+        // Imported resources are visible outside the graph, so anything written to them is needed
+        std::vector<bool> needed(m_resources.size());
+        for (size_t i = 0; i < m_resources.size(); i++)
+            needed[i] = m_resources[i].kind != ResourceKind::Transient;
+
+        // Walk backwards so each pass knows whether a later live pass reads what it writes
+        for (auto it = m_passes.rbegin(); it != m_passes.rend(); ++it) {
+            auto& pass = *it;
+            pass.m_live = false;
+
+            for (auto& attachment : pass.m_colorAttachments)
+                pass.m_live |= needed[attachment.texture - 1];
+
+            if (pass.m_depthAttachment.texture != 0)
+                pass.m_live |= needed[pass.m_depthAttachment.texture - 1];
+
+            for (auto& access : pass.m_accesses)
+                pass.m_live |= access.write && needed[access.resource - 1];
+
+            if (!pass.m_live) {
+                m_stats.culledPasses++;
+                continue;
+            }
+
+            for (auto& access : pass.m_accesses) {
+                if (!access.write)
+                    needed[access.resource - 1] = true;
+            }
+
+            // Loaded attachments read what earlier passes rendered
+            for (auto& attachment : pass.m_colorAttachments) {
+                if (attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+                    needed[attachment.texture - 1] = true;
+            }
+
+            if (pass.m_depthAttachment.texture != 0 && pass.m_depthAttachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+                needed[pass.m_depthAttachment.texture - 1] = true;
+        }
+    }
+
+    void RenderGraph::AllocateTransients() {
+        for (auto& resource : m_resources) {
+            if (resource.kind != ResourceKind::Transient)
+                continue;
+
+            resource.firstPass = UINT32_MAX;
+            resource.lastPass = 0;
+            resource.usage = 0;
+            resource.lazy = true;
+        }
+
+        // Lifetimes and usage over the live passes
+        for (uint32_t i = 0; i < m_passes.size(); i++) {
+            auto& pass = m_passes[i];
+            if (!pass.m_live)
+                continue;
+
+            auto use = [&](RenderGraphResource handle, VkImageUsageFlags usage, bool attachmentOnly) {
+                Resource& resource = m_resources[handle - 1];
+                if (resource.kind != ResourceKind::Transient)
+                    return;
+
+                resource.firstPass = std::min(resource.firstPass, i);
+                resource.lastPass = std::max(resource.lastPass, i);
+                resource.usage |= usage;
+                resource.lazy &= attachmentOnly;
+            };
+
+            for (auto& attachment : pass.m_colorAttachments)
+                use(attachment.texture, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, attachment.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD);
+
+            if (pass.m_depthAttachment.texture != 0)
+                use(pass.m_depthAttachment.texture, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                    pass.m_depthAttachment.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD);
+
+            for (auto& access : pass.m_accesses) {
+                bool storage = access.access == RenderGraphAccess::StorageRead || access.access == RenderGraphAccess::StorageWrite;
+                use(access.resource, storage ? VK_IMAGE_USAGE_STORAGE_BIT : VK_IMAGE_USAGE_SAMPLED_BIT, false);
+            }
+        }
+
+        VkDevice device = m_context.m_device;
+        VmaAllocator allocator = m_context.m_allocator;
+        VkExtent2D renderExtent = m_context.m_swapchainExtent;
+
+        // Create the images first, placement needs their memory requirements
+        std::vector<std::pair<uint32_t, VkMemoryRequirements>> placements;
+
+        for (uint32_t i = 0; i < m_resources.size(); i++) {
+            Resource& resource = m_resources[i];
+            if (resource.kind != ResourceKind::Transient || resource.firstPass == UINT32_MAX)
+                continue;
+
+            // Only attachments used within a single pass never need their contents in memory
+            resource.lazy &= resource.firstPass == resource.lastPass;
+
+            resource.extent = resource.desc.width != 0
+                ? VkExtent2D{ resource.desc.width, resource.desc.height }
+                : VkExtent2D{
+                    std::max(static_cast<uint32_t>(renderExtent.width * resource.desc.scale), 1u),
+                    std::max(static_cast<uint32_t>(renderExtent.height * resource.desc.scale), 1u)
+                };
+
+            VkImageCreateInfo ici = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                .imageType = VK_IMAGE_TYPE_2D,
+                .format = resource.desc.format,
+                .extent = {
+                    .width = resource.extent.width,
+                    .height = resource.extent.height,
+                    .depth = 1
+                },
+                .mipLevels = 1,
+                .arrayLayers = 1,
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .tiling = VK_IMAGE_TILING_OPTIMAL,
+                .usage = resource.usage | (resource.lazy ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0u),
+                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+            };
+            m_context.SetSharingMode(ici);
+
+            Context::TextureAllocation ta = {};
+            ta.format = resource.desc.format;
+            ta.extent = resource.extent;
+            ta.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            ta.aliased = true;
+
+            VK_ASSERT(vkCreateImage(device, &ici, nullptr, &ta.image));
+            resource.texture = m_context.m_textures.Create(ta);
+
+            VkMemoryRequirements mr;
+            vkGetImageMemoryRequirements(device, ta.image, &mr);
+
+            // Tile-based GPUs can keep these in on-chip memory, fall back to shared memory without support
+            if (resource.lazy) {
+                VmaAllocationCreateInfo aci = {
+                    .usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED
+                };
+
+                MemoryBlock block = {
+                    .requirements = mr,
+                    .lifetimes = { { resource.firstPass, resource.lastPass } }
+                };
+
+                if (vmaAllocateMemory(allocator, &mr, &aci, &block.alloc, nullptr) == VK_SUCCESS) {
+                    resource.memoryBlock = static_cast<uint32_t>(m_memoryBlocks.size());
+                    m_memoryBlocks.push_back(block);
+                    m_stats.lazyTextures++;
+                    continue;
+                }
+
+                resource.lazy = false;
+            }
+
+            placements.push_back({ i, mr });
+        }
+
+        // Largest first, then place each texture in the first block none of whose occupants overlap its lifetime
+        std::sort(placements.begin(), placements.end(), [](auto& a, auto& b) {
+            return a.second.size > b.second.size;
+        });
+
+        size_t firstSharedBlock = m_memoryBlocks.size();
+
+        for (auto& [index, mr] : placements) {
+            Resource& resource = m_resources[index];
+            MemoryBlock* pBlock = nullptr;
+
+            for (size_t b = firstSharedBlock; b < m_memoryBlocks.size() && pBlock == nullptr; b++) {
+                MemoryBlock& block = m_memoryBlocks[b];
+                if ((block.requirements.memoryTypeBits & mr.memoryTypeBits) == 0)
+                    continue;
+
+                bool overlaps = std::any_of(block.lifetimes.begin(), block.lifetimes.end(), [&](auto& lifetime) {
+                    return lifetime.first <= resource.lastPass && resource.firstPass <= lifetime.second;
+                });
+
+                if (!overlaps)
+                    pBlock = &block;
+            }
+
+            if (pBlock == nullptr) {
+                pBlock = &m_memoryBlocks.emplace_back();
+                pBlock->requirements = mr;
+            }
+
+            pBlock->requirements.size = std::max(pBlock->requirements.size, mr.size);
+            pBlock->requirements.alignment = std::max(pBlock->requirements.alignment, mr.alignment);
+            pBlock->requirements.memoryTypeBits &= mr.memoryTypeBits;
+            pBlock->lifetimes.push_back({ resource.firstPass, resource.lastPass });
+
+            resource.memoryBlock = static_cast<uint32_t>(pBlock - m_memoryBlocks.data());
+            m_stats.aliasedBytes += mr.size;
+        }
+
+        for (size_t b = firstSharedBlock; b < m_memoryBlocks.size(); b++) {
+            MemoryBlock& block = m_memoryBlocks[b];
+
+            VmaAllocationCreateInfo aci = {
+                .preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+            };
+
+            VK_ASSERT(vmaAllocateMemory(allocator, &block.requirements, &aci, &block.alloc, nullptr));
+
+            m_stats.transientBytes += block.requirements.size;
+            m_stats.aliasedBytes -= block.requirements.size;
+        }
+
+        // Bind memory and create the views now that every image has a home
+        for (auto& resource : m_resources) {
+            if (resource.kind != ResourceKind::Transient || resource.texture == 0)
+                continue;
+
+            MemoryBlock& block = m_memoryBlocks[resource.memoryBlock];
+            Context::TextureAllocation& ta = m_context.m_textures[resource.texture];
+
+            VK_ASSERT(vmaBindImageMemory(allocator, block.alloc, ta.image));
+            vmaGetAllocationInfo(allocator, block.alloc, &ta.allocInfo);
+
+            // Sampling a depth/stencil texture reads depth only, attachments need every aspect
+            VkImageAspectFlags aspect = Context::GetImageAspect(ta.format);
+
+            VkImageViewCreateInfo ivci = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                .image = ta.image,
+                .viewType = VK_IMAGE_VIEW_TYPE_2D,
+                .format = ta.format,
+                .subresourceRange = {
+                    .aspectMask = aspect & ~VK_IMAGE_ASPECT_STENCIL_BIT,
+                    .levelCount = 1,
+                    .layerCount = 1
+                }
+            };
+
+            VK_ASSERT(vkCreateImageView(device, &ivci, nullptr, &ta.imageView));
+            resource.attachmentView = ta.imageView;
+
+            if (aspect & VK_IMAGE_ASPECT_STENCIL_BIT) {
+                ivci.subresourceRange.aspectMask = aspect;
+                VK_ASSERT(vkCreateImageView(device, &ivci, nullptr, &resource.attachmentView));
+            }
+
+            // Storage views take a single aspect, depth for depth/stencil formats
+            if (resource.usage & VK_IMAGE_USAGE_STORAGE_BIT) {
+                ivci.subresourceRange.aspectMask = aspect & ~VK_IMAGE_ASPECT_STENCIL_BIT;
+
+                VkImageView storageView;
+                VK_ASSERT(vkCreateImageView(device, &ivci, nullptr, &storageView));
+                ta.mipViews = { storageView };
+            }
+        }
+    }
+
+    void RenderGraph::DestroyTransients() {
+        for (auto& resource : m_resources) {
+            if (resource.kind != ResourceKind::Transient || resource.texture == 0)
+                continue;
+
+            VkImageView imageView = m_context.m_textures[resource.texture].imageView;
+            if (resource.attachmentView != imageView) {
+                m_context.DeferDestroy([device = m_context.m_device, view = resource.attachmentView]() {
+                    vkDestroyImageView(device, view, nullptr);
+                });
+            }
+
+            // The texture has no allocation of its own, only the image and views are destroyed
+            m_context.DestroyTexture(resource.texture);
+            resource.texture = 0;
+        }
+
+        for (auto& block : m_memoryBlocks) {
+            m_context.DeferDestroy([allocator = m_context.m_allocator, alloc = block.alloc]() {
+                vmaFreeMemory(allocator, alloc);
+            });
+        }
+
+        m_memoryBlocks.clear();
+    }
+
+    void RenderGraph::Execute() {
+        if (m_context.DefersToRenderThread())
+            return m_context.m_renderThread->PushCallback([this]() { Execute(); });
+
+        assert(m_context.m_frameRecording && "Execute between BeginFrame and EndFrame");
+        m_executeCount++;
+
+        VkExtent2D renderExtent = m_context.m_swapchainExtent;
+        if (!m_compiled || renderExtent.width != m_compiledExtent.width || renderExtent.height != m_compiledExtent.height)
+            Compile();
+
+        m_stats.barriers = 0;
+
+        // Imported resources start out in whatever state the context left them
+        for (auto& resource : m_resources) {
+            resource.usedThisFrame = false;
+
+            switch (resource.kind) {
+            case ResourceKind::Texture:
+                resource.homeLayout = m_context.m_textures[resource.texture].layout;
+                resource.state = {
+                    .layout = resource.homeLayout,
+                    .writeStages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    .writeAccess = VK_ACCESS_2_MEMORY_WRITE_BIT
+                };
+                break;
+            case ResourceKind::Buffer:
+                resource.state = {
+                    .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+                    .writeStages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    .writeAccess = VK_ACCESS_2_MEMORY_WRITE_BIT
+                };
+                break;
+            case ResourceKind::Backbuffer:
+                resource.state = {
+                    .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    .writeStages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    .writeAccess = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT
+                };
+                break;
+            case ResourceKind::Depth:
+                resource.state = {
+                    .layout = m_context.m_depthLayout,
+                    .writeStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                    .writeAccess = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+                };
+                break;
+            default:
+                break;
+            }
+        }
+
+        VkCommandBuffer cmds = m_context.GetCommandBuffer();
+        std::vector<VkImageMemoryBarrier2> imageBarriers;
+        std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+
+        auto require = [&](RenderGraphResource handle, const AccessInfo& info) {
+            Resource& resource = m_resources[handle - 1];
+
+            // A transient's first use in a frame discards whatever the memory held before
+            bool discard = resource.kind == ResourceKind::Transient && !resource.usedThisFrame;
+            resource.usedThisFrame = true;
+
+            Require(resource, info, discard, imageBarriers, bufferBarriers);
+
+            // Descriptors written inside the pass pick up the layout the texture is in now
+            if (resource.texture != 0)
+                m_context.m_textures[resource.texture].layout = resource.state.layout;
+            else if (resource.kind == ResourceKind::Depth)
+                m_context.m_depthLayout = resource.state.layout;
+        };
+
+        const AccessInfo colorAttachment = {
+            .stages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .access = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .write = true
+        };
+
+        const AccessInfo depthAttachment = {
+            .stages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+            .access = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .write = true
+        };
+
+        for (auto& pass : m_passes) {
+            if (!pass.m_live)
+                continue;
+
+            bool hasDepth = pass.m_depthAttachment.texture != 0;
+            bool computePass = pass.m_colorAttachments.empty() && !hasDepth;
+
+            for (auto& access : pass.m_accesses) {
+                AccessInfo info = GetAccessInfo(m_resources[access.resource - 1], access.access, computePass);
+                info.write = access.write;
+                require(access.resource, info);
+            }
+
+            for (auto& attachment : pass.m_colorAttachments)
+                require(attachment.texture, colorAttachment);
+
+            if (hasDepth)
+                require(pass.m_depthAttachment.texture, depthAttachment);
+
+            // Everything this pass waits on goes out as a single barrier
+            Flush(imageBarriers, bufferBarriers);
+
+            if (computePass) {
+                pass.m_execute(m_context);
+                continue;
+            }
+
+            std::vector<VkRenderingAttachmentInfo> colorRais;
+            for (auto& attachment : pass.m_colorAttachments) {
+                const Resource& resource = m_resources[attachment.texture - 1];
+
+                colorRais.push_back({
+                    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                    .imageView = GetAttachmentView(resource),
+                    .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    .loadOp = attachment.loadOp,
+                    .storeOp = attachment.storeOp,
+                    .clearValue = attachment.clear
+                });
+
+                if (resource.kind == ResourceKind::Backbuffer)
+                    m_context.m_colorWritten = true;
+            }
+
+            VkRenderingAttachmentInfo depthRai = {};
+            bool hasStencil = false;
+
+            if (hasDepth) {
+                const Resource& resource = m_resources[pass.m_depthAttachment.texture - 1];
+                hasStencil = Context::HasStencilComponent(GetFormat(resource));
+
+                depthRai = {
+                    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                    .imageView = GetAttachmentView(resource),
+                    .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                    .loadOp = pass.m_depthAttachment.loadOp,
+                    .storeOp = pass.m_depthAttachment.storeOp,
+                    .clearValue = pass.m_depthAttachment.clear
+                };
+
+                if (resource.kind == ResourceKind::Depth)
+                    m_context.m_depthWritten = true;
+            }
+
+            // Render area covers the first attachment
+            RenderGraphResource first = colorRais.empty() ? pass.m_depthAttachment.texture : pass.m_colorAttachments[0].texture;
+            VkExtent2D extent = GetExtent(m_resources[first - 1]);
+
+            VkRenderingInfo ri = {
+                .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+                .renderArea = {
+                    .offset = { 0, 0 },
+                    .extent = extent
+                },
+                .layerCount = 1,
+                .colorAttachmentCount = static_cast<uint32_t>(colorRais.size()),
+                .pColorAttachments = colorRais.data(),
+                .pDepthAttachment = hasDepth ? &depthRai : nullptr,
+                .pStencilAttachment = hasStencil ? &depthRai : nullptr
+            };
+
+            vkCmdBeginRendering(cmds, &ri);
+
+            // Same -y up viewport as Context::BeginRendering
+            VkViewport vp = {
+                .x = 0.0f,
+                .y = float(extent.height),
+                .width = float(extent.width),
+                .height = -float(extent.height),
+                .minDepth = 0.0f,
+                .maxDepth = 1.0f
+            };
+
+            VkRect2D scissor = {
+                .offset = { 0, 0 },
+                .extent = extent
+            };
+
+            vkCmdSetViewport(cmds, 0, 1, &vp);
+            vkCmdSetScissor(cmds, 0, 1, &scissor);
+
+            pass.m_execute(m_context);
+
+            vkCmdEndRendering(cmds);
+        }
+
+        // Hand imported textures back in their usual layout and the backbuffer as EndFrame expects it
+        for (auto& resource : m_resources) {
+            if (!resource.usedThisFrame)
+                continue;
+
+            if (resource.kind == ResourceKind::Texture && resource.state.layout != resource.homeLayout) {
+                VkAccessFlags2 access = VK_ACCESS_2_SHADER_READ_BIT;
+                if (resource.homeLayout == VK_IMAGE_LAYOUT_GENERAL)
+                    access |= VK_ACCESS_2_SHADER_WRITE_BIT;
+
+                AccessInfo info = {
+                    .stages = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    .access = access,
+                    .layout = resource.homeLayout
+                };
+
+                Require(resource, info, false, imageBarriers, bufferBarriers);
+                m_context.m_textures[resource.texture].layout = resource.homeLayout;
+            }
+            else if (resource.kind == ResourceKind::Backbuffer && resource.state.layout != VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
+                Require(resource, colorAttachment, false, imageBarriers, bufferBarriers);
+            }
+        }
+
+        Flush(imageBarriers, bufferBarriers);
+    }
+
+    RenderGraph::AccessInfo RenderGraph::GetAccessInfo(const Resource& resource, RenderGraphAccess access, bool computePass) const {
+        VkPipelineStageFlags2 shaderStages = computePass
+            ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT
+            : VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+
+        bool depth = Context::GetImageAspect(GetFormat(resource)) & VK_IMAGE_ASPECT_DEPTH_BIT;
+
+        switch (access) {
+        case RenderGraphAccess::Sampled:
+            return {
+                shaderStages,
+                VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+            };
+        case RenderGraphAccess::StorageRead:
+            return { shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+        case RenderGraphAccess::StorageWrite:
+            return { shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL };
+        case RenderGraphAccess::UniformRead:
+            return { shaderStages, VK_ACCESS_2_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED };
+        case RenderGraphAccess::VertexRead:
+            return {
+                VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+                VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT,
+                VK_IMAGE_LAYOUT_UNDEFINED
+            };
+        case RenderGraphAccess::IndirectRead:
+            return { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED };
+        }
+
+        return {};
+    }
+
+    void RenderGraph::Require(Resource& resource, const AccessInfo& info, bool discard,
+        std::vector<VkImageMemoryBarrier2>& imageBarriers, std::vector<VkBufferMemoryBarrier2>& bufferBarriers) {
+        ResourceState& state = resource.state;
+        bool image = resource.kind != ResourceKind::Buffer;
+        bool layoutChange = image && info.layout != state.layout;
+
+        assert((!image || info.layout != VK_IMAGE_LAYOUT_UNDEFINED) && "buffer access declared on a texture");
+
+        VkPipelineStageFlags2 srcStages;
+        VkAccessFlags2 srcAccess;
+
+        if (discard) {
+            // Wait for the memory's previous user, last frame or an aliased texture
+            MemoryBlock& block = m_memoryBlocks[resource.memoryBlock];
+            srcStages = block.stages;
+            srcAccess = block.access;
+        }
+        else if (!info.write && !layoutChange) {
+            // Reads after reads need nothing, only the first read at a stage after a write waits for it
+            bool visible = (state.readStages & info.stages) == info.stages && (state.readAccess & info.access) == info.access;
+            if (visible || state.writeStages == 0) {
+                state.readStages |= info.stages;
+                state.readAccess |= info.access;
+                return;
+            }
+
+            srcStages = state.writeStages;
+            srcAccess = state.writeAccess;
+        }
+        else {
+            // Writes and layout transitions wait for every earlier access
+            srcStages = state.writeStages | state.readStages;
+            srcAccess = state.writeAccess;
+        }
+
+        if (image) {
+            imageBarriers.push_back({
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask = srcStages,
+                .srcAccessMask = srcAccess,
+                .dstStageMask = info.stages,
+                .dstAccessMask = info.access,
+                .oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout,
+                .newLayout = info.layout,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = GetImage(resource),
+                .subresourceRange = {
+                    .aspectMask = Context::GetImageAspect(GetFormat(resource)),
+                    .levelCount = VK_REMAINING_MIP_LEVELS,
+                    .layerCount = 1
+                }
+            });
+        }
+        else {
+            bufferBarriers.push_back({
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+                .srcStageMask = srcStages,
+                .srcAccessMask = srcAccess,
+                .dstStageMask = info.stages,
+                .dstAccessMask = info.access,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = m_context.m_buffers[resource.buffer].buffer,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE
+            });
+        }
+
+        if (info.write) {
+            state = {
+                .layout = info.layout,
+                .writeStages = info.stages,
+                .writeAccess = info.access
+            };
+        }
+        else if (layoutChange || discard) {
+            // The transition is the last write, later reads at other stages wait for this barrier
+            state = {
+                .layout = info.layout,
+                .writeStages = info.stages,
+                .writeAccess = 0,
+                .readStages = info.stages,
+                .readAccess = info.access
+            };
+        }
+        else {
+            state.readStages |= info.stages;
+            state.readAccess |= info.access;
+        }
+
+        if (resource.kind == ResourceKind::Transient) {
+            MemoryBlock& block = m_memoryBlocks[resource.memoryBlock];
+            block.stages = state.writeStages | state.readStages;
+            block.access = state.writeAccess;
+        }
+    }
+
+    void RenderGraph::Flush(std::vector<VkImageMemoryBarrier2>& imageBarriers, std::vector<VkBufferMemoryBarrier2>& bufferBarriers) {
+        if (imageBarriers.empty() && bufferBarriers.empty())
+            return;
+
+        VkDependencyInfo di = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size()),
+            .pBufferMemoryBarriers = bufferBarriers.data(),
+            .imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size()),
+            .pImageMemoryBarriers = imageBarriers.data()
+        };
+
+        vkCmdPipelineBarrier2(m_context.GetCommandBuffer(), &di);
+        m_stats.barriers++;
+
+        imageBarriers.clear();
+        bufferBarriers.clear();
+    }
+
+    VkImage RenderGraph::GetImage(const Resource& resource) const {
+        switch (resource.kind) {
+        case ResourceKind::Backbuffer:
+            if (m_context.m_dynamicResolution.enabled)
+                return m_context.m_sceneTarget.image;
+            return m_context.m_swapchainImages[m_context.m_swapchainImageIndex];
+        case ResourceKind::Depth:
+            return m_context.m_depthTarget.image;
+        default:
+            return m_context.m_textures[resource.texture].image;
+        }
+    }
+
+    VkFormat RenderGraph::GetFormat(const Resource& resource) const {
+        switch (resource.kind) {
+        case ResourceKind::Transient:
+            return resource.desc.format;
+        case ResourceKind::Texture:
+            return m_context.m_textures[resource.texture].format;
+        case ResourceKind::Backbuffer:
+            return m_context.m_swapchainFormat;
+        case ResourceKind::Depth:
+            return m_context.m_depthFormat;
+        default:
+            return VK_FORMAT_UNDEFINED;
+        }
+    }
+
+    VkExtent2D RenderGraph::GetExtent(const Resource& resource) const {
+        switch (resource.kind) {
+        case ResourceKind::Transient:
+            return resource.extent;
+        case ResourceKind::Texture:
+            return m_context.m_textures[resource.texture].extent;
+        default:
+            break;
+        }
+
+        // Scaled frames render into the top-left part of the scene and depth targets, as Context::BeginRendering does
+        VkExtent2D extent = m_context.m_swapchainExtent;
+        if (m_context.m_dynamicResolution.enabled) {
+            extent.width = static_cast<uint32_t>(std::max(std::floor(extent.width * m_context.m_renderScale), 1.0f));
+            extent.height = static_cast<uint32_t>(std::max(std::floor(extent.height * m_context.m_renderScale), 1.0f));
+        }
+
+        return extent;
+    }
+
+    VkImageView RenderGraph::GetAttachmentView(const Resource& resource) const {
+        switch (resource.kind) {
+        case ResourceKind::Transient:
+            return resource.attachmentView;
+        case ResourceKind::Backbuffer:
+            if (m_context.m_dynamicResolution.enabled)
+                return m_context.m_sceneTarget.imageView;
+            return m_context.m_swapchainImageViews[m_context.m_swapchainImageIndex];
+        case ResourceKind::Depth:
+            return m_context.m_depthTarget.imageView;
+        default:
+            return m_context.m_textures[resource.texture].imageView;
+        }
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,203 @@
+#pragma once
+
+#include "context.hpp"
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace vkr {
+
+    // Index of a texture or buffer declared on a RenderGraph, 0 is invalid
+    using RenderGraphResource = uint32_t;
+
+    struct RenderGraphTextureDesc {
+        VkFormat format;
+
+        // 0 follows the context's render extent, multiplied by scale
+        uint32_t width = 0, height = 0;
+        float scale = 1.0f;
+    };
+
+    // How a pass uses a resource besides rendering into it, decides layouts, stages and access masks
+    enum class RenderGraphAccess {
+        Sampled,        // SetTexture, or SetDepthTexture for the imported depth
+        StorageRead,    // SetStorageImage / SetStorageBuffer
+        StorageWrite,
+        UniformRead,    // SetUniformBuffer
+        VertexRead,     // SetVertexBuffers / SetIndexBuffer
+        IndirectRead    // DrawIndexedIndirect / DispatchIndirect arguments
+    };
+
+    struct RenderGraphStats {
+        uint32_t passes;
+        uint32_t culledPasses;          // Contribute nothing to an imported resource
+        uint32_t barriers;              // vkCmdPipelineBarrier2 calls during the last Execute
+        VkDeviceSize transientBytes;    // Memory backing transient textures
+        VkDeviceSize aliasedBytes;      // Saved by placing transient textures in shared memory
+        uint32_t lazyTextures;          // Transient attachments backed by lazily allocated memory
+    };
+
+    class RenderGraphPass {
+    public:
+        // Render into the texture during this pass, LOAD keeps (and so reads) what earlier passes wrote
+        RenderGraphPass& WriteColor(RenderGraphResource texture, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            VkClearColorValue clear = { { 0.0f, 0.0f, 0.0f, 1.0f } });
+        RenderGraphPass& WriteDepth(RenderGraphResource texture, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            float clear = 1.0f);
+
+        RenderGraphPass& Read(RenderGraphResource resource, RenderGraphAccess access);
+        RenderGraphPass& Write(RenderGraphResource resource, RenderGraphAccess access);
+
+    private:
+        friend class RenderGraph;
+
+        struct Access {
+            RenderGraphResource resource;
+            RenderGraphAccess access;
+            bool write;
+        };
+
+        struct Attachment {
+            RenderGraphResource texture;
+            VkAttachmentLoadOp loadOp;
+            VkClearValue clear;
+            VkAttachmentStoreOp storeOp;    // Resolved by Compile
+        };
+
+        std::string m_name;
+        std::function<void(Context&)> m_execute;
+        std::vector<Access> m_accesses;
+        std::vector<Attachment> m_colorAttachments;
+        Attachment m_depthAttachment = {};
+        bool m_live = true;
+    };
+
+    // Frame graph of passes that declare the resources they use
+    //
+    // Build once: declare resources and passes in execution order, then Compile()
+    // Each frame, between BeginFrame and EndFrame: Execute()
+    //
+    // Compile culls passes that contribute nothing to an imported resource and places transient textures
+    // with disjoint lifetimes in the same memory. Execute emits one batched barrier per pass, derived
+    // from the declared accesses. Passes with attachments run inside dynamic rendering with the viewport
+    // covering the first attachment, the others are treated as compute passes
+    class RenderGraph {
+    public:
+        RenderGraph(Context& context);
+        ~RenderGraph();
+
+        // Texture that only lives within a frame, its contents never carry over to the next one
+        RenderGraphResource CreateTexture(const char* name, const RenderGraphTextureDesc& desc);
+
+        // Resources that outlive the graph, passes writing them are never culled
+        RenderGraphResource ImportTexture(TextureHandle textureHandle);
+        RenderGraphResource ImportBuffer(BufferHandle bufferHandle);
+        RenderGraphResource ImportBackbuffer();     // The frame's swapchain (or headless) image, the scene target when scaled
+        RenderGraphResource ImportDepth();          // The context's depth target
+
+        // Passes execute in the order they are added
+        RenderGraphPass& AddPass(const char* name, std::function<void(Context&)> execute);
+
+        // Cull passes and (re)allocate transient textures, also done by Execute when the render extent changes
+        void Compile();
+
+        // With a render thread, the graph records when the render thread reaches this point of the frame
+        void Execute();
+
+        // Handle for binding a transient or imported texture inside a pass, e.g. with SetTexture
+        TextureHandle GetTexture(RenderGraphResource texture) const;
+
+        const RenderGraphStats& GetStats() const { return m_stats; }
+
+        // Executes recorded so far, counting the one in progress. With a render thread, passes record while the
+        // main thread builds the next frame, they use this to find the state of the frame they belong to
+        uint64_t GetExecuteCount() const { return m_executeCount; }
+
+    private:
+        enum class ResourceKind {
+            Transient,
+            Texture,
+            Buffer,
+            Backbuffer,
+            Depth
+        };
+
+        // Synchronization state of a resource, updated as passes are recorded
+        struct ResourceState {
+            VkImageLayout layout;
+            VkPipelineStageFlags2 writeStages;
+            VkAccessFlags2 writeAccess;
+            VkPipelineStageFlags2 readStages;   // Reads made visible since the last write
+            VkAccessFlags2 readAccess;
+        };
+
+        struct Resource {
+            std::string name;
+            ResourceKind kind;
+            RenderGraphTextureDesc desc;
+            TextureHandle texture;
+            BufferHandle buffer;
+
+            // Transients, resolved by Compile
+            VkImageUsageFlags usage;
+            VkExtent2D extent;
+            VkImageView attachmentView;     // Only differs from the texture's view for depth/stencil
+            uint32_t firstPass, lastPass;
+            uint32_t memoryBlock;
+            bool lazy;
+
+            ResourceState state;
+            VkImageLayout homeLayout;       // Imported textures are returned to this layout after Execute
+            bool usedThisFrame;
+        };
+
+        // Memory shared by transients whose lifetimes do not overlap
+        struct MemoryBlock {
+            VmaAllocation alloc;
+            VkMemoryRequirements requirements;
+            std::vector<std::pair<uint32_t, uint32_t>> lifetimes;   // [firstPass, lastPass] of each occupant
+
+            // Last accesses of the previous occupant, the next one waits for them before reusing the memory
+            VkPipelineStageFlags2 stages;
+            VkAccessFlags2 access;
+        };
+
+        struct AccessInfo {
+            VkPipelineStageFlags2 stages;
+            VkAccessFlags2 access;
+            VkImageLayout layout;
+            bool write;
+        };
+
+        RenderGraphResource AddResource(Resource&& resource);
+
+        AccessInfo GetAccessInfo(const Resource& resource, RenderGraphAccess access, bool computePass) const;
+
+        // Update a resource's state for an access, appending a barrier if one is needed
+        void Require(Resource& resource, const AccessInfo& info, bool discard,
+            std::vector<VkImageMemoryBarrier2>& imageBarriers, std::vector<VkBufferMemoryBarrier2>& bufferBarriers);
+
+        void Flush(std::vector<VkImageMemoryBarrier2>& imageBarriers, std::vector<VkBufferMemoryBarrier2>& bufferBarriers);
+
+        VkImage GetImage(const Resource& resource) const;
+        VkFormat GetFormat(const Resource& resource) const;
+        VkExtent2D GetExtent(const Resource& resource) const;
+        VkImageView GetAttachmentView(const Resource& resource) const;
+
+        void CullPasses();
+        void AllocateTransients();
+        void DestroyTransients();
+
+        Context& m_context;
+        std::vector<Resource> m_resources;
+        std::deque<RenderGraphPass> m_passes;
+        std::vector<MemoryBlock> m_memoryBlocks;
+        VkExtent2D m_compiledExtent = {};
+        bool m_compiled = false;
+        uint64_t m_executeCount = 0;
+        RenderGraphStats m_stats = {};
+    };
+
+}
\ No newline at end of file
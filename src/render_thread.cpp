@@ -0,0 +1,261 @@
+#include "render_thread.hpp"
+#include "context.hpp"
+
+namespace vkr {
+
+    RenderThread::RenderThread(Context& context)
+        : m_context(context), m_thread(&RenderThread::Run, this) {
+    }
+
+    RenderThread::~RenderThread() {
+        // Calls recorded since the last frame still execute, e.g. Destroy* calls made during shutdown
+        Submit();
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_exit = true;
+        }
+
+        m_signal.notify_all();
+        m_thread.join();
+    }
+
+    uint64_t RenderThread::PushData(const void* pData, size_t size) {
+        std::vector<uint8_t>& data = m_streams[m_recordStream].data;
+
+        // Aligned for any argument type, e.g. arrays of handles
+        constexpr size_t alignment = alignof(std::max_align_t);
+        size_t offset = (data.size() + alignment - 1) & ~(alignment - 1);
+
+        data.resize(offset + size);
+        if (size > 0)
+            std::memcpy(data.data() + offset, pData, size);
+
+        return offset;
+    }
+
+    void RenderThread::PushCallback(std::function<void()>&& callback) {
+        std::vector<std::function<void()>>& callbacks = m_streams[m_recordStream].callbacks;
+        callbacks.push_back(std::move(callback));
+
+        Push(RenderOp::Callback, uint64_t(callbacks.size() - 1));
+    }
+
+    void RenderThread::Submit() {
+        std::unique_lock lock(m_mutex);
+        m_signal.wait(lock, [this]() { return !m_pending; });
+
+        m_recordStream ^= 1;
+        m_pending = true;
+
+        lock.unlock();
+        m_signal.notify_all();
+    }
+
+    void RenderThread::Wait() {
+        std::unique_lock lock(m_mutex);
+        m_signal.wait(lock, [this]() { return !m_pending; });
+    }
+
+    void RenderThread::Run() {
+        std::unique_lock lock(m_mutex);
+
+        while (true) {
+            m_signal.wait(lock, [this]() { return m_pending || m_exit; });
+            if (!m_pending)
+                return;
+
+            // The application thread records into the other stream meanwhile
+            RenderStream& stream = m_streams[m_recordStream ^ 1];
+            lock.unlock();
+
+            Execute(stream);
+
+            // Cleared, not released, so later frames record without allocating
+            stream.packets.clear();
+            stream.data.clear();
+            stream.callbacks.clear();
+
+            lock.lock();
+            m_pending = false;
+            m_signal.notify_all();
+        }
+    }
+
+    void RenderThread::Execute(RenderStream& stream) {
+        // Calls made on this thread execute directly, so each packet is replayed through the public call it came from
+        for (const RenderPacket& packet : stream.packets) {
+            switch (packet.op) {
+            case RenderOp::BeginFrame:
+                m_context.BeginFrame();
+                break;
+            case RenderOp::EndFrame:
+                m_context.EndFrame();
+                break;
+            case RenderOp::BeginRendering: {
+                auto [viewport] = Unpack<VkViewport>(packet);
+                m_context.BeginRendering(viewport);
+                break;
+            }
+            case RenderOp::BeginDepthPrepass: {
+                auto [viewport] = Unpack<VkViewport>(packet);
+                m_context.BeginDepthPrepass(viewport);
+                break;
+            }
+            case RenderOp::EndRendering:
+                m_context.EndRendering();
+                break;
+
+            case RenderOp::SetVertexBuffers: {
+                auto [dataOffset, count] = Unpack<uint64_t, uint64_t>(packet);
+                BufferHandle* pBuffers = reinterpret_cast<BufferHandle*>(stream.data.data() + dataOffset);
+                m_context.SetVertexBuffers(std::span(pBuffers, count));
+                break;
+            }
+            case RenderOp::SetIndexBuffer: {
+                auto [buffer, indexType] = Unpack<BufferHandle, VkIndexType>(packet);
+                m_context.SetIndexBuffer(buffer, indexType);
+                break;
+            }
+            case RenderOp::SetUniformBuffer: {
+                auto [buffer, binding] = Unpack<BufferHandle, uint32_t>(packet);
+                m_context.SetUniformBuffer(buffer, binding);
+                break;
+            }
+            case RenderOp::SetTexture: {
+                auto [texture, sampler, binding] = Unpack<TextureHandle, SamplerHandle, uint32_t>(packet);
+                m_context.SetTexture(texture, sampler, binding);
+                break;
+            }
+            case RenderOp::SetStorageBuffer: {
+                auto [buffer, binding] = Unpack<BufferHandle, uint32_t>(packet);
+                m_context.SetStorageBuffer(buffer, binding);
+                break;
+            }
+            case RenderOp::SetStorageImage: {
+                auto [texture, mipLevel, binding] = Unpack<TextureHandle, uint32_t, uint32_t>(packet);
+                m_context.SetStorageImage(texture, mipLevel, binding);
+                break;
+            }
+            case RenderOp::SetDepthTexture: {
+                auto [sampler, binding] = Unpack<SamplerHandle, uint32_t>(packet);
+                m_context.SetDepthTexture(sampler, binding);
+                break;
+            }
+            case RenderOp::SetGraphicsPipeline: {
+                auto [pipeline] = Unpack<GraphicsPipelineHandle>(packet);
+                m_context.SetGraphicsPipeline(pipeline);
+                break;
+            }
+            case RenderOp::SetComputePipeline: {
+                auto [pipeline] = Unpack<ComputePipelineHandle>(packet);
+                m_context.SetComputePipeline(pipeline);
+                break;
+            }
+            case RenderOp::SetPushConstants: {
+                auto [dataOffset, size, offset] = Unpack<uint64_t, size_t, size_t>(packet);
+                m_context.SetPushConstants(stream.data.data() + dataOffset, size, offset);
+                break;
+            }
+            case RenderOp::SetPrimitiveTopology: {
+                auto [topology] = Unpack<VkPrimitiveTopology>(packet);
+                m_context.SetPrimitiveTopology(topology);
+                break;
+            }
+            case RenderOp::SetCullMode: {
+                auto [cullMode] = Unpack<VkCullModeFlags>(packet);
+                m_context.SetCullMode(cullMode);
+                break;
+            }
+
+            case RenderOp::Draw: {
+                auto [offset, count] = Unpack<uint32_t, uint32_t>(packet);
+                m_context.Draw(offset, count);
+                break;
+            }
+            case RenderOp::DrawIndexed: {
+                auto [offset, count, firstInstance] = Unpack<uint32_t, uint32_t, uint32_t>(packet);
+                m_context.DrawIndexed(offset, count, firstInstance);
+                break;
+            }
+            case RenderOp::DrawIndexedIndirect: {
+                auto [buffer, offset, drawCount, stride] = Unpack<BufferHandle, size_t, uint32_t, uint32_t>(packet);
+                m_context.DrawIndexedIndirect(buffer, offset, drawCount, stride);
+                break;
+            }
+            case RenderOp::Dispatch: {
+                auto [x, y, z] = Unpack<uint32_t, uint32_t, uint32_t>(packet);
+                m_context.Dispatch(x, y, z);
+                break;
+            }
+            case RenderOp::DispatchIndirect: {
+                auto [buffer, offset] = Unpack<BufferHandle, size_t>(packet);
+                m_context.DispatchIndirect(buffer, offset);
+                break;
+            }
+            case RenderOp::BeginAsyncCompute:
+                m_context.BeginAsyncCompute();
+                break;
+            case RenderOp::EndAsyncCompute: {
+                auto [consumerStages] = Unpack<VkPipelineStageFlags2>(packet);
+                m_context.EndAsyncCompute(consumerStages);
+                break;
+            }
+            case RenderOp::PipelineBarrier: {
+                auto [srcStage, srcAccess, dstStage, dstAccess] =
+                    Unpack<VkPipelineStageFlags2, VkAccessFlags2, VkPipelineStageFlags2, VkAccessFlags2>(packet);
+                m_context.PipelineBarrier(srcStage, srcAccess, dstStage, dstAccess);
+                break;
+            }
+
+            case RenderOp::DestroyBuffer: {
+                auto [buffer] = Unpack<BufferHandle>(packet);
+                m_context.DestroyBuffer(buffer);
+                break;
+            }
+            case RenderOp::DestroyShader: {
+                auto [shader] = Unpack<VkShaderModule>(packet);
+                m_context.DestroyShader(shader);
+                break;
+            }
+            case RenderOp::DestroySampler: {
+                auto [sampler] = Unpack<SamplerHandle>(packet);
+                m_context.DestroySampler(sampler);
+                break;
+            }
+            case RenderOp::DestroyTexture: {
+                auto [texture] = Unpack<TextureHandle>(packet);
+                m_context.DestroyTexture(texture);
+                break;
+            }
+            case RenderOp::DestroyGraphicsPipeline: {
+                auto [pipeline] = Unpack<GraphicsPipelineHandle>(packet);
+                m_context.DestroyGraphicsPipeline(pipeline);
+                break;
+            }
+            case RenderOp::DestroyComputePipeline: {
+                auto [pipeline] = Unpack<ComputePipelineHandle>(packet);
+                m_context.DestroyComputePipeline(pipeline);
+                break;
+            }
+
+            case RenderOp::CopyBufferData: {
+                auto [buffer, dataOffset, offset, size] = Unpack<BufferHandle, uint64_t, size_t, size_t>(packet);
+                m_context.CopyBufferData(buffer, stream.data.data() + dataOffset, offset, size);
+                break;
+            }
+            case RenderOp::RequestTextureResolution: {
+                auto [texture, screenSize] = Unpack<TextureHandle, float>(packet);
+                m_context.RequestTextureResolution(texture, screenSize);
+                break;
+            }
+            case RenderOp::Callback: {
+                auto [index] = Unpack<uint64_t>(packet);
+                stream.callbacks[index]();
+                break;
+            }
+            }
+        }
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace vkr {
+
+    class Context;
+
+    // Context calls the application thread hands to the render thread
+    enum class RenderOp : uint32_t {
+        BeginFrame,
+        EndFrame,
+        BeginRendering,
+        BeginDepthPrepass,
+        EndRendering,
+
+        SetVertexBuffers,
+        SetIndexBuffer,
+        SetUniformBuffer,
+        SetTexture,
+        SetStorageBuffer,
+        SetStorageImage,
+        SetDepthTexture,
+        SetGraphicsPipeline,
+        SetComputePipeline,
+        SetPushConstants,
+        SetPrimitiveTopology,
+        SetCullMode,
+
+        Draw,
+        DrawIndexed,
+        DrawIndexedIndirect,
+        Dispatch,
+        DispatchIndirect,
+        BeginAsyncCompute,
+        EndAsyncCompute,
+        PipelineBarrier,
+
+        DestroyBuffer,
+        DestroyShader,
+        DestroySampler,
+        DestroyTexture,
+        DestroyGraphicsPipeline,
+        DestroyComputePipeline,
+
+        CopyBufferData,
+        RequestTextureResolution,
+        Callback
+    };
+
+    // One call, arguments are packed in call order. Variable-size arguments live in the stream's data
+    struct RenderPacket {
+        RenderOp op;
+        alignas(8) uint8_t args[32];
+    };
+
+    // Calls recorded during one frame
+    struct RenderStream {
+        std::vector<RenderPacket> packets;
+        std::vector<uint8_t> data;
+        std::vector<std::function<void()>> callbacks;
+    };
+
+    // Executes a context's calls on a thread of its own. The application thread records a frame into one stream
+    // while the render thread translates the previous frame's stream into Vulkan commands
+    class RenderThread {
+    public:
+        RenderThread(Context& context);
+        ~RenderThread();
+
+        // True on the render thread, where calls on the context are executed instead of recorded
+        bool IsCurrent() const { return std::this_thread::get_id() == m_thread.get_id(); }
+
+        template <typename... TArgs>
+        void Push(RenderOp op, const TArgs&... args) {
+            static_assert((std::is_trivially_copyable_v<TArgs> && ...), "packet arguments are copied as bytes");
+            static_assert((sizeof(TArgs) + ... + 0) <= sizeof(RenderPacket::args), "arguments do not fit a packet");
+
+            RenderPacket& packet = m_streams[m_recordStream].packets.emplace_back();
+            packet.op = op;
+
+            size_t offset = 0;
+            ((std::memcpy(packet.args + offset, &args, sizeof(TArgs)), offset += sizeof(TArgs)), ...);
+        }
+
+        // Copy variable-size arguments into the stream, returns their offset in its data
+        uint64_t PushData(const void* pData, size_t size);
+
+        // Run work on the render thread at this point of the frame
+        void PushCallback(std::function<void()>&& callback);
+
+        // Hand the recorded stream to the render thread once it has finished the previous one
+        void Submit();
+
+        // Block until the render thread has executed every submitted stream
+        void Wait();
+
+    private:
+        void Run();
+        void Execute(RenderStream& stream);
+
+        template <typename... TArgs>
+        static std::tuple<TArgs...> Unpack(const RenderPacket& packet) {
+            std::tuple<TArgs...> args;
+            size_t offset = 0;
+            std::apply([&](auto&... arg) {
+                ((std::memcpy(&arg, packet.args + offset, sizeof(arg)), offset += sizeof(arg)), ...);
+            }, args);
+            return args;
+        }
+
+        Context& m_context;
+
+        RenderStream m_streams[2];
+        uint32_t m_recordStream = 0;        // Owned by the application thread, the other one by the render thread
+
+        std::mutex m_mutex;
+        std::condition_variable m_signal;
+        bool m_pending = false;             // A submitted stream has not been executed yet
+        bool m_exit = false;
+
+        std::thread m_thread;               // Last, so it starts after everything it uses
+    };
+
+}
\ No newline at end of file
@@ -21,8 +21,14 @@ public:
         m_resources.erase(id);
     }
 
+    bool Contains(ResourceID id) const { return m_resources.find(id) != m_resources.end(); }
+
     size_t GetSize() const { return m_resources.size(); }
 
+    // Iterate (id, resource) pairs, e.g. to release everything on shutdown
+    auto begin() { return m_resources.begin(); }
+    auto end() { return m_resources.end(); }
+
     T& operator[](ResourceID id) { return m_resources[id]; }
     const T& operator[](ResourceID id) const { return m_resources[id]; }
 
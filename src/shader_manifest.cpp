@@ -0,0 +1,47 @@
+#include "shader_manifest.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace vkr {
+
+    ShaderManifest::ShaderManifest(const char* path) {
+        std::ifstream file(path);
+
+        // One variant per line: <shader> <keywords, comma separated, - for none> <file>
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string keywords;
+            Variant variant;
+
+            if (!(fields >> variant.shader >> keywords >> variant.file))
+                continue;
+
+            if (keywords != "-") {
+                std::istringstream keywordList(keywords);
+                std::string keyword;
+
+                while (std::getline(keywordList, keyword, ','))
+                    variant.keywords.push_back(keyword);
+            }
+
+            std::sort(variant.keywords.begin(), variant.keywords.end());
+            m_variants.push_back(std::move(variant));
+        }
+    }
+
+    const char* ShaderManifest::GetVariant(const char* shader, std::span<const char* const> keywords) const {
+        std::vector<std::string> sortedKeywords(keywords.begin(), keywords.end());
+        std::sort(sortedKeywords.begin(), sortedKeywords.end());
+
+        for (auto& variant : m_variants) {
+            if (variant.shader == shader && variant.keywords == sortedKeywords)
+                return variant.file.c_str();
+        }
+
+        return nullptr;
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+
+namespace vkr {
+
+    // Shader variants listed in the shaders.manifest generated by the shader build
+    //
+    // Each shader is compiled once per subset of the keywords it declares with a "// keywords:" line,
+    // with those keywords defined. Variants are looked up by shader name, e.g. "test.fs", and keywords
+    class ShaderManifest {
+    public:
+        ShaderManifest(const char* path = "shaders.manifest");
+
+        // SPIR-V file of the variant compiled with exactly these keywords, in any order, nullptr if none was built
+        const char* GetVariant(const char* shader, std::span<const char* const> keywords = {}) const;
+
+        operator bool() const { return !m_variants.empty(); }
+
+    private:
+        struct Variant {
+            std::string shader;
+            std::vector<std::string> keywords;      // Sorted
+            std::string file;
+        };
+
+        std::vector<Variant> m_variants;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#version 450
+
+layout (local_size_x = 64) in;
+
+struct SkinVertex {
+    vec3 position;
+    uint joints01;          // Two 16-bit joint indices
+    vec3 normal;
+    uint joints23;
+    vec4 weights;
+};
+
+layout (set = 0, binding = 0) readonly buffer Vertices { SkinVertex vertices[]; };
+layout (set = 0, binding = 1) readonly buffer JointMatrices { mat4 jointMatrices[]; };
+
+// Tightly packed vec3s, the layout the vertex buffers are read with
+layout (set = 0, binding = 2) writeonly buffer Positions { float positions[]; };
+layout (set = 0, binding = 3) writeonly buffer Normals { float normals[]; };
+
+layout (push_constant) uniform constants {
+    uint vertexCount;
+    uint jointOffset;       // The instance's first matrix
+} PushConstants;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= PushConstants.vertexCount)
+        return;
+
+    SkinVertex vertex = vertices[i];
+
+    uvec4 joints = uvec4(
+        vertex.joints01 & 0xFFFF, vertex.joints01 >> 16,
+        vertex.joints23 & 0xFFFF, vertex.joints23 >> 16) + PushConstants.jointOffset;
+
+    mat4 skin =
+        vertex.weights.x * jointMatrices[joints.x] +
+        vertex.weights.y * jointMatrices[joints.y] +
+        vertex.weights.z * jointMatrices[joints.z] +
+        vertex.weights.w * jointMatrices[joints.w];
+
+    vec3 position = (skin * vec4(vertex.position, 1.0)).xyz;
+    vec3 normal = normalize(mat3(skin) * vertex.normal);
+
+    positions[i * 3 + 0] = position.x;
+    positions[i * 3 + 1] = position.y;
+    positions[i * 3 + 2] = position.z;
+
+    normals[i * 3 + 0] = normal.x;
+    normals[i * 3 + 1] = normal.y;
+    normals[i * 3 + 2] = normal.z;
+}
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "skinning.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace vkr {
+
+    // Must match SkinVertex in skin.cs.glsl
+    struct SkinVertex {
+        glm::vec3 position;
+        uint32_t joints01;      // Two 16-bit joint indices
+        glm::vec3 normal;
+        uint32_t joints23;
+        glm::vec4 weights;
+    };
+
+    // Must match the push constants in skin.cs.glsl
+    struct SkinConstants {
+        uint32_t vertexCount;
+        uint32_t jointOffset;
+    };
+
+    SkinningPass::SkinningPass(Context& context, const SkinningPassDesc& desc)
+        : m_context(context) {
+        ComputePipelineDesc cpd = {
+            .computeShader = desc.skinShader
+        };
+        m_skinPipeline = m_context.CreateComputePipeline(cpd);
+    }
+
+    SkinningPass::~SkinningPass() {
+        for (Instance& instance : m_instances) {
+            m_context.DestroyBuffer(instance.positions);
+            m_context.DestroyBuffer(instance.normals);
+        }
+
+        for (Mesh& mesh : m_meshes)
+            m_context.DestroyBuffer(mesh.vertices);
+
+        if (m_jointMatrixBuffer != 0)
+            m_context.DestroyBuffer(m_jointMatrixBuffer);
+
+        m_context.DestroyComputePipeline(m_skinPipeline);
+    }
+
+    uint32_t SkinningPass::AddMesh(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals,
+        std::span<const glm::u16vec4> joints, std::span<const glm::vec4> weights) {
+        assert(normals.size() == positions.size() && joints.size() == positions.size() && weights.size() == positions.size());
+
+        std::vector<SkinVertex> vertices(positions.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            vertices[i] = {
+                .position = positions[i],
+                .joints01 = joints[i].x | (uint32_t(joints[i].y) << 16),
+                .normal = normals[i],
+                .joints23 = joints[i].z | (uint32_t(joints[i].w) << 16),
+                .weights = weights[i]
+            };
+        }
+
+        BufferDesc bd = {
+            .pData = vertices.data(),
+            .size = vertices.size() * sizeof(SkinVertex),
+            .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        };
+
+        m_meshes.push_back({
+            .vertices = m_context.CreateBuffer(bd),
+            .vertexCount = static_cast<uint32_t>(vertices.size())
+        });
+
+        return static_cast<uint32_t>(m_meshes.size() - 1);
+    }
+
+    uint32_t SkinningPass::AddInstance(uint32_t mesh, uint32_t jointCount) {
+        // Written by the skin shader
+        BufferDesc bd = {
+            .pData = nullptr,
+            .size = m_meshes[mesh].vertexCount * sizeof(glm::vec3),
+            .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        };
+
+        m_instances.push_back({
+            .mesh = mesh,
+            .jointOffset = static_cast<uint32_t>(m_jointMatrices.size()),
+            .jointCount = jointCount,
+            .positions = m_context.CreateBuffer(bd),
+            .normals = m_context.CreateBuffer(bd),
+            .posed = true
+        });
+
+        // Identity joint matrices skin to the bind pose
+        m_jointMatrices.resize(m_jointMatrices.size() + jointCount, glm::mat4(1.0f));
+
+        return static_cast<uint32_t>(m_instances.size() - 1);
+    }
+
+    void SkinningPass::SetPose(uint32_t instance, std::span<const glm::mat4> jointMatrices) {
+        Instance& posed = m_instances[instance];
+        assert(jointMatrices.size() >= posed.jointCount);
+
+        // An unchanged pose keeps the vertices already skinned for it
+        glm::mat4* pCurrent = m_jointMatrices.data() + posed.jointOffset;
+        size_t size = posed.jointCount * sizeof(glm::mat4);
+
+        if (memcmp(pCurrent, jointMatrices.data(), size) == 0)
+            return;
+
+        memcpy(pCurrent, jointMatrices.data(), size);
+        posed.posed = true;
+    }
+
+    void SkinningPass::Skin() {
+        m_skinnedCount = 0;
+
+        if (std::none_of(m_instances.begin(), m_instances.end(), [](const Instance& instance) { return instance.posed; }))
+            return;
+
+        size_t jointMatrixSize = m_jointMatrices.size() * sizeof(glm::mat4);
+
+        // Grows with the instances, every instance's matrices are uploaded in one copy
+        if (m_jointMatrixCapacity < jointMatrixSize) {
+            if (m_jointMatrixBuffer != 0)
+                m_context.DestroyBuffer(m_jointMatrixBuffer);
+
+            BufferDesc bd = {
+                .pData = nullptr,
+                .size = jointMatrixSize,
+                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            };
+            m_jointMatrixBuffer = m_context.CreateBuffer(bd);
+            m_jointMatrixCapacity = jointMatrixSize;
+        }
+
+        m_context.CopyBufferData(m_jointMatrixBuffer, m_jointMatrices.data(), 0, jointMatrixSize);
+
+        // Earlier draws must be done reading the vertices before they are rewritten
+        m_context.PipelineBarrier(
+            VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, 0,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT);
+
+        m_context.SetComputePipeline(m_skinPipeline);
+        m_context.SetStorageBuffer(m_jointMatrixBuffer, 1);
+
+        for (Instance& instance : m_instances) {
+            if (!instance.posed)
+                continue;
+
+            const Mesh& mesh = m_meshes[instance.mesh];
+
+            m_context.SetStorageBuffer(mesh.vertices, 0);
+            m_context.SetStorageBuffer(instance.positions, 2);
+            m_context.SetStorageBuffer(instance.normals, 3);
+
+            SkinConstants constants = {
+                .vertexCount = mesh.vertexCount,
+                .jointOffset = instance.jointOffset
+            };
+            m_context.SetPushConstants(&constants, sizeof(constants), 0);
+            m_context.Dispatch((mesh.vertexCount + 63) / 64, 1, 1);
+
+            instance.posed = false;
+            m_skinnedCount++;
+        }
+
+        m_context.PipelineBarrier(
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+    }
+
+}
\ No newline at end of file
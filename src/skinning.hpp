@@ -0,0 +1,76 @@
+#pragma once
+
+#include "context.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include <span>
+#include <vector>
+
+namespace vkr {
+
+    struct SkinningPassDesc {
+        VkShaderModule skinShader;          // skin.cs.spv
+    };
+
+    // GPU linear blend skinning into per-instance vertex buffers
+    //
+    // Each frame, SetPose() every animated instance, then Skin() before the passes that draw them, outside a
+    // rendering scope. Instance i draws with GetPositions(i) and GetNormals(i) as tightly packed vec3 vertex
+    // buffers. Instances whose pose did not change keep last frame's vertices and are not skinned again
+    class SkinningPass {
+    public:
+        SkinningPass(Context& context, const SkinningPassDesc& desc);
+        ~SkinningPass();
+
+        // Bind pose vertices, shared by every instance of the mesh. Returns the mesh index
+        // joints and weights are JOINTS_0 and WEIGHTS_0, with joint indices into the instance's joint matrices
+        uint32_t AddMesh(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals,
+            std::span<const glm::u16vec4> joints, std::span<const glm::vec4> weights);
+
+        // Deformed copy of a mesh driven by jointCount joints, drawn in the bind pose until posed. Returns the instance index
+        uint32_t AddInstance(uint32_t mesh, uint32_t jointCount);
+
+        // Joint matrices of the instance for this frame, see ComputeJointMatrices
+        void SetPose(uint32_t instance, std::span<const glm::mat4> jointMatrices);
+
+        // Skin the instances posed since they were last skinned
+        void Skin();
+
+        BufferHandle GetPositions(uint32_t instance) const { return m_instances[instance].positions; }
+        BufferHandle GetNormals(uint32_t instance) const { return m_instances[instance].normals; }
+
+        // Instances skinned by the last Skin()
+        uint32_t GetSkinnedCount() const { return m_skinnedCount; }
+
+    private:
+        struct Mesh {
+            BufferHandle vertices;
+            uint32_t vertexCount;
+        };
+
+        struct Instance {
+            uint32_t mesh;
+            uint32_t jointOffset;       // First matrix in m_jointMatrices
+            uint32_t jointCount;
+            BufferHandle positions;
+            BufferHandle normals;
+            bool posed;                 // Pose changed since the last Skin()
+        };
+
+        Context& m_context;
+        ComputePipelineHandle m_skinPipeline = 0;
+
+        std::vector<Mesh> m_meshes;
+        std::vector<Instance> m_instances;
+
+        // Every instance's joint matrices back to back, uploaded when any of them changed
+        std::vector<glm::mat4> m_jointMatrices;
+        BufferHandle m_jointMatrixBuffer = 0;
+        size_t m_jointMatrixCapacity = 0;
+
+        uint32_t m_skinnedCount = 0;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,460 @@
+#include "spirv.hpp"
+
+#include <algorithm>
+
+namespace vkr {
+
+    namespace {
+
+        // The subset of the SPIR-V grammar needed for reflection
+        constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+        constexpr uint32_t SPIRV_HEADER_WORDS = 5;
+        constexpr uint32_t SPIRV_MAX_ID_BOUND = 0x3FFFFF;       // Universal limit of the SPIR-V spec
+        constexpr uint32_t SPIRV_MAX_MEMBERS = 0xFFFF;          // Word count of an OpTypeStruct
+        constexpr uint32_t MAX_CONSTANT_DEPTH = 64;             // Nesting of OpSpecConstantOp, also stops cycles
+
+        enum Op : uint32_t {
+            OpEntryPoint = 15,
+            OpTypeInt = 21,
+            OpTypeFloat = 22,
+            OpTypeVector = 23,
+            OpTypeMatrix = 24,
+            OpTypeImage = 25,
+            OpTypeSampler = 26,
+            OpTypeSampledImage = 27,
+            OpTypeArray = 28,
+            OpTypeRuntimeArray = 29,
+            OpTypeStruct = 30,
+            OpTypePointer = 32,
+            OpConstant = 43,
+            OpSpecConstantTrue = 48,
+            OpSpecConstantFalse = 49,
+            OpSpecConstant = 50,
+            OpSpecConstantComposite = 51,
+            OpSpecConstantOp = 52,
+            OpVariable = 59,
+            OpDecorate = 71,
+            OpMemberDecorate = 72,
+
+            // Integer operations evaluated for OpSpecConstantOp
+            OpSNegate = 126,
+            OpIAdd = 128,
+            OpISub = 130,
+            OpIMul = 132,
+            OpUDiv = 134,
+            OpSDiv = 135,
+            OpUMod = 137,
+            OpShiftRightLogical = 194,
+            OpShiftLeftLogical = 196,
+            OpBitwiseOr = 197,
+            OpBitwiseAnd = 199
+        };
+
+        enum Decoration : uint32_t {
+            DecorationBlock = 2,
+            DecorationBufferBlock = 3,
+            DecorationArrayStride = 6,
+            DecorationMatrixStride = 7,
+            DecorationBinding = 33,
+            DecorationDescriptorSet = 34,
+            DecorationOffset = 35
+        };
+
+        enum StorageClass : uint32_t {
+            StorageClassUniformConstant = 0,
+            StorageClassUniform = 2,
+            StorageClassPushConstant = 9,
+            StorageClassStorageBuffer = 12
+        };
+
+        constexpr uint32_t DIM_BUFFER = 5;
+
+        struct Id {
+            uint32_t opcode;
+            const uint32_t* pOperands;      // Words after the opcode
+            uint32_t operandCount;
+
+            // Decorations
+            uint32_t set;
+            uint32_t binding;
+            uint32_t arrayStride;
+            bool block;
+            bool bufferBlock;
+            std::vector<uint32_t> memberOffsets;
+            std::vector<uint32_t> memberMatrixStrides;
+        };
+
+        class Reflector {
+        public:
+            // The bound must be checked against SPIRV_MAX_ID_BOUND first
+            Reflector(const uint32_t* pWords, size_t wordCount)
+                : m_ids(pWords[3]) {
+                for (size_t i = SPIRV_HEADER_WORDS; i < wordCount && !m_malformed;) {
+                    uint32_t opcode = pWords[i] & 0xFFFF;
+                    uint32_t length = pWords[i] >> 16;
+                    if (length == 0 || i + length > wordCount) {
+                        Fail();
+                        break;
+                    }
+
+                    Parse(opcode, pWords + i + 1, length - 1);
+                    i += length;
+                }
+            }
+
+            // Returns false if the module is malformed, reflection is then incomplete
+            bool Reflect(ShaderReflection& reflection) {
+                reflection.stage = m_stage;
+
+                for (uint32_t id = 0; id < m_ids.size() && !m_malformed; id++) {
+                    Id& variable = m_ids[id];
+                    if (variable.opcode != OpVariable)
+                        continue;
+
+                    // OpVariable: result type, result, storage class
+                    uint32_t storageClass = variable.pOperands[2];
+                    uint32_t type = Pointee(variable.pOperands[0]);
+                    if (m_malformed)
+                        break;
+
+                    if (storageClass == StorageClassPushConstant) {
+                        reflection.pushConstantSize = std::max(reflection.pushConstantSize, TypeSize(type, 0));
+                        continue;
+                    }
+
+                    if (storageClass != StorageClassUniformConstant && storageClass != StorageClassUniform &&
+                        storageClass != StorageClassStorageBuffer)
+                        continue;
+
+                    // Arrays of resources take one binding with several descriptors
+                    uint32_t count = 1;
+                    while (m_ids[type].opcode == OpTypeArray || m_ids[type].opcode == OpTypeRuntimeArray) {
+                        count *= m_ids[type].opcode == OpTypeArray ? Constant(m_ids[type].pOperands[2]) : 0;
+                        type = m_ids[type].pOperands[1];
+                    }
+
+                    if (m_malformed)
+                        break;
+
+                    VkDescriptorType descriptorType;
+                    if (!GetDescriptorType(storageClass, type, descriptorType))
+                        continue;
+
+                    reflection.bindings.push_back({
+                        .set = variable.set,
+                        .binding = variable.binding,
+                        .type = descriptorType,
+                        .count = count
+                    });
+                }
+
+                return !m_malformed;
+            }
+
+        private:
+            void Parse(uint32_t opcode, const uint32_t* pOperands, uint32_t operandCount) {
+                // Fewest operands each instruction is read with
+                auto require = [&](uint32_t minOperands) {
+                    if (operandCount < minOperands)
+                        Fail();
+                    return !m_malformed;
+                };
+
+                switch (opcode) {
+                case OpEntryPoint:
+                    // Execution model, entry point, name, interface; the first entry point decides the stage
+                    if (require(3) && m_stage == 0)
+                        m_stage = GetStage(pOperands[0]);
+                    break;
+                case OpDecorate:
+                    if (require(2) && IsId(pOperands[0]))
+                        Decorate(m_ids[pOperands[0]], pOperands[1], operandCount > 2 ? pOperands[2] : 0);
+                    break;
+                case OpMemberDecorate:
+                    if (require(3) && IsId(pOperands[0]) && pOperands[1] < SPIRV_MAX_MEMBERS)
+                        MemberDecorate(m_ids[pOperands[0]], pOperands[1], pOperands[2], operandCount > 3 ? pOperands[3] : 0);
+                    else
+                        Fail();
+                    break;
+
+                // Types define their result id first, the types they are made of must already be defined
+                case OpTypeSampler:
+                case OpTypeStruct:
+                    if (require(1))
+                        Define(pOperands[0], opcode, pOperands, operandCount, 1, operandCount);
+                    break;
+                case OpTypeInt:
+                case OpTypeFloat:
+                    if (require(2))
+                        Define(pOperands[0], opcode, pOperands, operandCount);
+                    break;
+                case OpTypeSampledImage:
+                case OpTypeRuntimeArray:
+                    if (require(2))
+                        Define(pOperands[0], opcode, pOperands, operandCount, 1, 2);
+                    break;
+                case OpTypeVector:
+                case OpTypeMatrix:
+                    if (require(3))
+                        Define(pOperands[0], opcode, pOperands, operandCount, 1, 2);
+                    break;
+                case OpTypeArray:
+                    // Element type and length constant
+                    if (require(3))
+                        Define(pOperands[0], opcode, pOperands, operandCount, 1, 3);
+                    break;
+                case OpTypeImage:
+                    if (require(7))
+                        Define(pOperands[0], opcode, pOperands, operandCount);
+                    break;
+                case OpTypePointer:
+                    // May point at a type declared later with OpTypeForwardPointer
+                    if (require(3))
+                        Define(pOperands[0], opcode, pOperands, operandCount);
+                    break;
+
+                // Result type, then result id
+                case OpSpecConstantTrue:
+                case OpSpecConstantFalse:
+                case OpSpecConstantComposite:
+                    if (require(2))
+                        Define(pOperands[1], opcode, pOperands, operandCount);
+                    break;
+                case OpConstant:
+                case OpSpecConstant:
+                case OpVariable:
+                    if (require(3))
+                        Define(pOperands[1], opcode, pOperands, operandCount);
+                    break;
+                case OpSpecConstantOp:
+                    // Result type, result, opcode, then operands that are checked when evaluated
+                    if (require(4))
+                        Define(pOperands[1], opcode, pOperands, operandCount);
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            // Operands [firstRef, lastRef) are ids that have to be defined already
+            void Define(uint32_t id, uint32_t opcode, const uint32_t* pOperands, uint32_t operandCount,
+                uint32_t firstRef = 0, uint32_t lastRef = 0) {
+                if (!IsId(id) || m_ids[id].opcode != 0)
+                    return Fail();
+
+                for (uint32_t i = firstRef; i < lastRef; i++) {
+                    if (!IsId(pOperands[i]) || m_ids[pOperands[i]].opcode == 0)
+                        return Fail();
+                }
+
+                m_ids[id].opcode = opcode;
+                m_ids[id].pOperands = pOperands;
+                m_ids[id].operandCount = operandCount;
+            }
+
+            bool IsId(uint32_t id) {
+                if (id == 0 || id >= m_ids.size())
+                    Fail();
+                return !m_malformed;
+            }
+
+            void Fail() {
+                m_malformed = true;
+            }
+
+            void Decorate(Id& id, uint32_t decoration, uint32_t value) {
+                switch (decoration) {
+                case DecorationBlock:           id.block = true; break;
+                case DecorationBufferBlock:     id.bufferBlock = true; break;
+                case DecorationArrayStride:     id.arrayStride = value; break;
+                case DecorationBinding:         id.binding = value; break;
+                case DecorationDescriptorSet:   id.set = value; break;
+                default: break;
+                }
+            }
+
+            void MemberDecorate(Id& id, uint32_t member, uint32_t decoration, uint32_t value) {
+                auto set = [&](std::vector<uint32_t>& values) {
+                    if (values.size() <= member)
+                        values.resize(member + 1);
+                    values[member] = value;
+                };
+
+                if (decoration == DecorationOffset)
+                    set(id.memberOffsets);
+                else if (decoration == DecorationMatrixStride)
+                    set(id.memberMatrixStrides);
+            }
+
+            static VkShaderStageFlagBits GetStage(uint32_t executionModel) {
+                switch (executionModel) {
+                case 0:     return VK_SHADER_STAGE_VERTEX_BIT;
+                case 1:     return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+                case 2:     return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+                case 3:     return VK_SHADER_STAGE_GEOMETRY_BIT;
+                case 4:     return VK_SHADER_STAGE_FRAGMENT_BIT;
+                case 5:     return VK_SHADER_STAGE_COMPUTE_BIT;
+                case 5364:  return VK_SHADER_STAGE_TASK_BIT_EXT;
+                case 5365:  return VK_SHADER_STAGE_MESH_BIT_EXT;
+                default:    return VK_SHADER_STAGE_ALL;
+                }
+            }
+
+            bool GetDescriptorType(uint32_t storageClass, uint32_t type, VkDescriptorType& descriptorType) const {
+                const Id& id = m_ids[type];
+
+                if (storageClass == StorageClassStorageBuffer) {
+                    descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    return true;
+                }
+
+                // Before SPIR-V 1.3 storage buffers are Uniform blocks decorated BufferBlock
+                if (storageClass == StorageClassUniform) {
+                    descriptorType = id.bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                    return true;
+                }
+
+                switch (id.opcode) {
+                case OpTypeSampledImage:
+                    descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                    return true;
+                case OpTypeSampler:
+                    descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+                    return true;
+                case OpTypeImage: {
+                    // OpTypeImage: result, sampled type, dim, depth, arrayed, ms, sampled (1 = sampled, 2 = storage)
+                    bool buffer = id.pOperands[2] == DIM_BUFFER;
+                    bool storage = id.pOperands[6] == 2;
+
+                    if (buffer)
+                        descriptorType = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+                    else
+                        descriptorType = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+                    return true;
+                }
+                default:
+                    return false;
+                }
+            }
+
+            uint32_t Pointee(uint32_t pointerType) {
+                // OpTypePointer: result, storage class, type
+                if (!IsId(pointerType) || m_ids[pointerType].opcode != OpTypePointer)
+                    return Fail(), 0;
+
+                uint32_t type = m_ids[pointerType].pOperands[2];
+                if (!IsId(type) || m_ids[type].opcode == 0)
+                    return Fail(), 0;
+
+                return type;
+            }
+
+            // Value of a scalar constant, specialization constants evaluate with their default values
+            uint32_t Constant(uint32_t id, uint32_t depth = 0) {
+                if (!IsId(id) || depth > MAX_CONSTANT_DEPTH)
+                    return Fail(), 0;
+
+                const Id& constant = m_ids[id];
+
+                switch (constant.opcode) {
+                case OpConstant:
+                case OpSpecConstant:
+                    // Result type, result, value (low word is enough for array lengths)
+                    return constant.pOperands[2];
+                case OpSpecConstantTrue:
+                    return 1;
+                case OpSpecConstantFalse:
+                    return 0;
+                case OpSpecConstantOp:
+                    return SpecConstantOp(constant, depth + 1);
+                default:
+                    // Composites and anything else are not scalar constants
+                    return Fail(), 0;
+                }
+            }
+
+            // Integer operations array lengths are commonly derived with, anything else rejects the module
+            uint32_t SpecConstantOp(const Id& constant, uint32_t depth) {
+                uint32_t op = constant.pOperands[2];
+                uint32_t a = Constant(constant.pOperands[3], depth);
+
+                if (op == OpSNegate)
+                    return 0u - a;
+
+                if (constant.operandCount < 5)
+                    return Fail(), 0;
+
+                uint32_t b = Constant(constant.pOperands[4], depth);
+
+                switch (op) {
+                case OpIAdd:                return a + b;
+                case OpISub:                return a - b;
+                case OpIMul:                return a * b;
+                case OpUDiv:                return b != 0 ? a / b : (Fail(), 0);
+                case OpSDiv:                return b != 0 ? static_cast<uint32_t>(static_cast<int32_t>(a) / static_cast<int32_t>(b)) : (Fail(), 0);
+                case OpUMod:                return b != 0 ? a % b : (Fail(), 0);
+                case OpShiftRightLogical:   return b < 32 ? a >> b : 0;
+                case OpShiftLeftLogical:    return b < 32 ? a << b : 0;
+                case OpBitwiseOr:           return a | b;
+                case OpBitwiseAnd:          return a & b;
+                default:                    return Fail(), 0;
+                }
+            }
+
+            // Size in bytes as laid out in a block, matrixStride comes from the enclosing struct member
+            uint32_t TypeSize(uint32_t type, uint32_t matrixStride) {
+                const Id& id = m_ids[type];
+
+                switch (id.opcode) {
+                case OpTypeInt:
+                case OpTypeFloat:
+                    return id.pOperands[1] / 8;
+                case OpTypeVector:
+                    return id.pOperands[2] * TypeSize(id.pOperands[1], 0);
+                case OpTypeMatrix: {
+                    uint32_t columnSize = TypeSize(id.pOperands[1], 0);
+                    return id.pOperands[2] * std::max(matrixStride, columnSize);
+                }
+                case OpTypeArray: {
+                    uint32_t elementSize = id.arrayStride != 0 ? id.arrayStride : TypeSize(id.pOperands[1], matrixStride);
+                    return Constant(id.pOperands[2]) * elementSize;
+                }
+                case OpTypeStruct: {
+                    // Members follow the result id, the struct ends where its furthest member ends
+                    uint32_t size = 0;
+                    for (uint32_t member = 0; member + 1 < id.operandCount; member++) {
+                        uint32_t offset = member < id.memberOffsets.size() ? id.memberOffsets[member] : 0;
+                        uint32_t stride = member < id.memberMatrixStrides.size() ? id.memberMatrixStrides[member] : 0;
+                        size = std::max(size, offset + TypeSize(id.pOperands[member + 1], stride));
+                    }
+                    return size;
+                }
+                default:
+                    return 0;
+                }
+            }
+
+            std::vector<Id> m_ids;
+            VkShaderStageFlagBits m_stage = static_cast<VkShaderStageFlagBits>(0);
+            bool m_malformed = false;
+        };
+
+    }
+
+    bool ReflectShader(const void* pData, size_t size, ShaderReflection& reflection) {
+        reflection = {};
+
+        const uint32_t* pWords = static_cast<const uint32_t*>(pData);
+        size_t wordCount = size / sizeof(uint32_t);
+
+        if (wordCount < SPIRV_HEADER_WORDS || pWords[0] != SPIRV_MAGIC)
+            return false;
+
+        if (pWords[3] == 0 || pWords[3] > SPIRV_MAX_ID_BOUND)
+            return false;
+
+        Reflector reflector(pWords, wordCount);
+        return reflector.Reflect(reflection);
+    }
+
+}
\ No newline at end of file
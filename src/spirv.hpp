@@ -0,0 +1,32 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vkr {
+
+    struct ShaderBinding {
+        uint32_t set;
+        uint32_t binding;
+        VkDescriptorType type;
+        uint32_t count;
+    };
+
+    // What a pipeline layout needs to know about a shader module
+    struct ShaderReflection {
+        VkShaderStageFlagBits stage;
+        std::vector<ShaderBinding> bindings;
+
+        // End of the push constant block in bytes, 0 without one
+        uint32_t pushConstantSize;
+    };
+
+    // Reflect the entry point stage, descriptor bindings and push constant block of a SPIR-V module
+    // Returns false if the data is not SPIR-V or the module is malformed: ids out of bounds, truncated instructions,
+    // or array lengths that are not scalar constants. Specialization constants count with their default values
+    bool ReflectShader(const void* pData, size_t size, ShaderReflection& reflection);
+
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include "storage_table.hpp"
+
+#include <algorithm>
+
+namespace vkr {
+
+    StorageTable::StorageTable(Context& context, uint32_t stride, uint32_t capacity)
+        : m_context(context), m_stride(stride), m_capacity(std::max(capacity, 1u)) {
+    }
+
+    StorageTable::~StorageTable() {
+        if (m_buffer != 0)
+            m_context.DestroyBuffer(m_buffer);
+    }
+
+    uint32_t StorageTable::Append() {
+        m_elements.resize(size_t(m_count + 1) * m_stride);
+        return m_count++;
+    }
+
+    uint8_t* StorageTable::Touch(uint32_t index) {
+        assert(index < m_count && "element index out of range");
+
+        m_dirtyBegin = std::min(m_dirtyBegin, index);
+        m_dirtyEnd = std::max(m_dirtyEnd, index + 1);
+        return m_elements.data() + size_t(index) * m_stride;
+    }
+
+    void StorageTable::Flush() {
+        m_flushedBytes = 0;
+
+        // A larger buffer starts out empty, every element is uploaded to it
+        if (m_buffer == 0 || m_count > m_capacity) {
+            if (m_buffer != 0)
+                m_context.DestroyBuffer(m_buffer);
+
+            while (m_capacity < m_count)
+                m_capacity *= 2;
+
+            BufferDesc bd = {
+                .pData = nullptr,
+                .size = size_t(m_capacity) * m_stride,
+                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            };
+            m_buffer = m_context.CreateBuffer(bd);
+
+            m_dirtyBegin = 0;
+            m_dirtyEnd = m_count;
+        }
+
+        if (m_dirtyBegin >= m_dirtyEnd)
+            return;
+
+        size_t offset = size_t(m_dirtyBegin) * m_stride;
+        m_flushedBytes = size_t(m_dirtyEnd - m_dirtyBegin) * m_stride;
+        m_context.CopyBufferData(m_buffer, m_elements.data() + offset, offset, m_flushedBytes);
+
+        m_dirtyBegin = UINT32_MAX;
+        m_dirtyEnd = 0;
+    }
+
+}
\ No newline at end of file
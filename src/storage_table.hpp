@@ -0,0 +1,70 @@
+#pragma once
+
+#include "context.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace vkr {
+
+    // Array of fixed-size elements in one device-local storage buffer, shaders index it by element
+    //
+    // Elements are written to a CPU copy, Flush() uploads the range written since the last flush in one copy
+    // before the passes that read the table, outside a rendering scope. The buffer grows as elements are added,
+    // so bind GetBuffer() after flushing
+    class StorageTable {
+    public:
+        StorageTable(Context& context, uint32_t stride, uint32_t capacity = 256);
+        ~StorageTable();
+
+        // Returns the element's index
+        template <typename T>
+        uint32_t Add(const T& element) {
+            uint32_t index = Append();
+            Set(index, element);
+            return index;
+        }
+
+        template <typename T>
+        void Set(uint32_t index, const T& element) {
+            Modify<T>(index) = element;
+        }
+
+        // Mark an element written and return it, for changing part of it in place
+        template <typename T>
+        T& Modify(uint32_t index) {
+            static_assert(std::is_trivially_copyable_v<T>, "elements are uploaded as bytes");
+            assert(sizeof(T) == m_stride && "element type does not match the table's stride");
+            return *reinterpret_cast<T*>(Touch(index));
+        }
+
+        void Flush();
+
+        BufferHandle GetBuffer() const { return m_buffer; }
+        uint32_t GetCount() const { return m_count; }
+
+        // Bytes uploaded by the last Flush()
+        size_t GetFlushedBytes() const { return m_flushedBytes; }
+
+    private:
+        uint32_t Append();
+        uint8_t* Touch(uint32_t index);
+
+        Context& m_context;
+        uint32_t m_stride;
+        uint32_t m_count = 0;
+        uint32_t m_capacity;
+
+        std::vector<uint8_t> m_elements;
+        BufferHandle m_buffer = 0;
+
+        // Elements written since the last flush, empty when begin >= end
+        uint32_t m_dirtyBegin = UINT32_MAX;
+        uint32_t m_dirtyEnd = 0;
+
+        size_t m_flushedBytes = 0;
+    };
+
+}
\ No newline at end of file
@@ -1,26 +1,66 @@
 #version 450
 
+// keywords: ALPHA_TEST LOD_FADE
+
 layout (location = 0) in vec3 vNorm;
 layout (location = 1) in vec2 vTexCoord;
+layout (location = 2) flat in uint vLodFade;
+layout (location = 3) flat in uint vMaterial;
 
 layout (location = 0) out vec4 oFragColor;
 
-layout(set = 0, binding = 0) uniform MaterialBuffer {
+// See vkr::MaterialData
+struct MaterialData {
     vec4 baseColor;
-} material;
+};
 
 layout (set = 0, binding = 1) uniform sampler2D colorTexture;
+layout (set = 0, binding = 2) readonly buffer MaterialTable { MaterialData materials[]; };
 
-vec3 ambientColor = vec3(0.27, 0.27, 0.27);
-vec3 lightColor = vec3(1.0, 1.0, 1.0);
+// Lighting, specialized per pipeline (see TestLighting in main.cpp)
+layout (constant_id = 0) const float AMBIENT = 0.27;
+layout (constant_id = 1) const float LIGHT_INTENSITY = 1.0;
+layout (constant_id = 2) const float LIGHT_DIRECTION_X = 0.5;
+layout (constant_id = 3) const float LIGHT_DIRECTION_Y = 0.75;
+layout (constant_id = 4) const float LIGHT_DIRECTION_Z = 0.0;
+layout (constant_id = 5) const float ALPHA_CUTOFF = 0.5;
 
 void main() {
-    vec3 lightDirection = normalize(vec3(0.5, 0.75, 0.0));
-    float diff = max(dot(normalize(vNorm), lightDirection), 0.0);
-    vec3 diffuse = diff * lightColor;
+#ifdef LOD_FADE
+    // Screen-door cross-fade between two LOD levels, the outgoing and incoming level keep complementary pixels
+    uint fadeStep = vLodFade & 0xFFu;
+    if (fadeStep != 0u) {
+        const float bayer[16] = float[](
+            0.0, 8.0, 2.0, 10.0,
+            12.0, 4.0, 14.0, 6.0,
+            3.0, 11.0, 1.0, 9.0,
+            15.0, 7.0, 13.0, 5.0
+        );
+
+        uvec2 pixel = uvec2(gl_FragCoord.xy) & 3u;
+        float threshold = (bayer[pixel.y * 4u + pixel.x] + 0.5) / 16.0;
+        bool incoming = (vLodFade & 0x100u) != 0u;
+
+        if ((threshold < float(fadeStep) / 256.0) != incoming)
+            discard;
+    }
+#endif
+
+    MaterialData material = materials[vMaterial];
+
     vec4 textureSample = texture(colorTexture, vTexCoord);
+    float alpha = textureSample.a * material.baseColor.a;
+
+#ifdef ALPHA_TEST
+    if (alpha < ALPHA_CUTOFF)
+        discard;
+#endif
+
+    vec3 lightDirection = normalize(vec3(LIGHT_DIRECTION_X, LIGHT_DIRECTION_Y, LIGHT_DIRECTION_Z));
+    float diff = max(dot(normalize(vNorm), lightDirection), 0.0);
+    vec3 diffuse = diff * vec3(LIGHT_INTENSITY);
 
-    vec3 lightingResult = (ambientColor + diffuse) * (textureSample.rgb * material.baseColor.rgb);
+    vec3 lightingResult = (vec3(AMBIENT) + diffuse) * (textureSample.rgb * material.baseColor.rgb);
 
-    oFragColor = vec4(lightingResult, textureSample.a * material.baseColor.a);
+    oFragColor = vec4(lightingResult, alpha);
 }
\ No newline at end of file
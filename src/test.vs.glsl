@@ -6,14 +6,35 @@ layout (location = 2) in vec2 aTexCoord;
 
 layout (location = 0) out vec3 oNorm;
 layout (location = 1) out vec2 oTexCoord;
+layout (location = 2) flat out uint oLodFade;
+layout (location = 3) flat out uint oMaterial;
 
-layout (push_constant) uniform constants {
+// Keeps depth bit-identical to depth.vs.glsl for the depth pre-pass
+invariant gl_Position;
+
+// See vkr::ObjectData
+struct ObjectData {
     mat4 modelMatrix;
+    uint material;
+};
+
+layout (set = 0, binding = 0) readonly buffer ObjectTable { ObjectData objects[]; };
+
+// vkr::LOD_FADE_BITS, see vkr::GetDrawInstanceSpecialization
+layout (constant_id = 0) const uint LOD_FADE_BITS = 9u;
+
+layout (push_constant) uniform constants {
     mat4 viewProjectionMatrix;
 } PushConstants;
 
 void main() {
-    gl_Position = PushConstants.viewProjectionMatrix * PushConstants.modelMatrix * vec4(aPos, 1.0);
+    // The object above the LOD fade bits, see vkr::EncodeDrawInstance
+    uint instance = uint(gl_InstanceIndex);
+    ObjectData object = objects[instance >> LOD_FADE_BITS];
+
+    gl_Position = PushConstants.viewProjectionMatrix * object.modelMatrix * vec4(aPos, 1.0);
     oNorm = aNorm;
     oTexCoord = aTexCoord;
+    oLodFade = instance & ((1u << LOD_FADE_BITS) - 1u);     // See vkr::EncodeLodFade
+    oMaterial = object.material;
 }
\ No newline at end of file
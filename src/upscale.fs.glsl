@@ -0,0 +1,37 @@
+#version 450
+
+layout (location = 0) in vec2 vTexCoord;
+
+layout (location = 0) out vec4 oFragColor;
+
+layout (set = 0, binding = 0) uniform sampler2D sceneTexture;
+
+layout (push_constant) uniform constants {
+    vec2 uvScale;       // Rendered part of the scene target
+    vec2 texelSize;
+    float sharpness;
+} PushConstants;
+
+// Bilinear tap, kept half a texel inside the rendered area so the filter never reads past its edge
+vec3 Tap(vec2 uv) {
+    vec2 halfTexel = PushConstants.texelSize * 0.5;
+    return texture(sceneTexture, clamp(uv, halfTexel, PushConstants.uvScale - halfTexel)).rgb;
+}
+
+void main() {
+    vec2 uv = vTexCoord * PushConstants.uvScale;
+    vec2 texel = PushConstants.texelSize;
+
+    vec3 center = Tap(uv);
+    vec3 north = Tap(uv - vec2(0.0, texel.y));
+    vec3 south = Tap(uv + vec2(0.0, texel.y));
+    vec3 west = Tap(uv - vec2(texel.x, 0.0));
+    vec3 east = Tap(uv + vec2(texel.x, 0.0));
+
+    // Unsharp mask to win back detail lost to the bilinear filter, clamped so edges do not ring
+    vec3 sharpened = center + (4.0 * center - north - south - east - west) * (PushConstants.sharpness * 0.25);
+    vec3 minimum = min(center, min(min(north, south), min(east, west)));
+    vec3 maximum = max(center, max(max(north, south), max(east, west)));
+
+    oFragColor = vec4(clamp(sharpened, minimum, maximum), 1.0);
+}
\ No newline at end of file
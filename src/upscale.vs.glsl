@@ -0,0 +1,11 @@
+#version 450
+
+layout (location = 0) out vec2 oTexCoord;
+
+void main() {
+    // One triangle covering the viewport, (0,0) (2,0) (0,2)
+    vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+
+    oTexCoord = position;
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
\ No newline at end of file
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <fstream>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <cstdint>
+#include <cstdio>
 
 class FileReader {
 public:
@@ -26,4 +29,27 @@ public:
 
 private:
     std::vector<uint8_t> m_buf;
-};
\ No newline at end of file
+};
+
+// Escape a string for a JSON string literal, e.g. a device name with quotes in it
+inline std::string EscapeJson(std::string_view str) {
+    std::string escaped;
+    escaped.reserve(str.size());
+
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else {
+            escaped += c;
+        }
+    }
+
+    return escaped;
+}
\ No newline at end of file